@@ -156,7 +156,7 @@ static const T_I2C_GAME i2c_database[] =
   {"XXXXXXXX" , 0          , 0xDF39 , mapper_i2c_jcart_init       , NO_EEPROM     }, /* Pete Sampras Tennis 96 (Prototype ?) */
 };
 
-static struct
+static CTX_LOCAL struct
 {
   uint8 sda;              /* current SDA line state */
   uint8 scl;              /* current SCL line state */
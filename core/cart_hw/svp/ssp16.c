@@ -339,9 +339,9 @@
 }
 
 
-static ssp1601_t *ssp = NULL;
-static unsigned short *PC;
-static int g_cycles;
+static CTX_LOCAL ssp1601_t *ssp = NULL;
+static CTX_LOCAL unsigned short *PC;
+static CTX_LOCAL int g_cycles;
 
 #ifdef USE_DEBUGGER
 static int running = 0;
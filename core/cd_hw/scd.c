@@ -1899,6 +1899,8 @@ void scd_update(unsigned int cycles)
   int s68k_run_cycles;
   int s68k_end_cycles = scd.cycles + SCYCLES_PER_LINE;
 
+  PROFILE_ENTER(PROF_SCD);
+
   /* run both CPU in sync until end of line */
   do
   {
@@ -1933,7 +1935,9 @@ void scd_update(unsigned int cycles)
       cdd.cycles -= (500000 * 4);
 
       /* update CDD sector */
+      PROFILE_ENTER(PROF_CDD);
       cdd_update();
+      PROFILE_LEAVE();
 
       /* check if CDD communication is enabled */
       if (scd.regs[0x37>>1].byte.l & 0x04)
@@ -1985,6 +1989,8 @@ void scd_update(unsigned int cycles)
   {
     gfx_update(scd.cycles);
   }
+
+  PROFILE_LEAVE();
 }
 
 void scd_end_frame(unsigned int cycles)
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "bpt_index.h"
+
+// Breakpoint index
+//
+// Every hooked access used to walk the whole breakpoint list. Now each hook type gets:
+// - a page bitmap over the 24-bit address space, so "no breakpoint on this page" is a single bit test
+// - an array of ranges sorted by start address, read as an implicit balanced tree (middle element
+//   is the root of each subarray) augmented with the largest end of each subtree - an interval
+//   tree, so ranged watchpoints are found in O(log n) per hit whatever the other ranges are
+
+struct bpt_range
+{
+    unsigned int start;
+    unsigned int end;
+    // Largest end of the subtree rooted at this range
+    unsigned int max_end;
+    struct breakpoint_s *bp;
+};
+
+struct bpt_ranges
+{
+    int len;
+    int size;
+    struct bpt_range *arr;
+};
+
+static uint32_t bpt_pages[BPT_HOOK_TYPES][BPT_PAGE_WORDS];
+static struct bpt_ranges bpt_ranges[BPT_HOOK_TYPES];
+hook_type_t bpt_index_types;
+// Query results, large enough for every range of any type
+static struct breakpoint_s **bpt_hits;
+static int bpt_hits_size;
+
+static int hook_type_index(hook_type_t type)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return type ? __builtin_ctz(type) : BPT_HOOK_TYPES;
+#else
+    int index = 0;
+    while (!(type & 1) && index < BPT_HOOK_TYPES)
+    {
+        type >>= 1;
+        index++;
+    }
+
+    return index;
+#endif
+}
+
+void bpt_index_clear(void)
+{
+    memset(bpt_pages, 0, sizeof(bpt_pages));
+    bpt_index_types = 0;
+    for (int i = 0; i < BPT_HOOK_TYPES; i++)
+    {
+        bpt_ranges[i].len = 0;
+    }
+}
+
+static void ranges_append(struct bpt_ranges *ranges, struct breakpoint_s *bp, unsigned int start, unsigned int end)
+{
+    if (ranges->len == ranges->size)
+    {
+        ranges->size += 20;
+        ranges->arr = realloc(ranges->arr, ranges->size * sizeof(struct bpt_range));
+        if (ranges->arr == NULL)
+        {
+            printf("failed to realloc breakpoint ranges");
+            exit(-1);
+        }
+    }
+
+    struct bpt_range *range = &ranges->arr[ranges->len++];
+    range->start = start;
+    range->end = end;
+    range->max_end = end;
+    range->bp = bp;
+}
+
+void bpt_index_add(struct breakpoint_s *bp, hook_type_t type, unsigned int start, unsigned int end)
+{
+    start &= BPT_ADDRESS_MASK;
+    end &= BPT_ADDRESS_MASK;
+    if (end < start)
+    {
+        end = BPT_ADDRESS_MASK;
+    }
+
+    // An access of width w at address a touches [a, a + w], so it can hit a range starting a bit further
+    unsigned int first_page = (start > BPT_MAX_ACCESS_WIDTH ? start - BPT_MAX_ACCESS_WIDTH : 0) >> BPT_PAGE_SHIFT;
+    unsigned int last_page = end >> BPT_PAGE_SHIFT;
+
+    for (int i = 0; i < BPT_HOOK_TYPES; i++)
+    {
+        if (!(type & (1 << i)))
+            continue;
+
+        for (unsigned int page = first_page; page <= last_page; page++)
+        {
+            bpt_pages[i][page >> 5] |= 1u << (page & 31);
+        }
+
+        ranges_append(&bpt_ranges[i], bp, start, end);
+        bpt_index_types |= 1 << i;
+    }
+}
+
+static int cmp_range(const void *a, const void *b)
+{
+    const struct bpt_range *ra = a;
+    const struct bpt_range *rb = b;
+
+    if (ra->start != rb->start)
+        return ra->start < rb->start ? -1 : 1;
+
+    return 0;
+}
+
+// Stores largest end of each subtree of arr[lo, hi) in its root, returns the one of the whole subarray
+static unsigned int build_max_end(struct bpt_range *arr, int lo, int hi)
+{
+    if (lo >= hi)
+        return 0;
+
+    int mid = (lo + hi) / 2;
+    unsigned int max_end = arr[mid].end;
+    unsigned int left = build_max_end(arr, lo, mid);
+    unsigned int right = build_max_end(arr, mid + 1, hi);
+
+    if (left > max_end)
+        max_end = left;
+    if (right > max_end)
+        max_end = right;
+
+    arr[mid].max_end = max_end;
+    return max_end;
+}
+
+void bpt_index_build(void)
+{
+    int max_len = 0;
+
+    for (int i = 0; i < BPT_HOOK_TYPES; i++)
+    {
+        struct bpt_ranges *ranges = &bpt_ranges[i];
+        if (ranges->len == 0)
+            continue;
+
+        qsort(ranges->arr, ranges->len, sizeof(struct bpt_range), cmp_range);
+        build_max_end(ranges->arr, 0, ranges->len);
+
+        if (ranges->len > max_len)
+            max_len = ranges->len;
+    }
+
+    if (max_len > bpt_hits_size)
+    {
+        bpt_hits = realloc(bpt_hits, max_len * sizeof(struct breakpoint_s *));
+        if (bpt_hits == NULL)
+        {
+            printf("failed to realloc breakpoint hits");
+            exit(-1);
+        }
+        bpt_hits_size = max_len;
+    }
+}
+
+// Appends ranges of subtree arr[lo, hi) overlapping [first, last] to bpt_hits, in start order
+static int query_ranges(const struct bpt_range *arr, int lo, int hi, unsigned int first, unsigned int last, int count)
+{
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        // Nothing in this subtree reaches the access
+        if (arr[mid].max_end < first)
+            break;
+
+        count = query_ranges(arr, lo, mid, first, last, count);
+
+        // This range and the right subtree start past the access
+        if (arr[mid].start > last)
+            break;
+
+        if (arr[mid].end >= first)
+            bpt_hits[count++] = arr[mid].bp;
+
+        lo = mid + 1;
+    }
+
+    return count;
+}
+
+int bpt_index_lookup(hook_type_t type, unsigned int address, int width, struct breakpoint_s ***hits)
+{
+    int index = hook_type_index(type);
+    address &= BPT_ADDRESS_MASK;
+    unsigned int page = address >> BPT_PAGE_SHIFT;
+    if (!((bpt_pages[index][page >> 5] >> (page & 31)) & 1))
+        return 0;
+
+    struct bpt_ranges *ranges = &bpt_ranges[index];
+    *hits = bpt_hits;
+
+    return query_ranges(ranges->arr, 0, ranges->len, address, address + width, 0);
+}
@@ -0,0 +1,47 @@
+#ifndef _BPT_INDEX_H_
+#define _BPT_INDEX_H_
+
+#include "cpuhook.h"
+
+// Number of single-bit hook types (HOOK_M68K_E ... HOOK_M68K_REG)
+#define BPT_HOOK_TYPES 14
+
+// Every address space we hook (68K, Z80, VRAM, CRAM, VSRAM) fits in 24 bits
+#define BPT_ADDRESS_MASK 0xFFFFFF
+
+// Page bitmap granularity - 256 bytes per bit, 8KB of bits per hook type
+#define BPT_PAGE_SHIFT 8
+#define BPT_PAGE_WORDS (((BPT_ADDRESS_MASK + 1) >> BPT_PAGE_SHIFT) / 32)
+
+// Maximum access width passed to cpu_hook, pages are padded below by this much
+#define BPT_MAX_ACCESS_WIDTH 4
+
+struct breakpoint_s;
+
+// Drops everything from the index, call bpt_index_add() for each breakpoint afterwards
+void bpt_index_clear(void);
+
+// Registers breakpoint covering [start, end] for every hook type bit set in type
+void bpt_index_add(struct breakpoint_s *bp, hook_type_t type, unsigned int start, unsigned int end);
+
+// Sorts ranges added since bpt_index_clear(), must be called before querying
+void bpt_index_build(void);
+
+// Hook types with at least one breakpoint in the index
+extern hook_type_t bpt_index_types;
+
+// Out of line part of bpt_index_query(), for hook types that have breakpoints
+int bpt_index_lookup(hook_type_t type, unsigned int address, int width, struct breakpoint_s ***hits);
+
+// Collects every breakpoint whose range overlaps access [address, address + width] and returns their count,
+// *hits is set to an array owned by the index that stays valid until the next query or bpt_index_build().
+// Inline so that accesses of types without breakpoints cost a single test at the call site
+static inline int bpt_index_query(hook_type_t type, unsigned int address, int width, struct breakpoint_s ***hits)
+{
+    if (!(type & bpt_index_types))
+        return 0;
+
+    return bpt_index_lookup(type, address, width, hits);
+}
+
+#endif /* _BPT_INDEX_H_ */
@@ -45,9 +45,17 @@
 
 void(*cpu_hook)(hook_type_t type, int width, unsigned int address, unsigned int value) = NULL;
 
+unsigned int active_hook_mask = 0;
+
 void set_cpu_hook(void(*hook)(hook_type_t type, int width, unsigned int address, unsigned int value))
 {
 	cpu_hook = hook;
+	active_hook_mask = hook ? HOOK_ALL : 0;
+}
+
+void set_cpu_hook_mask(unsigned int mask)
+{
+	active_hook_mask = cpu_hook ? (mask & HOOK_ALL) : 0;
 }
 
 #endif /* HOOK_CPU */
\ No newline at end of file
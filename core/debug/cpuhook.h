@@ -75,17 +75,44 @@ typedef enum {
   // REGS
   HOOK_VDP_REG  = (1 << 12),
   HOOK_M68K_REG = (1 << 13),
+
+  HOOK_M68K_ALL = HOOK_M68K_E | HOOK_M68K_RW,
+  HOOK_ALL      = (1 << 14) - 1,
 } hook_type_t;
 
 
+/* Hook types compiled into the core. Call sites for other types are removed
+ * at compile time. Define HOOK_CPU_NO_M68K to strip 68K execute/read/write
+ * hooks, leaving VDP and Z80 hooks only.
+ */
+#ifndef HOOK_CPU_MASK
+#ifdef HOOK_CPU_NO_M68K
+#define HOOK_CPU_MASK (HOOK_ALL & ~HOOK_M68K_ALL)
+#else
+#define HOOK_CPU_MASK HOOK_ALL
+#endif
+#endif
+
+/* Hook types that cpu_hook() currently wants to receive. Call sites test it
+ * before making the indirect call, so unused hook types cost a single AND.
+ */
+extern unsigned int active_hook_mask;
+
+#define CPU_HOOK_ACTIVE(type) ((HOOK_CPU_MASK & (type)) && (active_hook_mask & (type)))
+
+
 /* CPU hook is called on read, write, and execute.
  */
-void (*cpu_hook)(hook_type_t type, int width, unsigned int address, unsigned int value);
+extern void (*cpu_hook)(hook_type_t type, int width, unsigned int address, unsigned int value);
 
 /* Use set_cpu_hook() to assign a callback that can process the data provided
- * by cpu_hook().
+ * by cpu_hook(). All hook types are enabled until set_cpu_hook_mask() is used.
  */
 void set_cpu_hook(void(*hook)(hook_type_t type, int width, unsigned int address, unsigned int value));
 
+/* Use set_cpu_hook_mask() to restrict cpu_hook() calls to given hook types.
+ */
+void set_cpu_hook_mask(unsigned int mask);
+
 
 #endif /* _CPUHOOK_H_ */
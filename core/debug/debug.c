@@ -1,4 +1,6 @@
 #include "debug.h"
+#include "bpt_index.h"
+#include "mem_watch.h"
 #include <stdio.h>
 
 // Start of - To read m68k memory
@@ -38,6 +40,14 @@ debug_hook_t debug_hooks[5];
 int debug_hook_count = 0;
 
 static breakpoint_t *first_bp = NULL;
+// Set whenever breakpoint list changes, index is rebuilt lazily on the emulation thread
+static int bpt_index_dirty = 1;
+// If set 68K writes to 0xA14400 print a string from ROM, needs HOOK_M68K_W even without breakpoints
+static int rom_log = 0;
+// If set functions called by JSR/JMP are discovered and analyzed, needs HOOK_M68K_E
+static int function_discovery = 0;
+// Set while HOOK_M68K_E is in the active mask
+static int exec_hooked = 0;
 
 breakpoint_t *add_bpt(hook_type_t type, unsigned int address, int width, int condition_provided, unsigned int value_equal)
 {
@@ -50,6 +60,7 @@ breakpoint_t *add_bpt(hook_type_t type, unsigned int address, int width, int con
 
     bp->condition_provided = condition_provided;
     bp->value_equal = value_equal;
+    bp->once = 0;
 
     if (first_bp)
     {
@@ -65,6 +76,9 @@ breakpoint_t *add_bpt(hook_type_t type, unsigned int address, int width, int con
         bp->prev = bp;
     }
 
+    bpt_index_dirty = 1;
+    update_hook_mask();
+
     return bp;
 }
 
@@ -73,6 +87,54 @@ static breakpoint_t *next_breakpoint(breakpoint_t *bp)
     return bp->next != first_bp ? bp->next : 0;
 }
 
+void update_hook_mask(void)
+{
+    unsigned int mask = 0;
+
+    // Execution hook is only needed while stepping or discovering functions (or by exec breakpoints below)
+    if (dbg_trace || dbg_step_over || dbg_step_over_line || dbg_paused || dbg_continue_after_bp || function_discovery)
+    {
+        mask |= HOOK_M68K_E;
+    }
+
+    if (rom_log)
+    {
+        mask |= HOOK_M68K_W;
+    }
+
+    mask |= mem_watch_hook_mask();
+
+    breakpoint_t *bp;
+    for (bp = first_bp; bp; bp = next_breakpoint(bp))
+    {
+        if (bp->enabled)
+        {
+            mask |= bp->type;
+        }
+    }
+
+    // Interrupts entered while execution was not hooked never saw their RTE, stepping starts from here
+    if ((mask & HOOK_M68K_E) && !exec_hooked)
+    {
+        dbg_in_interrupt = 0;
+    }
+    exec_hooked = (mask & HOOK_M68K_E) != 0;
+
+    set_cpu_hook_mask(mask);
+}
+
+void set_rom_log(int enabled)
+{
+    rom_log = enabled;
+    update_hook_mask();
+}
+
+void set_function_discovery(int enabled)
+{
+    function_discovery = enabled;
+    update_hook_mask();
+}
+
 static void delete_breakpoint(breakpoint_t *bp)
 {
     if (bp == first_bp)
@@ -91,6 +153,9 @@ static void delete_breakpoint(breakpoint_t *bp)
     bp->prev->next = bp->next;
 
     free(bp);
+
+    bpt_index_dirty = 1;
+    update_hook_mask();
 }
 
 void delete_breakpoint_with_address(unsigned int address)
@@ -138,9 +203,26 @@ void debug_hook(dbg_event_t type, void *data)
     }
 }
 
+static void rebuild_bpt_index(void)
+{
+    bpt_index_clear();
+
+    breakpoint_t *bp;
+    for (bp = first_bp; bp; bp = next_breakpoint(bp))
+    {
+        if (bp->enabled)
+        {
+            bpt_index_add(bp, bp->type, bp->address, bp->address + bp->width);
+        }
+    }
+
+    bpt_index_build();
+    bpt_index_dirty = 0;
+}
+
 void check_breakpoint(hook_type_t type, int width, unsigned int address, unsigned int value)
 {
-    if (type == HOOK_M68K_W)
+    if (type == HOOK_M68K_W && rom_log)
     {
         // Prints debug messages from ROM to terminal
         // Send string pointer to this address within the ROM to display the message
@@ -152,65 +234,157 @@ void check_breakpoint(hook_type_t type, int width, unsigned int address, unsigne
         }
     }
 
-    breakpoint_t *bp;
-    for (bp = first_bp; bp; bp = next_breakpoint(bp))
+    if (bpt_index_dirty)
     {
-        if (!(bp->type & type) || !bp->enabled)
-            continue;
+        rebuild_bpt_index();
+    }
+
+    // Every address space fits in 24 bits, RAM writes come in as full 32-bit addresses
+    address = address & BPT_ADDRESS_MASK;
+
+    breakpoint_t **hits;
+    int hit_count = bpt_index_query(type, address, width, &hits);
+
+    for (int i = 0; i < hit_count; i++)
+    {
+        breakpoint_t *bp = hits[i];
+        unsigned int bp_value = value;
 
         if (type == HOOK_CRAM_W)
         {
-            value = cram_9b_to_16b(value);
+            bp_value = cram_9b_to_16b(value);
 
             // CRAM writes are always 2 bytes at the time
             // If we're monitoring odd address - compare second byte only
             if (bp->width == 1 && bp->address % 2)
             {
-                value = value & 0xFF;
+                bp_value = bp_value & 0xFF;
             }
 
-            printf("cram write to address %u, width: %d, value: %u\n", address, width, value);
+            printf("cram write to address %u, width: %d, value: %u\n", address, width, bp_value);
         }
 
-        if (type == HOOK_M68K_W)
-        {
-            // printf("ram write to address %u, width: %d, value: %u\n", address, width, value);
-            // RAM is located at 0xFF0000 - 0xFFFFFF
-            // Address we're getting is full 32-bit address, so we need to mask it
-            address = address & 0xFFFFFF;
-        }
-
-        if (bp->condition_provided && bp->value_equal != value)
+        if (bp->condition_provided && bp->value_equal != bp_value)
             continue;
 
-        if ((address <= (bp->address + bp->width)) && ((address + width) >= bp->address))
-        {
-            printf("breakpoint hit at addr: 0x%X, type: %u, width: %d, value: 0x%X\n", address, type, width, value);
-            dbg_paused = 1;
+        printf("breakpoint hit at addr: 0x%X, type: %u, width: %d, value: 0x%X\n", address, type, width, bp_value);
+        dbg_paused = 1;
 
-            if (bp->once)
-            {
-                delete_breakpoint(bp);
-            }
-            break;
+        if (bp->once)
+        {
+            delete_breakpoint(bp);
         }
+        break;
     }
 }
 
-static struct fam *extracted_functions;
+// One bit per 68K word address, set for every function start that is known or queued for analysis
+static uint32_t known_functions[(BPT_ADDRESS_MASK + 1) >> 6];
+static int known_functions_loaded = 0;
 static struct timespec start, end;
 
 static char *ym2612_buf;
 static int send_next = 0;
 const char *template = "{ \"type\": \"ym2612\", \"data\": [";
 
-void process_breakpoints(hook_type_t type, int width, unsigned int address, unsigned int value)
+static int is_known_function(unsigned int address)
+{
+    unsigned int word = (address & BPT_ADDRESS_MASK) >> 1;
+    return (known_functions[word >> 5] >> (word & 31)) & 1;
+}
+
+static void set_known_function(unsigned int address, int known)
+{
+    unsigned int word = (address & BPT_ADDRESS_MASK) >> 1;
+    if (known)
+        known_functions[word >> 5] |= 1u << (word & 31);
+    else
+        known_functions[word >> 5] &= ~(1u << (word & 31));
+}
+
+// Copy of the cartridge area (0x000000-0x3FFFFF) as mapped when analysis started, in memory map byte order.
+// The analysis thread reads code from it, live banks can be remapped by the emulation thread at any time
+#define CODE_SNAPSHOT_SIZE 0x400000
+static unsigned char *code_snapshot;
+
+// Called on the emulation thread - goes straight to the memory map so no hooks or I/O handlers are triggered
+static void snapshot_code(void)
+{
+    code_snapshot = malloc(CODE_SNAPSHOT_SIZE);
+    if (code_snapshot == NULL)
+    {
+        printf("failed to malloc code snapshot");
+        exit(-1);
+    }
+
+    for (unsigned int bank = 0; bank < (CODE_SNAPSHOT_SIZE >> 16); bank++)
+    {
+        cpu_memory_map *temp = &m68k.memory_map[bank];
+        if (temp->read8)
+        {
+            // I/O or SRAM handler, nothing to disassemble
+            memset(code_snapshot + (bank << 16), 0xFF, 0x10000);
+        }
+        else
+        {
+            memcpy(code_snapshot + (bank << 16), temp->base, 0x10000);
+        }
+    }
+}
+
+// Reads code for the analysis thread from the snapshot, code outside of the cartridge area (e.g. copied to RAM) reads as 0xFF
+static unsigned char *read_code(unsigned int size, unsigned int address)
 {
-    if (extracted_functions == NULL)
+    // Only used by the analysis thread
+    static unsigned char *buffer = NULL;
+    static unsigned int buffer_size = 0;
+
+    if (size > buffer_size)
     {
-        extracted_functions = get_functions();
+        buffer = realloc(buffer, size);
+        buffer_size = size;
     }
 
+    for (unsigned int i = 0; i < size; i++)
+    {
+        unsigned int offset = (address + i) & BPT_ADDRESS_MASK;
+        buffer[i] = offset < CODE_SNAPSHOT_SIZE ? READ_BYTE(code_snapshot, offset) : 0xFF;
+    }
+
+    return buffer;
+}
+
+static void load_known_functions(void)
+{
+    struct fam *functions = get_functions();
+    for (size_t i = 0; i < functions->len; i++)
+    {
+        set_known_function(functions->arr[i], 1);
+    }
+
+    free(functions->arr);
+    free(functions);
+
+    known_functions_loaded = 1;
+    snapshot_code();
+    analysis_start(read_code);
+}
+
+void start_function_analysis(void)
+{
+    if (!known_functions_loaded)
+    {
+        load_known_functions();
+    }
+}
+
+void process_breakpoints(hook_type_t type, int width, unsigned int address, unsigned int value)
+{
+    start_function_analysis();
+
+    // Tracks writes to memory the debugger client is subscribed to
+    mem_watch_write(type, width, address);
+
     switch (type)
     {
     case HOOK_Z80_W:
@@ -250,22 +424,16 @@ void process_breakpoints(hook_type_t type, int width, unsigned int address, unsi
                     dbg_paused = 0;
                 }
 
-                int function_found = 0;
-                for (size_t i = 0; i < extracted_functions->len; i++)
+                if (function_discovery && !is_known_function(m68k.pc))
                 {
-                    if (extracted_functions->arr[i] == m68k.pc)
+                    set_known_function(m68k.pc, 1);
+
+                    // Analysis runs on a background thread, retry on a later call if its queue is full
+                    if (!analysis_enqueue(m68k.prev_pc, m68k.pc))
                     {
-                        function_found = 1;
-                        break;
+                        set_known_function(m68k.pc, 0);
                     }
                 }
-
-                if (!function_found)
-                {
-                    printf("new function %04X, sent by %04X from %04X\n", m68k.pc, opc, m68k.prev_pc);
-                    fam_append(extracted_functions, m68k.pc);
-                    extract_functions(m68k.prev_pc, m68k.pc, read_memory);
-                }
             }
         }
 
@@ -277,8 +445,9 @@ void process_breakpoints(hook_type_t type, int width, unsigned int address, unsi
 
         if (dbg_step_over_line)
         {
-            dwarf_ask_t *dwarf_info = dwarf_ask(m68k.pc);
-            if (dwarf_info->line_number != dbg_step_over_line)
+            // Code without line info (library asm) is stepped through
+            dwarf_ask_t dwarf_info;
+            if (dwarf_ask(m68k.pc, &dwarf_info) && dwarf_info.line_number != dbg_step_over_line)
             {
                 dbg_paused = 1;
                 dbg_step_over_line = 0;
@@ -377,6 +546,10 @@ unsigned char read_memory_byte(unsigned int address, char *type)
         {
             return read_cram_byte(cram, address);
         }
+        else if (strcmp(type, "vsram") == 0)
+        {
+            return READ_BYTE(vsram, address & 0x7f);
+        }
         else if (strcmp(type, "z80") == 0)
         {
             return zram[address - 0xA00000];
@@ -404,6 +577,89 @@ void write_memory_byte(unsigned int address, unsigned int value, char *memtype)
     WRITE_BYTE(temp->base, (address) & 0xffff, value);
 }
 
+// Bulk version of read_memory_byte() for the debugger viewers: memtype is resolved once and
+// memory-backed regions are copied straight from their buffers instead of byte by byte
+void read_memory_block(unsigned char *dst, unsigned int address, unsigned int size, char *memtype)
+{
+    unsigned int i;
+
+    if (memtype && strcmp(memtype, "cram") == 0)
+    {
+        for (i = 0; i < size; i++)
+        {
+            dst[i] = read_cram_byte(cram, (address + i) & 0x7f);
+        }
+        return;
+    }
+
+    if (memtype && strcmp(memtype, "z80") == 0)
+    {
+        address -= 0xA00000;
+        while (size)
+        {
+            unsigned int offset = address & 0x1fff;
+            unsigned int chunk = 0x2000 - offset;
+            if (chunk > size)
+                chunk = size;
+            memcpy(dst, zram + offset, chunk);
+            dst += chunk;
+            address += chunk;
+            size -= chunk;
+        }
+        return;
+    }
+
+    if (memtype && strcmp(memtype, "vsram") == 0)
+    {
+        for (i = 0; i < size; i++)
+        {
+            dst[i] = READ_BYTE(vsram, (address + i) & 0x7f);
+        }
+        return;
+    }
+
+    unsigned char *base = vram;
+    while (size)
+    {
+        // VRAM is a single 64KB bank, 68K space is split in 64KB banks with their own base or handler
+        unsigned int offset = address & 0xffff;
+        unsigned int chunk = 0x10000 - offset;
+        if (chunk > size)
+            chunk = size;
+
+        if (!memtype || strcmp(memtype, "vram") != 0)
+        {
+            cpu_memory_map *temp = &m68k.memory_map[(address >> 16) & 0xff];
+            base = temp->read8 ? NULL : temp->base;
+            if (base == NULL)
+            {
+                // I/O area, has to go through its handler
+                for (i = 0; i < chunk; i++)
+                {
+                    dst[i] = temp->read8(ADDRESS_68K(address + i));
+                }
+            }
+        }
+
+        if (base != NULL)
+        {
+#ifdef LSB_FIRST
+            // Words are stored byte swapped
+            for (i = 0; i < chunk; i++)
+            {
+                dst[i] = base[(offset + i) ^ 1];
+            }
+#else
+            memcpy(dst, base + offset, chunk);
+#endif
+        }
+
+        dst += chunk;
+        address += chunk;
+        size -= chunk;
+    }
+}
+
 unsigned char *read_memory(unsigned int size, unsigned int address)
 {
     unsigned char *bytes = malloc(size);
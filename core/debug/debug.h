@@ -31,6 +31,7 @@ void set_debug_hook(void(*hook)(dbg_event_t type, void *data));
 unsigned char read_memory_byte(unsigned int address, char* type);
 void write_memory_byte(unsigned int address, unsigned int value, char *memtype);
 unsigned char* read_memory(unsigned int size, unsigned int address);
+void read_memory_block(unsigned char *dst, unsigned int address, unsigned int size, char *memtype);
 
 typedef struct breakpoint_s {
     struct breakpoint_s *next, *prev;
@@ -49,4 +50,14 @@ void delete_breakpoint_with_address(unsigned int address);
 
 void clear_bpt_list();
 
+// Narrows cpu_hook() calls to hook types used by breakpoints and debugger features,
+// call it after changing stepping flags (frontends do it once per frame)
+void update_hook_mask(void);
+// Toggles printing of ROM debug strings written to 0xA14400 (off by default)
+void set_rom_log(int enabled);
+// Toggles discovery and analysis of functions reached by JSR/JMP (off by default)
+void set_function_discovery(int enabled);
+// Loads known functions and starts the analysis thread, if not done yet
+void start_function_analysis(void);
+
 #endif /* _DEBUG_H_ */
@@ -0,0 +1,219 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "mem_watch.h"
+
+// Memory watch
+//
+// Debugger viewers subscribe to ranges of video and work memory and get sent only the parts
+// that changed since the previous frame. Writes are tracked per 64 byte block from the cpu hook
+// (vdp_bus_w, DMA, 68K and Z80 write paths), nothing is diffed.
+//
+// Subscriptions change from debugger commands, which run on the emulation thread between frames
+// (run_commands), so subscribed, requested (blocks to send in full after subscribing) and dirty
+// all belong to the emulation thread. requested is still set and taken atomically.
+
+static const unsigned int region_sizes[WATCH_REGIONS] = {0x10000, 0x80, 0x80, 0x10000, 0x2000};
+
+static uint32_t subscribed[WATCH_REGIONS][WATCH_WORDS];
+static uint32_t requested[WATCH_REGIONS][WATCH_WORDS];
+static uint32_t dirty[WATCH_REGIONS][WATCH_WORDS];
+
+// Bit per region with at least one subscribed block
+static unsigned int active_regions;
+
+unsigned int mem_watch_size(watch_region_t region)
+{
+    return region_sizes[region];
+}
+
+static int region_words(watch_region_t region)
+{
+    unsigned int blocks = region_sizes[region] >> WATCH_BLOCK_SHIFT;
+    return blocks < 32 ? 1 : blocks / 32;
+}
+
+static void update_active_regions(void)
+{
+    unsigned int active = 0;
+    for (int region = 0; region < WATCH_REGIONS; region++)
+    {
+        for (int i = 0; i < region_words(region); i++)
+        {
+            if (subscribed[region][i])
+            {
+                active |= 1 << region;
+                break;
+            }
+        }
+    }
+
+    active_regions = active;
+}
+
+// Sets or clears the bit of every block in [offset, offset + size), clamped to region
+static void set_blocks(uint32_t *bits, watch_region_t region, unsigned int offset, unsigned int size, int value, int atomic)
+{
+    unsigned int region_size = region_sizes[region];
+    if (offset >= region_size || size == 0)
+        return;
+
+    if (size > region_size - offset)
+        size = region_size - offset;
+
+    unsigned int first = offset >> WATCH_BLOCK_SHIFT;
+    unsigned int last = (offset + size - 1) >> WATCH_BLOCK_SHIFT;
+    for (unsigned int block = first; block <= last; block++)
+    {
+        uint32_t bit = 1u << (block & 31);
+        if (atomic)
+            __atomic_fetch_or(&bits[block >> 5], bit, __ATOMIC_RELEASE);
+        else if (value)
+            bits[block >> 5] |= bit;
+        else
+            bits[block >> 5] &= ~bit;
+    }
+}
+
+void mem_watch_subscribe(watch_region_t region, unsigned int offset, unsigned int size)
+{
+    set_blocks(subscribed[region], region, offset, size, 1, 0);
+    set_blocks(requested[region], region, offset, size, 1, 1);
+    update_active_regions();
+}
+
+void mem_watch_unsubscribe(watch_region_t region, unsigned int offset, unsigned int size)
+{
+    set_blocks(subscribed[region], region, offset, size, 0, 0);
+    update_active_regions();
+}
+
+void mem_watch_clear(void)
+{
+    memset(subscribed, 0, sizeof(subscribed));
+    active_regions = 0;
+}
+
+int mem_watch_active(void)
+{
+    return active_regions != 0;
+}
+
+unsigned int mem_watch_hook_mask(void)
+{
+    unsigned int mask = 0;
+
+    if (active_regions & (1 << WATCH_VRAM))
+        mask |= HOOK_VRAM_W;
+    if (active_regions & (1 << WATCH_CRAM))
+        mask |= HOOK_CRAM_W;
+    if (active_regions & (1 << WATCH_VSRAM))
+        mask |= HOOK_VSRAM_W;
+    if (active_regions & (1 << WATCH_RAM))
+        mask |= HOOK_M68K_W;
+    if (active_regions & (1 << WATCH_ZRAM))
+        mask |= HOOK_M68K_W | HOOK_Z80_W;
+
+    return mask;
+}
+
+static void mark_dirty(watch_region_t region, unsigned int offset, int width)
+{
+    unsigned int mask = region_sizes[region] - 1;
+    unsigned int first = (offset & mask) >> WATCH_BLOCK_SHIFT;
+    unsigned int last = ((offset + width - 1) & mask) >> WATCH_BLOCK_SHIFT;
+
+    dirty[region][first >> 5] |= 1u << (first & 31);
+    dirty[region][last >> 5] |= 1u << (last & 31);
+}
+
+void mem_watch_write(hook_type_t type, int width, unsigned int address)
+{
+    if (!active_regions)
+        return;
+
+    if (width < 1)
+        width = 1;
+
+    switch (type)
+    {
+    case HOOK_VRAM_W:
+        mark_dirty(WATCH_VRAM, address, width);
+        break;
+
+    case HOOK_CRAM_W:
+        mark_dirty(WATCH_CRAM, address, width);
+        break;
+
+    case HOOK_VSRAM_W:
+        mark_dirty(WATCH_VSRAM, address, width);
+        break;
+
+    case HOOK_M68K_W:
+        if ((address & 0xE00000) == 0xE00000)
+        {
+            mark_dirty(WATCH_RAM, address, width);
+        }
+        else if ((address & 0xFFC000) == 0xA00000)
+        {
+            mark_dirty(WATCH_ZRAM, address, width);
+        }
+        break;
+
+    case HOOK_Z80_W:
+        if (address < 0x4000)
+        {
+            mark_dirty(WATCH_ZRAM, address, width);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+int mem_watch_collect(watch_region_t region, unsigned int *runs)
+{
+    int count = 0;
+    int words = region_words(region);
+    unsigned int blocks = region_sizes[region] >> WATCH_BLOCK_SHIFT;
+    // Start of the run being extended, -1 when outside of a run
+    int run_start = -1;
+
+    for (int i = 0; i < words; i++)
+    {
+        uint32_t changed = dirty[region][i] | __atomic_exchange_n(&requested[region][i], 0, __ATOMIC_ACQUIRE);
+        uint32_t bits = changed & subscribed[region][i];
+        dirty[region][i] = 0;
+
+        if (!bits && run_start < 0)
+            continue;
+
+        for (int bit = 0; bit < 32; bit++)
+        {
+            int block = i * 32 + bit;
+            int set = block < blocks && ((bits >> bit) & 1);
+
+            if (set && run_start < 0)
+            {
+                run_start = block;
+            }
+            else if (!set && run_start >= 0)
+            {
+                runs[count * 2] = run_start << WATCH_BLOCK_SHIFT;
+                runs[count * 2 + 1] = (block - run_start) << WATCH_BLOCK_SHIFT;
+                count++;
+                run_start = -1;
+            }
+        }
+    }
+
+    if (run_start >= 0)
+    {
+        runs[count * 2] = run_start << WATCH_BLOCK_SHIFT;
+        runs[count * 2 + 1] = (blocks - run_start) << WATCH_BLOCK_SHIFT;
+        count++;
+    }
+
+    return count;
+}
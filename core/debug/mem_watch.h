@@ -0,0 +1,50 @@
+#ifndef _MEM_WATCH_H_
+#define _MEM_WATCH_H_
+
+#include "cpuhook.h"
+
+typedef enum
+{
+    WATCH_VRAM = 0,
+    WATCH_CRAM,
+    WATCH_VSRAM,
+    // 68K work RAM, 0xFF0000-0xFFFFFF
+    WATCH_RAM,
+    // Z80 RAM, 0xA00000-0xA01FFF from 68K side
+    WATCH_ZRAM,
+    WATCH_REGIONS
+} watch_region_t;
+
+// Dirty tracking granularity - 64 bytes per bit
+#define WATCH_BLOCK_SHIFT 6
+#define WATCH_BLOCK_SIZE (1 << WATCH_BLOCK_SHIFT)
+
+// Largest region is 64KB
+#define WATCH_WORDS ((0x10000 >> WATCH_BLOCK_SHIFT) / 32)
+
+// Size of region in bytes
+unsigned int mem_watch_size(watch_region_t region);
+
+// Adds [offset, offset + size) of region to subscribed blocks, they are all reported on next collect
+void mem_watch_subscribe(watch_region_t region, unsigned int offset, unsigned int size);
+
+// Removes [offset, offset + size) of region from subscribed blocks
+void mem_watch_unsubscribe(watch_region_t region, unsigned int offset, unsigned int size);
+
+// Drops all subscriptions
+void mem_watch_clear(void);
+
+// Returns 1 if anything is subscribed
+int mem_watch_active(void);
+
+// Hook types needed to track writes to subscribed regions, merged into cpu hook mask
+unsigned int mem_watch_hook_mask(void);
+
+// Marks blocks touched by a write, called from cpu_hook
+void mem_watch_write(hook_type_t type, int width, unsigned int address);
+
+// Stores runs of subscribed blocks written since last call as (offset, size) pairs and resets dirty state.
+// Returns number of runs, runs must have room for WATCH_WORDS * 16 + 1 pairs.
+int mem_watch_collect(watch_region_t region, unsigned int *runs);
+
+#endif /* _MEM_WATCH_H_ */
@@ -42,18 +42,18 @@
 #include "shared.h"
 
 #ifdef USE_DYNAMIC_ALLOC
-external_t *ext;
+CTX_LOCAL external_t *ext;
 #else                     /* External Hardware (Cartridge, CD unit, ...) */
-external_t ext;
+CTX_LOCAL external_t ext;
 #endif
-uint8 boot_rom[0x800];    /* Genesis BOOT ROM   */
-uint8 work_ram[0x10000];  /* 68K RAM  */
-uint8 zram[0x2000];       /* Z80 RAM  */
-uint32 zbank;             /* Z80 bank window address */
-uint8 zstate;             /* Z80 bus state (d0 = /RESET, d1 = BUSREQ, d2 = WAIT) */
-uint8 pico_current;       /* PICO current page */
-
-static uint8 tmss[4];     /* TMSS security register */
+CTX_LOCAL uint8 boot_rom[0x800];    /* Genesis BOOT ROM   */
+CTX_LOCAL uint8 work_ram[0x10000];  /* 68K RAM  */
+CTX_LOCAL uint8 zram[0x2000];       /* Z80 RAM  */
+CTX_LOCAL uint32 zbank;             /* Z80 bank window address */
+CTX_LOCAL uint8 zstate;             /* Z80 bus state (d0 = /RESET, d1 = BUSREQ, d2 = WAIT) */
+CTX_LOCAL uint8 pico_current;       /* PICO current page */
+
+static CTX_LOCAL uint8 tmss[4];     /* TMSS security register */
 
 /*--------------------------------------------------------------------------*/
 /* Init, reset, shutdown functions                                          */
@@ -40,7 +40,7 @@
 #include "shared.h"
 #include "gamepad.h"
 
-static struct
+static CTX_LOCAL struct
 {
   uint8 State;
   uint8 Counter;
@@ -48,13 +48,13 @@ static struct
   uint32 Latency;
 } gamepad[MAX_DEVICES];
 
-static struct
+static CTX_LOCAL struct
 {
   uint8 Latch;
   uint8 Counter;
 } flipflop[2];
 
-static uint8 latch;
+static CTX_LOCAL uint8 latch;
 
 
 void gamepad_reset(int port)
@@ -38,7 +38,7 @@
 
 #include "shared.h"
 
-static struct
+static CTX_LOCAL struct
 {
   uint8 axis;
   uint8 busy;
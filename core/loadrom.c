@@ -90,10 +90,10 @@ typedef struct
 } PERIPHERALINFO;
 
 
-ROMINFO rominfo;
-uint8 romtype;
+CTX_LOCAL ROMINFO rominfo;
+CTX_LOCAL uint8 romtype;
 
-static uint8 rom_region;
+static CTX_LOCAL uint8 rom_region;
 
 /***************************************************************************
  * Genesis ROM Manufacturers
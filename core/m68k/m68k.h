@@ -286,8 +286,8 @@ typedef struct
 } m68ki_cpu_core;
 
 /* CPU cores */
-extern m68ki_cpu_core m68k;
-extern m68ki_cpu_core s68k;
+extern CTX_LOCAL m68ki_cpu_core m68k;
+extern CTX_LOCAL m68ki_cpu_core s68k;
 
 
 /* ======================================================================== */
@@ -18,6 +18,7 @@ extern int vdp_68k_irq_ack(int int_level);
 #include "m68kconf.h"
 #include "m68kcpu.h"
 #include "m68kops.h"
+#include "profiler.h"
 
 /* ======================================================================== */
 /* ================================= DATA ================================= */
@@ -27,9 +28,9 @@ extern int vdp_68k_irq_ack(int int_level);
 static unsigned char m68ki_cycles[0x10000];
 #endif
 
-static int irq_latency;
+static CTX_LOCAL int irq_latency;
 
-m68ki_cpu_core m68k;
+CTX_LOCAL m68ki_cpu_core m68k;
 
 
 /* ======================================================================== */
@@ -272,6 +273,8 @@ void m68k_run(unsigned int cycles)
     return;
   }
 
+  PROFILE_ENTER_SAMPLED(PROF_M68K);
+
   /* Save end cycles count for when CPU is stopped */
   m68k.cycle_end = cycles;
 
@@ -292,7 +295,7 @@ void m68k_run(unsigned int cycles)
 
 #ifdef HOOK_CPU
     /* Trigger execution hook */
-    if (cpu_hook)
+    if (CPU_HOOK_ACTIVE(HOOK_M68K_E))
       cpu_hook(HOOK_M68K_E, 0, REG_PC, 0);
 #endif
 
@@ -312,10 +315,13 @@ void m68k_run(unsigned int cycles)
     /* Execute instruction */
     m68ki_instruction_jump_table[REG_IR]();
     USE_CYCLES(CYC_INSTRUCTION[REG_IR]);
+    PROFILE_COUNT(m68k_instructions, 1);
 
     /* Trace m68k_exception, if necessary */
     m68ki_exception_if_trace(); /* auto-disable (see m68kcpu.h) */
   }
+
+  PROFILE_LEAVE_SAMPLED(PROF_M68K);
 }
 
 int m68k_cycles(void)
@@ -14,7 +14,10 @@
 #endif /* M68K_EMULATE_ADDRESS_ERROR */
 
 #include "m68k.h"
+
+#ifdef HOOK_CPU
 #include "debug.h"
+#endif
 
 
 /* ======================================================================== */
@@ -860,7 +863,7 @@ INLINE uint m68ki_read_8(uint address)
   else val = READ_BYTE(temp->base, (address) & 0xffff);
 
 #ifdef HOOK_CPU
-  if (cpu_hook)
+  if (CPU_HOOK_ACTIVE(HOOK_M68K_R))
     cpu_hook(HOOK_M68K_R, 1, address, val);
 #endif
 
@@ -880,7 +883,7 @@ INLINE uint m68ki_read_16(uint address)
   else val = *(uint16 *)(temp->base + ((address) & 0xffff));
 
 #ifdef HOOK_CPU
-  if (cpu_hook)
+  if (CPU_HOOK_ACTIVE(HOOK_M68K_R))
     cpu_hook(HOOK_M68K_R, 2, address, val);
 #endif
 
@@ -900,7 +903,7 @@ INLINE uint m68ki_read_32(uint address)
   else val = m68k_read_immediate_32(address);
 
 #ifdef HOOK_CPU
-  if (cpu_hook)
+  if (CPU_HOOK_ACTIVE(HOOK_M68K_R))
     cpu_hook(HOOK_M68K_R, 4, address, val);
 #endif
 
@@ -914,7 +917,7 @@ INLINE void m68ki_write_8(uint address, uint value)
   m68ki_set_fc(FLAG_S | FUNCTION_CODE_USER_DATA) /* auto-disable (see m68kcpu.h) */
 
 #ifdef HOOK_CPU
-  if (cpu_hook)
+  if (CPU_HOOK_ACTIVE(HOOK_M68K_W))
     cpu_hook(HOOK_M68K_W, 1, address, value);
 #endif
 
@@ -931,7 +934,7 @@ INLINE void m68ki_write_16(uint address, uint value)
   m68ki_check_address_error(address, MODE_WRITE, FLAG_S | FUNCTION_CODE_USER_DATA); /* auto-disable (see m68kcpu.h) */
 
 #ifdef HOOK_CPU
-  if (cpu_hook)
+  if (CPU_HOOK_ACTIVE(HOOK_M68K_W))
     cpu_hook(HOOK_M68K_W, 2, address, value);
 #endif
 
@@ -948,7 +951,7 @@ INLINE void m68ki_write_32(uint address, uint value)
   m68ki_check_address_error(address, MODE_WRITE, FLAG_S | FUNCTION_CODE_USER_DATA) /* auto-disable (see m68kcpu.h) */
 
 #ifdef HOOK_CPU
-  if (cpu_hook)
+  if (CPU_HOOK_ACTIVE(HOOK_M68K_W))
     cpu_hook(HOOK_M68K_W, 4, address, value);
 #endif
 
@@ -1416,8 +1419,10 @@ INLINE void m68ki_exception_interrupt(uint int_level)
   if(new_pc == 0)
     new_pc = m68ki_read_32((EXCEPTION_UNINITIALIZED_INTERRUPT<<2));
 
+#ifdef HOOK_CPU
   /* Debugger uses this flag to prevent jumping to interrupts */
   dbg_in_interrupt = 1;
+#endif
 
   /* Generate a stack frame */
   m68ki_stack_frame_3word(REG_PC, sr);
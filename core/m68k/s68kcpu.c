@@ -41,7 +41,7 @@ static const uint8 irq_level[0x40] =
   6, 6, 6, 6, 6, 6, 6, 6
 };
 
-m68ki_cpu_core s68k;
+CTX_LOCAL m68ki_cpu_core s68k;
 
 
 /* ======================================================================== */
@@ -32,9 +32,9 @@
 #define WRITE_WORD_LONG(BASE, ADDR, VAL) *(uint32 *)((BASE) + (ADDR)) = VAL & 0xffffffff
 #endif
 
-/* C89 compatibility */
+/* C89 compatibility (double, as math.h one: YM2612 sine table depends on it) */
 #ifndef M_PI
-#define M_PI 3.14159265358979323846264338327f
+#define M_PI 3.14159265358979323846264338327
 #endif /* M_PI */
 
 /* Set to your compiler's static inline keyword to enable it, or
@@ -46,6 +46,20 @@
 #define INLINE static __inline__
 #endif /* INLINE */
 
+/* Storage class of mutable emulator state.
+ * When USE_THREAD_CONTEXT is defined, each thread owns a separate emulated console
+ * (see system.h), read-only look-up tables remain shared by all threads.
+ */
+#ifdef USE_THREAD_CONTEXT
+#if defined(_MSC_VER)
+#define CTX_LOCAL __declspec(thread)
+#else
+#define CTX_LOCAL __thread
+#endif
+#else
+#define CTX_LOCAL
+#endif
+
 /* Alignment macros for cross compiler compatibility */
 #if defined(_MSC_VER)
 #define ALIGNED_(x) __declspec(align(x))
@@ -53,6 +67,11 @@
 #define ALIGNED_(x) __attribute__ ((aligned(x)))
 #endif
 
+/* x86 SIMD kernels (intrinsics with function target attributes, selected at runtime) */
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_X86_SIMD
+#endif
+
 /* Default CD image file access (read-only) functions */
 /* If you need to override default stdio.h functions with custom filesystem API,
    redefine following macros in platform specific include file (osd.h) or Makefile
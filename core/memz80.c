@@ -160,7 +160,7 @@ unsigned char z80_memory_r(unsigned int address)
 void z80_memory_w(unsigned int address, unsigned char data)
 {
   #ifdef HOOK_CPU
-  if (cpu_hook)
+  if (CPU_HOOK_ACTIVE(HOOK_Z80_W))
     cpu_hook(HOOK_Z80_W, 1, address, data);
   #endif
 
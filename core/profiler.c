@@ -0,0 +1,177 @@
+/***************************************************************************************
+ *  Genesis Plus
+ *  Per-subsystem frame profiler
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************************/
+
+#if defined(USE_PROFILER) && !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 199309L   /* clock_gettime */
+#endif
+
+#include "shared.h"
+
+#ifdef USE_PROFILER
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/* Per-subsystem time and call counts of each emulated frame, read back with profiler_read().
+ *
+ * Subsystems are bracketed with PROFILE_ENTER / PROFILE_LEAVE (compiled out without USE_PROFILER):
+ * each switch reads the time stamp counter once and charges the elapsed ticks to the subsystem
+ * being left, so nested calls are not counted twice. Subsystems run on every line (CPUs and
+ * line rendering) use PROFILE_ENTER_SAMPLED / PROFILE_LEAVE_SAMPLED instead: only one call in
+ * PROFILE_SAMPLE_RATE is timed, which keeps the time stamp counter reads to a few hundred per
+ * frame, and the time of other calls is estimated at frame end. Ticks are converted to time with the
+ * frame_ns / frame_ticks ratio of each record, which also covers platforms where ticks are
+ * nanoseconds already. Completed frames go to a ring buffer holding the last PROFILE_FRAMES.
+ */
+
+CTX_LOCAL profiler_t profiler;
+
+static CTX_LOCAL profile_frame_t ring[PROFILE_FRAMES];
+static CTX_LOCAL uint32 frames;   /* frames recorded */
+
+static const char *const names[PROF_MAX] =
+{
+  "frame", "m68k", "z80", "render", "dma", "fm", "sound", "scd", "cdd"
+};
+
+uint32 profiler_ns(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER count, freq;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&freq);
+  return (uint32)((count.QuadPart * 1000000000.0) / freq.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+void profiler_reset(void)
+{
+  memset(&profiler, 0, sizeof(profiler));
+  profiler.id = PROF_MAX;
+  frames = 0;
+}
+
+void profiler_frame_start(void)
+{
+  /* a debugger break may have left subsystems open */
+  profiler.depth = 0;
+  profiler.id = PROF_MAX;
+  profiler_switch(PROF_FRAME);
+  profiler.start = profiler.last;
+  profiler.start_ns = profiler_ns();
+}
+
+/* Moves the estimated time of untimed calls from their callers to the sampled subsystems */
+static void estimate_untimed(void)
+{
+  uint32 ticks[PROF_MAX], calls[PROF_MAX];
+  int id, caller;
+
+  /* averages come from timed calls only */
+  memcpy(ticks, profiler.current.ticks, sizeof(ticks));
+  memcpy(calls, profiler.current.calls, sizeof(calls));
+
+  for (id = 0; id < PROF_MAX; id++)
+  {
+    for (caller = 0; caller <= PROF_MAX; caller++)
+    {
+      uint32 count = profiler.untimed[id][caller];
+      if (count && calls[id])
+      {
+        uint32 *from = (caller < PROF_MAX) ? &profiler.current.ticks[caller] : &profiler.idle;
+        uint32 moved = (uint32)((double)ticks[id] * count / calls[id]);
+        if (moved > *from)
+        {
+          moved = *from;
+        }
+        *from -= moved;
+        profiler.current.ticks[id] += moved;
+      }
+      profiler.current.calls[id] += count;
+    }
+  }
+
+  memset(profiler.untimed, 0, sizeof(profiler.untimed));
+}
+
+void profiler_frame_end(void)
+{
+  profile_frame_t *frame = &ring[frames % PROFILE_FRAMES];
+
+  profiler_switch(PROF_MAX);
+  estimate_untimed();
+  profiler.current.calls[PROF_FRAME]++;
+  profiler.current.frame_ticks = profiler.last - profiler.start;
+  profiler.current.frame_ns = profiler_ns() - profiler.start_ns;
+  profiler.current.frame = ++frames;
+
+  *frame = profiler.current;
+  memset(&profiler.current, 0, sizeof(profiler.current));
+}
+
+/* Copies up to max frames recorded after frame number since, oldest first, returns their count. */
+/* Frame numbers restart from 1 after profiler_reset(), a newer since reads from the oldest frame. */
+int profiler_read(uint32 since, profile_frame_t *out, int max)
+{
+  uint32 first = (frames > PROFILE_FRAMES) ? (frames - PROFILE_FRAMES) : 0;
+  int count = 0;
+
+  if (since > first && since <= frames)
+  {
+    first = since;
+  }
+
+  while (first < frames && count < max)
+  {
+    out[count++] = ring[first++ % PROFILE_FRAMES];
+  }
+
+  return count;
+}
+
+const char *profiler_name(int id)
+{
+  return names[id];
+}
+
+#endif /* USE_PROFILER */
@@ -0,0 +1,189 @@
+/***************************************************************************************
+ *  Genesis Plus
+ *  Per-subsystem frame profiler
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************************/
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+/* Profiled subsystems. Time is exclusive: a subsystem called from another one */
+/* (DMA from a 68k write, FM update from a Z80 write...) is not counted twice. */
+enum
+{
+  PROF_FRAME = 0,       /* frame loop and everything not listed below */
+  PROF_M68K,            /* m68k_run, including memory handlers */
+  PROF_Z80,             /* z80_run, including memory handlers */
+  PROF_RENDER,          /* render_line */
+  PROF_DMA,             /* vdp_dma_update */
+  PROF_FM,              /* FM chip sample generation */
+  PROF_SOUND,           /* sound_update: PSG and FM mixing */
+  PROF_SCD,             /* scd_update: SUB-CPU and CD hardware */
+  PROF_CDD,             /* cdd_update */
+  PROF_MAX
+};
+
+/* Frames kept in the ring buffer */
+#define PROFILE_FRAMES 256
+
+/* Subsystems run once per line are only timed once every that many calls (power of two) */
+#define PROFILE_SAMPLE_RATE 8
+
+typedef struct
+{
+  uint32 frame;               /* frame number, starting at 1 */
+  uint32 ticks[PROF_MAX];     /* time spent in each subsystem, in ticks */
+  uint32 calls[PROF_MAX];     /* calls to each subsystem */
+  uint32 frame_ticks;         /* system_frame duration in ticks */
+  uint32 frame_ns;            /* the same in nanoseconds (gives the tick rate) */
+  uint32 m68k_instructions;   /* 68k instructions executed */
+  uint32 dma_bytes;           /* VDP DMA bytes (words for CRAM/VSRAM) transferred */
+  uint32 fm_samples;          /* FM samples generated (at chip rate) */
+  uint32 fm_idle_samples;     /* FM channel samples (same rate) skipped on idle channels */
+} profile_frame_t;
+
+#ifdef USE_PROFILER
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define profiler_ticks() ((uint32)__rdtsc())
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define profiler_ticks() ((uint32)__rdtsc())
+#else
+#define profiler_ticks() profiler_ns()
+#endif
+
+extern uint32 profiler_ns(void);
+
+/* Frame being profiled. Subsystems called between frames (sound_update from audio_update) */
+/* are counted in the next frame, time outside subsystems and frames goes to idle. */
+typedef struct
+{
+  profile_frame_t current;
+  uint32 last;                /* timestamp of last subsystem switch */
+  uint32 start;               /* frame start timestamp */
+  uint32 start_ns;
+  uint32 idle;
+  int id;                     /* subsystem being timed, PROF_MAX outside frames */
+  int depth;
+  uint8 stack[16];            /* interrupted subsystems */
+  uint8 timed[PROF_MAX];      /* current call of a sampled subsystem is timed */
+  uint32 sampled[PROF_MAX];   /* calls of each sampled subsystem, picks the timed ones */
+  uint32 untimed[PROF_MAX][PROF_MAX + 1];   /* other calls, per caller (PROF_MAX = idle) */
+} profiler_t;
+
+extern CTX_LOCAL profiler_t profiler;
+
+INLINE void profiler_switch(int id)
+{
+  uint32 now = profiler_ticks();
+  uint32 *ticks = (profiler.id < PROF_MAX) ? &profiler.current.ticks[profiler.id] : &profiler.idle;
+  *ticks += now - profiler.last;
+  profiler.last = now;
+  profiler.id = id;
+}
+
+/* Calls nested deeper than the stack are counted in their caller */
+INLINE void profiler_enter(int id)
+{
+  if (profiler.depth < (int)sizeof(profiler.stack))
+  {
+    profiler.stack[profiler.depth] = profiler.id;
+    profiler_switch(id);
+  }
+  profiler.depth++;
+}
+
+INLINE void profiler_leave(void)
+{
+  if (profiler.depth > 0 && --profiler.depth < (int)sizeof(profiler.stack))
+  {
+    if (profiler.id < PROF_MAX)
+    {
+      profiler.current.calls[profiler.id]++;
+    }
+    profiler_switch(profiler.stack[profiler.depth]);
+  }
+}
+
+/* Untimed calls are charged to their caller, then given the average time of timed calls at frame end */
+INLINE void profiler_enter_sampled(int id)
+{
+  profiler.timed[id] = !(profiler.sampled[id]++ & (PROFILE_SAMPLE_RATE - 1));
+  if (profiler.timed[id])
+  {
+    profiler_enter(id);
+  }
+  else
+  {
+    profiler.untimed[id][profiler.id]++;
+  }
+}
+
+INLINE void profiler_leave_sampled(int id)
+{
+  if (profiler.timed[id])
+  {
+    profiler_leave();
+  }
+}
+
+#define PROFILE_FRAME_START() profiler_frame_start()
+#define PROFILE_FRAME_END() profiler_frame_end()
+#define PROFILE_ENTER(id) profiler_enter(id)
+#define PROFILE_LEAVE() profiler_leave()
+#define PROFILE_ENTER_SAMPLED(id) profiler_enter_sampled(id)
+#define PROFILE_LEAVE_SAMPLED(id) profiler_leave_sampled(id)
+#define PROFILE_COUNT(counter, n) profiler.current.counter += (n)
+
+/* Function prototypes */
+extern void profiler_reset(void);
+extern void profiler_frame_start(void);
+extern void profiler_frame_end(void);
+extern int profiler_read(uint32 since, profile_frame_t *frames, int max);
+extern const char *profiler_name(int id);
+
+#else
+
+#define PROFILE_FRAME_START()
+#define PROFILE_FRAME_END()
+#define PROFILE_ENTER(id)
+#define PROFILE_LEAVE()
+#define PROFILE_ENTER_SAMPLED(id)
+#define PROFILE_LEAVE_SAMPLED(id)
+#define PROFILE_COUNT(counter, n)
+
+#endif /* USE_PROFILER */
+
+#endif
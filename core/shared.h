@@ -36,6 +36,8 @@
 #include "areplay.h"
 #include "svp.h"
 #include "state.h"
+#include "snapshot.h"
+#include "profiler.h"
 
 #endif /* _SHARED_H_ */
 
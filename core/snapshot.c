@@ -0,0 +1,431 @@
+/***************************************************************************************
+ *  Genesis Plus
+ *  Incremental snapshots (rewind / rollback)
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ ****************************************************************************************/
+
+
+#include "shared.h"
+
+/* Frame history for rewind and rollback.
+ *
+ * Every pushed frame is the savestate image followed by SRAM and by the 68k bus refresh counter,
+ * which savestates do not hold but replayed frames need to be cycle-exact. A keyframe stores the full image,
+ * other frames store it XORed with their keyframe: the image is compared page by page, unchanged
+ * pages are skipped and changed bytes are stored as (offset, length, xor data) runs, so a frame
+ * costs about as much as the memory the game touched since the keyframe.
+ * Restoring a frame copies its keyframe and applies a single delta, whatever its age.
+ */
+
+/* Compare granularity, only dirty pages are scanned byte per byte */
+#define PAGE_SIZE     256
+
+/* Equal bytes that end a run, shorter gaps are cheaper to store than a new run header */
+#define RUN_GAP       8
+
+/* New keyframe once a delta grows past this fraction of the full image */
+#define MAX_DELTA(size) ((size) / 4)
+
+/* Largest image */
+#define IMAGE_SIZE (STATE_SIZE + sizeof(sram.sram) + sizeof(m68k.refresh_cycles))
+
+typedef struct
+{
+  uint8 *data;
+  int size;
+  int capacity;
+  uint32 key;           /* keyframe id */
+} frame_t;
+
+typedef struct
+{
+  uint8 *data;
+  uint32 frame;         /* id of the frame it was taken at */
+} keyframe_t;
+
+static CTX_LOCAL struct
+{
+  frame_t *frames;
+  keyframe_t *keys;
+  int max_frames;
+  int max_keys;
+  int interval;
+  int size;             /* full image size, 0 until first push */
+  uint32 newest;        /* next frame id */
+  uint32 count;         /* frames held */
+  uint32 next_key;      /* next keyframe id */
+  int last_bytes;
+  uint8 *image;         /* current image */
+  uint8 *delta;         /* encoder output, worst case size */
+} snap;
+
+/* Serializes current machine into snap.image, returns image size */
+static int capture(void)
+{
+  int size = state_save(snap.image);
+
+  if (sram.on)
+  {
+    memcpy(snap.image + size, sram.sram, sizeof(sram.sram));
+    size += sizeof(sram.sram);
+  }
+
+  memcpy(snap.image + size, &m68k.refresh_cycles, sizeof(m68k.refresh_cycles));
+  size += sizeof(m68k.refresh_cycles);
+
+  return size;
+}
+
+static void put32(uint8 *p, uint32 v)
+{
+  memcpy(p, &v, 4);
+}
+
+static uint32 get32(const uint8 *p)
+{
+  uint32 v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static int emit_run(uint8 *out, int len, const uint8 *cur, const uint8 *key, int start, int end)
+{
+  int i;
+
+  put32(out + len, start);
+  put32(out + len + 4, end - start);
+  len += 8;
+
+  for (i = start; i < end; i++)
+  {
+    out[len++] = cur[i] ^ key[i];
+  }
+
+  return len;
+}
+
+static int encode_delta(const uint8 *cur, const uint8 *key, int size, uint8 *out)
+{
+  int pos = 0, len = 0;
+  int run_start = -1, run_end = 0;
+
+  while (pos < size)
+  {
+    /* skip clean pages */
+    if ((run_start < 0) && !(pos & (PAGE_SIZE - 1)) && ((size - pos) >= PAGE_SIZE) && !memcmp(cur + pos, key + pos, PAGE_SIZE))
+    {
+      pos += PAGE_SIZE;
+      continue;
+    }
+
+    if (cur[pos] != key[pos])
+    {
+      if (run_start < 0)
+      {
+        run_start = pos;
+      }
+      run_end = pos + 1;
+    }
+    else if ((run_start >= 0) && ((pos - run_end) >= RUN_GAP))
+    {
+      len = emit_run(out, len, cur, key, run_start, run_end);
+      run_start = -1;
+    }
+
+    pos++;
+  }
+
+  if (run_start >= 0)
+  {
+    len = emit_run(out, len, cur, key, run_start, run_end);
+  }
+
+  return len;
+}
+
+static void apply_delta(uint8 *image, const uint8 *delta, int len)
+{
+  int pos = 0;
+
+  while (pos < len)
+  {
+    uint32 offset = get32(delta + pos);
+    uint32 size = get32(delta + pos + 4);
+    uint8 *dst = image + offset;
+    const uint8 *src = delta + pos + 8;
+    uint32 i;
+
+    for (i = 0; i < size; i++)
+    {
+      dst[i] ^= src[i];
+    }
+
+    pos += 8 + size;
+  }
+}
+
+static int key_valid(uint32 key)
+{
+  return (key < snap.next_key) && ((snap.next_key - key) <= (uint32)snap.max_keys);
+}
+
+static void frame_store(frame_t *frame, const uint8 *data, int size)
+{
+  if (frame->capacity < size)
+  {
+    uint8 *buf = realloc(frame->data, size);
+    if (!buf)
+    {
+      frame->size = -1;
+      return;
+    }
+    frame->data = buf;
+    frame->capacity = size;
+  }
+
+  if (size)
+  {
+    memcpy(frame->data, data, size);
+  }
+  frame->size = size;
+}
+
+int snapshot_init(int frames, int keyframe_interval)
+{
+  snapshot_shutdown();
+
+  if ((frames < 1) || (keyframe_interval < 1))
+  {
+    return 0;
+  }
+
+  snap.max_frames = frames;
+  snap.interval = keyframe_interval;
+
+  /* one more than needed at keyframe interval, keyframes forced by large deltas may still
+     evict the one oldest frames were stored against: those frames are dropped by snapshot_push */
+  snap.max_keys = (frames + keyframe_interval - 1) / keyframe_interval + 1;
+
+  snap.frames = calloc(snap.max_frames, sizeof(frame_t));
+  snap.keys = calloc(snap.max_keys, sizeof(keyframe_t));
+  snap.image = malloc(IMAGE_SIZE);
+
+  /* runs are at least RUN_GAP bytes apart, each costs 8 bytes of header */
+  snap.delta = malloc(2 * IMAGE_SIZE + 16);
+
+  if (!snap.frames || !snap.keys || !snap.image || !snap.delta)
+  {
+    snapshot_shutdown();
+    return 0;
+  }
+
+  return 1;
+}
+
+void snapshot_shutdown(void)
+{
+  int i;
+
+  if (snap.frames)
+  {
+    for (i = 0; i < snap.max_frames; i++)
+    {
+      free(snap.frames[i].data);
+    }
+  }
+
+  if (snap.keys)
+  {
+    for (i = 0; i < snap.max_keys; i++)
+    {
+      free(snap.keys[i].data);
+    }
+  }
+
+  free(snap.frames);
+  free(snap.keys);
+  free(snap.image);
+  free(snap.delta);
+  memset(&snap, 0, sizeof(snap));
+}
+
+/* Drops history, to be called after loading a ROM or a savestate */
+void snapshot_reset(void)
+{
+  snap.count = 0;
+  snap.newest = 0;
+  snap.next_key = 0;
+  snap.size = 0;
+  snap.last_bytes = 0;
+}
+
+/* Stores current machine state as the newest frame, returns bytes stored for it (0 on error) */
+int snapshot_push(void)
+{
+  frame_t *frame;
+  keyframe_t *key = NULL;
+  int size, len = 0;
+
+  if (!snap.frames)
+  {
+    return 0;
+  }
+
+  size = capture();
+  if (size != snap.size)
+  {
+    /* machine changed, older frames can't be restored into it */
+    snapshot_reset();
+    snap.size = size;
+  }
+
+  if (snap.next_key)
+  {
+    key = &snap.keys[(snap.next_key - 1) % snap.max_keys];
+    len = encode_delta(snap.image, key->data, size, snap.delta);
+
+    /* keyframe too old or too far from current state */
+    if (((snap.newest - key->frame) >= (uint32)snap.interval) || (len > MAX_DELTA(size)))
+    {
+      key = NULL;
+    }
+  }
+
+  if (!key)
+  {
+    key = &snap.keys[snap.next_key % snap.max_keys];
+    if (!key->data)
+    {
+      key->data = malloc(IMAGE_SIZE);
+      if (!key->data)
+      {
+        return 0;
+      }
+    }
+
+    memcpy(key->data, snap.image, size);
+    key->frame = snap.newest;
+    snap.next_key++;
+    len = 0;
+  }
+
+  frame = &snap.frames[snap.newest % snap.max_frames];
+  frame_store(frame, snap.delta, len);
+  if (frame->size < 0)
+  {
+    snapshot_reset();
+    return 0;
+  }
+  frame->key = snap.next_key - 1;
+
+  snap.newest++;
+  if (snap.count < (uint32)snap.max_frames)
+  {
+    snap.count++;
+  }
+
+  /* only frames whose keyframe is still held can be restored */
+  while (snap.count && !key_valid(snap.frames[(snap.newest - snap.count) % snap.max_frames].key))
+  {
+    snap.count--;
+  }
+
+  snap.last_bytes = len ? (len + sizeof(frame_t)) : (size + sizeof(frame_t));
+  return snap.last_bytes;
+}
+
+/* Restores the frame pushed age frames ago (0 = newest), newer frames are dropped */
+int snapshot_restore(int age)
+{
+  frame_t *frame;
+  keyframe_t *key;
+  uint32 id;
+
+  if ((age < 0) || ((uint32)age >= snap.count))
+  {
+    return 0;
+  }
+
+  id = snap.newest - 1 - age;
+  frame = &snap.frames[id % snap.max_frames];
+  if (!key_valid(frame->key))
+  {
+    return 0;
+  }
+
+  key = &snap.keys[frame->key % snap.max_keys];
+  memcpy(snap.image, key->data, snap.size);
+  apply_delta(snap.image, frame->data, frame->size);
+
+  if (!state_load(snap.image))
+  {
+    return 0;
+  }
+
+  memcpy(&m68k.refresh_cycles, snap.image + snap.size - sizeof(m68k.refresh_cycles), sizeof(m68k.refresh_cycles));
+
+  if (sram.on)
+  {
+    memcpy(sram.sram, snap.image + snap.size - sizeof(m68k.refresh_cycles) - sizeof(sram.sram), sizeof(sram.sram));
+  }
+
+  /* restored frame becomes the newest one */
+  snap.newest = id + 1;
+  snap.count -= age;
+  snap.next_key = frame->key + 1;
+  return 1;
+}
+
+void snapshot_get_stats(snapshot_stats_t *stats)
+{
+  uint32 i, total = 0;
+  uint32 keys = 0;
+
+  for (i = 0; i < snap.count; i++)
+  {
+    frame_t *frame = &snap.frames[(snap.newest - 1 - i) % snap.max_frames];
+    total += frame->size + sizeof(frame_t);
+  }
+
+  for (i = 0; (i < (uint32)snap.max_keys) && (i < snap.next_key); i++)
+  {
+    keys++;
+    total += snap.size;
+  }
+
+  stats->frames = snap.count;
+  stats->keyframes = keys;
+  stats->state_size = snap.size;
+  stats->last_bytes = snap.last_bytes;
+  stats->total_bytes = total;
+}
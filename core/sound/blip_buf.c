@@ -6,8 +6,10 @@
 /*  - added blip_mix_samples function (see blip_buf.h)              */
 /*  - added stereo buffer support (define #BLIP_MONO to disable)    */
 /*  - added inverted stereo output (define #BLIP_INVERT to enable)*/
+/*  - added SIMD kernels (define #NO_SIMD_BLIP to disable)          */
 
 #include "blip_buf.h"
+#include "macros.h"
 
 #ifdef BLIP_ASSERT
 #include <assert.h>
@@ -16,6 +18,12 @@
 #include <string.h>
 #include <stdlib.h>
 
+/* SIMD delta insertion and sample output (x86 stereo buffers only) */
+#if !defined(NO_SIMD_BLIP) && !defined(BLIP_MONO) && defined(HAVE_X86_SIMD)
+#include <immintrin.h>
+#define BLIP_SIMD
+#endif
+
 /* Library Copyright (C) 2003-2009 Shay Green. This library is free software;
 you can redistribute it and/or modify it under the terms of the GNU Lesser
 General Public License as published by the Free Software Foundation; either
@@ -71,6 +79,14 @@ increased by decreasing time_bits, which would reduce resample ratio accuracy.
 
 typedef int buf_t;
 
+#ifdef BLIP_SIMD
+/* SIMD kernels, NULL when the scalar code is used */
+typedef void (*add_step_t)( buf_t* out_l, buf_t* out_r, short const* in, short const* rev,
+                            int delta_l, int delta_r, int interp );
+typedef void (*integrate_t)( int* integrator, buf_t const* const* in_l, buf_t const* const* in_r,
+                             int sources, short* out, int count );
+#endif
+
 struct blip_t
 {
 	fixed_t factor;
@@ -82,6 +98,10 @@ struct blip_t
   int integrator[2];
   buf_t* buffer[2];
 #endif
+#ifdef BLIP_SIMD
+  add_step_t add_step;
+  integrate_t integrate;
+#endif
 };
 
 #ifdef BLIP_MONO
@@ -149,6 +169,14 @@ blip_t* blip_new( int size )
       blip_delete(m);
       return 0;
     }
+#endif
+#ifdef BLIP_SIMD
+    /* Fastest delta insertion supported by the CPU. SIMD sample output is not faster */
+    /* on PSG noise and three buffer mixing workloads, scalar one is kept by default.  */
+    m->add_step = NULL;
+    if ( !blip_set_kernel( m, blip_kernel_avx2 ) )
+      blip_set_kernel( m, blip_kernel_sse2 );
+    m->integrate = NULL;
 #endif
 		m->factor = time_unit / blip_max_ratio;
 		m->size   = size;
@@ -286,6 +314,14 @@ int blip_read_samples( blip_t* m, short out [], int count)
 		int sum2 = m->integrator[1];
 #endif
 		buf_t const* end = in + count;
+#ifdef BLIP_SIMD
+		if ( m->integrate )
+		{
+			m->integrate( m->integrator, &in, &in2, 1, out, count );
+			remove_samples( m, count );
+			return count;
+		}
+#endif
 		do
 		{
 			/* Eliminate fraction */
@@ -362,6 +398,17 @@ int blip_mix_samples( blip_t* m1, blip_t* m2, blip_t* m3, short out [], int coun
     in2[2] = m3->buffer[1];
 #endif
 
+#ifdef BLIP_SIMD
+    if ( m1->integrate )
+    {
+      m1->integrate( m1->integrator, in, in2, 3, out, count );
+      remove_samples( m1, count );
+      remove_samples( m2, count );
+      remove_samples( m3, count );
+      return count;
+    }
+#endif
+
     end = in[0] + count;
     do
     {
@@ -462,6 +509,264 @@ simply ignoring the low half. */
 
 #ifndef BLIP_MONO
 
+#ifdef BLIP_SIMD
+
+/* Delta insertion: kernel pairs (step[phase][k], step[phase+1][k]) are interleaved
+so that pmaddwd returns in[k]*delta_l + in[half_width+k]*delta for all 16 taps,
+exactly as the scalar code. Deltas that don't fit in 16 bits (large FM jumps) use
+32-bit multiplies (AVX2) or the scalar code (SSE2). */
+
+static void add_taps_c( buf_t* out, short const* in, short const* rev, int delta_l, int delta )
+{
+	out [0] += in[0]*delta_l + in[half_width+0]*delta;
+	out [1] += in[1]*delta_l + in[half_width+1]*delta;
+	out [2] += in[2]*delta_l + in[half_width+2]*delta;
+	out [3] += in[3]*delta_l + in[half_width+3]*delta;
+	out [4] += in[4]*delta_l + in[half_width+4]*delta;
+	out [5] += in[5]*delta_l + in[half_width+5]*delta;
+	out [6] += in[6]*delta_l + in[half_width+6]*delta;
+	out [7] += in[7]*delta_l + in[half_width+7]*delta;
+	out [8] += rev[7]*delta_l + rev[7-half_width]*delta;
+	out [9] += rev[6]*delta_l + rev[6-half_width]*delta;
+	out [10] += rev[5]*delta_l + rev[5-half_width]*delta;
+	out [11] += rev[4]*delta_l + rev[4-half_width]*delta;
+	out [12] += rev[3]*delta_l + rev[3-half_width]*delta;
+	out [13] += rev[2]*delta_l + rev[2-half_width]*delta;
+	out [14] += rev[1]*delta_l + rev[1-half_width]*delta;
+	out [15] += rev[0]*delta_l + rev[0-half_width]*delta;
+}
+
+#define FITS_16BIT( n ) ((unsigned) (n) + 0x8000u < 0x10000u)
+
+__attribute__((target("sse2")))
+static void load_taps_sse2( __m128i taps [4], short const* in, short const* rev )
+{
+	__m128i a = _mm_loadu_si128( (__m128i const*) in );
+	__m128i b = _mm_loadu_si128( (__m128i const*) (in + half_width) );
+	__m128i c = _mm_loadu_si128( (__m128i const*) rev );
+	__m128i d = _mm_loadu_si128( (__m128i const*) (rev - half_width) );
+
+	taps [0] = _mm_unpacklo_epi16( a, b );
+	taps [1] = _mm_unpackhi_epi16( a, b );
+
+	/* second half of the kernel is read backwards */
+	taps [2] = _mm_shuffle_epi32( _mm_unpackhi_epi16( c, d ), 0x1B );
+	taps [3] = _mm_shuffle_epi32( _mm_unpacklo_epi16( c, d ), 0x1B );
+}
+
+__attribute__((target("sse2")))
+static void add_taps_sse2( buf_t* out, __m128i const prod [4] )
+{
+	int i;
+	for ( i = 0; i < 4; i++ )
+	{
+		__m128i* p = (__m128i*) (out + i*4);
+		_mm_storeu_si128( p, _mm_add_epi32( _mm_loadu_si128( p ), prod [i] ) );
+	}
+}
+
+__attribute__((target("sse2")))
+static void add_step_sse2( buf_t* out_l, buf_t* out_r, short const* in, short const* rev,
+                           int delta_l, int delta_r, int interp )
+{
+	__m128i taps [4];
+	__m128i prod [4];
+	__m128i d;
+	int delta = (delta_l * interp) >> delta_bits;
+	int same = (delta_l == delta_r);
+	int i;
+
+	load_taps_sse2( taps, in, rev );
+
+	delta_l -= delta;
+	if ( FITS_16BIT( delta_l ) && FITS_16BIT( delta ) )
+	{
+		d = _mm_unpacklo_epi16( _mm_set1_epi16( (short) delta_l ), _mm_set1_epi16( (short) delta ) );
+		for ( i = 0; i < 4; i++ )
+			prod [i] = _mm_madd_epi16( taps [i], d );
+		add_taps_sse2( out_l, prod );
+		if ( same )
+		{
+			add_taps_sse2( out_r, prod );
+			return;
+		}
+	}
+	else
+	{
+		add_taps_c( out_l, in, rev, delta_l, delta );
+		if ( same )
+		{
+			add_taps_c( out_r, in, rev, delta_l, delta );
+			return;
+		}
+	}
+
+	delta = (delta_r * interp) >> delta_bits;
+	delta_r -= delta;
+	if ( FITS_16BIT( delta_r ) && FITS_16BIT( delta ) )
+	{
+		d = _mm_unpacklo_epi16( _mm_set1_epi16( (short) delta_r ), _mm_set1_epi16( (short) delta ) );
+		for ( i = 0; i < 4; i++ )
+			prod [i] = _mm_madd_epi16( taps [i], d );
+		add_taps_sse2( out_r, prod );
+	}
+	else
+	{
+		add_taps_c( out_r, in, rev, delta_r, delta );
+	}
+}
+
+__attribute__((target("avx2")))
+static __m256i mul_taps_avx2( __m256i taps, int delta_l, int delta )
+{
+	if ( FITS_16BIT( delta_l ) && FITS_16BIT( delta ) )
+	{
+		return _mm256_madd_epi16( taps, _mm256_unpacklo_epi16( _mm256_set1_epi16( (short) delta_l ),
+		                                                       _mm256_set1_epi16( (short) delta ) ) );
+	}
+
+	return _mm256_add_epi32(
+		_mm256_mullo_epi32( _mm256_srai_epi32( _mm256_slli_epi32( taps, 16 ), 16 ), _mm256_set1_epi32( delta_l ) ),
+		_mm256_mullo_epi32( _mm256_srai_epi32( taps, 16 ), _mm256_set1_epi32( delta ) ) );
+}
+
+__attribute__((target("avx2")))
+static void add_taps_avx2( buf_t* out, __m256i lo, __m256i hi )
+{
+	__m256i* p = (__m256i*) out;
+	_mm256_storeu_si256( p, _mm256_add_epi32( _mm256_loadu_si256( p ), lo ) );
+	_mm256_storeu_si256( p + 1, _mm256_add_epi32( _mm256_loadu_si256( p + 1 ), hi ) );
+}
+
+__attribute__((target("avx2")))
+static void add_step_avx2( buf_t* out_l, buf_t* out_r, short const* in, short const* rev,
+                           int delta_l, int delta_r, int interp )
+{
+	__m128i taps [4];
+	__m256i lo, hi;
+	int delta = (delta_l * interp) >> delta_bits;
+	int same = (delta_l == delta_r);
+
+	load_taps_sse2( taps, in, rev );
+	lo = _mm256_inserti128_si256( _mm256_castsi128_si256( taps [0] ), taps [1], 1 );
+	hi = _mm256_inserti128_si256( _mm256_castsi128_si256( taps [2] ), taps [3], 1 );
+
+	delta_l -= delta;
+	add_taps_avx2( out_l, mul_taps_avx2( lo, delta_l, delta ), mul_taps_avx2( hi, delta_l, delta ) );
+	if ( same )
+	{
+		add_taps_avx2( out_r, mul_taps_avx2( lo, delta_l, delta ), mul_taps_avx2( hi, delta_l, delta ) );
+		return;
+	}
+
+	delta = (delta_r * interp) >> delta_bits;
+	delta_r -= delta;
+	add_taps_avx2( out_r, mul_taps_avx2( lo, delta_r, delta ), mul_taps_avx2( hi, delta_r, delta ) );
+}
+
+/* Sample output: left and right integrators are run in the two low lanes of one
+register. Without clamping, each step only is sum += in - ((sum >> 15) << 6),
+so blocks of four samples are computed that way and redone with the clamped
+filter when one of them reached the 16-bit limits (the conversion saturates the
+same way). Following blocks use the clamped filter until one is not clipped. */
+
+__attribute__((target("sse2")))
+static __m128i integrate_step( __m128i* sum, __m128i in, int clamp )
+{
+	__m128i s = _mm_srai_epi32( *sum, delta_bits );
+	if ( clamp )
+	{
+		s = _mm_packs_epi32( s, s );
+		s = _mm_srai_epi32( _mm_unpacklo_epi16( s, s ), 16 );
+	}
+	*sum = _mm_sub_epi32( _mm_add_epi32( *sum, in ), _mm_slli_epi32( s, delta_bits - bass_shift ) );
+	return s;
+}
+
+/* four samples of both channels, in holds L0 R0 L1 R1 and L2 R2 L3 R3 */
+__attribute__((target("sse2")))
+static __m128i integrate_block( __m128i* sum, __m128i const in [2], int clamp )
+{
+	__m128i s0 = integrate_step( sum, in [0], clamp );
+	__m128i s1 = integrate_step( sum, _mm_srli_si128( in [0], 8 ), clamp );
+	__m128i s2 = integrate_step( sum, in [1], clamp );
+	__m128i s3 = integrate_step( sum, _mm_srli_si128( in [1], 8 ), clamp );
+	return _mm_packs_epi32( _mm_unpacklo_epi64( s0, s1 ), _mm_unpacklo_epi64( s2, s3 ) );
+}
+
+__attribute__((target("sse2")))
+static int clipped( __m128i pcm )
+{
+	return _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi16( pcm, _mm_set1_epi16( max_sample ) ),
+	                                        _mm_cmpeq_epi16( pcm, _mm_set1_epi16( min_sample ) ) ) );
+}
+
+__attribute__((target("sse2")))
+static void integrate_sse2( int* integrator, buf_t const* const* in_l, buf_t const* const* in_r,
+                            int sources, short* out, int count )
+{
+	__m128i sum = _mm_setr_epi32( integrator [0], integrator [1], 0, 0 );
+	int clamp = 0;
+	int i = 0;
+
+	for ( ; i + 4 <= count; i += 4, out += 8 )
+	{
+		__m128i l = _mm_loadu_si128( (__m128i const*) (in_l [0] + i) );
+		__m128i r = _mm_loadu_si128( (__m128i const*) (in_r [0] + i) );
+		__m128i in [2], pcm;
+
+		if ( sources == 3 )
+		{
+			l = _mm_add_epi32( l, _mm_add_epi32( _mm_loadu_si128( (__m128i const*) (in_l [1] + i) ),
+			                                     _mm_loadu_si128( (__m128i const*) (in_l [2] + i) ) ) );
+			r = _mm_add_epi32( r, _mm_add_epi32( _mm_loadu_si128( (__m128i const*) (in_r [1] + i) ),
+			                                     _mm_loadu_si128( (__m128i const*) (in_r [2] + i) ) ) );
+		}
+
+		in [0] = _mm_unpacklo_epi32( l, r );
+		in [1] = _mm_unpackhi_epi32( l, r );
+
+		if ( !clamp )
+		{
+			__m128i last = sum;
+			pcm = integrate_block( &sum, in, 0 );
+			if ( !clipped( pcm ) )
+			{
+				_mm_storeu_si128( (__m128i*) out, pcm );
+				continue;
+			}
+			sum = last;
+		}
+
+		pcm = integrate_block( &sum, in, 1 );
+		_mm_storeu_si128( (__m128i*) out, pcm );
+		clamp = clipped( pcm );
+	}
+
+	for ( ; i < count; i++, out += 2 )
+	{
+		int l = in_l [0] [i];
+		int r = in_r [0] [i];
+		__m128i s;
+		int pcm;
+
+		if ( sources == 3 )
+		{
+			l += in_l [1] [i] + in_l [2] [i];
+			r += in_r [1] [i] + in_r [2] [i];
+		}
+
+		s = integrate_step( &sum, _mm_setr_epi32( l, r, 0, 0 ), 1 );
+		pcm = _mm_cvtsi128_si32( _mm_packs_epi32( s, s ) );
+		memcpy( out, &pcm, sizeof pcm );
+	}
+
+	integrator [0] = _mm_cvtsi128_si32( sum );
+	integrator [1] = _mm_cvtsi128_si32( _mm_srli_si128( sum, 4 ) );
+}
+
+#endif /* BLIP_SIMD */
+
 void blip_add_delta( blip_t* m, unsigned time, int delta_l, int delta_r )
 {
   if (delta_l | delta_r)
@@ -488,6 +793,14 @@ void blip_add_delta( blip_t* m, unsigned time, int delta_l, int delta_r )
     assert( pos <= m->size + end_frame_extra );
 #endif
 
+#ifdef BLIP_SIMD
+    if (m->add_step)
+    {
+      m->add_step(out_l, out_r, in, rev, delta_l, delta_r, interp);
+      return;
+    }
+#endif
+
     if (delta_l == delta_r)
     {
       buf_t out;
@@ -684,3 +997,32 @@ void blip_add_delta_fast( blip_t* m, unsigned time, int delta )
 	out [8] += delta2;
 }
 #endif
+
+int blip_set_kernel( blip_t* m, int kernel )
+{
+	switch ( kernel )
+	{
+		case blip_kernel_scalar:
+#ifdef BLIP_SIMD
+			m->add_step = NULL;
+			m->integrate = NULL;
+#endif
+			return 1;
+
+#ifdef BLIP_SIMD
+		case blip_kernel_sse2:
+			if ( !__builtin_cpu_supports( "sse2" ) ) break;
+			m->add_step = add_step_sse2;
+			m->integrate = integrate_sse2;
+			return 1;
+
+		case blip_kernel_avx2:
+			if ( !__builtin_cpu_supports( "avx2" ) ) break;
+			m->add_step = add_step_avx2;
+			m->integrate = integrate_sse2;
+			return 1;
+#endif
+	}
+
+	return 0;
+}
@@ -71,6 +71,16 @@ int blip_read_samples( blip_t*, short out [], int count);
 /* Same as above function except sample is mixed from three blip buffers source */
 int blip_mix_samples( blip_t* m1, blip_t* m2, blip_t* m3, short out [], int count);
 
+enum { /** Kernels used by blip_add_delta() and to read samples */
+blip_kernel_scalar, blip_kernel_sse2, blip_kernel_avx2 };
+
+/** Selects kernels used by blip_add_delta() and to read samples from buffer (by
+blip_mix_samples(), those of first buffer), all of them give identical results.
+By default, delta insertion uses the fastest kernel supported by the CPU and
+samples are read by scalar code. Returns 0 if kernel is not supported by the CPU
+or the build. */
+int blip_set_kernel( blip_t*, int kernel );
+
 /** Frees buffer. No effect if NULL is passed. */
 void blip_delete( blip_t* );
 
@@ -74,7 +74,7 @@ static const uint16 chanVolume[16] = {
   0                             /*  OFF  */
 };
 
-static struct
+static CTX_LOCAL struct
 {
   int clocks;
   int latch;
@@ -92,6 +92,7 @@ static struct
 } psg;
 
 static void psg_update(unsigned int clocks);
+static void psg_skip(unsigned int clocks);
 
 void psg_init(PSG_TYPE type)
 {
@@ -209,14 +210,17 @@ int psg_context_load(uint8 *state)
     }
   }
 
-  /* update mixed channels output */
-  if (config.hq_psg)
+  /* update mixed channels output (held output is left unchanged when restoring speculative frames) */
+  if (!system_skip)
   {
-    blip_add_delta(snd.blips[0], psg.clocks, delta[0], delta[1]);
-  }
-  else
-  {
-    blip_add_delta_fast(snd.blips[0], psg.clocks, delta[0], delta[1]);
+    if (config.hq_psg)
+    {
+      blip_add_delta(snd.blips[0], psg.clocks, delta[0], delta[1]);
+    }
+    else
+    {
+      blip_add_delta_fast(snd.blips[0], psg.clocks, delta[0], delta[1]);
+    }
   }
 
   return bufferptr;
@@ -226,6 +230,15 @@ void psg_write(unsigned int clocks, unsigned int data)
 {
   int index;
 
+#ifdef USE_THREAD_CONTEXT
+  /* PSG chip is run by the context replaying sound log */
+  if (sound_log)
+  {
+    sound_log_add(SOUND_LOG_PSG_WRITE, clocks, 0, data);
+    return;
+  }
+#endif
+
   /* PSG chip synchronization */
   if (clocks > psg.clocks)
   {
@@ -380,6 +393,15 @@ void psg_config(unsigned int clocks, unsigned int preamp, unsigned int panning)
 {
   int i;
 
+#ifdef USE_THREAD_CONTEXT
+  /* PSG chip is run by the context replaying sound log */
+  if (sound_log)
+  {
+    sound_log_add(SOUND_LOG_PSG_CONFIG, clocks, panning, preamp);
+    return;
+  }
+#endif
+
   /* PSG chip synchronization */
   if (clocks > psg.clocks)
   {
@@ -456,6 +478,13 @@ static void psg_update(unsigned int clocks)
 {
   int i, timestamp, polarity;
 
+  /* audio output is not needed */
+  if (system_skip)
+  {
+    psg_skip(clocks);
+    return;
+  }
+
   for (i=0; i<4; i++)
   {
     /* apply any pending channel volume variations */
@@ -567,3 +596,84 @@ static void psg_update(unsigned int clocks)
     psg.polarity[i] = polarity;
   }
 }  
+
+/* Same as psg_update, without any output */
+static void psg_skip(unsigned int clocks)
+{
+  int i, timestamp, polarity;
+
+  for (i=0; i<4; i++)
+  {
+    /* pending channel volume variations are not output */
+    psg.chanDelta[i][0] = 0;
+    psg.chanDelta[i][1] = 0;
+
+    /* timestamp of next transition */
+    timestamp = psg.freqCounter[i];
+
+    /* current channel generator polarity */
+    polarity = psg.polarity[i];
+
+    /* Tone channels */
+    if (i < 3)
+    {
+      /* skip all transitions occurring until current clock timestamp */
+      if (timestamp < clocks)
+      {
+        int count = (clocks - timestamp + psg.freqInc[i] - 1) / psg.freqInc[i];
+
+        /* tone generator polarity is inverted on each transition */
+        if (count & 1)
+        {
+          polarity = -polarity;
+        }
+
+        timestamp += count * psg.freqInc[i];
+      }
+    }
+
+    /* Noise channel */
+    else
+    {
+      /* current noise shift register value */
+      int shiftValue = psg.noiseShiftValue;
+
+      /* process all transitions occurring until current clock timestamp */
+      while (timestamp < clocks)
+      {
+        /* invert noise generator polarity */
+        polarity = -polarity;
+
+        /* noise register is shifted on positive edge only */
+        if (polarity > 0)
+        {
+          /* White noise (-----1xx) */
+          if (psg.regs[6] & 0x04)
+          {
+            /* shift and apply XOR feedback network */
+            shiftValue = (shiftValue >> 1) | (noiseFeedback[shiftValue & psg.noiseBitMask] << psg.noiseShiftWidth);
+          }
+
+          /* Periodic noise (-----0xx) */
+          else
+          {
+            /* shift and feedback current output */
+            shiftValue = (shiftValue >> 1) | ((shiftValue & 0x01) << psg.noiseShiftWidth);
+          }
+        }
+
+        /* timestamp of next transition */
+        timestamp += psg.freqInc[3];
+      }
+
+      /* save shift register value */
+      psg.noiseShiftValue = shiftValue;
+    }
+
+    /* save timestamp of next transition */
+    psg.freqCounter[i] = timestamp;
+
+    /* save channel generator polarity */
+    psg.polarity[i] = polarity;
+  }
+}
@@ -45,39 +45,56 @@
 
 /* FM output buffer (large enough to hold a whole frame at original chips rate) */
 #if defined(HAVE_YM3438_CORE) || defined(HAVE_OPLL_CORE)
-static int fm_buffer[1080 * 2 * 24];
+static CTX_LOCAL int fm_buffer[1080 * 2 * 24];
 #else
-static int fm_buffer[1080 * 2];
+static CTX_LOCAL int fm_buffer[1080 * 2];
 #endif
 
-static int fm_last[2];
-static int *fm_ptr;
+static CTX_LOCAL int fm_last[2];
+static CTX_LOCAL int *fm_ptr;
 
 /* Cycle-accurate FM samples */
-static int fm_cycles_ratio;
-static int fm_cycles_start;
-static int fm_cycles_count;
-static int fm_cycles_busy;
+static CTX_LOCAL int fm_cycles_ratio;
+static CTX_LOCAL int fm_cycles_start;
+static CTX_LOCAL int fm_cycles_count;
+static CTX_LOCAL int fm_cycles_busy;
 
 /* YM chip function pointers */
-static void (*YM_Update)(int *buffer, int length);
-void (*fm_reset)(unsigned int cycles);
-void (*fm_write)(unsigned int cycles, unsigned int address, unsigned int data);
-unsigned int (*fm_read)(unsigned int cycles, unsigned int address);
+static CTX_LOCAL void (*YM_Update)(int *buffer, int length);
+static CTX_LOCAL void (*YM_Skip)(int length);
+CTX_LOCAL void (*fm_reset)(unsigned int cycles);
+CTX_LOCAL void (*fm_write)(unsigned int cycles, unsigned int address, unsigned int data);
+CTX_LOCAL unsigned int (*fm_read)(unsigned int cycles, unsigned int address);
+
+/* FM chip status update (timers only), used when sound is logged */
+static CTX_LOCAL void (*YM_Status)(int length);
+
+#ifdef USE_THREAD_CONTEXT
+/* Sound log being recorded, NULL when chips are run */
+CTX_LOCAL sound_log_t *sound_log;
+
+/* FM chip functions, while writes are logged */
+static CTX_LOCAL void (*chip_reset)(unsigned int cycles);
+static CTX_LOCAL void (*chip_write)(unsigned int cycles, unsigned int address, unsigned int data);
+
+#define SOUND_LOGGED (sound_log != NULL)
+#else
+#define SOUND_LOGGED 0
+#endif
 
 #ifdef HAVE_YM3438_CORE
-static ym3438_t ym3438;
-static short ym3438_accm[24][2];
-static int ym3438_sample[2];
-static int ym3438_cycles;
+static CTX_LOCAL ym3438_t ym3438;
+static CTX_LOCAL short ym3438_accm[24][2];
+static CTX_LOCAL int ym3438_sample[2];
+static CTX_LOCAL int ym3438_cycles;
 #endif
 
 #ifdef HAVE_OPLL_CORE
-static opll_t opll;
-static int opll_accm[18][2];
-static int opll_sample;
-static int opll_cycles;
-static int opll_status;
+static CTX_LOCAL opll_t opll;
+static CTX_LOCAL int opll_accm[18][2];
+static CTX_LOCAL int opll_sample;
+static CTX_LOCAL int opll_cycles;
+static CTX_LOCAL int opll_status;
 #endif
 
 /* Run FM chip until required M-cycles */
@@ -88,14 +105,36 @@ INLINE void fm_update(int cycles)
     /* number of samples to run */
     int samples = (cycles - fm_cycles_count + fm_cycles_ratio - 1) / fm_cycles_ratio;
 
-    /* run FM chip to sample buffer */
-    YM_Update(fm_ptr, samples);
+    PROFILE_ENTER(PROF_FM);
+    PROFILE_COUNT(fm_samples, samples);
+
+    /* run FM chip status only if samples are generated by the context replaying sound log */
+    if (SOUND_LOGGED)
+    {
+      if (YM_Status)
+      {
+        YM_Status(samples);
+      }
+    }
+
+    /* run FM chip without output for speculative frames (chip state is restored afterwards) */
+    else if (system_skip && YM_Skip)
+    {
+      YM_Skip(samples);
+    }
+    else
+    {
+      /* run FM chip to sample buffer */
+      YM_Update(fm_ptr, samples);
+    }
 
     /* update FM buffer pointer */
     fm_ptr += (samples * 2);
 
     /* update FM cycle counter */
     fm_cycles_count += (samples * fm_cycles_ratio);
+
+    PROFILE_LEAVE();
   }
 }
 
@@ -183,9 +222,24 @@ static unsigned int YM2413_Read(unsigned int cycles, unsigned int a)
 #ifdef HAVE_YM3438_CORE
 static void YM3438_Update(int *buffer, int length)
 {
-  int i, j;
+  int i, j, idle = 0;
   for (i = 0; i < length; i++)
   {
+    if ((ym3438_cycles == 0) && ((length - i) >= 24))
+    {
+      /* run a whole sample at once, previous output is kept until its last clock */
+      for (j = 0; j < 23; j++)
+      {
+        *buffer++ = ym3438_sample[0] * 11;
+        *buffer++ = ym3438_sample[1] * 11;
+      }
+      idle += OPN2_ClockSample(&ym3438, ym3438_sample);
+      *buffer++ = ym3438_sample[0] * 11;
+      *buffer++ = ym3438_sample[1] * 11;
+      i += 23;
+      continue;
+    }
+
     OPN2_Clock(&ym3438, ym3438_accm[ym3438_cycles]);
     ym3438_cycles = (ym3438_cycles + 1) % 24;
     if (ym3438_cycles == 0)
@@ -201,6 +255,9 @@ static void YM3438_Update(int *buffer, int length)
     *buffer++ = ym3438_sample[0] * 11;
     *buffer++ = ym3438_sample[1] * 11;
   }
+
+  /* idle channels are skipped for the 24 clocks of a sample */
+  PROFILE_COUNT(fm_idle_samples, idle * 24);
 }
 
 static void YM3438_Reset(unsigned int cycles)
@@ -229,6 +286,15 @@ static unsigned int YM3438_Read(unsigned int cycles, unsigned int a)
   /* read FM status */
   return OPN2_Read(&ym3438, a);
 }
+
+static void YM3438_Status(int length)
+{
+  do
+  {
+    OPN2_ClockStatus(&ym3438);
+  }
+  while (--length);
+}
 #endif
 
 #ifdef HAVE_OPLL_CORE
@@ -298,6 +364,8 @@ void sound_init( void )
       memset(&ym3438_sample, 0, sizeof(ym3438_sample));
       memset(&ym3438_accm, 0, sizeof(ym3438_accm));
       YM_Update = YM3438_Update;
+      YM_Skip = NULL;
+      YM_Status = YM3438_Status;
       fm_reset = YM3438_Reset;
       fm_write = YM3438_Write;
       fm_read = YM3438_Read;
@@ -312,6 +380,8 @@ void sound_init( void )
       YM2612Init();
       YM2612Config(config.ym2612);
       YM_Update = YM2612Update;
+      YM_Skip = YM2612Skip;
+      YM_Status = YM2612UpdateTimers;
       fm_reset = YM2612_Reset;
       fm_write = YM2612_Write;
       fm_read = YM2612_Read;
@@ -332,6 +402,8 @@ void sound_init( void )
       opll_sample = 0;
       opll_status = 0;
       YM_Update = (config.ym2413 & 1) ? OPLL2413_Update : NULL;
+      YM_Skip = NULL;
+      YM_Status = NULL;
       fm_reset = OPLL2413_Reset;
       fm_write = OPLL2413_Write;
       fm_read = OPLL2413_Read;
@@ -344,6 +416,8 @@ void sound_init( void )
     {
       YM2413Init();
       YM_Update = (config.ym2413 & 1) ? YM2413Update : NULL;
+      YM_Skip = NULL;
+      YM_Status = NULL;
       fm_reset = YM2413_Reset;
       fm_write = YM2413_Write;
       fm_read = YM2413_Read;
@@ -359,13 +433,28 @@ void sound_init( void )
 
 void sound_reset(void)
 {
+#ifdef USE_THREAD_CONTEXT
+  if (sound_log)
+  {
+    /* sound chips are reset when the log is replayed, only FM chip status is reset here */
+    sound_log_add(SOUND_LOG_RESET, 0, 0, 0);
+    chip_reset(0);
+    fm_ptr = fm_buffer;
+    fm_cycles_start = fm_cycles_count = 0;
+    return;
+  }
+#endif
+
   /* reset sound chips */
   fm_reset(0);
   psg_reset();
   psg_config(0, config.psg_preamp, 0xff);
 
-  /* reset FM buffer ouput */
-  fm_last[0] = fm_last[1] = 0;
+  /* reset FM buffer ouput (unless held output is restored after speculative frames) */
+  if (!system_skip)
+  {
+    fm_last[0] = fm_last[1] = 0;
+  }
 
   /* reset FM buffer pointer */
   fm_ptr = fm_buffer;
@@ -376,8 +465,20 @@ void sound_reset(void)
 
 int sound_update(unsigned int cycles)
 {
-  /* Run PSG chip until end of frame */
-  psg_end_frame(cycles);
+  PROFILE_ENTER(PROF_SOUND);
+
+#ifdef USE_THREAD_CONTEXT
+  if (sound_log)
+  {
+    sound_log_add(SOUND_LOG_END, cycles, 0, 0);
+  }
+#endif
+
+  /* Run PSG chip until end of frame (by the context replaying sound log if recorded) */
+  if (!SOUND_LOGGED)
+  {
+    psg_end_frame(cycles);
+  }
 
   /* FM chip is enabled ? */
   if (YM_Update)
@@ -401,7 +502,16 @@ int sound_update(unsigned int cycles)
     ptr = fm_buffer;
 
     /* flush FM samples */
-    if (config.hq_fm)
+    if (system_skip || SOUND_LOGGED)
+    {
+      /* no output, last FM output is held */
+      do
+      {
+        time += fm_cycles_ratio;
+      }
+      while (time < cycles);
+    }
+    else if (config.hq_fm)
     {
       /* high-quality Band-Limited synthesis */
       do
@@ -455,8 +565,16 @@ int sound_update(unsigned int cycles)
     }
   }
 
+  /* no samples output */
+  if (system_skip || SOUND_LOGGED)
+  {
+    PROFILE_LEAVE();
+    return 0;
+  }
+
   /* end of blip buffer time frame */
   blip_end_frame(snd.blips[0], cycles);
+  PROFILE_LEAVE();
 
   /* return number of available samples */
   return blip_samples_avail(snd.blips[0]);
@@ -562,3 +680,132 @@ int sound_context_load(uint8 *state)
 
   return bufferptr;
 }
+
+#ifdef USE_THREAD_CONTEXT
+
+/*--------------------------------------------------------------------------*/
+/* Sound logs                                                               */
+/*--------------------------------------------------------------------------*/
+
+typedef struct
+{
+  uint8 type;
+  uint8 address;    /* FM chip port or PSG stereo panning */
+  uint16 data;      /* written value or PSG preamp */
+  unsigned int cycles;
+} sound_cmd_t;
+
+static void LOG_FM_Reset(unsigned int cycles)
+{
+  sound_log_add(SOUND_LOG_FM_RESET, cycles, 0, 0);
+
+  /* reset FM chip status */
+  chip_reset(cycles);
+}
+
+static void LOG_FM_Write(unsigned int cycles, unsigned int a, unsigned int v)
+{
+  sound_log_add(SOUND_LOG_FM_WRITE, cycles, a, v);
+
+  /* write FM chip registers (status & timers) */
+  chip_write(cycles, a, v);
+}
+
+void sound_log_add(int type, unsigned int cycles, unsigned int address, unsigned int data)
+{
+  sound_log_t *log = sound_log;
+  sound_cmd_t *cmd;
+
+  if (log->size + sizeof(sound_cmd_t) > log->alloc)
+  {
+    int alloc = (log->alloc + sizeof(sound_cmd_t)) * 2;
+    uint8 *data = realloc(log->data, alloc);
+    if (!data)
+    {
+      /* previously recorded commands are kept */
+      log->lost++;
+      return;
+    }
+    log->data = data;
+    log->alloc = alloc;
+  }
+
+  cmd = (sound_cmd_t *)(log->data + log->size);
+  cmd->type = type;
+  cmd->address = address;
+  cmd->data = data;
+  cmd->cycles = cycles;
+  log->size += sizeof(sound_cmd_t);
+}
+
+/* Starts recording chip writes to log (at the start of a frame), NULL runs chips again */
+void sound_log_record(sound_log_t *log)
+{
+  if (log && !sound_log)
+  {
+    chip_reset = fm_reset;
+    chip_write = fm_write;
+    fm_reset = LOG_FM_Reset;
+    fm_write = LOG_FM_Write;
+  }
+  else if (!log && sound_log)
+  {
+    fm_reset = chip_reset;
+    fm_write = chip_write;
+  }
+
+  if (log)
+  {
+    log->size = 0;
+    log->lost = 0;
+  }
+
+  sound_log = log;
+}
+
+/* Runs chip writes recorded for a frame, audio_update() then returns the frame samples */
+void sound_log_replay(const sound_log_t *log)
+{
+  const sound_cmd_t *cmd = (const sound_cmd_t *)log->data;
+  const sound_cmd_t *end = (const sound_cmd_t *)(log->data + log->size);
+
+  for (; cmd < end; cmd++)
+  {
+    switch (cmd->type)
+    {
+      case SOUND_LOG_FM_RESET:
+        fm_reset(cmd->cycles);
+        break;
+
+      case SOUND_LOG_FM_WRITE:
+        fm_write(cmd->cycles, cmd->address, cmd->data);
+        break;
+
+      case SOUND_LOG_PSG_WRITE:
+        psg_write(cmd->cycles, cmd->data);
+        break;
+
+      case SOUND_LOG_PSG_CONFIG:
+        psg_config(cmd->cycles, cmd->data, cmd->address);
+        break;
+
+      case SOUND_LOG_RESET:
+        sound_reset();
+        break;
+
+      case SOUND_LOG_END:
+        /* frame length */
+        mcycles_vdp = cmd->cycles;
+        break;
+    }
+  }
+}
+
+void sound_log_free(sound_log_t *log)
+{
+  free(log->data);
+  log->data = NULL;
+  log->size = log->alloc = 0;
+}
+
+#endif /* USE_THREAD_CONTEXT */
@@ -40,14 +40,49 @@
 #ifndef _SOUND_H_
 #define _SOUND_H_
 
+#ifdef USE_THREAD_CONTEXT
+/* Sound logs: chip writes of a frame are recorded with their timestamp instead of being */
+/* run, then replayed by another thread (with its own sound context) which generates the */
+/* samples while emulation goes on with next frame. FM status reads are answered by the */
+/* recording context, which only runs FM chip timers. Chips are only emulated by the     */
+/* replaying context: its sound state has to be copied back once recording is stopped   */
+/* (sound_context_save there, then sound_context_load in recording context). Savestates */
+/* and run-ahead are not supported while recording, as recording context chips are not  */
+/* up to date.                                                                           */
+typedef struct
+{
+  uint8 *data;
+  int size;
+  int alloc;
+  int lost;     /* commands that could not be recorded (out of memory) */
+} sound_log_t;
+
+/* Sound log commands */
+#define SOUND_LOG_FM_RESET   0   /* fm_reset() */
+#define SOUND_LOG_FM_WRITE   1   /* fm_write() */
+#define SOUND_LOG_PSG_WRITE  2   /* psg_write() */
+#define SOUND_LOG_PSG_CONFIG 3   /* psg_config(), address is stereo panning & data preamp */
+#define SOUND_LOG_RESET      4   /* sound_reset() */
+#define SOUND_LOG_END        5   /* end of frame (sound_update) */
+
+/* Sound log being recorded, NULL when chips are run */
+extern CTX_LOCAL sound_log_t *sound_log;
+#endif
+
 /* Function prototypes */
 extern void sound_init(void);
 extern void sound_reset(void);
 extern int sound_context_save(uint8 *state);
 extern int sound_context_load(uint8 *state);
 extern int sound_update(unsigned int cycles);
-extern void (*fm_reset)(unsigned int cycles);
-extern void (*fm_write)(unsigned int cycles, unsigned int address, unsigned int data);
-extern unsigned int (*fm_read)(unsigned int cycles, unsigned int address);
+extern CTX_LOCAL void (*fm_reset)(unsigned int cycles);
+extern CTX_LOCAL void (*fm_write)(unsigned int cycles, unsigned int address, unsigned int data);
+extern CTX_LOCAL unsigned int (*fm_read)(unsigned int cycles, unsigned int address);
+#ifdef USE_THREAD_CONTEXT
+extern void sound_log_record(sound_log_t *log);
+extern void sound_log_replay(const sound_log_t *log);
+extern void sound_log_free(sound_log_t *log);
+extern void sound_log_add(int type, unsigned int cycles, unsigned int address, unsigned int data);
+#endif
 
 #endif /* _SOUND_H_ */
@@ -149,6 +149,12 @@
 
 #include "shared.h"
 
+/* SIMD operator output kernels (define NO_SIMD_FM to disable) */
+#if !defined(NO_SIMD_FM) && defined(HAVE_X86_SIMD)
+#include <immintrin.h>
+#define SIMD_FM
+#endif
+
 /* envelope generator */
 #define ENV_BITS    10
 #define ENV_LEN      (1<<ENV_BITS)
@@ -183,13 +189,23 @@
 *   TL_RES_LEN - sinus resolution (X axis)
 */
 #define TL_TAB_LEN (13*2*TL_RES_LEN)
-static signed int tl_tab[TL_TAB_LEN];
 
 #define ENV_QUIET    (TL_TAB_LEN>>3)
 
+#ifndef BUILD_TABLES
+
+/* Linear power (tl_tab), sin waveform (sin_tab) and LFO PM (lfo_pm_table) tables */
+#include "ym2612_tables.h"
+
+#else
+
+static signed int tl_tab[TL_TAB_LEN];
+
 /* sin waveform table in 'decibel' scale */
 static unsigned int sin_tab[SIN_LEN];
 
+#endif
+
 /* sustain level table (3dB per step) */
 /* bit0, bit1, bit2, bit3, bit4, bit5, bit6 */
 /* 1,    2,    4,    8,    16,   32,   64   (value)*/
@@ -406,6 +422,7 @@ static const UINT8 lfo_ams_depth_shift[4] = {8, 3, 1, 0};
    samples (32*432=13824; 32 because we store only a quarter of whole
             waveform in the table below)
 */
+#ifdef BUILD_TABLES
 static const UINT8 lfo_pm_output[7*8][8]={
 /* 7 bits meaningful (of F-NUMBER), 8 LFO output levels per one depth (out of 32), 8 LFO depths */
 /* FNUM BIT 4: 000 0001xxxx */
@@ -479,9 +496,12 @@ static const UINT8 lfo_pm_output[7*8][8]={
 /* DEPTH 7 */ {0,   0,0x20,0x30,0x40,0x40,0x50,0x60},
 
 };
+#endif
 
+#ifdef BUILD_TABLES
 /* all 128 LFO PM waveforms */
 static INT32 lfo_pm_table[128*8*32]; /* 128 combinations of 7 bits meaningful (of F-NUMBER), 8 LFO depths, 32 LFO output levels per one depth */
+#endif
 
 /* register number to channel number , slot offset */
 #define OPN_CHAN(N) (N&3)
@@ -625,16 +645,19 @@ typedef struct
 } YM2612;
 
 /* emulated chip */
-static YM2612 ym2612;
+static CTX_LOCAL YM2612 ym2612;
 
 /* current chip state */
-static INT32  m2,c1,c2;   /* Phase Modulation input for operators 2,3,4 */
-static INT32  mem;        /* one sample delay memory */
-static INT32  out_fm[6];  /* outputs of working channels */
+static CTX_LOCAL INT32  m2,c1,c2;   /* Phase Modulation input for operators 2,3,4 */
+static CTX_LOCAL INT32  mem;        /* one sample delay memory */
+static CTX_LOCAL INT32  out_fm[6];  /* outputs of working channels */
 
 /* chip type */
-static UINT32 op_mask[8][4];  /* operator output bitmasking (DAC quantization) */
-static int chip_type = YM2612_DISCRETE;
+static CTX_LOCAL UINT32 op_mask[8][4];  /* operator output bitmasking (DAC quantization) */
+static CTX_LOCAL int chip_type = YM2612_DISCRETE;
+
+/* output rendering kernel (see YM2612SetKernel) */
+static CTX_LOCAL int fm_kernel = YM2612_KERNEL_SAMPLE;
 
 
 INLINE void FM_KEYON(FM_CH *CH , int s )
@@ -1222,6 +1245,55 @@ INLINE void advance_eg_channels(FM_CH *CH, unsigned int eg_cnt)
 /* SSG-EG update process */
 /* The behavior is based upon Nemesis tests on real hardware */
 /* This is actually executed before each samples */
+INLINE void update_ssg_eg_slot(FM_SLOT *SLOT)
+{
+  /* detect SSG-EG transition */
+  /* this is not required during release phase as the attenuation has been forced to MAX and output invert flag is not used */
+  /* if an Attack Phase is programmed, inversion can occur on each sample */
+  if ((SLOT->ssg & 0x08) && (SLOT->volume >= 0x200) && (SLOT->state > EG_REL))
+  {
+    if (SLOT->ssg & 0x01)  /* bit 0 = hold SSG-EG */
+    {
+      /* set inversion flag */
+      if (SLOT->ssg & 0x02)
+        SLOT->ssgn = 4;
+
+      /* force attenuation level during decay phases */
+      if ((SLOT->state != EG_ATT) && !(SLOT->ssgn ^ (SLOT->ssg & 0x04)))
+        SLOT->volume  = MAX_ATT_INDEX;
+    }
+    else  /* loop SSG-EG */
+    {
+      /* toggle output inversion flag or reset Phase Generator */
+      if (SLOT->ssg & 0x02)
+        SLOT->ssgn ^= 4;
+      else
+        SLOT->phase = 0;
+
+      /* same as Key ON */
+      if (SLOT->state != EG_ATT)
+      {
+        if ((SLOT->ar + SLOT->ksr) < 94 /*32+62*/)
+        {
+          SLOT->state = (SLOT->volume <= MIN_ATT_INDEX) ? ((SLOT->sl == MIN_ATT_INDEX) ? EG_SUS : EG_DEC) : EG_ATT;
+        }
+        else
+        {
+          /* Attack Rate is maximal: directly switch to Decay or Substain */
+          SLOT->volume = MIN_ATT_INDEX;
+          SLOT->state = (SLOT->sl == MIN_ATT_INDEX) ? EG_SUS : EG_DEC;
+        }
+      }
+    }
+
+    /* recalculate EG output */
+    if (SLOT->ssgn ^ (SLOT->ssg&0x04))
+      SLOT->vol_out = ((UINT32)(0x200 - SLOT->volume) & MAX_ATT_INDEX) + SLOT->tl;
+    else
+      SLOT->vol_out = (UINT32)SLOT->volume + SLOT->tl;
+  }
+}
+
 INLINE void update_ssg_eg_channels(FM_CH *CH)
 {
   unsigned int i = 6; /* six channels */
@@ -1235,51 +1307,7 @@ INLINE void update_ssg_eg_channels(FM_CH *CH)
 
     do
     {
-      /* detect SSG-EG transition */
-      /* this is not required during release phase as the attenuation has been forced to MAX and output invert flag is not used */
-      /* if an Attack Phase is programmed, inversion can occur on each sample */
-      if ((SLOT->ssg & 0x08) && (SLOT->volume >= 0x200) && (SLOT->state > EG_REL))
-      {
-        if (SLOT->ssg & 0x01)  /* bit 0 = hold SSG-EG */
-        {
-          /* set inversion flag */
-          if (SLOT->ssg & 0x02)
-            SLOT->ssgn = 4;
-
-          /* force attenuation level during decay phases */
-          if ((SLOT->state != EG_ATT) && !(SLOT->ssgn ^ (SLOT->ssg & 0x04)))
-            SLOT->volume  = MAX_ATT_INDEX;
-        }
-        else  /* loop SSG-EG */
-        {
-          /* toggle output inversion flag or reset Phase Generator */
-          if (SLOT->ssg & 0x02)
-            SLOT->ssgn ^= 4;
-          else
-            SLOT->phase = 0;
-
-          /* same as Key ON */
-          if (SLOT->state != EG_ATT)
-          {
-            if ((SLOT->ar + SLOT->ksr) < 94 /*32+62*/)
-            {
-              SLOT->state = (SLOT->volume <= MIN_ATT_INDEX) ? ((SLOT->sl == MIN_ATT_INDEX) ? EG_SUS : EG_DEC) : EG_ATT;
-            }
-            else
-            {
-              /* Attack Rate is maximal: directly switch to Decay or Substain */
-              SLOT->volume = MIN_ATT_INDEX;
-              SLOT->state = (SLOT->sl == MIN_ATT_INDEX) ? EG_SUS : EG_DEC;
-            }
-          }
-        }
-
-        /* recalculate EG output */
-        if (SLOT->ssgn ^ (SLOT->ssg&0x04))
-          SLOT->vol_out = ((UINT32)(0x200 - SLOT->volume) & MAX_ATT_INDEX) + SLOT->tl;
-        else
-          SLOT->vol_out = (UINT32)SLOT->volume + SLOT->tl;
-      }
+      update_ssg_eg_slot(SLOT);
 
       /* next slot */
       SLOT++;
@@ -1356,6 +1384,36 @@ INLINE void update_phase_lfo_channel(FM_CH *CH)
   }
 }
 
+/* update channel phase counters */
+INLINE void update_phase_chan(FM_CH *CH)
+{
+  if (CH->pms)
+  {
+    /* 3-slot mode */
+    if ((ym2612.OPN.ST.mode & 0xC0) && (CH == &ym2612.CH[2]))
+    {
+      /* keyscale code is not modifiedby LFO */
+      UINT8 kc = ym2612.CH[2].kcode;
+      UINT32 pm = ym2612.CH[2].pms + ym2612.OPN.LFO_PM;
+      update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT1], pm, kc, ym2612.OPN.SL3.block_fnum[1]);
+      update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT2], pm, kc, ym2612.OPN.SL3.block_fnum[2]);
+      update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT3], pm, kc, ym2612.OPN.SL3.block_fnum[0]);
+      update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT4], pm, kc, ym2612.CH[2].block_fnum);
+    }
+    else
+    {
+      update_phase_lfo_channel(CH);
+    }
+  }
+  else  /* no LFO phase modulation */
+  {
+    CH->SLOT[SLOT1].phase += CH->SLOT[SLOT1].Incr;
+    CH->SLOT[SLOT2].phase += CH->SLOT[SLOT2].Incr;
+    CH->SLOT[SLOT3].phase += CH->SLOT[SLOT3].Incr;
+    CH->SLOT[SLOT4].phase += CH->SLOT[SLOT4].Incr;
+  }
+}
+
 /* update phase increment and envelope generator */
 INLINE void refresh_fc_eg_slot(FM_SLOT *SLOT , unsigned int fc , unsigned int kc )
 {
@@ -1433,14 +1491,31 @@ INLINE signed int op_calc1(UINT32 phase, unsigned int env, unsigned int pm, unsi
   return (tl_tab[p] & opmask);
 }
 
-INLINE void chan_calc(FM_CH *CH, int num)
+INLINE void chan_calc(FM_CH *CH, int num, unsigned int idle)
 {
   do
   {
     INT32 out = 0;
-    UINT32 AM = ym2612.OPN.LFO_AM >> CH->ams;
-    unsigned int eg_out = volume_calc(&CH->SLOT[SLOT1]);
-    UINT32 *mask = op_mask[CH->ALGO];
+    UINT32 AM;
+    unsigned int eg_out;
+    UINT32 *mask;
+
+    /* idle channel (see idle_channels): output is zero, only phase counters modulated by LFO */
+    /* have to be updated every sample, other ones are updated once by skip_idle_channel     */
+    if (idle & 1)
+    {
+      if (CH->pms)
+        update_phase_chan(CH);
+
+      idle >>= 1;
+      CH++;
+      continue;
+    }
+    idle >>= 1;
+
+    AM = ym2612.OPN.LFO_AM >> CH->ams;
+    eg_out = volume_calc(&CH->SLOT[SLOT1]);
+    mask = op_mask[CH->ALGO];
 
     m2 = c1 = c2 = mem = 0;
 
@@ -1481,31 +1556,7 @@ INLINE void chan_calc(FM_CH *CH, int num)
     CH->mem_value = mem;
 
     /* update phase counters AFTER output calculations */
-    if (CH->pms)
-    {
-      /* 3-slot mode */
-      if ((ym2612.OPN.ST.mode & 0xC0) && (CH == &ym2612.CH[2]))
-      {
-        /* keyscale code is not modifiedby LFO */
-        UINT8 kc = ym2612.CH[2].kcode;
-        UINT32 pm = ym2612.CH[2].pms + ym2612.OPN.LFO_PM;
-        update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT1], pm, kc, ym2612.OPN.SL3.block_fnum[1]);
-        update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT2], pm, kc, ym2612.OPN.SL3.block_fnum[2]);
-        update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT3], pm, kc, ym2612.OPN.SL3.block_fnum[0]);
-        update_phase_lfo_slot(&ym2612.CH[2].SLOT[SLOT4], pm, kc, ym2612.CH[2].block_fnum);
-      }
-      else
-      {
-        update_phase_lfo_channel(CH);
-      }
-    }
-    else  /* no LFO phase modulation */
-    {
-      CH->SLOT[SLOT1].phase += CH->SLOT[SLOT1].Incr;
-      CH->SLOT[SLOT2].phase += CH->SLOT[SLOT2].Incr;
-      CH->SLOT[SLOT3].phase += CH->SLOT[SLOT3].Incr;
-      CH->SLOT[SLOT4].phase += CH->SLOT[SLOT4].Incr;
-    }
+    update_phase_chan(CH);
 
     /* next channel */
     CH++;
@@ -1784,7 +1835,9 @@ static void reset_channels(FM_CH *CH , int num )
 /* initialize generic tables */
 static void init_tables(void)
 {
-  signed int d,i,x;
+  signed int d,i;
+#ifdef BUILD_TABLES
+  signed int x;
   signed int n;
   double o,m;
 
@@ -1877,6 +1930,7 @@ static void init_tables(void)
       }
     }
   }
+#endif
 
   /* build DETUNE table */
   for (d = 0;d <= 3;d++)
@@ -1906,6 +1960,12 @@ void YM2612Init(void)
 {
   memset(&ym2612,0,sizeof(YM2612));
   init_tables();
+
+  /* blocks of samples are only faster with SIMD operators (scalar block kernel is not) */
+  if (!YM2612SetKernel(YM2612_KERNEL_AVX2))
+  {
+    YM2612SetKernel(YM2612_KERNEL_SAMPLE);
+  }
 }
 
 /* reset OPN registers */
@@ -2002,13 +2062,9 @@ unsigned int YM2612Read(void)
   return ym2612.OPN.ST.status;
 }
 
-/* Generate samples for ym2612 */
-void YM2612Update(int *buffer, int length)
+/* refresh PG increments and EG rates of all channels if required */
+INLINE void refresh_fc_eg_chans(void)
 {
-  int i;
-  int lt,rt;
-
-  /* refresh PG increments and EG rates if required */
   refresh_fc_eg_chan(&ym2612.CH[0]);
   refresh_fc_eg_chan(&ym2612.CH[1]);
 
@@ -2031,126 +2087,739 @@ void YM2612Update(int *buffer, int length)
   refresh_fc_eg_chan(&ym2612.CH[3]);
   refresh_fc_eg_chan(&ym2612.CH[4]);
   refresh_fc_eg_chan(&ym2612.CH[5]);
+}
 
-  /* buffering */
-  for(i=0; i<length; i++)
+/* advance LFO and envelope generator by one sample */
+INLINE void advance_lfo_eg(void)
+{
+  /* advance LFO */
+  advance_lfo();
+
+  /* EG is updated every 3 samples */
+  ym2612.OPN.eg_timer++;
+  if (ym2612.OPN.eg_timer >= 3)
   {
-    /* clear outputs */
-    out_fm[0] = 0;
-    out_fm[1] = 0;
-    out_fm[2] = 0;
-    out_fm[3] = 0;
-    out_fm[4] = 0;
-    out_fm[5] = 0;
+    /* reset EG timer */
+    ym2612.OPN.eg_timer = 0;
 
-    /* update SSG-EG output */
-    update_ssg_eg_channels(&ym2612.CH[0]);
+    /* increment EG counter */
+    ym2612.OPN.eg_cnt++;
 
-    /* calculate FM */
-    if (!ym2612.dacen)
+    /* EG counter is 12-bit only and zero value is skipped (verified on real hardware) */
+    if (ym2612.OPN.eg_cnt == 4096)
+      ym2612.OPN.eg_cnt = 1;
+
+    /* advance envelope generator */
+    advance_eg_channels(&ym2612.CH[0], ym2612.OPN.eg_cnt);
+  }
+}
+
+/* advance timer A by one sample */
+INLINE void advance_timer_a(void)
+{
+  /* CSM mode: if CSM Key ON has occurred, CSM Key OFF need to be sent      */
+  /* only if Timer A does not overflow again (i.e CSM Key ON not set again) */
+  ym2612.OPN.SL3.key_csm <<= 1;
+
+  /* timer A control */
+  INTERNAL_TIMER_A();
+
+  /* CSM Mode Key ON still disabled */
+  if (ym2612.OPN.SL3.key_csm & 2)
+  {
+    /* CSM Mode Key OFF (verified by Nemesis on real hardware) */
+    FM_KEYOFF_CSM(&ym2612.CH[2],SLOT1);
+    FM_KEYOFF_CSM(&ym2612.CH[2],SLOT2);
+    FM_KEYOFF_CSM(&ym2612.CH[2],SLOT3);
+    FM_KEYOFF_CSM(&ym2612.CH[2],SLOT4);
+    ym2612.OPN.SL3.key_csm = 0;
+  }
+}
+
+/* advance timer A by length samples at once (same as advance_timer_a without CSM mode) */
+INLINE void skip_timer_a(int length)
+{
+  if (ym2612.OPN.ST.mode & 0x01)
+  {
+    ym2612.OPN.ST.TAC -= length;
+    if (ym2612.OPN.ST.TAC <= 0)
+    {
+      /* set status (if enabled) */
+      if (ym2612.OPN.ST.mode & 0x04)
+        ym2612.OPN.ST.status |= 0x01;
+
+      /* reload the counter */
+      do
+      {
+        ym2612.OPN.ST.TAC += ym2612.OPN.ST.TAL;
+      }
+      while (ym2612.OPN.ST.TAC <= 0);
+    }
+  }
+}
+
+/* Channels with all operators off (max attenuation, not running any EG phase). They can only */
+/* be restarted by a key on, written between two updates, or by CSM mode on channel 3.       */
+INLINE unsigned int idle_channels(void)
+{
+  unsigned int idle = 0;
+  int ch;
+
+  for (ch=0; ch<6; ch++)
+  {
+    FM_SLOT *SLOT = ym2612.CH[ch].SLOT;
+
+    if (((SLOT[SLOT1].state | SLOT[SLOT2].state | SLOT[SLOT3].state | SLOT[SLOT4].state) == EG_OFF) &&
+        (SLOT[SLOT1].vol_out >= ENV_QUIET) && (SLOT[SLOT2].vol_out >= ENV_QUIET) &&
+        (SLOT[SLOT3].vol_out >= ENV_QUIET) && (SLOT[SLOT4].vol_out >= ENV_QUIET))
     {
-      chan_calc(&ym2612.CH[0],6);
+      idle |= (1 << ch);
+    }
+  }
+
+  /* CSM Key ON or Key OFF may occur on any sample */
+  if (((ym2612.OPN.ST.mode & 0xC0) == 0x80) || ym2612.OPN.SL3.key_csm)
+  {
+    idle &= ~(1 << 2);
+  }
+
+  return idle;
+}
+
+/* Run idle channel for length samples: chan_calc would only shift zero outputs through feedback */
+/* and delayed sample (MEM) memories and update phase counters.                                */
+INLINE void skip_idle_channel(FM_CH *CH, int length)
+{
+  CH->op1_out[0] = (length > 1) ? 0 : CH->op1_out[1];
+  CH->op1_out[1] = 0;
+
+  /* delayed sample is kept only when MEM is not used and not written by SLOT1 */
+  if ((CH->mem_connect != &mem) || !CH->connect1 || (CH->connect1 == &mem))
+    CH->mem_value = 0;
+
+  /* phase increments are constant without LFO PM */
+  if (!CH->pms)
+  {
+    CH->SLOT[SLOT1].phase += CH->SLOT[SLOT1].Incr * length;
+    CH->SLOT[SLOT2].phase += CH->SLOT[SLOT2].Incr * length;
+    CH->SLOT[SLOT3].phase += CH->SLOT[SLOT3].Incr * length;
+    CH->SLOT[SLOT4].phase += CH->SLOT[SLOT4].Incr * length;
+  }
+}
+
+/* advance LFO and envelope generator by length samples when all operators are off */
+INLINE void skip_lfo_eg(int length)
+{
+  UINT32 total;
+
+  if (ym2612.OPN.lfo_timer_overflow)
+  {
+    /* first LFO step occurs when timer reaches overflow value, then every overflow samples */
+    UINT32 first = (ym2612.OPN.lfo_timer < ym2612.OPN.lfo_timer_overflow) ? (ym2612.OPN.lfo_timer_overflow - ym2612.OPN.lfo_timer) : 1;
+
+    if ((UINT32)length >= first)
+    {
+      total = length - first;
+      ym2612.OPN.lfo_timer = total % ym2612.OPN.lfo_timer_overflow;
+      ym2612.OPN.lfo_cnt = (ym2612.OPN.lfo_cnt + 1 + (total / ym2612.OPN.lfo_timer_overflow)) & 127;
+
+      /* same as advance_lfo */
+      if (ym2612.OPN.lfo_cnt<64)
+        ym2612.OPN.LFO_AM = (ym2612.OPN.lfo_cnt ^ 63) << 1;
+      else
+        ym2612.OPN.LFO_AM = (ym2612.OPN.lfo_cnt & 63) << 1;
+      ym2612.OPN.LFO_PM = ym2612.OPN.lfo_cnt >> 2;
     }
     else
     {
-      /* DAC Mode */
-      out_fm[5] = ym2612.dacout;
-      chan_calc(&ym2612.CH[0],5);
+      ym2612.OPN.lfo_timer += length;
+    }
+  }
+
+  /* EG counter is 12-bit only and zero value is skipped, nothing else to update */
+  total = ym2612.OPN.eg_timer + length;
+  ym2612.OPN.eg_timer = total % 3;
+  if (total >= 3)
+  {
+    ym2612.OPN.eg_cnt = ((ym2612.OPN.eg_cnt + (total / 3) - 1) % 4095) + 1;
+  }
+}
+
+/* channels accumulator output clipping, stereo panning & mixing */
+INLINE void mix_channels(int *buffer)
+{
+  int lt,rt;
+
+  /* channels accumulator output clipping (14-bit max) */
+  if (out_fm[0] > 8191) out_fm[0] = 8191;
+  else if (out_fm[0] < -8192) out_fm[0] = -8192;
+  if (out_fm[1] > 8191) out_fm[1] = 8191;
+  else if (out_fm[1] < -8192) out_fm[1] = -8192;
+  if (out_fm[2] > 8191) out_fm[2] = 8191;
+  else if (out_fm[2] < -8192) out_fm[2] = -8192;
+  if (out_fm[3] > 8191) out_fm[3] = 8191;
+  else if (out_fm[3] < -8192) out_fm[3] = -8192;
+  if (out_fm[4] > 8191) out_fm[4] = 8191;
+  else if (out_fm[4] < -8192) out_fm[4] = -8192;
+  if (out_fm[5] > 8191) out_fm[5] = 8191;
+  else if (out_fm[5] < -8192) out_fm[5] = -8192;
+
+  /* stereo DAC output panning & mixing  */
+  lt  = ((out_fm[0]) & ym2612.OPN.pan[0]);
+  rt  = ((out_fm[0]) & ym2612.OPN.pan[1]);
+  lt += ((out_fm[1]) & ym2612.OPN.pan[2]);
+  rt += ((out_fm[1]) & ym2612.OPN.pan[3]);
+  lt += ((out_fm[2]) & ym2612.OPN.pan[4]);
+  rt += ((out_fm[2]) & ym2612.OPN.pan[5]);
+  lt += ((out_fm[3]) & ym2612.OPN.pan[6]);
+  rt += ((out_fm[3]) & ym2612.OPN.pan[7]);
+  lt += ((out_fm[4]) & ym2612.OPN.pan[8]);
+  rt += ((out_fm[4]) & ym2612.OPN.pan[9]);
+  lt += ((out_fm[5]) & ym2612.OPN.pan[10]);
+  rt += ((out_fm[5]) & ym2612.OPN.pan[11]);
+
+  /* discrete YM2612 DAC */
+  if (chip_type == YM2612_DISCRETE)
+  {
+    int i;
+
+    /* DAC 'ladder effect' */
+    for (i=0; i<6; i++)
+    {
+      if (out_fm[i] < 0)
+      {
+        /* -4 offset (-3 when not muted) on negative channel output (9-bit) */
+        lt -= ((4 - (ym2612.OPN.pan[(2*i)+0] & 1)) << 5);
+        rt -= ((4 - (ym2612.OPN.pan[(2*i)+1] & 1)) << 5);
+      }
+      else
+      {
+        /* +4 offset (when muted or not) on positive channel output (9-bit) */
+        lt += (4 << 5);
+        rt += (4 << 5);
+      }
+    }
+  }
+
+  buffer[0] = lt;
+  buffer[1] = rt;
+}
+
+/* Block rendering: samples between two register writes (sound.c updates the chip at every write) */
+/* are rendered in two passes. Envelope, SSG-EG, LFO, phase and timer updates are run sample by   */
+/* sample first, with SLOT1 output (feedback) of every channel, storing phase and attenuation of  */
+/* other operators. Their outputs are then computed channel by channel, all samples of a block at */
+/* once (in SIMD lanes when supported). Output is the same as with chan_calc.                     */
+#define FM_BLOCK 64
+#define FM_BLOCK_MIN 8   /* shorter updates are rendered sample by sample */
+
+static CTX_LOCAL INT32  block_op1[6][FM_BLOCK];       /* SLOT1 outputs */
+static CTX_LOCAL UINT32 block_phase[6][4][FM_BLOCK];  /* operator phases (FM_SLOT order, SLOT1 unused) */
+static CTX_LOCAL UINT32 block_env[6][4][FM_BLOCK];    /* operator attenuations, AM included (SLOT1 unused) */
+static CTX_LOCAL INT32  block_out[6][FM_BLOCK];       /* channel outputs */
+
+/* operator outputs of count samples, pm is phase modulation input (NULL if not modulated) */
+static void op_calc_block(const UINT32 *phase, const UINT32 *env, const INT32 *pm, INT32 *out, int count, UINT32 opmask)
+{
+  int i;
+
+  for (i=0; i<count; i++)
+  {
+    out[i] = 0;
+    if (env[i] < ENV_QUIET)
+      out[i] = op_calc(phase[i], env[i], pm ? pm[i] : 0, opmask);
+  }
+}
+
+#ifdef SIMD_FM
+/* sin_tab & tl_tab look-ups of 8 samples are done with AVX2 gathers */
+__attribute__((target("avx2")))
+static void op_calc_block_avx2(const UINT32 *phase, const UINT32 *env, const INT32 *pm, INT32 *out, int count, UINT32 opmask)
+{
+  const __m256i sin_mask = _mm256_set1_epi32(SIN_MASK);
+  const __m256i env_quiet = _mm256_set1_epi32(ENV_QUIET);
+  const __m256i tl_len = _mm256_set1_epi32(TL_TAB_LEN);
+  const __m256i mask = _mm256_set1_epi32(opmask);
+  __m256i in = _mm256_setzero_si256();
+  int i = 0;
+
+  for (; i+8<=count; i+=8)
+  {
+    __m256i e = _mm256_loadu_si256((const __m256i *)&env[i]);
+    __m256i index, p, valid = _mm256_cmpgt_epi32(env_quiet, e);
+
+    /* attenuation above ENV_QUIET always gives p >= TL_TAB_LEN (zero output) */
+    if (_mm256_testz_si256(valid, valid))
+    {
+      _mm256_storeu_si256((__m256i *)&out[i], _mm256_setzero_si256());
+      continue;
+    }
+
+    index = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)&phase[i]), SIN_BITS);
+    if (pm)
+      in = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *)&pm[i]), 1);
+
+    index = _mm256_and_si256(_mm256_add_epi32(index, in), sin_mask);
+    p = _mm256_i32gather_epi32((const int *)sin_tab, index, 4);
+    p = _mm256_add_epi32(_mm256_slli_epi32(e, 3), p);
+
+    /* only lanes with p < TL_TAB_LEN are loaded, other ones are zero */
+    valid = _mm256_cmpgt_epi32(tl_len, p);
+    p = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)tl_tab, p, valid, 4);
+    _mm256_storeu_si256((__m256i *)&out[i], _mm256_and_si256(p, mask));
+  }
+
+  if (i < count)
+    op_calc_block(&phase[i], &env[i], pm ? &pm[i] : NULL, &out[i], count - i, opmask);
+}
+#endif
+
+/* delayed samples: out[i] = in[i-1], out[0] = previous block last one */
+INLINE void mem_delay_block(const INT32 *in, INT32 *out, INT32 mem_value, int count)
+{
+  int i;
+
+  out[0] = mem_value;
+  for (i=1; i<count; i++)
+    out[i] = in[i-1];
+}
+
+/* outputs of one channel for count samples from SLOT1 outputs, stored phases and attenuations (see chan_calc) */
+static void chan_calc_block(FM_CH *CH, const INT32 *o1, const UINT32 phase[4][FM_BLOCK], const UINT32 env[4][FM_BLOCK], INT32 *out, int count)
+{
+  INT32 o2[FM_BLOCK], o3[FM_BLOCK], o4[FM_BLOCK], in[FM_BLOCK];
+  UINT32 *mask = op_mask[CH->ALGO];
+  void (*op)(const UINT32 *phase, const UINT32 *env, const INT32 *pm, INT32 *out, int count, UINT32 opmask) = op_calc_block;
+  int i;
+
+#ifdef SIMD_FM
+  if (fm_kernel == YM2612_KERNEL_AVX2)
+    op = op_calc_block_avx2;
+#endif
+
+  /* SLOT 3 (M2), SLOT 2 (C1) and SLOT 4 (C2) in each algorithm (see setup_connection) */
+  switch (CH->ALGO)
+  {
+    case 0:
+      /* M1---C1---MEM---M2---C2---OUT */
+      op(phase[SLOT2], env[SLOT2], o1, o2, count, mask[1]);
+      mem_delay_block(o2, in, CH->mem_value, count);
+      op(phase[SLOT3], env[SLOT3], in, o3, count, mask[2]);
+      op(phase[SLOT4], env[SLOT4], o3, out, count, mask[3]);
+      CH->mem_value = o2[count-1];
+      break;
+
+    case 1:
+      /* M1------+-MEM---M2---C2---OUT */
+      /*      C1-+                     */
+      op(phase[SLOT2], env[SLOT2], NULL, o2, count, mask[1]);
+      for (i=0; i<count; i++)
+        o2[i] += o1[i];
+      mem_delay_block(o2, in, CH->mem_value, count);
+      op(phase[SLOT3], env[SLOT3], in, o3, count, mask[2]);
+      op(phase[SLOT4], env[SLOT4], o3, out, count, mask[3]);
+      CH->mem_value = o2[count-1];
+      break;
+
+    case 2:
+      /* M1-----------------+-C2---OUT */
+      /*      C1---MEM---M2-+          */
+      op(phase[SLOT2], env[SLOT2], NULL, o2, count, mask[1]);
+      mem_delay_block(o2, in, CH->mem_value, count);
+      op(phase[SLOT3], env[SLOT3], in, o3, count, mask[2]);
+      for (i=0; i<count; i++)
+        in[i] = o1[i] + o3[i];
+      op(phase[SLOT4], env[SLOT4], in, out, count, mask[3]);
+      CH->mem_value = o2[count-1];
+      break;
+
+    case 3:
+      /* M1---C1---MEM------+-C2---OUT */
+      /*                 M2-+          */
+      op(phase[SLOT2], env[SLOT2], o1, o2, count, mask[1]);
+      op(phase[SLOT3], env[SLOT3], NULL, o3, count, mask[2]);
+      mem_delay_block(o2, in, CH->mem_value, count);
+      for (i=0; i<count; i++)
+        in[i] += o3[i];
+      op(phase[SLOT4], env[SLOT4], in, out, count, mask[3]);
+      CH->mem_value = o2[count-1];
+      break;
+
+    case 4:
+      /* M1---C1-+-OUT */
+      /* M2---C2-+     */
+      op(phase[SLOT2], env[SLOT2], o1, o2, count, mask[1]);
+      op(phase[SLOT3], env[SLOT3], NULL, o3, count, mask[2]);
+      op(phase[SLOT4], env[SLOT4], o3, o4, count, mask[3]);
+      for (i=0; i<count; i++)
+        out[i] = o2[i] + o4[i];
+      break;
+
+    case 5:
+      /*    +----C1----+     */
+      /* M1-+-MEM---M2-+-OUT */
+      /*    +----C2----+     */
+      mem_delay_block(o1, in, CH->mem_value, count);
+      op(phase[SLOT3], env[SLOT3], in, o3, count, mask[2]);
+      op(phase[SLOT2], env[SLOT2], o1, o2, count, mask[1]);
+      op(phase[SLOT4], env[SLOT4], o1, o4, count, mask[3]);
+      for (i=0; i<count; i++)
+        out[i] = o3[i] + o2[i] + o4[i];
+      CH->mem_value = o1[count-1];
+      break;
+
+    case 6:
+      /* M1---C1-+     */
+      /*      M2-+-OUT */
+      /*      C2-+     */
+      op(phase[SLOT3], env[SLOT3], NULL, o3, count, mask[2]);
+      op(phase[SLOT2], env[SLOT2], o1, o2, count, mask[1]);
+      op(phase[SLOT4], env[SLOT4], NULL, o4, count, mask[3]);
+      for (i=0; i<count; i++)
+        out[i] = o3[i] + o2[i] + o4[i];
+      break;
+
+    default:
+      /* M1-+     */
+      /* C1-+-OUT */
+      /* M2-+     */
+      /* C2-+     */
+      op(phase[SLOT3], env[SLOT3], NULL, o3, count, mask[2]);
+      op(phase[SLOT2], env[SLOT2], NULL, o2, count, mask[1]);
+      op(phase[SLOT4], env[SLOT4], NULL, o4, count, mask[3]);
+      for (i=0; i<count; i++)
+        out[i] = o1[i] + o3[i] + o2[i] + o4[i];
+      break;
+  }
+}
+
+#ifdef SIMD_FM
+/* same as mix_channels for count samples of block_out, 8 samples at once */
+__attribute__((target("avx2")))
+static void mix_block_avx2(int *buffer, int count)
+{
+  const __m256i max = _mm256_set1_epi32(8191);
+  const __m256i min = _mm256_set1_epi32(-8192);
+  const __m256i zero = _mm256_setzero_si256();
+  int i = 0, c;
+
+  for (; i+8<=count; i+=8)
+  {
+    __m256i lt = zero, rt = zero, lo, hi;
+
+    for (c=0; c<6; c++)
+    {
+      __m256i pan_l = _mm256_set1_epi32(ym2612.OPN.pan[(2*c)+0]);
+      __m256i pan_r = _mm256_set1_epi32(ym2612.OPN.pan[(2*c)+1]);
+
+      /* channels accumulator output clipping (14-bit max) */
+      __m256i out = _mm256_loadu_si256((const __m256i *)&block_out[c][i]);
+      out = _mm256_max_epi32(_mm256_min_epi32(out, max), min);
+
+      /* stereo DAC output panning & mixing  */
+      lt = _mm256_add_epi32(lt, _mm256_and_si256(out, pan_l));
+      rt = _mm256_add_epi32(rt, _mm256_and_si256(out, pan_r));
+
+      /* discrete YM2612 DAC 'ladder effect' */
+      if (chip_type == YM2612_DISCRETE)
+      {
+        /* -4 offset (-3 when not muted) on negative channel output, +4 offset on positive one (9-bit) */
+        __m256i neg = _mm256_cmpgt_epi32(zero, out);
+        __m256i pos = _mm256_set1_epi32(4 << 5);
+        __m256i neg_l = _mm256_set1_epi32(-((4 - (int)(ym2612.OPN.pan[(2*c)+0] & 1)) << 5));
+        __m256i neg_r = _mm256_set1_epi32(-((4 - (int)(ym2612.OPN.pan[(2*c)+1] & 1)) << 5));
+        lt = _mm256_add_epi32(lt, _mm256_blendv_epi8(pos, neg_l, neg));
+        rt = _mm256_add_epi32(rt, _mm256_blendv_epi8(pos, neg_r, neg));
+      }
     }
 
-    /* advance LFO */
-    advance_lfo();
+    /* interleave left & right samples */
+    lo = _mm256_unpacklo_epi32(lt, rt);
+    hi = _mm256_unpackhi_epi32(lt, rt);
+    _mm256_storeu_si256((__m256i *)&buffer[2*i], _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i *)&buffer[2*i+8], _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+
+  for (; i<count; i++)
+  {
+    for (c=0; c<6; c++)
+      out_fm[c] = block_out[c][i];
+
+    mix_channels(&buffer[2*i]);
+  }
+}
+#endif
+
+/* render count samples (count <= FM_BLOCK) of num channels, idle ones excepted, with a block pass */
+INLINE void render_block(int *buffer, int count, int num, unsigned int idle, FM_SLOT **ssg, int ssg_count)
+{
+  int i, c, s;
+
+  /* phase & envelope generators, LFO, timers */
+  for (i=0; i<count; i++)
+  {
+    /* update SSG-EG output of operators with SSG-EG enabled */
+    for (s=0; s<ssg_count; s++)
+      update_ssg_eg_slot(ssg[s]);
 
-    /* EG is updated every 3 samples */
-    ym2612.OPN.eg_timer++;
-    if (ym2612.OPN.eg_timer >= 3)
+    for (c=0; c<num; c++)
+    {
+      FM_CH *CH = &ym2612.CH[c];
+
+      if (idle & (1 << c))
+      {
+        /* see chan_calc */
+        if (CH->pms)
+          update_phase_chan(CH);
+      }
+      else
+      {
+        UINT32 AM = ym2612.OPN.LFO_AM >> CH->ams;
+        unsigned int eg_out = volume_calc(&CH->SLOT[SLOT1]);
+        INT32 out = 0;
+
+        /* SLOT 1 (feedback from the two previous samples, see chan_calc) */
+        if (eg_out < ENV_QUIET)
+        {
+          if (CH->FB < SIN_BITS)
+            out = (CH->op1_out[0] + CH->op1_out[1]) >> CH->FB;
+
+          out = op_calc1(CH->SLOT[SLOT1].phase, eg_out, out, op_mask[CH->ALGO][0]);
+        }
+
+        CH->op1_out[0] = CH->op1_out[1];
+        CH->op1_out[1] = out;
+        block_op1[c][i] = out;
+
+        for (s=1; s<4; s++)
+        {
+          block_phase[c][s][i] = CH->SLOT[s].phase;
+          block_env[c][s][i] = volume_calc(&CH->SLOT[s]);
+        }
+
+        /* update phase counters AFTER output calculations */
+        update_phase_chan(CH);
+      }
+    }
+
+    /* advance LFO & EG */
+    advance_lfo_eg();
+
+    /* timer A & CSM mode control */
+    advance_timer_a();
+  }
+
+  /* operator outputs */
+  for (c=0; c<6; c++)
+  {
+    if ((c < num) && !(idle & (1 << c)))
+    {
+      chan_calc_block(&ym2612.CH[c], block_op1[c], block_phase[c], block_env[c], block_out[c], count);
+    }
+    else
     {
-      /* reset EG timer */
-      ym2612.OPN.eg_timer = 0;
+      /* idle channel or DAC Mode */
+      INT32 out = (c < num) ? 0 : ym2612.dacout;
+      for (i=0; i<count; i++)
+        block_out[c][i] = out;
+    }
+  }
 
-      /* increment EG counter */
-      ym2612.OPN.eg_cnt++;
+  /* buffering */
+#ifdef SIMD_FM
+  if (fm_kernel == YM2612_KERNEL_AVX2)
+  {
+    mix_block_avx2(buffer, count);
+    return;
+  }
+#endif
 
-      /* EG counter is 12-bit only and zero value is skipped (verified on real hardware) */
-      if (ym2612.OPN.eg_cnt == 4096)
-        ym2612.OPN.eg_cnt = 1;
+  for (i=0; i<count; i++)
+  {
+    for (c=0; c<6; c++)
+      out_fm[c] = block_out[c][i];
 
-      /* advance envelope generator */
-      advance_eg_channels(&ym2612.CH[0], ym2612.OPN.eg_cnt);
+    mix_channels(buffer);
+    buffer += 2;
+  }
+}
+
+/* operators with SSG-EG enabled, which is only done by register writes (i.e between two updates) */
+INLINE int ssg_eg_slots(FM_SLOT **slots)
+{
+  int ch, s, count = 0;
+
+  for (ch=0; ch<6; ch++)
+  {
+    for (s=0; s<4; s++)
+    {
+      if (ym2612.CH[ch].SLOT[s].ssg & 0x08)
+        slots[count++] = &ym2612.CH[ch].SLOT[s];
     }
+  }
+
+  return count;
+}
+
+/* Generate samples for ym2612 */
+void YM2612Update(int *buffer, int length)
+{
+  int i;
+  unsigned int idle = 0;
+
+  /* channel 6 is not running in DAC mode */
+  int num = ym2612.dacen ? 5 : 6;
+
+  /* refresh PG increments and EG rates if required */
+  refresh_fc_eg_chans();
 
-    /* channels accumulator output clipping (14-bit max) */
-    if (out_fm[0] > 8191) out_fm[0] = 8191;
-    else if (out_fm[0] < -8192) out_fm[0] = -8192;
-    if (out_fm[1] > 8191) out_fm[1] = 8191;
-    else if (out_fm[1] < -8192) out_fm[1] = -8192;
-    if (out_fm[2] > 8191) out_fm[2] = 8191;
-    else if (out_fm[2] < -8192) out_fm[2] = -8192;
-    if (out_fm[3] > 8191) out_fm[3] = 8191;
-    else if (out_fm[3] < -8192) out_fm[3] = -8192;
-    if (out_fm[4] > 8191) out_fm[4] = 8191;
-    else if (out_fm[4] < -8192) out_fm[4] = -8192;
-    if (out_fm[5] > 8191) out_fm[5] = 8191;
-    else if (out_fm[5] < -8192) out_fm[5] = -8192;
-
-    /* stereo DAC output panning & mixing  */
-    lt  = ((out_fm[0]) & ym2612.OPN.pan[0]);
-    rt  = ((out_fm[0]) & ym2612.OPN.pan[1]);
-    lt += ((out_fm[1]) & ym2612.OPN.pan[2]);
-    rt += ((out_fm[1]) & ym2612.OPN.pan[3]);
-    lt += ((out_fm[2]) & ym2612.OPN.pan[4]);
-    rt += ((out_fm[2]) & ym2612.OPN.pan[5]);
-    lt += ((out_fm[3]) & ym2612.OPN.pan[6]);
-    rt += ((out_fm[3]) & ym2612.OPN.pan[7]);
-    lt += ((out_fm[4]) & ym2612.OPN.pan[8]);
-    rt += ((out_fm[4]) & ym2612.OPN.pan[9]);
-    lt += ((out_fm[5]) & ym2612.OPN.pan[10]);
-    rt += ((out_fm[5]) & ym2612.OPN.pan[11]);
-
-    /* discrete YM2612 DAC */
-    if (chip_type == YM2612_DISCRETE)
+  if (length > 0)
+  {
+    idle = idle_channels();
+
+    /* whole chip is idle, channel 6 envelope generator included: output is constant */
+    if (idle == 0x3f)
     {
-      int i;
+      for (i=0; i<num; i++)
+      {
+        if (ym2612.CH[i].pms)
+          break;
+      }
 
-      /* DAC 'ladder effect' */
-      for (i=0; i<6; i++)
+      if (i == num)
       {
-        if (out_fm[i] < 0)
+        for (i=0; i<num; i++)
         {
-          /* -4 offset (-3 when not muted) on negative channel output (9-bit) */
-          lt -= ((4 - (ym2612.OPN.pan[(2*i)+0] & 1)) << 5);
-          rt -= ((4 - (ym2612.OPN.pan[(2*i)+1] & 1)) << 5);
+          skip_idle_channel(&ym2612.CH[i], length);
         }
-        else
+
+        PROFILE_COUNT(fm_idle_samples, num * length);
+
+        out_fm[0] = 0;
+        out_fm[1] = 0;
+        out_fm[2] = 0;
+        out_fm[3] = 0;
+        out_fm[4] = 0;
+        out_fm[5] = ym2612.dacen ? ym2612.dacout : 0;
+        mix_channels(buffer);
+        for (i=1; i<length; i++)
         {
-          /* +4 offset (when muted or not) on positive channel output (9-bit) */
-          lt += (4 << 5);
-          rt += (4 << 5);
+          buffer[2*i] = buffer[0];
+          buffer[2*i+1] = buffer[1];
         }
+
+        skip_lfo_eg(length);
+        skip_timer_a(length);
+        INTERNAL_TIMER_B(length);
+        return;
+      }
+    }
+
+    /* channels kept idle during the whole update */
+    idle &= (1 << num) - 1;
+
+    for (i=0; i<num; i++)
+    {
+      if (idle & (1 << i))
+      {
+        skip_idle_channel(&ym2612.CH[i], length);
+        PROFILE_COUNT(fm_idle_samples, length);
       }
     }
+  }
+
+  /* render blocks of samples */
+  if ((fm_kernel != YM2612_KERNEL_SAMPLE) && (length >= FM_BLOCK_MIN))
+  {
+    FM_SLOT *ssg[6*4];
+    int ssg_count = ssg_eg_slots(ssg);
+
+    for (i=0; i<length; i+=FM_BLOCK)
+    {
+      render_block(buffer + 2*i, ((length - i) < FM_BLOCK) ? (length - i) : FM_BLOCK, num, idle, ssg, ssg_count);
+    }
+
+    /* timer B control */
+    INTERNAL_TIMER_B(length);
+    return;
+  }
+
+  /* buffering */
+  for(i=0; i<length; i++)
+  {
+    /* clear outputs */
+    out_fm[0] = 0;
+    out_fm[1] = 0;
+    out_fm[2] = 0;
+    out_fm[3] = 0;
+    out_fm[4] = 0;
+    out_fm[5] = 0;
+
+    /* update SSG-EG output */
+    update_ssg_eg_channels(&ym2612.CH[0]);
+
+    /* calculate FM */
+    if (ym2612.dacen)
+    {
+      /* DAC Mode */
+      out_fm[5] = ym2612.dacout;
+    }
+    chan_calc(&ym2612.CH[0],num,idle);
+
+    /* advance LFO & EG */
+    advance_lfo_eg();
 
     /* buffering */
-    *buffer++ = lt;
-    *buffer++ = rt;
+    mix_channels(buffer);
+    buffer += 2;
 
-    /* CSM mode: if CSM Key ON has occurred, CSM Key OFF need to be sent      */
-    /* only if Timer A does not overflow again (i.e CSM Key ON not set again) */
-    ym2612.OPN.SL3.key_csm <<= 1;
+    /* timer A & CSM mode control */
+    advance_timer_a();
+  }
 
-    /* timer A control */
-    INTERNAL_TIMER_A();
+  /* timer B control */
+  INTERNAL_TIMER_B(length);
+}
+
+/* Run timers only (chip status), output is generated by another instance */
+void YM2612UpdateTimers(int length)
+{
+  /* timer A control (same as running INTERNAL_TIMER_A every sample) */
+  skip_timer_a(length);
 
-    /* CSM Mode Key ON still disabled */
-    if (ym2612.OPN.SL3.key_csm & 2)
+  /* timer B control */
+  INTERNAL_TIMER_B(length);
+}
+
+/* Run chip for length samples without generating any output: phase, LFO, envelope */
+/* generators and timers are updated exactly as with YM2612Update. Operator outputs */
+/* (feedback & delayed MEM samples) are left as is, so output rendered afterwards   */
+/* differs from an uninterrupted YM2612Update: only use it for speculative frames   */
+/* whose chip state is discarded afterwards (see system_run_ahead).                  */
+void YM2612Skip(int length)
+{
+  int i, j, num;
+
+  /* refresh PG increments and EG rates if required */
+  refresh_fc_eg_chans();
+
+  for(i=0; i<length; i++)
+  {
+    /* update SSG-EG output */
+    update_ssg_eg_channels(&ym2612.CH[0]);
+
+    /* update phase counters (channel 6 is not running in DAC mode) */
+    num = ym2612.dacen ? 5 : 6;
+    for (j=0; j<num; j++)
     {
-      /* CSM Mode Key OFF (verified by Nemesis on real hardware) */
-      FM_KEYOFF_CSM(&ym2612.CH[2],SLOT1);
-      FM_KEYOFF_CSM(&ym2612.CH[2],SLOT2);
-      FM_KEYOFF_CSM(&ym2612.CH[2],SLOT3);
-      FM_KEYOFF_CSM(&ym2612.CH[2],SLOT4);
-      ym2612.OPN.SL3.key_csm = 0;
+      update_phase_chan(&ym2612.CH[j]);
     }
+
+    /* advance LFO & EG */
+    advance_lfo_eg();
+
+    /* timer A & CSM mode control */
+    advance_timer_a();
   }
 
   /* timer B control */
@@ -2205,6 +2874,27 @@ void YM2612Config(int type)
   }
 }
 
+/* select output rendering kernel, returns 0 if not supported */
+int YM2612SetKernel(int kernel)
+{
+  switch (kernel)
+  {
+    case YM2612_KERNEL_SAMPLE:
+    case YM2612_KERNEL_BLOCK:
+      fm_kernel = kernel;
+      return 1;
+
+#ifdef SIMD_FM
+    case YM2612_KERNEL_AVX2:
+      if (!__builtin_cpu_supports("avx2")) break;
+      fm_kernel = kernel;
+      return 1;
+#endif
+  }
+
+  return 0;
+}
+
 int YM2612LoadContext(unsigned char *state)
 {
   int c,s;
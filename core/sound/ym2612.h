@@ -22,10 +22,18 @@ enum {
   YM2612_ENHANCED
 };
 
+/* Output rendering kernels */
+#define YM2612_KERNEL_SAMPLE 0  /* sample by sample */
+#define YM2612_KERNEL_BLOCK  1  /* blocks of samples */
+#define YM2612_KERNEL_AVX2   2  /* blocks of samples, AVX2 operators */
+
 extern void YM2612Init(void);
 extern void YM2612Config(int type);
+extern int YM2612SetKernel(int kernel);
 extern void YM2612ResetChip(void);
 extern void YM2612Update(int *buffer, int length);
+extern void YM2612Skip(int length);
+extern void YM2612UpdateTimers(int length);
 extern void YM2612Write(unsigned int a, unsigned int v);
 extern unsigned int YM2612Read(void);
 extern int YM2612LoadContext(unsigned char *state);
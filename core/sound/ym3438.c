@@ -30,6 +30,16 @@
 
 #include <string.h>
 #include "ym3438.h"
+#include "macros.h"
+
+/* Clock stages are inlined in OPN2_Clock and in the stage loops of OPN2_SampleFast */
+#if defined(__GNUC__)
+#define OPN2_INLINE static __inline__ __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define OPN2_INLINE static __forceinline
+#else
+#define OPN2_INLINE static
+#endif
 
 #define SIGN_EXTEND(bit_index, value) (((value) & ((1u << (bit_index)) - 1u)) - ((value) & (1u << (bit_index))))
 
@@ -220,9 +230,9 @@ static const Bit32u fm_algorithm[4][6][8] = {
     }
 };
 
-static Bit32u chip_type = ym3438_mode_readmode;
+static CTX_LOCAL Bit32u chip_type = ym3438_mode_readmode;
 
-static void OPN2_DoIO(ym3438_t *chip)
+OPN2_INLINE void OPN2_DoIO(ym3438_t *chip)
 {
     /* Write signal check */
     chip->write_a_en = (chip->write_a & 0x03) == 0x01;
@@ -236,12 +246,55 @@ static void OPN2_DoIO(ym3438_t *chip)
     chip->write_busy_cnt &= 0x1f;
 }
 
-static void OPN2_DoRegWrite(ym3438_t *chip)
+OPN2_INLINE void OPN2_WriteSlot(ym3438_t *chip, Bit32u slot)
+{
+    switch (chip->address & 0xf0)
+    {
+    case 0x30: /* DT, MULTI */
+        chip->multi[slot] = chip->data & 0x0f;
+        if (!chip->multi[slot])
+        {
+            chip->multi[slot] = 1;
+        }
+        else
+        {
+            chip->multi[slot] <<= 1;
+        }
+        chip->dt[slot] = (chip->data >> 4) & 0x07;
+        break;
+    case 0x40: /* TL */
+        chip->tl[slot] = chip->data & 0x7f;
+        break;
+    case 0x50: /* KS, AR */
+        chip->ar[slot] = chip->data & 0x1f;
+        chip->ks[slot] = (chip->data >> 6) & 0x03;
+        break;
+    case 0x60: /* AM, DR */
+        chip->dr[slot] = chip->data & 0x1f;
+        chip->am[slot] = (chip->data >> 7) & 0x01;
+        break;
+    case 0x70: /* SR */
+        chip->sr[slot] = chip->data & 0x1f;
+        break;
+    case 0x80: /* SL, RR */
+        chip->rr[slot] = chip->data & 0x0f;
+        chip->sl[slot] = (chip->data >> 4) & 0x0f;
+        chip->sl[slot] |= (chip->sl[slot] + 1) & 0x10;
+        break;
+    case 0x90: /* SSG-EG */
+        chip->ssg_eg[slot] = chip->data & 0x0f;
+        break;
+    default:
+        break;
+    }
+}
+
+OPN2_INLINE void OPN2_DoRegWrite(ym3438_t *chip, Bit32u cycles)
 {
     Bit32u i;
-    Bit32u slot = chip->cycles % 12;
+    Bit32u slot = cycles % 12;
     Bit32u address;
-    Bit32u channel = chip->channel;
+    Bit32u channel = cycles % 6;
     /* Update registers */
     if (chip->write_fm_data)
     {
@@ -253,46 +306,7 @@ static void OPN2_DoRegWrite(ym3438_t *chip)
                 /* OP2, OP4 */
                 slot += 12;
             }
-            address = chip->address & 0xf0;
-            switch (address)
-            {
-            case 0x30: /* DT, MULTI */
-                chip->multi[slot] = chip->data & 0x0f;
-                if (!chip->multi[slot])
-                {
-                    chip->multi[slot] = 1;
-                }
-                else
-                {
-                    chip->multi[slot] <<= 1;
-                }
-                chip->dt[slot] = (chip->data >> 4) & 0x07;
-                break;
-            case 0x40: /* TL */
-                chip->tl[slot] = chip->data & 0x7f;
-                break;
-            case 0x50: /* KS, AR */
-                chip->ar[slot] = chip->data & 0x1f;
-                chip->ks[slot] = (chip->data >> 6) & 0x03;
-                break;
-            case 0x60: /* AM, DR */
-                chip->dr[slot] = chip->data & 0x1f;
-                chip->am[slot] = (chip->data >> 7) & 0x01;
-                break;
-            case 0x70: /* SR */
-                chip->sr[slot] = chip->data & 0x1f;
-                break;
-            case 0x80: /* SL, RR */
-                chip->rr[slot] = chip->data & 0x0f;
-                chip->sl[slot] = (chip->data >> 4) & 0x0f;
-                chip->sl[slot] |= (chip->sl[slot] + 1) & 0x10;
-                break;
-            case 0x90: /* SSG-EG */
-                chip->ssg_eg[slot] = chip->data & 0x0f;
-                break;
-            default:
-                break;
-            }
+            OPN2_WriteSlot(chip, slot);
         }
 
         /* Channel */
@@ -455,23 +469,14 @@ static void OPN2_DoRegWrite(ym3438_t *chip)
     }
 }
 
-static void OPN2_PhaseCalcIncrement(ym3438_t *chip)
+/* Frequency of a channel with the LFO applied, before detune and multiplier */
+OPN2_INLINE Bit32u OPN2_PhaseBase(ym3438_t *chip, Bit32u chan, Bit32u fnum, Bit32u block)
 {
-    Bit32u chan = chip->channel;
-    Bit32u slot = chip->cycles;
-    Bit32u fnum = chip->pg_fnum;
     Bit32u fnum_h = fnum >> 4;
     Bit32u fm;
-    Bit32u basefreq;
     Bit8u lfo = chip->lfo_pm;
     Bit8u lfo_l = lfo & 0x0f;
     Bit8u pms = chip->pms[chan];
-    Bit8u dt = chip->dt[slot];
-    Bit8u dt_l = dt & 0x03;
-    Bit8u detune = 0;
-    Bit8u block, note;
-    Bit8u sum, sum_h, sum_l;
-    Bit8u kcode = chip->pg_kcode;
 
     fnum <<= 1;
     /* Apply LFO */
@@ -495,7 +500,16 @@ static void OPN2_PhaseCalcIncrement(ym3438_t *chip)
     }
     fnum &= 0xfff;
 
-    basefreq = (fnum << chip->pg_block) >> 2;
+    return (fnum << block) >> 2;
+}
+
+OPN2_INLINE void OPN2_PhaseIncrement(ym3438_t *chip, Bit32u slot, Bit32u basefreq, Bit8u kcode)
+{
+    Bit8u dt = chip->dt[slot];
+    Bit8u dt_l = dt & 0x03;
+    Bit8u detune = 0;
+    Bit8u block, note;
+    Bit8u sum, sum_h, sum_l;
 
     /* Apply detune */
     if (dt_l)
@@ -524,17 +538,22 @@ static void OPN2_PhaseCalcIncrement(ym3438_t *chip)
     chip->pg_inc[slot] &= 0xfffff;
 }
 
-static void OPN2_PhaseGenerate(ym3438_t *chip)
+OPN2_INLINE void OPN2_PhaseCalcIncrement(ym3438_t *chip, Bit32u cycles)
+{
+    OPN2_PhaseIncrement(chip, cycles, OPN2_PhaseBase(chip, cycles % 6, chip->pg_fnum, chip->pg_block), chip->pg_kcode);
+}
+
+OPN2_INLINE void OPN2_PhaseGenerate(ym3438_t *chip, Bit32u cycles)
 {
     Bit32u slot;
     /* Mask increment */
-    slot = (chip->cycles + 20) % 24;
+    slot = (cycles + 20) % 24;
     if (chip->pg_reset[slot])
     {
         chip->pg_inc[slot] = 0;
     }
     /* Phase step */
-    slot = (chip->cycles + 19) % 24;
+    slot = (cycles + 19) % 24;
     if (chip->pg_reset[slot] || chip->mode_test_21[3])
     {
         chip->pg_phase[slot] = 0;
@@ -543,9 +562,9 @@ static void OPN2_PhaseGenerate(ym3438_t *chip)
     chip->pg_phase[slot] &= 0xfffff;
 }
 
-static void OPN2_EnvelopeSSGEG(ym3438_t *chip)
+OPN2_INLINE void OPN2_EnvelopeSSGEG(ym3438_t *chip, Bit32u cycles)
 {
-    Bit32u slot = chip->cycles;
+    Bit32u slot = cycles;
     Bit8u direction = 0;
     chip->eg_ssg_pgrst_latch[slot] = 0;
     chip->eg_ssg_repeat_latch[slot] = 0;
@@ -589,9 +608,9 @@ static void OPN2_EnvelopeSSGEG(ym3438_t *chip)
                            & chip->eg_kon[slot];
 }
 
-static void OPN2_EnvelopeADSR(ym3438_t *chip)
+OPN2_INLINE void OPN2_EnvelopeADSR(ym3438_t *chip, Bit32u cycles)
 {
-    Bit32u slot = (chip->cycles + 22) % 24;
+    Bit32u slot = (cycles + 22) % 24;
 
     Bit8u nkon = chip->eg_kon_latch[slot];
     Bit8u okon = chip->eg_kon[slot];
@@ -713,13 +732,11 @@ static void OPN2_EnvelopeADSR(ym3438_t *chip)
     chip->eg_state[slot] = nextstate;
 }
 
-static void OPN2_EnvelopePrepare(ym3438_t *chip)
+OPN2_INLINE void OPN2_EnvelopeIncrement(ym3438_t *chip)
 {
     Bit8u rate;
     Bit8u sum;
     Bit8u inc = 0;
-    Bit32u slot = chip->cycles;
-    Bit8u rate_sel;
 
     /* Prepare increment */
     rate = (chip->eg_rate << 1) + chip->eg_ksv;
@@ -760,6 +777,12 @@ static void OPN2_EnvelopePrepare(ym3438_t *chip)
     }
     chip->eg_inc = inc;
     chip->eg_ratemax = (rate >> 1) == 0x1f;
+}
+
+OPN2_INLINE void OPN2_EnvelopeLatch(ym3438_t *chip, Bit32u cycles)
+{
+    Bit32u slot = cycles;
+    Bit8u rate_sel;
 
     /* Prepare rate & ksv */
     rate_sel = chip->eg_state[slot];
@@ -788,7 +811,7 @@ static void OPN2_EnvelopePrepare(ym3438_t *chip)
     chip->eg_ksv = chip->pg_kcode >> (chip->ks[slot] ^ 0x03);
     if (chip->am[slot])
     {
-        chip->eg_lfo_am = chip->lfo_am >> eg_am_shift[chip->ams[chip->channel]];
+        chip->eg_lfo_am = chip->lfo_am >> eg_am_shift[chip->ams[cycles % 6]];
     }
     else
     {
@@ -801,9 +824,15 @@ static void OPN2_EnvelopePrepare(ym3438_t *chip)
     chip->eg_sl[0] = chip->sl[slot];
 }
 
-static void OPN2_EnvelopeGenerate(ym3438_t *chip)
+OPN2_INLINE void OPN2_EnvelopePrepare(ym3438_t *chip, Bit32u cycles)
 {
-    Bit32u slot = (chip->cycles + 23) % 24;
+    OPN2_EnvelopeIncrement(chip);
+    OPN2_EnvelopeLatch(chip, cycles);
+}
+
+OPN2_INLINE void OPN2_EnvelopeGenerate(ym3438_t *chip, Bit32u cycles)
+{
+    Bit32u slot = (cycles + 23) % 24;
     Bit16u level;
 
     level = chip->eg_level[slot];
@@ -823,7 +852,7 @@ static void OPN2_EnvelopeGenerate(ym3438_t *chip)
     level += chip->eg_lfo_am;
 
     /* Apply TL */
-    if (!(chip->mode_csm && chip->channel == 2 + 1))
+    if (!(chip->mode_csm && cycles % 6 == 2 + 1))
     {
         level += chip->eg_tl[0] << 3;
     }
@@ -834,7 +863,7 @@ static void OPN2_EnvelopeGenerate(ym3438_t *chip)
     chip->eg_out[slot] = level;
 }
 
-static void OPN2_UpdateLFO(ym3438_t *chip)
+OPN2_INLINE void OPN2_UpdateLFO(ym3438_t *chip)
 {
     if ((chip->lfo_quotient & lfo_cycles[chip->lfo_freq]) == lfo_cycles[chip->lfo_freq])
     {
@@ -848,14 +877,14 @@ static void OPN2_UpdateLFO(ym3438_t *chip)
     chip->lfo_cnt &= chip->lfo_en;
 }
 
-static void OPN2_FMPrepare(ym3438_t *chip)
+OPN2_INLINE void OPN2_FMPrepare(ym3438_t *chip, Bit32u cycles)
 {
-    Bit32u slot = (chip->cycles + 6) % 24;
-    Bit32u channel = chip->channel;
+    Bit32u slot = (cycles + 6) % 24;
+    Bit32u channel = cycles % 6;
     Bit16s mod, mod1, mod2;
     Bit32u op = slot / 6;
     Bit8u connect = chip->connect[channel];
-    Bit32u prevslot = (chip->cycles + 18) % 24;
+    Bit32u prevslot = (cycles + 18) % 24;
 
     /* Calculate modulation */
     mod1 = mod2 = 0;
@@ -896,7 +925,7 @@ static void OPN2_FMPrepare(ym3438_t *chip)
     }
     chip->fm_mod[slot] = mod;
 
-    slot = (chip->cycles + 18) % 24;
+    slot = (cycles + 18) % 24;
     /* OP1 */
     if (slot / 6 == 0)
     {
@@ -910,10 +939,10 @@ static void OPN2_FMPrepare(ym3438_t *chip)
     }
 }
 
-static void OPN2_ChGenerate(ym3438_t *chip)
+OPN2_INLINE void OPN2_ChGenerate(ym3438_t *chip, Bit32u cycles)
 {
-    Bit32u slot = (chip->cycles + 18) % 24;
-    Bit32u channel = chip->channel;
+    Bit32u slot = (cycles + 18) % 24;
+    Bit32u channel = cycles % 6;
     Bit32u op = slot / 6;
     Bit32u test_dac = chip->mode_test_2c[5];
     Bit16s acc = chip->ch_acc[channel];
@@ -945,11 +974,10 @@ static void OPN2_ChGenerate(ym3438_t *chip)
     chip->ch_acc[channel] = sum;
 }
 
-static void OPN2_ChOutput(ym3438_t *chip)
+OPN2_INLINE void OPN2_ChOutput(ym3438_t *chip, Bit32u cycles)
 {
-    Bit32u cycles = chip->cycles;
-    Bit32u slot = chip->cycles;
-    Bit32u channel = chip->channel;
+    Bit32u slot = cycles;
+    Bit32u channel = cycles % 6;
     Bit32u test_dac = chip->mode_test_2c[5];
     Bit16s out;
     Bit16s sign;
@@ -1027,9 +1055,9 @@ static void OPN2_ChOutput(ym3438_t *chip)
     }
 }
 
-static void OPN2_FMGenerate(ym3438_t *chip)
+OPN2_INLINE void OPN2_FMGenerate(ym3438_t *chip, Bit32u cycles)
 {
-    Bit32u slot = (chip->cycles + 19) % 24;
+    Bit32u slot = (cycles + 19) % 24;
     /* Calculate phase */
     Bit16u phase = (chip->fm_mod[slot] + (chip->pg_phase[slot] >> 10)) & 0x3ff;
     Bit16u quarter;
@@ -1064,12 +1092,12 @@ static void OPN2_FMGenerate(ym3438_t *chip)
     chip->fm_out[slot] = output;
 }
 
-static void OPN2_DoTimerA(ym3438_t *chip)
+OPN2_INLINE void OPN2_DoTimerA(ym3438_t *chip, Bit32u cycles)
 {
     Bit16u time;
     Bit8u load;
     load = chip->timer_a_overflow;
-    if (chip->cycles == 2)
+    if (cycles == 2)
     {
         /* Lock load value */
         load |= (!chip->timer_a_load_lock && chip->timer_a_load);
@@ -1095,7 +1123,7 @@ static void OPN2_DoTimerA(ym3438_t *chip)
     }
     chip->timer_a_load_latch = load;
     /* Increase counter */
-    if ((chip->cycles == 1 && chip->timer_a_load_lock) || chip->mode_test_21[2])
+    if ((cycles == 1 && chip->timer_a_load_lock) || chip->mode_test_21[2])
     {
         time++;
     }
@@ -1113,12 +1141,12 @@ static void OPN2_DoTimerA(ym3438_t *chip)
     chip->timer_a_cnt = time & 0x3ff;
 }
 
-static void OPN2_DoTimerB(ym3438_t *chip)
+OPN2_INLINE void OPN2_DoTimerB(ym3438_t *chip, Bit32u cycles)
 {
     Bit16u time;
     Bit8u load;
     load = chip->timer_b_overflow;
-    if (chip->cycles == 2)
+    if (cycles == 2)
     {
         /* Lock load value */
         load |= (!chip->timer_b_load_lock && chip->timer_b_load);
@@ -1135,7 +1163,7 @@ static void OPN2_DoTimerB(ym3438_t *chip)
     }
     chip->timer_b_load_latch = load;
     /* Increase counter */
-    if (chip->cycles == 1)
+    if (cycles == 1)
     {
         chip->timer_b_subcnt++;
     }
@@ -1158,20 +1186,20 @@ static void OPN2_DoTimerB(ym3438_t *chip)
     chip->timer_b_cnt = time & 0xff;
 }
 
-static void OPN2_KeyOn(ym3438_t*chip)
+OPN2_INLINE void OPN2_KeyOn(ym3438_t *chip, Bit32u cycles)
 {
-    Bit32u slot = chip->cycles;
-    Bit32u chan = chip->channel;
+    Bit32u slot = cycles;
+    Bit32u chan = cycles % 6;
     /* Key On */
     chip->eg_kon_latch[slot] = chip->mode_kon[slot];
     chip->eg_kon_csm[slot] = 0;
-    if (chip->channel == 2 && chip->mode_kon_csm)
+    if (cycles % 6 == 2 && chip->mode_kon_csm)
     {
         /* CSM Key On */
         chip->eg_kon_latch[slot] = 1;
         chip->eg_kon_csm[slot] = 1;
     }
-    if (chip->cycles == chip->mode_kon_channel)
+    if (cycles == chip->mode_kon_channel)
     {
         /* OP1 */
         chip->mode_kon[chan] = chip->mode_kon_operator[0];
@@ -1209,13 +1237,14 @@ void OPN2_SetChipType(Bit32u type)
 
 void OPN2_Clock(ym3438_t *chip, Bit16s *buffer)
 {
-    Bit32u slot = chip->cycles;
+    Bit32u cycles = chip->cycles;
+    Bit32u slot = cycles;
     chip->lfo_inc = chip->mode_test_21[1];
     chip->pg_read >>= 1;
     chip->eg_read[1] >>= 1;
     chip->eg_cycle++;
     /* Lock envelope generator timer value */
-    if (chip->cycles == 1 && chip->eg_quotient == 2)
+    if (cycles == 1 && chip->eg_quotient == 2)
     {
         if (chip->eg_cycle_stop)
         {
@@ -1228,7 +1257,7 @@ void OPN2_Clock(ym3438_t *chip, Bit16s *buffer)
         chip->eg_timer_low_lock = chip->eg_timer & 0x03;
     }
     /* Cycle specific functions */
-    switch (chip->cycles)
+    switch (cycles)
     {
     case 0:
         chip->lfo_pm = chip->lfo_cnt >> 2;
@@ -1278,23 +1307,23 @@ void OPN2_Clock(ym3438_t *chip, Bit16s *buffer)
 
     OPN2_DoIO(chip);
 
-    OPN2_DoTimerA(chip);
-    OPN2_DoTimerB(chip);
-    OPN2_KeyOn(chip);
+    OPN2_DoTimerA(chip, cycles);
+    OPN2_DoTimerB(chip, cycles);
+    OPN2_KeyOn(chip, cycles);
 
-    OPN2_ChOutput(chip);
-    OPN2_ChGenerate(chip);
+    OPN2_ChOutput(chip, cycles);
+    OPN2_ChGenerate(chip, cycles);
 
-    OPN2_FMPrepare(chip);
-    OPN2_FMGenerate(chip);
+    OPN2_FMPrepare(chip, cycles);
+    OPN2_FMGenerate(chip, cycles);
 
-    OPN2_PhaseGenerate(chip);
-    OPN2_PhaseCalcIncrement(chip);
+    OPN2_PhaseGenerate(chip, cycles);
+    OPN2_PhaseCalcIncrement(chip, cycles);
 
-    OPN2_EnvelopeADSR(chip);
-    OPN2_EnvelopeGenerate(chip);
-    OPN2_EnvelopeSSGEG(chip);
-    OPN2_EnvelopePrepare(chip);
+    OPN2_EnvelopeADSR(chip, cycles);
+    OPN2_EnvelopeGenerate(chip, cycles);
+    OPN2_EnvelopeSSGEG(chip, cycles);
+    OPN2_EnvelopePrepare(chip, cycles);
 
     /* Prepare fnum & block */
     if (chip->mode_ch3)
@@ -1319,22 +1348,22 @@ void OPN2_Clock(ym3438_t *chip, Bit16s *buffer)
             break;
         case 19: /* OP4 */
         default:
-            chip->pg_fnum = chip->fnum[(chip->channel + 1) % 6];
-            chip->pg_block = chip->block[(chip->channel + 1) % 6];
-            chip->pg_kcode = chip->kcode[(chip->channel + 1) % 6];
+            chip->pg_fnum = chip->fnum[(cycles + 1) % 6];
+            chip->pg_block = chip->block[(cycles + 1) % 6];
+            chip->pg_kcode = chip->kcode[(cycles + 1) % 6];
             break;
         }
     }
     else
     {
-        chip->pg_fnum = chip->fnum[(chip->channel + 1) % 6];
-        chip->pg_block = chip->block[(chip->channel + 1) % 6];
-        chip->pg_kcode = chip->kcode[(chip->channel + 1) % 6];
+        chip->pg_fnum = chip->fnum[(cycles + 1) % 6];
+        chip->pg_block = chip->block[(cycles + 1) % 6];
+        chip->pg_kcode = chip->kcode[(cycles + 1) % 6];
     }
 
     OPN2_UpdateLFO(chip);
-    OPN2_DoRegWrite(chip);
-    chip->cycles = (chip->cycles + 1) % 24;
+    OPN2_DoRegWrite(chip, cycles);
+    chip->cycles = (cycles + 1) % 24;
     chip->channel = chip->cycles % 6;
 
     buffer[0] = chip->mol;
@@ -1344,6 +1373,450 @@ void OPN2_Clock(ym3438_t *chip, Bit16s *buffer)
         chip->status_time--;
 }
 
+/* Same as OPN2_Clock for what OPN2_Read depends on (busy flag, timers), output is generated by another chip */
+void OPN2_ClockStatus(ym3438_t *chip)
+{
+    Bit32u cycles = chip->cycles;
+
+    OPN2_DoIO(chip);
+
+    OPN2_DoTimerA(chip, cycles);
+    OPN2_DoTimerB(chip, cycles);
+
+    OPN2_DoRegWrite(chip, cycles);
+    chip->cycles = (cycles + 1) % 24;
+    chip->channel = chip->cycles % 6;
+
+    if (chip->status_time)
+        chip->status_time--;
+}
+
+/* Returns 1 when the FM data latched for a channel register is not applied yet.
+   Slot registers are handled by OPN2_SampleFast, see below. */
+OPN2_INLINE Bit32u OPN2_ChannelPending(ym3438_t *chip)
+{
+    Bit32u channel = (chip->address & 0x03) + ((chip->address >> 8) & 0x01) * 3;
+    Bit32u data = chip->data;
+
+    if ((chip->address & 0x03) == 0x03)
+    {
+        return 0;
+    }
+    switch (chip->address & 0xfc)
+    {
+    case 0xa0:
+        return chip->fnum[channel] != (data | ((chip->reg_a4 & 0x07) << 8))
+            || chip->block[channel] != ((chip->reg_a4 >> 3) & 0x07);
+    case 0xa4:
+        return chip->reg_a4 != data;
+    case 0xa8:
+        return chip->fnum_3ch[channel] != (data | ((chip->reg_ac & 0x07) << 8))
+            || chip->block_3ch[channel] != ((chip->reg_ac >> 3) & 0x07);
+    case 0xac:
+        return chip->reg_ac != data;
+    case 0xb0:
+        return chip->connect[channel] != (data & 0x07) || chip->fb[channel] != ((data >> 3) & 0x07);
+    case 0xb4:
+        return chip->pms[channel] != (data & 0x07) || chip->ams[channel] != ((data >> 4) & 0x03)
+            || chip->pan_l[channel] != ((data >> 7) & 0x01) || chip->pan_r[channel] != ((data >> 6) & 0x01);
+    default:
+        return 0;
+    }
+}
+
+/* Runs one sample from the first slot stage by stage instead of clock by clock.
+   Each slot goes through the same steps at the same point of its pipeline as in
+   OPN2_Clock: the slots whose pipeline wraps around the sample boundary are run
+   first, then every stage runs over all slots in a row. Only used while no
+   register write is in progress (see OPN2_ClockSample). */
+/* Channels with all operators released at max attenuation, no key on latched or pending, and
+   only zeros in their operator and accumulator pipeline: operator and accumulator stages would
+   only write zeros again, so they can be skipped for a whole sample */
+static Bit32u OPN2_IdleChannels(ym3438_t *chip)
+{
+    Bit32u idle = 0, ch, op, slot;
+
+    for (ch = 0; ch < 6; ch++)
+    {
+        if (chip->fm_op1[ch][0] | chip->fm_op1[ch][1] | chip->fm_op2[ch] | chip->ch_acc[ch] | chip->ch_out[ch])
+        {
+            continue;
+        }
+        for (op = 0; op < 4; op++)
+        {
+            slot = ch + op * 6;
+            if (chip->eg_level[slot] != 0x3ff || chip->eg_out[slot] != 0x3ff || chip->eg_state[slot] != eg_num_release
+             || chip->mode_kon[slot] | chip->eg_kon_latch[slot] | chip->eg_kon[slot] | chip->eg_kon_csm[slot]
+             || (chip->ssg_eg[slot] & 0x08) | chip->eg_ssg_enable[slot] | chip->eg_ssg_inv[slot]
+             || chip->fm_out[slot] | chip->fm_mod[slot])
+            {
+                break;
+            }
+        }
+        if (op == 4)
+        {
+            idle |= 1 << ch;
+        }
+    }
+
+    /* Key on register is applied again on every sample */
+    if (chip->mode_kon_channel < 24 && (chip->mode_kon_operator[0] | chip->mode_kon_operator[1]
+                                      | chip->mode_kon_operator[2] | chip->mode_kon_operator[3]))
+    {
+        idle &= ~(1 << (chip->mode_kon_channel % 6));
+    }
+
+    /* CSM key on */
+    if (chip->mode_csm | chip->mode_kon_csm)
+    {
+        idle &= ~(1 << 2);
+    }
+
+    return idle;
+}
+
+static Bit32u OPN2_SampleFast(ym3438_t *chip, Bit32s *sample)
+{
+    Bit32s mol = 0, mor = 0;
+    Bit32u c, slot = 24;
+    Bit32u idle, skip;
+    Bit8u rate[24], ksv[24], lfo_am[24], inc[24], ratemax[24];
+    Bit32u base[24];
+    Bit16u fnum[24];
+    Bit8u block[24], kcode[24];
+
+    /* Registers of a slot are read at its own cycle, a slot register write pending
+       for OP1/OP3 lands after that cycle, for OP2/OP4 before it */
+    if (chip->write_fm_data)
+    {
+        for (c = 0; c < 12; c++)
+        {
+            if (op_offset[c] == (chip->address & 0x107))
+            {
+                slot = c + ((chip->address & 0x08) ? 12 : 0);
+            }
+        }
+        if (slot >= 12 && slot < 24)
+        {
+            OPN2_WriteSlot(chip, slot);
+        }
+    }
+
+    /* Idle channels, a slot register written during this sample may restart one. Stages of
+       a channel are skipped on the cycles they run for one of its slots */
+    idle = OPN2_IdleChannels(chip);
+    if (slot < 24)
+    {
+        idle &= ~(1 << (slot % 6));
+    }
+    skip = idle * 0x41041;
+
+    /* Slot 23 envelope output and slot 22, 23 envelope update, on the previous sample latches */
+    OPN2_EnvelopeGenerate(chip, 0);
+    OPN2_EnvelopeADSR(chip, 0);
+    OPN2_EnvelopeIncrement(chip);
+    chip->eg_tl[1] = chip->eg_tl[0];
+    chip->eg_sl[1] = chip->eg_sl[0];
+    OPN2_EnvelopeADSR(chip, 1);
+
+    /* LFO output of this sample */
+    chip->lfo_pm = chip->lfo_cnt >> 2;
+    if (chip->lfo_cnt & 0x40)
+    {
+        chip->lfo_am = chip->lfo_cnt & 0x3f;
+    }
+    else
+    {
+        chip->lfo_am = chip->lfo_cnt ^ 0x3f;
+    }
+    chip->lfo_am <<= 1;
+
+    /* Envelope generator timer: cycle 0 ends the previous shift search, cycles 1 and 13
+       advance the timer and search its lowest set bit again */
+    chip->eg_cycle++;
+    if ((chip->eg_timer >> chip->eg_cycle) & chip->eg_cycle_stop)
+    {
+        chip->eg_shift = chip->eg_cycle;
+        chip->eg_cycle_stop = 0;
+    }
+    if (chip->eg_quotient == 2)
+    {
+        if (chip->eg_cycle_stop)
+        {
+            chip->eg_shift_lock = 0;
+        }
+        else
+        {
+            chip->eg_shift_lock = chip->eg_shift + 1;
+        }
+        chip->eg_timer_low_lock = chip->eg_timer & 0x03;
+    }
+    chip->eg_quotient++;
+    chip->eg_quotient %= 3;
+    chip->eg_timer_inc |= chip->eg_quotient >> 1;
+    chip->eg_timer = chip->eg_timer + chip->eg_timer_inc;
+    chip->eg_timer_inc = chip->eg_timer >> 12;
+    chip->eg_timer &= 0xfff;
+    chip->eg_timer = chip->eg_timer + chip->eg_timer_inc;
+    chip->eg_timer_inc = chip->eg_timer >> 12;
+    chip->eg_timer &= 0xfff;
+    chip->eg_cycle = 10;
+    chip->eg_cycle_stop = 1;
+    chip->eg_shift = 0;
+    for (c = 0; c < 11; c++)
+    {
+        if ((chip->eg_timer >> c) & 0x01)
+        {
+            chip->eg_shift = c;
+            chip->eg_cycle_stop = 0;
+            break;
+        }
+    }
+
+    /* No write signal, the busy counter runs out after 32 clocks */
+    chip->write_a = 0;
+    chip->write_d = 0;
+    chip->write_a_en = 0;
+    chip->write_d_en = 0;
+    chip->busy = chip->write_busy;
+    if (chip->write_busy)
+    {
+        if (chip->write_busy_cnt < 32 - 24)
+        {
+            chip->write_busy_cnt += 24;
+        }
+        else
+        {
+            chip->busy = (chip->write_busy_cnt == 32 - 24);
+            chip->write_busy_cnt = 0;
+            chip->write_busy = 0;
+        }
+    }
+
+    /* Without test mode, timers count on cycle 1 and reload on cycles 2-3, nothing changes after */
+    for (c = 0; c < 4; c++)
+    {
+        OPN2_DoTimerA(chip, c);
+        OPN2_DoTimerB(chip, c);
+    }
+
+    /* LFO counter, the quotient is increased on the last cycle */
+    if ((chip->lfo_quotient & lfo_cycles[chip->lfo_freq]) == lfo_cycles[chip->lfo_freq])
+    {
+        chip->lfo_quotient = 0;
+        chip->lfo_cnt++;
+    }
+    chip->lfo_quotient++;
+    chip->lfo_cnt &= chip->lfo_en;
+    chip->lfo_inc = 1;
+    chip->pg_read = 0;
+    chip->eg_read[1] = 0;
+
+    /* Phase generator latches */
+    fnum[0] = chip->pg_fnum;
+    block[0] = chip->pg_block;
+    kcode[0] = chip->pg_kcode;
+    for (c = 1; c < 24; c++)
+    {
+        fnum[c] = chip->fnum[c % 6];
+        block[c] = chip->block[c % 6];
+        kcode[c] = chip->kcode[c % 6];
+    }
+    if (chip->mode_ch3)
+    {
+        fnum[2] = chip->fnum_3ch[1];
+        block[2] = chip->block_3ch[1];
+        kcode[2] = chip->kcode_3ch[1];
+        fnum[8] = chip->fnum_3ch[0];
+        block[8] = chip->block_3ch[0];
+        kcode[8] = chip->kcode_3ch[0];
+        fnum[14] = chip->fnum_3ch[2];
+        block[14] = chip->block_3ch[2];
+        kcode[14] = chip->kcode_3ch[2];
+    }
+
+    /* First clocks of the channel and operator pipeline, reading phases of slots 19-23 */
+    for (c = 0; c < 5; c++)
+    {
+        OPN2_ChOutput(chip, c);
+        mol += chip->mol;
+        mor += chip->mor;
+        if (!((skip >> c) & 1))
+        {
+            OPN2_ChGenerate(chip, c);
+            OPN2_FMPrepare(chip, c);
+        }
+        if (!((skip >> ((c + 19) % 24)) & 1))
+        {
+            OPN2_FMGenerate(chip, c);
+        }
+    }
+
+    /* Phase step of slots 19-23 */
+    for (c = 20; c < 24; c++)
+    {
+        if (chip->pg_reset[c])
+        {
+            chip->pg_inc[c] = 0;
+        }
+    }
+    for (c = 19; c < 24; c++)
+    {
+        if (chip->pg_reset[c])
+        {
+            chip->pg_phase[c] = 0;
+        }
+        chip->pg_phase[c] += chip->pg_inc[c];
+        chip->pg_phase[c] &= 0xfffff;
+    }
+
+    /* Key on, SSG-EG and envelope rates of all slots */
+    for (c = 0; c < 24; c++)
+    {
+        OPN2_KeyOn(chip, c);
+        OPN2_EnvelopeSSGEG(chip, c);
+    }
+    for (c = 0; c < 24; c++)
+    {
+        if (c)
+        {
+            OPN2_EnvelopeIncrement(chip);
+            inc[c - 1] = chip->eg_inc;
+            ratemax[c - 1] = chip->eg_ratemax;
+        }
+        chip->pg_kcode = kcode[c];
+        OPN2_EnvelopeLatch(chip, c);
+        rate[c] = chip->eg_rate;
+        ksv[c] = chip->eg_ksv;
+        lfo_am[c] = chip->eg_lfo_am;
+    }
+
+    /* Envelope output of slots 0-22 */
+    for (c = 1; c < 24; c++)
+    {
+        chip->eg_lfo_am = lfo_am[c - 1];
+        chip->eg_tl[0] = chip->tl[c - 1];
+        OPN2_EnvelopeGenerate(chip, c);
+    }
+
+    /* Remaining clocks of the channel and operator pipeline */
+    for (c = 5; c < 24; c++)
+    {
+        OPN2_ChOutput(chip, c);
+        mol += chip->mol;
+        mor += chip->mor;
+        if (!((skip >> c) & 1))
+        {
+            OPN2_ChGenerate(chip, c);
+            OPN2_FMPrepare(chip, c);
+        }
+        if (!((skip >> ((c + 19) % 24)) & 1))
+        {
+            OPN2_FMGenerate(chip, c);
+        }
+    }
+
+    /* Envelope update of slots 0-21 */
+    for (c = 2; c < 24; c++)
+    {
+        chip->eg_inc = inc[c - 2];
+        chip->eg_ratemax = ratemax[c - 2];
+        chip->eg_sl[1] = chip->sl[c - 2];
+        chip->eg_tl[1] = chip->tl[c - 2];
+        OPN2_EnvelopeADSR(chip, c);
+    }
+
+    /* Phase increment of all slots, phase step of slots 0-18 */
+    for (c = 0; c < 24; c++)
+    {
+        /* Slot 0 uses the frequency latched at the end of the previous sample */
+        if (c < 7 || (chip->mode_ch3 && c % 6 == 2))
+        {
+            base[c] = OPN2_PhaseBase(chip, c % 6, fnum[c], block[c]);
+        }
+        else
+        {
+            base[c] = base[c - 6];
+        }
+        OPN2_PhaseIncrement(chip, c, base[c], kcode[c]);
+    }
+    for (c = 0; c < 20; c++)
+    {
+        if (chip->pg_reset[c])
+        {
+            chip->pg_inc[c] = 0;
+        }
+    }
+    for (c = 0; c < 19; c++)
+    {
+        if (chip->pg_reset[c])
+        {
+            chip->pg_phase[c] = 0;
+        }
+        chip->pg_phase[c] += chip->pg_inc[c];
+        chip->pg_phase[c] &= 0xfffff;
+    }
+
+    /* Latches as left by the last clock */
+    chip->eg_rate = rate[23];
+    chip->eg_ksv = ksv[23];
+    chip->eg_inc = inc[22];
+    chip->eg_ratemax = ratemax[22];
+    chip->eg_lfo_am = lfo_am[23];
+    chip->eg_tl[0] = chip->tl[23];
+    chip->eg_tl[1] = chip->tl[22];
+    chip->eg_sl[0] = chip->sl[23];
+    chip->eg_sl[1] = chip->sl[22];
+    chip->pg_fnum = chip->fnum[0];
+    chip->pg_block = chip->block[0];
+    chip->pg_kcode = chip->kcode[0];
+
+    if (slot < 12)
+    {
+        OPN2_WriteSlot(chip, slot);
+    }
+
+    chip->status_time = (chip->status_time > 24) ? (chip->status_time - 24) : 0;
+
+    sample[0] = mol;
+    sample[1] = mor;
+
+    for (c = 0, slot = 0; c < 6; c++)
+    {
+        slot += (idle >> c) & 1;
+    }
+    return slot;
+}
+
+/* Runs the 24 internal clocks of one output sample and returns the sum of their outputs,
+   same as 24 OPN2_Clock calls. Returns the number of idle channels that were skipped */
+Bit32u OPN2_ClockSample(ym3438_t *chip, Bit32s *sample)
+{
+    Bit32s mol = 0, mor = 0;
+    Bit16s buffer[2];
+    Bit32u i;
+
+    /* No write in progress, test registers cleared */
+    if (chip->cycles == 0 && !((chip->write_a | chip->write_d) & 0x01)
+     && (!chip->write_fm_data || (chip->data == (chip->write_data & 0xff) && !OPN2_ChannelPending(chip)))
+     && !(chip->mode_test_21[1] | chip->mode_test_21[2] | chip->mode_test_21[3] | chip->mode_test_21[4] | chip->mode_test_21[5])
+     && !chip->mode_test_2c[5] && !(chip->pin_test_in & chip->eg_custom_timer))
+    {
+        return OPN2_SampleFast(chip, sample);
+    }
+
+    for (i = 0; i < 24; i++)
+    {
+        OPN2_Clock(chip, buffer);
+        mol += buffer[0];
+        mor += buffer[1];
+    }
+    sample[0] = mol;
+    sample[1] = mor;
+
+    return 0;
+}
+
 void OPN2_Write(ym3438_t *chip, Bit32u port, Bit8u data)
 {
     port &= 3;
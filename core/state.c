@@ -44,6 +44,15 @@ int state_load(unsigned char *state)
 
   /* signature check (GENPLUS-GX x.x.x) */
   char version[17];
+
+#ifdef USE_THREAD_CONTEXT
+  /* sound chips are emulated by the context replaying sound logs */
+  if (sound_log)
+  {
+    return 0;
+  }
+#endif
+
   load_param(version,16);
   version[16] = 0;
   if (memcmp(version,STATE_VERSION,11))
@@ -197,6 +206,15 @@ int state_save(unsigned char *state)
 
   /* version string */
   char version[16];
+
+#ifdef USE_THREAD_CONTEXT
+  /* sound chips are emulated by the context replaying sound logs */
+  if (sound_log)
+  {
+    return 0;
+  }
+#endif
+
   memcpy(version,STATE_VERSION,16);
   save_param(version, 16);
 
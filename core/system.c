@@ -43,17 +43,23 @@
 #include "eq.h"
 
 /* Global variables */
-t_bitmap bitmap;
-t_snd snd;
-uint32 mcycles_vdp;
-uint8 system_hw;
-uint8 system_bios;
-uint32 system_clock;
-int16 SVP_cycles = 800; 
-
-static uint8 pause_b;
-static EQSTATE eq[2];
-static int16 llp,rrp;
+CTX_LOCAL t_bitmap bitmap;
+CTX_LOCAL t_snd snd;
+CTX_LOCAL uint32 mcycles_vdp;
+CTX_LOCAL uint8 system_hw;
+CTX_LOCAL uint8 system_bios;
+CTX_LOCAL uint32 system_clock;
+CTX_LOCAL int16 SVP_cycles = 800; 
+CTX_LOCAL uint8 system_skip;
+
+static CTX_LOCAL uint8 *ahead_state;
+static CTX_LOCAL uint8 *ahead_vram;
+static CTX_LOCAL m68ki_cpu_core ahead_m68k;
+static CTX_LOCAL Z80_Regs ahead_z80;
+
+static CTX_LOCAL uint8 pause_b;
+static CTX_LOCAL EQSTATE eq[2];
+static CTX_LOCAL int16 llp,rrp;
 
 /******************************************************************************************/
 /* Audio subsystem                                                                        */
@@ -151,6 +157,12 @@ void audio_set_rate(int samplerate, double framerate)
 void audio_reset(void)
 {
   int i;
+
+  /* audio output is held when restoring speculative frames */
+  if (system_skip)
+  {
+    return;
+  }
   
   /* Clear blip buffers */
   for (i=0; i<3; i++)
@@ -195,6 +207,14 @@ int audio_update(int16 *buffer)
   /* run sound chips until end of frame */
   int size = sound_update(mcycles_vdp);
 
+#ifdef USE_THREAD_CONTEXT
+  /* samples are output by the context replaying sound log */
+  if (sound_log)
+  {
+    return 0;
+  }
+#endif
+
   /* Mega CD sound hardware enabled ? */
   if (snd.blips[1] && snd.blips[2])
   {
@@ -313,6 +333,9 @@ void system_init(void)
   vdp_init();
   render_init();
   sound_init();
+#ifdef USE_PROFILER
+  profiler_reset();
+#endif
 }
 
 void system_reset(void)
@@ -330,6 +353,8 @@ void system_frame_gen(int do_skip)
   /* line counters */
   int start, end, line;
 
+  PROFILE_FRAME_START();
+
   /* reset frame cycle counter */
   mcycles_vdp = 0;
 
@@ -665,6 +690,8 @@ void system_frame_gen(int do_skip)
   m68k.cycles -= mcycles_vdp;
   Z80.cycles -= mcycles_vdp;
   dma_endCycles = 0;
+
+  PROFILE_FRAME_END();
 }
 
 void system_frame_scd(int do_skip)
@@ -672,6 +699,8 @@ void system_frame_scd(int do_skip)
   /* line counters */
   int start, end, line;
 
+  PROFILE_FRAME_START();
+
   /* reset frame cycle counter */
   mcycles_vdp = 0;
   scd.cycles = 0;
@@ -993,6 +1022,8 @@ void system_frame_scd(int do_skip)
   m68k.cycles -= mcycles_vdp;
   Z80.cycles -= mcycles_vdp;
   dma_endCycles = 0;
+
+  PROFILE_FRAME_END();
 }
 
 void system_frame_sms(int do_skip)
@@ -1000,6 +1031,8 @@ void system_frame_sms(int do_skip)
   /* line counter */
   int start, end, line;
 
+  PROFILE_FRAME_START();
+
   /* reset frame cycle count */
   mcycles_vdp = 0;
 
@@ -1399,4 +1432,124 @@ void system_frame_sms(int do_skip)
   /* adjust timings for next frame */
   input_end_frame(mcycles_vdp);
   Z80.cycles -= mcycles_vdp;
+
+  PROFILE_FRAME_END();
+}
+
+/* Run-ahead: runs frames from current state with audio output disabled (sound chips  */
+/* state is still updated) and only last frame rendered, then restores current state. */
+/* Current frame is expected to have been run (without rendering) and its audio read  */
+/* with audio_update(). Display and audio output are left unchanged by state restore. */
+/* Inputs are refreshed as usual on each frame, they should not change meanwhile.     */
+/* Calling it with 0 frames releases the state buffer. Returns 0 if not supported.    */
+int system_run_ahead(int frames)
+{
+  t_bitmap display;
+  void (*cache_update)(int index);
+  int i, size;
+
+  if (frames <= 0)
+  {
+    free(ahead_state);
+    free(ahead_vram);
+    ahead_state = ahead_vram = NULL;
+    return 0;
+  }
+
+  /* Mega CD PCM & CD-DA are synchronized with audio output */
+  if (system_hw == SYSTEM_MCD)
+  {
+    return 0;
+  }
+
+#ifdef USE_THREAD_CONTEXT
+  /* sound chips state is not up to date while sound logs are recorded */
+  if (sound_log)
+  {
+    return 0;
+  }
+#endif
+
+  if (!ahead_state)
+  {
+    ahead_state = malloc(STATE_SIZE + sizeof(sram.sram));
+    ahead_vram = malloc(sizeof(vram));
+    if (!ahead_state || !ahead_vram)
+    {
+      system_run_ahead(0);
+      return 0;
+    }
+  }
+
+  /* save current state (display area and some CPU internals are not part of it) */
+  size = state_save(ahead_state);
+
+  /* battery RAM & EEPROM are not either, speculative frames must not write to them */
+  if (sram.on)
+  {
+    memcpy(ahead_state + size, sram.sram, sizeof(sram.sram));
+  }
+  display = bitmap;
+  ahead_m68k = m68k;
+  ahead_z80 = Z80;
+
+  system_skip = 1;
+
+  for (i=1; i<=frames; i++)
+  {
+    if ((system_hw & SYSTEM_PBC) == SYSTEM_MD)
+    {
+      system_frame_gen(i < frames);
+    }
+    else
+    {
+      system_frame_sms(i < frames);
+    }
+
+    /* run sound chips until end of frame */
+    sound_update(mcycles_vdp);
+  }
+
+  /* pattern cache is kept, bring it up to date with VRAM */
+  if (bg_list_index)
+  {
+    update_bg_pattern_cache(bg_list_index);
+    bg_list_index = 0;
+  }
+  memcpy(ahead_vram, vram, sizeof(vram));
+  cache_update = update_bg_pattern_cache;
+
+  /* restore current state */
+  state_load(ahead_state);
+  if (sram.on)
+  {
+    memcpy(sram.sram, ahead_state + size, sizeof(sram.sram));
+  }
+  bitmap.viewport = display.viewport;
+  m68k = ahead_m68k;
+  Z80 = ahead_z80;
+
+  /* only invalidate patterns modified by speculative frames (unless cache format has changed) */
+  if (update_bg_pattern_cache == cache_update)
+  {
+    memset(bg_name_dirty, 0, sizeof(bg_name_dirty));
+    bg_list_index = 0;
+
+    for (i=0; i<sizeof(vram); i+=4)
+    {
+      if (*(uint32 *)&vram[i] != *(uint32 *)&ahead_vram[i])
+      {
+        int name = i >> 5;
+        if (bg_name_dirty[name] == 0)
+        {
+          bg_name_list[bg_list_index++] = name;
+        }
+        bg_name_dirty[name] |= (1 << ((i >> 2) & 7));
+      }
+    }
+  }
+
+  system_skip = 0;
+
+  return 1;
 }
@@ -96,13 +96,17 @@ typedef struct
 } t_snd;
 
 /* Global variables */
-extern t_bitmap bitmap;
-extern t_snd snd;
-extern uint32 mcycles_vdp;
-extern int16 SVP_cycles; 
-extern uint8 system_hw;
-extern uint8 system_bios;
-extern uint32 system_clock;
+/* With USE_THREAD_CONTEXT, these and all other mutable emulator state are thread-local and
+   each thread runs its own console. load_rom, audio_init and system_init also build look-up
+   tables shared by all threads, so they must not run concurrently, frames can. */
+extern CTX_LOCAL t_bitmap bitmap;
+extern CTX_LOCAL t_snd snd;
+extern CTX_LOCAL uint32 mcycles_vdp;
+extern CTX_LOCAL int16 SVP_cycles; 
+extern CTX_LOCAL uint8 system_hw;
+extern CTX_LOCAL uint8 system_bios;
+extern CTX_LOCAL uint32 system_clock;
+extern CTX_LOCAL uint8 system_skip;
 
 /* Function prototypes */
 extern int audio_init(int samplerate, double framerate);
@@ -116,5 +120,6 @@ extern void system_reset(void);
 extern void system_frame_gen(int do_skip);
 extern void system_frame_scd(int do_skip);
 extern void system_frame_sms(int do_skip);
+extern int system_run_ahead(int frames);
 
 #endif /* _SYSTEM_H_ */
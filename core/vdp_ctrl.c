@@ -64,51 +64,51 @@
 #define HBLANK_H40_END_MCYCLE   (872)
 
 /* VDP context */
-uint8 ALIGNED_(4) sat[0x400];     /* Internal copy of sprite attribute table */
-uint8 ALIGNED_(4) vram[0x10000];  /* Video RAM (64K x 8-bit) */
-uint8 ALIGNED_(4) cram[0x80];     /* On-chip color RAM (64 x 9-bit) */
-uint8 ALIGNED_(4) vsram[0x80];    /* On-chip vertical scroll RAM (40 x 11-bit) */
-uint8 reg[0x20];                  /* Internal VDP registers (23 x 8-bit) */
-uint8 hint_pending;               /* 0= Line interrupt is pending */
-uint8 vint_pending;               /* 1= Frame interrupt is pending */
-uint16 status;                    /* VDP status flags */
-uint32 dma_length;                /* DMA remaining length */
-uint32 dma_endCycles;             /* DMA end cycle */
-uint8 dma_type;                   /* DMA mode */
+CTX_LOCAL uint8 ALIGNED_(4) sat[0x400];     /* Internal copy of sprite attribute table */
+CTX_LOCAL uint8 ALIGNED_(4) vram[0x10000];  /* Video RAM (64K x 8-bit) */
+CTX_LOCAL uint8 ALIGNED_(4) cram[0x80];     /* On-chip color RAM (64 x 9-bit) */
+CTX_LOCAL uint8 ALIGNED_(4) vsram[0x80];    /* On-chip vertical scroll RAM (40 x 11-bit) */
+CTX_LOCAL uint8 reg[0x20];                  /* Internal VDP registers (23 x 8-bit) */
+CTX_LOCAL uint8 hint_pending;               /* 0= Line interrupt is pending */
+CTX_LOCAL uint8 vint_pending;               /* 1= Frame interrupt is pending */
+CTX_LOCAL uint16 status;                    /* VDP status flags */
+CTX_LOCAL uint32 dma_length;                /* DMA remaining length */
+CTX_LOCAL uint32 dma_endCycles;             /* DMA end cycle */
+CTX_LOCAL uint8 dma_type;                   /* DMA mode */
 
 /* Global variables */
-uint16 ntab;                      /* Name table A base address */
-uint16 ntbb;                      /* Name table B base address */
-uint16 ntwb;                      /* Name table W base address */
-uint16 satb;                      /* Sprite attribute table base address */
-uint16 hscb;                      /* Horizontal scroll table base address */
-uint8 bg_name_dirty[0x800];       /* 1= This pattern is dirty */
-uint16 bg_name_list[0x800];       /* List of modified pattern indices */
-uint16 bg_list_index;             /* # of modified patterns in list */
-uint8 hscroll_mask;               /* Horizontal Scrolling line mask */
-uint8 playfield_shift;            /* Width of planes A, B (in bits) */
-uint8 playfield_col_mask;         /* Playfield column mask */
-uint16 playfield_row_mask;        /* Playfield row mask */
-uint16 vscroll;                   /* Latched vertical scroll value */
-uint8 odd_frame;                  /* 1: odd field, 0: even field */
-uint8 im2_flag;                   /* 1= Interlace mode 2 is being used */
-uint8 interlaced;                 /* 1: Interlaced mode 1 or 2 */
-uint8 vdp_pal;                    /* 1: PAL , 0: NTSC (default) */
-uint8 h_counter;                  /* Horizontal counter */
-uint16 v_counter;                 /* Vertical counter */
-uint16 vc_max;                    /* Vertical counter overflow value */
-uint16 lines_per_frame;           /* PAL: 313 lines, NTSC: 262 lines */
-uint16 max_sprite_pixels;         /* Max. sprites pixels per line (parsing & rendering) */
-uint32 fifo_cycles[4];            /* VDP FIFO read-out cycles */
-uint32 hvc_latch;                 /* latched HV counter */
-uint32 vint_cycle;                /* VINT occurence cycle */
-const uint8 *hctab;               /* pointer to H Counter table */
+CTX_LOCAL uint16 ntab;                      /* Name table A base address */
+CTX_LOCAL uint16 ntbb;                      /* Name table B base address */
+CTX_LOCAL uint16 ntwb;                      /* Name table W base address */
+CTX_LOCAL uint16 satb;                      /* Sprite attribute table base address */
+CTX_LOCAL uint16 hscb;                      /* Horizontal scroll table base address */
+CTX_LOCAL uint8 bg_name_dirty[0x800];       /* 1= This pattern is dirty */
+CTX_LOCAL uint16 bg_name_list[0x800];       /* List of modified pattern indices */
+CTX_LOCAL uint16 bg_list_index;             /* # of modified patterns in list */
+CTX_LOCAL uint8 hscroll_mask;               /* Horizontal Scrolling line mask */
+CTX_LOCAL uint8 playfield_shift;            /* Width of planes A, B (in bits) */
+CTX_LOCAL uint8 playfield_col_mask;         /* Playfield column mask */
+CTX_LOCAL uint16 playfield_row_mask;        /* Playfield row mask */
+CTX_LOCAL uint16 vscroll;                   /* Latched vertical scroll value */
+CTX_LOCAL uint8 odd_frame;                  /* 1: odd field, 0: even field */
+CTX_LOCAL uint8 im2_flag;                   /* 1= Interlace mode 2 is being used */
+CTX_LOCAL uint8 interlaced;                 /* 1: Interlaced mode 1 or 2 */
+CTX_LOCAL uint8 vdp_pal;                    /* 1: PAL , 0: NTSC (default) */
+CTX_LOCAL uint8 h_counter;                  /* Horizontal counter */
+CTX_LOCAL uint16 v_counter;                 /* Vertical counter */
+CTX_LOCAL uint16 vc_max;                    /* Vertical counter overflow value */
+CTX_LOCAL uint16 lines_per_frame;           /* PAL: 313 lines, NTSC: 262 lines */
+CTX_LOCAL uint16 max_sprite_pixels;         /* Max. sprites pixels per line (parsing & rendering) */
+CTX_LOCAL uint32 fifo_cycles[4];            /* VDP FIFO read-out cycles */
+CTX_LOCAL uint32 hvc_latch;                 /* latched HV counter */
+CTX_LOCAL uint32 vint_cycle;                /* VINT occurence cycle */
+CTX_LOCAL const uint8 *hctab;               /* pointer to H Counter table */
 
 /* Function pointers */
-void (*vdp_68k_data_w)(unsigned int data);
-void (*vdp_z80_data_w)(unsigned int data);
-unsigned int (*vdp_68k_data_r)(void);
-unsigned int (*vdp_z80_data_r)(void);
+CTX_LOCAL void (*vdp_68k_data_w)(unsigned int data);
+CTX_LOCAL void (*vdp_z80_data_w)(unsigned int data);
+CTX_LOCAL unsigned int (*vdp_68k_data_r)(void);
+CTX_LOCAL unsigned int (*vdp_z80_data_r)(void);
 
 /* Function prototypes */
 static void vdp_68k_data_w_m4(unsigned int data);
@@ -136,26 +136,26 @@ static const uint8 shift_table[]        = { 6, 7, 0, 8 };
 static const uint8 col_mask_table[]     = { 0x0F, 0x1F, 0x0F, 0x3F };
 static const uint16 row_mask_table[]    = { 0x0FF, 0x1FF, 0x2FF, 0x3FF };
 
-static uint8 border;            /* Border color index */
-static uint8 pending;           /* Pending write flag */
-static uint8 code;              /* Code register */
-static uint16 addr;             /* Address register */
-static uint16 addr_latch;       /* Latched A15, A14 of address */
-static uint16 sat_base_mask;    /* Base bits of SAT */
-static uint16 sat_addr_mask;    /* Index bits of SAT */
-static uint16 dma_src;          /* DMA source address */
-static int dmafill;             /* DMA Fill pending flag */
-static int cached_write;        /* 2nd part of 32-bit CTRL port write (Genesis mode) or LSB of CRAM data (Game Gear mode) */
-static uint16 fifo[4];          /* FIFO ring-buffer */
-static int fifo_idx;            /* FIFO write index */
-static int fifo_byte_access;    /* FIFO byte access flag */
-static int *fifo_timing;        /* FIFO slots timing table */
-static int hblank_start_cycle;  /* HBLANK flag set cycle */
-static int hblank_end_cycle;    /* HBLANK flag clear cycle */
+static CTX_LOCAL uint8 border;            /* Border color index */
+static CTX_LOCAL uint8 pending;           /* Pending write flag */
+static CTX_LOCAL uint8 code;              /* Code register */
+static CTX_LOCAL uint16 addr;             /* Address register */
+static CTX_LOCAL uint16 addr_latch;       /* Latched A15, A14 of address */
+static CTX_LOCAL uint16 sat_base_mask;    /* Base bits of SAT */
+static CTX_LOCAL uint16 sat_addr_mask;    /* Index bits of SAT */
+static CTX_LOCAL uint16 dma_src;          /* DMA source address */
+static CTX_LOCAL int dmafill;             /* DMA Fill pending flag */
+static CTX_LOCAL int cached_write;        /* 2nd part of 32-bit CTRL port write (Genesis mode) or LSB of CRAM data (Game Gear mode) */
+static CTX_LOCAL uint16 fifo[4];          /* FIFO ring-buffer */
+static CTX_LOCAL int fifo_idx;            /* FIFO write index */
+static CTX_LOCAL int fifo_byte_access;    /* FIFO byte access flag */
+static CTX_LOCAL int *fifo_timing;        /* FIFO slots timing table */
+static CTX_LOCAL int hblank_start_cycle;  /* HBLANK flag set cycle */
+static CTX_LOCAL int hblank_end_cycle;    /* HBLANK flag clear cycle */
 
  /* set Z80 or 68k interrupt lines */
-static void (*set_irq_line)(unsigned int level);
-static void (*set_irq_line_delay)(unsigned int level);
+static CTX_LOCAL void (*set_irq_line)(unsigned int level);
+static CTX_LOCAL void (*set_irq_line_delay)(unsigned int level);
 
 /* Vertical counter overflow values (see hvc.h) */
 static const uint16 vc_table[4][2] = 
@@ -523,6 +523,22 @@ int vdp_context_load(uint8 *state)
     {
       vdp_reg_w(i, temp_reg[i], 0);
     }
+
+    /* interlaced modes (otherwise only updated on next frame, which would reset field status flag) */
+    interlaced = (reg[12] & 0x02) >> 1;
+    im2_flag = ((reg[12] & 0x06) == 0x06);
+    if (interlaced)
+    {
+      /* video mode has changed */
+      bitmap.viewport.changed |= 5;
+
+      /* update rendering mode */
+      if (im2_flag && (reg[1] & 0x04))
+      {
+        render_bg = (reg[11] & 0x04) ? render_bg_m5_im2_vs : render_bg_m5_im2;
+        render_obj = (reg[12] & 0x08) ? render_obj_m5_im2_ste : render_obj_m5_im2;
+      }
+    }
   }
 
   load_param(&addr, sizeof(addr));
@@ -550,6 +566,12 @@ int vdp_context_load(uint8 *state)
     status = (status & ~1) | vdp_pal;
   }
 
+  /* restore even/odd field flag (interlaced modes) */
+  if (interlaced)
+  {
+    odd_frame = (status >> 4) & 1;
+  }
+
   if (reg[1] & 0x04)
   {
     /* Mode 5 */
@@ -619,6 +641,8 @@ void vdp_dma_update(unsigned int cycles)
   */
   unsigned int rate = dma_timing[(status & 8) || !(reg[1] & 0x40)][reg[12] & 1];
 
+  PROFILE_ENTER(PROF_DMA);
+
   /* Adjust for 68k bus DMA to VRAM (one word = 2 access) or DMA Copy (one read + one write = 2 access) */
   rate = rate >> (dma_type & 1);
   
@@ -701,6 +725,7 @@ void vdp_dma_update(unsigned int cycles)
   {
     /* Update DMA length */
     dma_length -= dma_bytes;
+    PROFILE_COUNT(dma_bytes, dma_bytes);
 
     /* Process DMA operation */
     dma_func[reg[23] >> 4](dma_bytes);
@@ -727,6 +752,8 @@ void vdp_dma_update(unsigned int cycles)
       zstate &= ~4;
     }
   }
+
+  PROFILE_LEAVE();
 }
 
 
@@ -2162,7 +2189,7 @@ static void vdp_bus_w(unsigned int data)
       }
 
 #ifdef HOOK_CPU
-      if (cpu_hook)
+      if (CPU_HOOK_ACTIVE(HOOK_VRAM_W))
         cpu_hook(HOOK_VRAM_W, 2, addr, data);
 #endif
 
@@ -2211,7 +2238,7 @@ static void vdp_bus_w(unsigned int data)
       }
 
 #ifdef HOOK_CPU
-      if (cpu_hook)
+      if (CPU_HOOK_ACTIVE(HOOK_CRAM_W))
         cpu_hook(HOOK_CRAM_W, 2, addr, data);
 #endif
 
@@ -2237,7 +2264,7 @@ static void vdp_bus_w(unsigned int data)
       }
 
 #ifdef HOOK_CPU
-      if (cpu_hook)
+      if (CPU_HOOK_ACTIVE(HOOK_VSRAM_W))
         cpu_hook(HOOK_VSRAM_W, 2, addr, data);
 #endif
 
@@ -2448,7 +2475,7 @@ static unsigned int vdp_68k_data_r_m5(void)
       data = *(uint16 *)&vram[addr & 0xFFFE];
 
 #ifdef HOOK_CPU
-      if (cpu_hook)
+      if (CPU_HOOK_ACTIVE(HOOK_VRAM_R))
         cpu_hook(HOOK_VRAM_R, 2, addr, data);
 #endif
 
@@ -2477,7 +2504,7 @@ static unsigned int vdp_68k_data_r_m5(void)
       data |= (fifo[fifo_idx] & ~0x7FF);
 
 #ifdef HOOK_CPU
-      if (cpu_hook)
+      if (CPU_HOOK_ACTIVE(HOOK_VSRAM_R))
         cpu_hook(HOOK_VSRAM_R, 2, addr, data);
 #endif
 
@@ -2499,7 +2526,7 @@ static unsigned int vdp_68k_data_r_m5(void)
       data |= (fifo[fifo_idx] & ~0xEEE);
 
 #ifdef HOOK_CPU
-      if (cpu_hook)
+      if (CPU_HOOK_ACTIVE(HOOK_CRAM_R))
         cpu_hook(HOOK_CRAM_R, 2, addr, data);
 #endif
 
@@ -2518,7 +2545,7 @@ static unsigned int vdp_68k_data_r_m5(void)
       data |= (fifo[fifo_idx] & ~0xFF);
 
 #ifdef HOOK_CPU
-      if (cpu_hook)
+      if (CPU_HOOK_ACTIVE(HOOK_VRAM_R))
         cpu_hook(HOOK_VRAM_R, 2, addr, data);
 #endif
 
@@ -3112,6 +3139,11 @@ static void vdp_dma_copy(unsigned int length)
       /* Update pattern cache */
       MARK_BG_DIRTY(addr);
 
+#ifdef HOOK_CPU
+      if (CPU_HOOK_ACTIVE(HOOK_VRAM_W))
+        cpu_hook(HOOK_VRAM_W, 1, addr ^ 1, data);
+#endif
+
       /* Increment VRAM source address */
       source++;
 
@@ -3153,6 +3185,11 @@ static void vdp_dma_fill(unsigned int length)
         /* Update pattern cache */
         MARK_BG_DIRTY (addr);
 
+#ifdef HOOK_CPU
+        if (CPU_HOOK_ACTIVE(HOOK_VRAM_W))
+          cpu_hook(HOOK_VRAM_W, 1, addr ^ 1, data);
+#endif
+
         /* Increment VRAM address */
         addr += reg[15];
       }
@@ -3195,6 +3232,11 @@ static void vdp_dma_fill(unsigned int length)
             color_update_m5(0x00, data);
           }
         }
+
+#ifdef HOOK_CPU
+        if (CPU_HOOK_ACTIVE(HOOK_CRAM_W))
+          cpu_hook(HOOK_CRAM_W, 2, addr, data);
+#endif
           
         /* Increment CRAM address */
         addr += reg[15];
@@ -3212,6 +3254,11 @@ static void vdp_dma_fill(unsigned int length)
       {
         /* Write VSRAM data */
         *(uint16 *)&vsram[addr & 0x7E] = data;
+
+#ifdef HOOK_CPU
+        if (CPU_HOOK_ACTIVE(HOOK_VSRAM_W))
+          cpu_hook(HOOK_VSRAM_W, 2, addr, data);
+#endif
           
         /* Increment VSRAM address */
         addr += reg[15];
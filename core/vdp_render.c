@@ -66,6 +66,18 @@ extern sms_ntsc_t *sms_ntsc;
 #define PIXEL_OUT_T uint16
 #endif
 
+/* SIMD pixel remapping (15, 16 or 32-bit pixels, define NO_SIMD_REMAP to disable) */
+#if !defined(NO_SIMD_REMAP) && !defined(USE_8BPP_RENDERING)
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIMD_REMAP
+#define SIMD_REMAP_NEON
+#elif defined(HAVE_X86_SIMD)
+#include <immintrin.h>
+#define SIMD_REMAP
+#endif
+#endif
+
 
 /* Pixel priority look-up tables information */
 #define LUT_MAX     (6)
@@ -118,6 +130,12 @@ INLINE void WRITE_LONG(void *address, uint32 data)
 #endif  /* ALIGN_LONG */
 
 
+/* Flipped pattern variants are expanded when first used (key = VH + pattern name) */
+#define PATTERN_M4(KEY) \
+  if (!bg_pattern_ready[KEY]) expand_pattern_m4(KEY);
+#define PATTERN_M5(KEY) \
+  if (!bg_pattern_ready[KEY]) expand_pattern_m5(KEY);
+
 /* Draw 2-cell column (8-pixels high) */
 /*
    Pattern cache base address: VHN NNNNNNNN NNYYYxxx
@@ -130,9 +148,11 @@ INLINE void WRITE_LONG(void *address, uint32 data)
 */
 #define GET_LSB_TILE(ATTR, LINE) \
   atex = atex_table[(ATTR >> 13) & 7]; \
+  PATTERN_M5(ATTR & 0x1FFF) \
   src = (uint32 *)&bg_pattern_cache[(ATTR & 0x00001FFF) << 6 | (LINE)];
 #define GET_MSB_TILE(ATTR, LINE) \
   atex = atex_table[(ATTR >> 29) & 7]; \
+  PATTERN_M5((ATTR >> 16) & 0x1FFF) \
   src = (uint32 *)&bg_pattern_cache[(ATTR & 0x1FFF0000) >> 10 | (LINE)];
 
 /* Draw 2-cell column (16 pixels high) */
@@ -147,9 +167,13 @@ INLINE void WRITE_LONG(void *address, uint32 data)
 */
 #define GET_LSB_TILE_IM2(ATTR, LINE) \
   atex = atex_table[(ATTR >> 13) & 7]; \
+  PATTERN_M5(((ATTR & 0x03FF) << 1) | (ATTR & 0x1800)) \
+  PATTERN_M5(((ATTR & 0x03FF) << 1) | (ATTR & 0x1800) | 1) \
   src = (uint32 *)&bg_pattern_cache[((ATTR & 0x000003FF) << 7 | (ATTR & 0x00001800) << 6 | (LINE)) ^ ((ATTR & 0x00001000) >> 6)];
 #define GET_MSB_TILE_IM2(ATTR, LINE) \
   atex = atex_table[(ATTR >> 29) & 7]; \
+  PATTERN_M5(((ATTR >> 15) & 0x07FE) | ((ATTR >> 16) & 0x1800)) \
+  PATTERN_M5(((ATTR >> 15) & 0x07FE) | ((ATTR >> 16) & 0x1800) | 1) \
   src = (uint32 *)&bg_pattern_cache[((ATTR & 0x03FF0000) >> 9 | (ATTR & 0x18000000) >> 10 | (LINE)) ^ ((ATTR & 0x10000000) >> 22)];
 
 /*
@@ -494,7 +518,7 @@ INLINE void WRITE_LONG(void *address, uint32 data)
 #endif
 
 /* Window & Plane A clipping */
-static struct clip_t
+static CTX_LOCAL struct clip_t
 {
   uint8 left;
   uint8 right;
@@ -562,7 +586,20 @@ static const uint32 tms_palette[16] =
 #endif
 
 /* Cached and flipped patterns */
-static uint8 ALIGNED_(4) bg_pattern_cache[0x80000];
+static CTX_LOCAL uint8 ALIGNED_(4) bg_pattern_cache[0x80000];
+
+/* Flipped pattern variants up to date in pattern cache (VH + pattern name) */
+static CTX_LOCAL uint8 bg_pattern_ready[0x2000];
+
+/* Pattern cache statistics */
+static CTX_LOCAL pattern_cache_stats_t cache_stats;
+
+#ifndef BUILD_TABLES
+
+/* Sprite pattern name offset, bitplane to packed pixel and layer priority look-up tables */
+#include "vdp_render_tables.h"
+
+#else
 
 /* Sprite pattern name offset look-up table (Mode 5) */
 static uint8 name_lut[0x400];
@@ -573,16 +610,18 @@ static uint32 bp_lut[0x10000];
 /* Layer priority pixel look-up tables */
 static uint8 lut[LUT_MAX][LUT_SIZE];
 
-/* Output pixel data look-up tables*/
-static PIXEL_OUT_T pixel[0x100];
+#endif
+
+/* Output pixel data look-up tables (one extra entry for 32-bit gathers of 16-bit pixels) */
+static CTX_LOCAL PIXEL_OUT_T pixel[0x100 + 1];
 static PIXEL_OUT_T pixel_lut[3][0x200];
 static PIXEL_OUT_T pixel_lut_m4[0x40];
 
 /* Background & Sprite line buffers */
-static uint8 linebuf[2][0x200];
+static CTX_LOCAL uint8 linebuf[2][0x200];
 
 /* Sprite limit flag */
-static uint8 spr_ovr;
+static CTX_LOCAL uint8 spr_ovr;
 
 /* Sprite parsing lists */
 typedef struct
@@ -593,20 +632,27 @@ typedef struct
   uint16 size;
 } object_info_t;
 
-static object_info_t obj_info[2][MAX_SPRITES_PER_LINE];
+static CTX_LOCAL object_info_t obj_info[2][MAX_SPRITES_PER_LINE];
 
 /* Sprite Counter */
-static uint8 object_count[2];
+static CTX_LOCAL uint8 object_count[2];
 
 /* Sprite Collision Info */
-uint16 spr_col;
+CTX_LOCAL uint16 spr_col;
 
 /* Function pointers */
-void (*render_bg)(int line);
-void (*render_obj)(int line);
-void (*parse_satb)(int line);
-void (*update_bg_pattern_cache)(int index);
+CTX_LOCAL void (*render_bg)(int line);
+CTX_LOCAL void (*render_obj)(int line);
+CTX_LOCAL void (*parse_satb)(int line);
+CTX_LOCAL void (*update_bg_pattern_cache)(int index);
+
+static int output_row(int line);
+static void output_line(int line);
+static void expand_pattern_m4(int key);
+static void expand_pattern_m5(int key);
+
 
+#ifdef BUILD_TABLES
 
 /*--------------------------------------------------------------------------*/
 /* Sprite pattern name offset look-up table function (Mode 5)               */
@@ -947,12 +993,14 @@ static uint32 make_lut_bgobj_m4(uint32 bx, uint32 sx)
   return (c | 0x80);
 }
 
+#endif /* BUILD_TABLES */
+
 
 /*--------------------------------------------------------------------------*/
 /* Pixel layer merging function                                             */
 /*--------------------------------------------------------------------------*/
 
-INLINE void merge(uint8 *srca, uint8 *srcb, uint8 *dst, uint8 *table, int width)
+INLINE void merge(uint8 *srca, uint8 *srcb, uint8 *dst, const uint8 *table, int width)
 {
   do
   {
@@ -1491,6 +1539,7 @@ void render_bg_m4(int line)
     atex = atex_table[(attr >> 11) & 3];
 
     /* Cached pattern data line (4 bytes = 4 pixels at once) */
+    PATTERN_M4(attr & 0x7FF)
     src = (uint32 *)&bg_pattern_cache[((attr & 0x7FF) << 6) | (v_line)];
 
     /* Copy left & right half, adding the attribute bits in */
@@ -2501,7 +2550,7 @@ void render_bg_m5(int line)
   int width = bitmap.viewport.w >> 4;
 
   /* Layer priority table */
-  uint8 *table = lut[(reg[12] & 8) >> 2];
+  const uint8 *table = lut[(reg[12] & 8) >> 2];
 
   /* Window vertical range (cell 0-31) */
   int a = (reg[18] & 0x1F) << 3;
@@ -2659,7 +2708,7 @@ void render_bg_m5_vs(int line)
   int width = bitmap.viewport.w >> 4;
 
   /* Layer priority table */
-  uint8 *table = lut[(reg[12] & 8) >> 2];
+  const uint8 *table = lut[(reg[12] & 8) >> 2];
 
   /* Window vertical range (cell 0-31) */
   int a = (reg[18] & 0x1F) << 3;
@@ -2856,7 +2905,7 @@ void render_bg_m5_vs_enhanced(int line)
   int width = bitmap.viewport.w >> 4;
 
   /* Layer priority table */
-  uint8 *table = lut[(reg[12] & 8) >> 2];
+  const uint8 *table = lut[(reg[12] & 8) >> 2];
 
   /* Window vertical range (cell 0-31) */
   int a = (reg[18] & 0x1F) << 3;
@@ -3192,7 +3241,7 @@ void render_bg_m5_im2(int line)
   int width = bitmap.viewport.w >> 4;
 
   /* Layer priority table */
-  uint8 *table = lut[(reg[12] & 8) >> 2];
+  const uint8 *table = lut[(reg[12] & 8) >> 2];
 
   /* Window vertical range (cell 0-31) */
   int a = (reg[18] & 0x1F) << 3;
@@ -3351,7 +3400,7 @@ void render_bg_m5_im2_vs(int line)
   int width = bitmap.viewport.w >> 4;
 
   /* Layer priority table */
-  uint8 *table = lut[(reg[12] & 8) >> 2];
+  const uint8 *table = lut[(reg[12] & 8) >> 2];
 
   /* Window vertical range (cell 0-31) */
   uint32 a = (reg[18] & 0x1F) << 3;
@@ -3707,6 +3756,7 @@ void render_obj_m4(int line)
     temp = (object_info->attr | 0x100) & sg_mask;
 
     /* Pointer to pattern cache line */
+    PATTERN_M4(temp)
     src = (uint8 *)&bg_pattern_cache[(temp << 6) | (object_info->ypos << 3)];
 
     /* Sprite X position */
@@ -3789,7 +3839,8 @@ void render_obj_m5(int line)
   int masked = 0;
   int max_pixels = MODE5_MAX_SPRITE_PIXELS;
 
-  uint8 *src, *s, *lb;
+  uint8 *src, *lb;
+  const uint8 *s;
   uint32 temp, v_line;
   uint32 attr, name, atex;
 
@@ -3868,6 +3919,7 @@ void render_obj_m5(int line)
       for (column = 0; column < width; column++, lb+=8)
       {
         temp = attr | ((name + s[column]) & 0x07FF);
+        PATTERN_M5(temp)
         src = &bg_pattern_cache[(temp << 6) | (v_line)];
         DRAW_SPRITE_TILE(8,atex,lut[1])
       }
@@ -3899,7 +3951,8 @@ void render_obj_m5_ste(int line)
   int masked = 0;
   int max_pixels = MODE5_MAX_SPRITE_PIXELS;
 
-  uint8 *src, *s, *lb;
+  uint8 *src, *lb;
+  const uint8 *s;
   uint32 temp, v_line;
   uint32 attr, name, atex;
 
@@ -3980,6 +4033,7 @@ void render_obj_m5_ste(int line)
       for (column = 0; column < width; column++, lb+=8)
       {
         temp = attr | ((name + s[column]) & 0x07FF);
+        PATTERN_M5(temp)
         src = &bg_pattern_cache[(temp << 6) | (v_line)];
         DRAW_SPRITE_TILE(8,atex,lut[3])
       }
@@ -4018,7 +4072,8 @@ void render_obj_m5_im2(int line)
   int odd = odd_frame;
   int max_pixels = MODE5_MAX_SPRITE_PIXELS;
 
-  uint8 *src, *s, *lb;
+  uint8 *src, *lb;
+  const uint8 *s;
   uint32 temp, v_line;
   uint32 attr, name, atex;
 
@@ -4096,6 +4151,8 @@ void render_obj_m5_im2(int line)
       for(column = 0; column < width; column ++, lb+=8)
       {
         temp = attr | (((name + s[column]) & 0x3ff) << 1);
+        PATTERN_M5(temp)
+        PATTERN_M5(temp | 1)
         src = &bg_pattern_cache[((temp << 6) | (v_line)) ^ ((attr & 0x1000) >> 6)];
         DRAW_SPRITE_TILE(8,atex,lut[1])
       }
@@ -4128,7 +4185,8 @@ void render_obj_m5_im2_ste(int line)
   int odd = odd_frame;
   int max_pixels = MODE5_MAX_SPRITE_PIXELS;
 
-  uint8 *src, *s, *lb;
+  uint8 *src, *lb;
+  const uint8 *s;
   uint32 temp, v_line;
   uint32 attr, name, atex;
 
@@ -4209,6 +4267,8 @@ void render_obj_m5_im2_ste(int line)
       for(column = 0; column < width; column ++, lb+=8)
       {
         temp = attr | (((name + s[column]) & 0x3ff) << 1);
+        PATTERN_M5(temp)
+        PATTERN_M5(temp | 1)
         src = &bg_pattern_cache[((temp << 6) | (v_line)) ^ ((attr & 0x1000) >> 6)];
         DRAW_SPRITE_TILE(8,atex,lut[3])
       }
@@ -4516,114 +4576,125 @@ void parse_satb_m5(int line)
 void update_bg_pattern_cache_m4(int index)
 {
   int i;
-  uint8 x, y, c;
-  uint8 *dst;
-  uint16 name, bp01, bp23;
-  uint32 bp;
+  uint16 name;
 
   for(i = 0; i < index; i++)
   {
     /* Get modified pattern name index */
-    name = bg_name_list[i];
-
-    /* Pattern cache base address */
-    dst = &bg_pattern_cache[name << 6];
-
-    /* Check modified lines */
-    for(y = 0; y < 8; y++)
-    {
-      if(bg_name_dirty[name] & (1 << y))
-      {
-        /* Byteplane data */
-        bp01 = *(uint16 *)&vram[(name << 5) | (y << 2) | (0)];
-        bp23 = *(uint16 *)&vram[(name << 5) | (y << 2) | (2)];
-
-        /* Convert to pixel line data (4 bytes = 8 pixels)*/
-        /* (msb) p7p6 p5p4 p3p2 p1p0 (lsb) */
-        bp = (bp_lut[bp01] >> 2) | (bp_lut[bp23]);
+    name = bg_name_list[i] & 0x1FF;
 
-        /* Update cached line (8 pixels = 8 bytes) */
-        for(x = 0; x < 8; x++)
-        {
-          /* Extract pixel data */
-          c = bp & 0x0F;
-
-          /* Pattern cache data (one pattern = 8 bytes) */
-          /* byte0 <-> p0 p1 p2 p3 p4 p5 p6 p7 <-> byte7 (hflip = 0) */
-          /* byte0 <-> p7 p6 p5 p4 p3 p2 p1 p0 <-> byte7 (hflip = 1) */
-          dst[0x00000 | (y << 3) | (x)] = (c);            /* vflip=0 & hflip=0 */
-          dst[0x08000 | (y << 3) | (x ^ 7)] = (c);        /* vflip=0 & hflip=1 */
-          dst[0x10000 | ((y ^ 7) << 3) | (x)] = (c);      /* vflip=1 & hflip=0 */
-          dst[0x18000 | ((y ^ 7) << 3) | (x ^ 7)] = (c);  /* vflip=1 & hflip=1 */
-
-          /* Next pixel */
-          bp = bp >> 4;
-        }
-      }
-    }
+    /* Flipped variants are expanded again when next used */
+    bg_pattern_ready[name] = 0;
+    bg_pattern_ready[name | 0x200] = 0;
+    bg_pattern_ready[name | 0x400] = 0;
+    bg_pattern_ready[name | 0x600] = 0;
 
     /* Clear modified pattern flag */
-    bg_name_dirty[name] = 0;
+    bg_name_dirty[bg_name_list[i]] = 0;
   }
+
+  cache_stats.invalidated += index;
 }
 
 void update_bg_pattern_cache_m5(int index)
 {
   int i;
-  uint8 x, y, c;
-  uint8 *dst;
   uint16 name;
-  uint32 bp;
 
   for(i = 0; i < index; i++)
   {
     /* Get modified pattern name index */
     name = bg_name_list[i];
 
-    /* Pattern cache base address */
-    dst = &bg_pattern_cache[name << 6];
+    /* Flipped variants are expanded again when next used */
+    bg_pattern_ready[name] = 0;
+    bg_pattern_ready[name | 0x0800] = 0;
+    bg_pattern_ready[name | 0x1000] = 0;
+    bg_pattern_ready[name | 0x1800] = 0;
 
-    /* Check modified lines */
-    for(y = 0; y < 8; y ++)
+    /* Clear modified pattern flag */
+    bg_name_dirty[name] = 0;
+  }
+
+  cache_stats.invalidated += index;
+}
+
+/* Key = VH + pattern name (9 bits) */
+static void expand_pattern_m4(int key)
+{
+  int x, y;
+  uint8 *dst = &bg_pattern_cache[key << 6];
+  uint8 *src = &vram[(key & 0x1FF) << 5];
+  int yflip = (key & 0x400) ? 7 : 0;
+  int xflip = (key & 0x200) ? 7 : 0;
+  uint16 bp01, bp23;
+  uint32 bp;
+
+  for(y = 0; y < 8; y++)
+  {
+    /* Byteplane data */
+    bp01 = *(uint16 *)&src[(y << 2) | (0)];
+    bp23 = *(uint16 *)&src[(y << 2) | (2)];
+
+    /* Convert to pixel line data (4 bytes = 8 pixels)*/
+    /* (msb) p7p6 p5p4 p3p2 p1p0 (lsb) */
+    bp = (bp_lut[bp01] >> 2) | (bp_lut[bp23]);
+
+    /* Pattern cache data (one pattern = 8 bytes) */
+    /* byte0 <-> p0 p1 p2 p3 p4 p5 p6 p7 <-> byte7 (hflip = 0) */
+    /* byte0 <-> p7 p6 p5 p4 p3 p2 p1 p0 <-> byte7 (hflip = 1) */
+    for(x = 0; x < 8; x++)
     {
-      if(bg_name_dirty[name] & (1 << y))
-      {
-        /* Byteplane data (one pattern = 4 bytes) */
-        /* LIT_ENDIAN: byte0 (lsb) p2p3 p0p1 p6p7 p4p5 (msb) byte3 */
-        /* BIG_ENDIAN: byte0 (msb) p0p1 p2p3 p4p5 p6p7 (lsb) byte3 */
-        bp = *(uint32 *)&vram[(name << 5) | (y << 2)];
+      dst[((y ^ yflip) << 3) | (x ^ xflip)] = bp & 0x0F;
+      bp = bp >> 4;
+    }
+  }
 
-        /* Update cached line (8 pixels = 8 bytes) */
-        for(x = 0; x < 8; x ++)
-        {
-          /* Extract pixel data */
-          c = bp & 0x0F;
+  bg_pattern_ready[key] = 1;
+  cache_stats.expanded++;
+}
 
-          /* Pattern cache data (one pattern = 8 bytes) */
-          /* byte0 <-> p0 p1 p2 p3 p4 p5 p6 p7 <-> byte7 (hflip = 0) */
-          /* byte0 <-> p7 p6 p5 p4 p3 p2 p1 p0 <-> byte7 (hflip = 1) */
+/* Key = VH + pattern name (11 bits) */
+static void expand_pattern_m5(int key)
+{
+  int x, y;
+  uint8 *dst = &bg_pattern_cache[key << 6];
+  uint8 *src = &vram[(key & 0x7FF) << 5];
+  int yflip = (key & 0x1000) ? 7 : 0;
 #ifdef LSB_FIRST
-          /* Byteplane data = (msb) p4p5 p6p7 p0p1 p2p3 (lsb) */
-          dst[0x00000 | (y << 3) | (x ^ 3)] = (c);        /* vflip=0, hflip=0 */
-          dst[0x20000 | (y << 3) | (x ^ 4)] = (c);        /* vflip=0, hflip=1 */
-          dst[0x40000 | ((y ^ 7) << 3) | (x ^ 3)] = (c);  /* vflip=1, hflip=0 */
-          dst[0x60000 | ((y ^ 7) << 3) | (x ^ 4)] = (c);  /* vflip=1, hflip=1 */
+  /* Byteplane data = (msb) p4p5 p6p7 p0p1 p2p3 (lsb) */
+  int xflip = (key & 0x800) ? 4 : 3;
 #else
-          /* Byteplane data = (msb) p0p1 p2p3 p4p5 p6p7 (lsb) */
-          dst[0x00000 | (y << 3) | (x ^ 7)] = (c);        /* vflip=0, hflip=0 */
-          dst[0x20000 | (y << 3) | (x)] = (c);            /* vflip=0, hflip=1 */
-          dst[0x40000 | ((y ^ 7) << 3) | (x ^ 7)] = (c);  /* vflip=1, hflip=0 */
-          dst[0x60000 | ((y ^ 7) << 3) | (x)] = (c);      /* vflip=1, hflip=1 */
+  /* Byteplane data = (msb) p0p1 p2p3 p4p5 p6p7 (lsb) */
+  int xflip = (key & 0x800) ? 0 : 7;
 #endif
-          /* Next pixel */
-          bp = bp >> 4;
-        }
-      }
-    }
+  uint32 bp;
 
-    /* Clear modified pattern flag */
-    bg_name_dirty[name] = 0;
+  for(y = 0; y < 8; y++)
+  {
+    /* Byteplane data (one pattern = 4 bytes) */
+    /* LIT_ENDIAN: byte0 (lsb) p2p3 p0p1 p6p7 p4p5 (msb) byte3 */
+    /* BIG_ENDIAN: byte0 (msb) p0p1 p2p3 p4p5 p6p7 (lsb) byte3 */
+    bp = *(uint32 *)&src[y << 2];
+
+    /* Pattern cache data (one pattern = 8 bytes) */
+    /* byte0 <-> p0 p1 p2 p3 p4 p5 p6 p7 <-> byte7 (hflip = 0) */
+    /* byte0 <-> p7 p6 p5 p4 p3 p2 p1 p0 <-> byte7 (hflip = 1) */
+    for(x = 0; x < 8; x++)
+    {
+      dst[((y ^ yflip) << 3) | (x ^ xflip)] = bp & 0x0F;
+      bp = bp >> 4;
+    }
   }
+
+  bg_pattern_ready[key] = 1;
+  cache_stats.expanded++;
+}
+
+void render_get_cache_stats(pattern_cache_stats_t *stats)
+{
+  *stats = cache_stats;
+  memset(&cache_stats, 0, sizeof(cache_stats));
 }
 
 
@@ -4676,12 +4747,410 @@ void window_clip(unsigned int data, unsigned int sw)
 }
 
 
+#ifdef USE_THREAD_CONTEXT
+
+/*--------------------------------------------------------------------------*/
+/* Deferred rendering (render lists)                                        */
+/*--------------------------------------------------------------------------*/
+
+/* Render list commands */
+#define CMD_RESET   0   /* render_reset() */
+#define CMD_SYNC    1   /* VRAM, line buffer & sprite masking state */
+#define CMD_STATE   2   /* VDP registers & derived state */
+#define CMD_VSRAM   3   /* VSRAM */
+#define CMD_PIXEL   4   /* output pixel palette */
+#define CMD_PATTERN 5   /* modified VRAM pattern (32 bytes) */
+#define CMD_LINE    6   /* render_line() with its sprite list & sprite masking state */
+#define CMD_BLANK   7   /* blank_line() */
+#define CMD_REMAP   8   /* remap_line() */
+
+typedef struct
+{
+  uint8 type;
+  uint8 mask;       /* CMD_PATTERN: modified rows, CMD_LINE: sprite overflow on previous line */
+  uint16 index;     /* CMD_PATTERN: pattern name, CMD_LINE: sprite count */
+  int line;
+} render_cmd_t;
+
+/* VDP state used by line rendering functions, apart from VRAM, VSRAM & palette */
+typedef struct
+{
+  void (*render_bg)(int line);
+  void (*render_obj)(int line);
+  void (*update_bg_pattern_cache)(int index);
+  int viewport[4];
+  uint8 reg[0x20];
+  uint16 ntab, ntbb, ntwb, hscb;
+  uint16 playfield_row_mask;
+  uint16 vscroll;
+  uint16 lines_per_frame;
+  uint16 max_sprite_pixels;
+  uint8 hscroll_mask, playfield_shift, playfield_col_mask;
+  uint8 odd_frame, im2_flag, interlaced;
+  uint8 system_hw;
+  struct clip_t clip[2];
+} render_state_t;
+
+/* Render list being recorded, NULL when rendering inline */
+static CTX_LOCAL render_list_t *record_list;
+
+/* 1: lines are also rendered inline (validation) */
+static CTX_LOCAL int record_inline;
+
+/* 1: next command is preceded by a full state copy */
+static CTX_LOCAL int record_sync;
+
+/* Framebuffer rows rendered by this context when replaying: (row / 8) % replay_bands == replay_band */
+static CTX_LOCAL int replay_band;
+static CTX_LOCAL int replay_bands;
+
+/* Last state written to render lists */
+static CTX_LOCAL render_state_t record_state;
+static CTX_LOCAL uint8 record_vsram[sizeof(vsram)];
+static CTX_LOCAL PIXEL_OUT_T record_pixel[0x100];
+
+static void *record_cmd(int type, int line, int size)
+{
+  render_list_t *list = record_list;
+  render_cmd_t *cmd;
+
+  /* keep commands 8-byte aligned */
+  size = (size + 7) & ~7;
+
+  if (list->size + sizeof(render_cmd_t) + size > list->alloc)
+  {
+    list->alloc = (list->alloc + sizeof(render_cmd_t) + size) * 2;
+    list->data = realloc(list->data, list->alloc);
+  }
+
+  cmd = (render_cmd_t *)(list->data + list->size);
+  cmd->type = type;
+  cmd->mask = 0;
+  cmd->index = 0;
+  cmd->line = line;
+  list->size += sizeof(render_cmd_t) + size;
+  return cmd + 1;
+}
+
+static void record_changes(void)
+{
+  render_state_t state;
+
+  if (record_sync)
+  {
+    uint8 *data = record_cmd(CMD_SYNC, 0, sizeof(vram) + sizeof(linebuf) + 4);
+    memcpy(data, vram, sizeof(vram));
+    memcpy(data + sizeof(vram), linebuf, sizeof(linebuf));
+    data[sizeof(vram) + sizeof(linebuf)] = spr_ovr;
+  }
+
+  memset(&state, 0, sizeof(state));
+  state.render_bg = render_bg;
+  state.render_obj = render_obj;
+  state.update_bg_pattern_cache = update_bg_pattern_cache;
+  state.viewport[0] = bitmap.viewport.x;
+  state.viewport[1] = bitmap.viewport.y;
+  state.viewport[2] = bitmap.viewport.w;
+  state.viewport[3] = bitmap.viewport.h;
+  memcpy(state.reg, reg, sizeof(reg));
+  state.ntab = ntab;
+  state.ntbb = ntbb;
+  state.ntwb = ntwb;
+  state.hscb = hscb;
+  state.playfield_row_mask = playfield_row_mask;
+  state.vscroll = vscroll;
+  state.lines_per_frame = lines_per_frame;
+  state.max_sprite_pixels = max_sprite_pixels;
+  state.hscroll_mask = hscroll_mask;
+  state.playfield_shift = playfield_shift;
+  state.playfield_col_mask = playfield_col_mask;
+  state.odd_frame = odd_frame;
+  state.im2_flag = im2_flag;
+  state.interlaced = interlaced;
+  state.system_hw = system_hw;
+  memcpy(state.clip, clip, sizeof(clip));
+
+  if (record_sync || memcmp(&state, &record_state, sizeof(state)))
+  {
+    record_state = state;
+    memcpy(record_cmd(CMD_STATE, 0, sizeof(state)), &state, sizeof(state));
+  }
+
+  if (record_sync || memcmp(vsram, record_vsram, sizeof(vsram)))
+  {
+    memcpy(record_vsram, vsram, sizeof(vsram));
+    memcpy(record_cmd(CMD_VSRAM, 0, sizeof(vsram)), vsram, sizeof(vsram));
+  }
+
+  if (record_sync || memcmp(pixel, record_pixel, sizeof(record_pixel)))
+  {
+    memcpy(record_pixel, pixel, sizeof(record_pixel));
+    memcpy(record_cmd(CMD_PIXEL, 0, sizeof(record_pixel)), pixel, sizeof(record_pixel));
+  }
+
+  record_sync = 0;
+}
+
+static void record_line(int line)
+{
+  render_cmd_t *cmd;
+  int i, count = 0;
+
+  record_changes();
+
+  if (reg[1] & 0x40)
+  {
+    /* Patterns modified since last rendered line, before the pattern cache update clears the list */
+    for (i = 0; i < bg_list_index; i++)
+    {
+      int name = bg_name_list[i];
+      cmd = (render_cmd_t *)record_cmd(CMD_PATTERN, 0, 32) - 1;
+      cmd->index = name;
+      cmd->mask = bg_name_dirty[name];
+      memcpy(cmd + 1, &vram[name << 5], 32);
+    }
+
+    /* Sprites are parsed by emulation, render list only holds the result */
+    count = object_count[line & 1];
+  }
+
+  cmd = (render_cmd_t *)record_cmd(CMD_LINE, line, count * sizeof(object_info_t)) - 1;
+  cmd->index = count;
+  cmd->mask = spr_ovr;
+  memcpy(cmd + 1, obj_info[line & 1], count * sizeof(object_info_t));
+}
+
+/* Rendering side effects on emulation, when lines are only recorded */
+static void record_line_status(int line)
+{
+  if (reg[1] & 0x40)
+  {
+    /* Update pattern cache */
+    if (bg_list_index)
+    {
+      update_bg_pattern_cache(bg_list_index);
+      bg_list_index = 0;
+    }
+
+    /* Sprite collision & masking do not depend on background pixels */
+    memset(linebuf[0], 0, sizeof(linebuf[0]));
+    render_obj(line & 1);
+
+    /* Parse sprites for next line */
+    if (line < (bitmap.viewport.h - 1))
+    {
+      parse_satb(line);
+    }
+  }
+}
+
+static void parse_satb_none(int line)
+{
+}
+
+void render_list_record(render_list_t *list, int validate)
+{
+  /* Lines recorded so far are rendered with the state at the end of the list */
+  if (record_list)
+  {
+    record_changes();
+  }
+  else
+  {
+    record_sync = 1;
+  }
+
+  if (list)
+  {
+    list->size = 0;
+  }
+
+  record_list = list;
+  record_inline = validate;
+}
+
+/* Checks if line is output to a framebuffer row rendered by this context */
+static int replay_line(int line)
+{
+  int row = output_row(line);
+
+  /* Lines that are not output only matter to the first band */
+  if (row < 0)
+  {
+    return (replay_band == 0);
+  }
+
+  return (((row >> 3) % replay_bands) == replay_band);
+}
+
+void render_list_replay(const render_list_t *list)
+{
+  render_list_replay_band(list, 0, 1);
+}
+
+void render_list_replay_band(const render_list_t *list, int band, int bands)
+{
+  const uint8 *data = list->data;
+  const uint8 *end = data + list->size;
+
+  /* Sprite lists are recorded */
+  parse_satb = parse_satb_none;
+
+  replay_band = band;
+  replay_bands = bands;
+
+  while (data < end)
+  {
+    const render_cmd_t *cmd = (const render_cmd_t *)data;
+    const uint8 *payload = (const uint8 *)(cmd + 1);
+    int size = 0;
+
+    switch (cmd->type)
+    {
+      case CMD_RESET:
+      {
+        render_reset();
+        break;
+      }
+
+      case CMD_SYNC:
+      {
+        int name;
+
+        memcpy(vram, payload, sizeof(vram));
+        memcpy(linebuf, payload + sizeof(vram), sizeof(linebuf));
+        spr_ovr = payload[sizeof(vram) + sizeof(linebuf)];
+
+        /* Rebuild whole pattern cache */
+        for (name = 0; name < 0x800; name++)
+        {
+          bg_name_list[name] = name;
+          bg_name_dirty[name] = 0xFF;
+        }
+        bg_list_index = 0x800;
+
+        size = sizeof(vram) + sizeof(linebuf) + 4;
+        break;
+      }
+
+      case CMD_STATE:
+      {
+        const render_state_t *state = (const render_state_t *)payload;
+
+        render_bg = state->render_bg;
+        render_obj = state->render_obj;
+        update_bg_pattern_cache = state->update_bg_pattern_cache;
+        bitmap.viewport.x = state->viewport[0];
+        bitmap.viewport.y = state->viewport[1];
+        bitmap.viewport.w = state->viewport[2];
+        bitmap.viewport.h = state->viewport[3];
+        memcpy(reg, state->reg, sizeof(reg));
+        ntab = state->ntab;
+        ntbb = state->ntbb;
+        ntwb = state->ntwb;
+        hscb = state->hscb;
+        playfield_row_mask = state->playfield_row_mask;
+        vscroll = state->vscroll;
+        lines_per_frame = state->lines_per_frame;
+        max_sprite_pixels = state->max_sprite_pixels;
+        hscroll_mask = state->hscroll_mask;
+        playfield_shift = state->playfield_shift;
+        playfield_col_mask = state->playfield_col_mask;
+        odd_frame = state->odd_frame;
+        im2_flag = state->im2_flag;
+        interlaced = state->interlaced;
+        system_hw = state->system_hw;
+        memcpy(clip, state->clip, sizeof(clip));
+
+        size = sizeof(render_state_t);
+        break;
+      }
+
+      case CMD_VSRAM:
+      {
+        memcpy(vsram, payload, sizeof(vsram));
+        size = sizeof(vsram);
+        break;
+      }
+
+      case CMD_PIXEL:
+      {
+        memcpy(pixel, payload, sizeof(record_pixel));
+        size = sizeof(record_pixel);
+        break;
+      }
+
+      case CMD_PATTERN:
+      {
+        int name = cmd->index;
+
+        memcpy(&vram[name << 5], payload, 32);
+        if (bg_name_dirty[name] == 0)
+        {
+          bg_name_list[bg_list_index++] = name;
+        }
+        bg_name_dirty[name] |= cmd->mask;
+
+        size = 32;
+        break;
+      }
+
+      case CMD_LINE:
+      {
+        size = cmd->index * sizeof(object_info_t);
+        if (replay_line(cmd->line))
+        {
+          memcpy(obj_info[cmd->line & 1], payload, size);
+          object_count[cmd->line & 1] = cmd->index;
+          spr_ovr = cmd->mask;
+          render_line(cmd->line);
+        }
+        break;
+      }
+
+      case CMD_BLANK:
+      {
+        const int *area = (const int *)payload;
+        if (replay_line(cmd->line))
+        {
+          blank_line(cmd->line, area[0], area[1]);
+        }
+        size = 2 * sizeof(int);
+        break;
+      }
+
+      case CMD_REMAP:
+      {
+        if (replay_line(cmd->line))
+        {
+          remap_line(cmd->line);
+        }
+        break;
+      }
+    }
+
+    data = payload + ((size + 7) & ~7);
+  }
+
+  replay_bands = 0;
+}
+
+void render_list_free(render_list_t *list)
+{
+  free(list->data);
+  list->data = NULL;
+  list->size = list->alloc = 0;
+}
+
+#endif /* USE_THREAD_CONTEXT */
+
 /*--------------------------------------------------------------------------*/
 /* Init, reset routines                                                     */
 /*--------------------------------------------------------------------------*/
 
 void render_init(void)
 {
+#ifdef BUILD_TABLES
   int bx, ax;
 
   /* Initialize layers priority pixel look-up tables */
@@ -4701,20 +5170,57 @@ void render_init(void)
     }
   }
 
-  /* Initialize pixel color look-up tables */
-  palette_init();
-
   /* Make sprite pattern name index look-up table (Mode 5) */
   make_name_lut();
 
   /* Make bitplane to pixel look-up table (Mode 4) */
   make_bp_lut();
+#endif
+
+  /* Initialize pixel color look-up tables */
+  palette_init();
+
+  /* Select fastest pixel remapping kernels supported by the CPU */
+  if (!render_set_remap(REMAP_AVX2) && !render_set_remap(REMAP_SSE2) && !render_set_remap(REMAP_NEON))
+  {
+    render_set_remap(REMAP_SCALAR);
+  }
 }
 
 void render_reset(void)
 {
-  /* Clear display bitmap */
-  memset(bitmap.data, 0, bitmap.pitch * bitmap.height);
+#ifdef USE_THREAD_CONTEXT
+  if (record_list)
+  {
+    record_cmd(CMD_RESET, 0, 0);
+    record_sync = 1;
+  }
+#endif
+
+  /* Display bitmap & pattern cache are kept when restoring speculative frames */
+  if (!system_skip)
+  {
+#ifdef USE_THREAD_CONTEXT
+    /* Framebuffer is shared with other bands: only clear rows rendered by this context */
+    if (replay_bands > 1)
+    {
+      int row;
+      for (row = 0; row < bitmap.height; row++)
+      {
+        if (((row >> 3) % replay_bands) == replay_band)
+        {
+          memset(&bitmap.data[row * bitmap.pitch], 0, bitmap.pitch);
+        }
+      }
+    }
+    else
+#endif
+    /* Clear display bitmap */
+    memset(bitmap.data, 0, bitmap.pitch * bitmap.height);
+
+    /* Clear pattern cache */
+    memset (bg_pattern_ready, 0, sizeof (bg_pattern_ready));
+  }
 
   /* Clear line buffers */
   memset(linebuf, 0, sizeof(linebuf));
@@ -4722,9 +5228,6 @@ void render_reset(void)
   /* Clear color palettes */
   memset(pixel, 0, sizeof(pixel));
 
-  /* Clear pattern cache */
-  memset ((char *) bg_pattern_cache, 0, sizeof (bg_pattern_cache));
-
   /* Reset Sprite infos */
   spr_ovr = spr_col = object_count[0] = object_count[1] = 0;
 }
@@ -4736,6 +5239,21 @@ void render_reset(void)
 
 void render_line(int line)
 {
+  PROFILE_ENTER_SAMPLED(PROF_RENDER);
+
+#ifdef USE_THREAD_CONTEXT
+  if (record_list)
+  {
+    record_line(line);
+    if (!record_inline)
+    {
+      record_line_status(line);
+      PROFILE_LEAVE_SAMPLED(PROF_RENDER);
+      return;
+    }
+  }
+#endif
+
   /* Check display status */
   if (reg[1] & 0x40)
   {
@@ -4792,28 +5310,405 @@ void render_line(int line)
   }
 
   /* Pixel color remapping */
-  remap_line(line);
+  output_line(line);
+
+  PROFILE_LEAVE_SAMPLED(PROF_RENDER);
 }
 
 void blank_line(int line, int offset, int width)
 {
+#ifdef USE_THREAD_CONTEXT
+  if (record_list)
+  {
+    int *area;
+    record_changes();
+    area = record_cmd(CMD_BLANK, line, 2 * sizeof(int));
+    area[0] = offset;
+    area[1] = width;
+    if (!record_inline) return;
+  }
+#endif
+
   memset(&linebuf[0][0x20 + offset], 0x40, width);
-  remap_line(line);
+  output_line(line);
+}
+
+/*--------------------------------------------------------------------------*/
+/* Pixel remapping kernels                                                  */
+/*--------------------------------------------------------------------------*/
+
+static void remap_copy_c(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width)
+{
+  do
+  {
+    *dst++ = table[*src++];
+  }
+  while (--width);
+}
+
+static void remap_lcd_c(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width, int rate)
+{
+  do
+  {
+    RENDER_PIXEL_LCD(src,dst,table,rate);
+  }
+  while (--width);
+}
+
+/* Selected kernels (same for all threads) */
+static void (*remap_copy)(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width) = remap_copy_c;
+static void (*remap_lcd)(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width, int rate) = remap_lcd_c;
+
+#ifdef SIMD_REMAP
+
+/* LCD filter: each color channel is increased by (rate * decay) >> 8 when it is darker than the old one,  */
+/* the positive part of the decay is obtained with unsigned saturated subtraction, so results are exactly */
+/* the same as RENDER_PIXEL_LCD. 16-bit pixels are split into 5/6-bit channels, 32-bit pixels into bytes. */
+#if defined(USE_15BPP_RENDERING)
+#define LCD_R_SHIFT 10
+#define LCD_G_MASK  0x1f
+#define LCD_ALPHA   0x8000
+#elif defined(USE_16BPP_RENDERING)
+#define LCD_R_SHIFT 11
+#define LCD_G_MASK  0x3f
+#define LCD_ALPHA   0x0000
+#else
+#define LCD_ALPHA   0xff000000
+#endif
+
+#if defined(SIMD_REMAP_NEON)
+
+#if defined(USE_32BPP_RENDERING)
+static void remap_lcd_neon(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width, int rate)
+{
+  uint32 ALIGNED_(16) in[4];
+  uint8x8_t k = vdup_n_u8(rate);
+  uint32x4_t alpha = vdupq_n_u32(LCD_ALPHA);
+
+  while (width >= 4)
+  {
+    uint8x16_t pix, old, decay;
+    uint16x8_t lo, hi;
+
+    in[0] = table[src[0]];
+    in[1] = table[src[1]];
+    in[2] = table[src[2]];
+    in[3] = table[src[3]];
+    pix = vreinterpretq_u8_u32(vld1q_u32(in));
+    old = vreinterpretq_u8_u32(vld1q_u32(dst));
+
+    /* decay = max(old - pix, 0), pix += (rate * decay) >> 8 */
+    decay = vqsubq_u8(old, pix);
+    lo = vmull_u8(vget_low_u8(decay), k);
+    hi = vmull_u8(vget_high_u8(decay), k);
+    pix = vaddq_u8(pix, vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+
+    vst1q_u32(dst, vorrq_u32(vreinterpretq_u32_u8(pix), alpha));
+    src += 4;
+    dst += 4;
+    width -= 4;
+  }
+
+  if (width)
+  {
+    remap_lcd_c(src, dst, table, width, rate);
+  }
+}
+#else
+static void remap_lcd_neon(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width, int rate)
+{
+  uint16 ALIGNED_(16) in[8];
+  uint16x8_t k = vdupq_n_u16(rate);
+  uint16x8_t mask5 = vdupq_n_u16(0x1f);
+  uint16x8_t mask_g = vdupq_n_u16(LCD_G_MASK);
+  uint16x8_t alpha = vdupq_n_u16(LCD_ALPHA);
+
+  while (width >= 8)
+  {
+    uint16x8_t pix, old, r, g, b;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+      in[i] = table[src[i]];
+    }
+    pix = vld1q_u16(in);
+    old = vld1q_u16(dst);
+
+    /* decay = max(old - pix, 0), channel += (rate * decay) >> 8 */
+    r = vandq_u16(vshrq_n_u16(pix, LCD_R_SHIFT), mask5);
+    g = vandq_u16(vshrq_n_u16(pix, 5), mask_g);
+    b = vandq_u16(pix, mask5);
+    r = vaddq_u16(r, vshrq_n_u16(vmulq_u16(vqsubq_u16(vandq_u16(vshrq_n_u16(old, LCD_R_SHIFT), mask5), r), k), 8));
+    g = vaddq_u16(g, vshrq_n_u16(vmulq_u16(vqsubq_u16(vandq_u16(vshrq_n_u16(old, 5), mask_g), g), k), 8));
+    b = vaddq_u16(b, vshrq_n_u16(vmulq_u16(vqsubq_u16(vandq_u16(old, mask5), b), k), 8));
+
+    pix = vorrq_u16(vorrq_u16(vshlq_n_u16(r, LCD_R_SHIFT), vshlq_n_u16(g, 5)), vorrq_u16(b, alpha));
+    vst1q_u16(dst, pix);
+    src += 8;
+    dst += 8;
+    width -= 8;
+  }
+
+  if (width)
+  {
+    remap_lcd_c(src, dst, table, width, rate);
+  }
+}
+#endif
+
+#else
+
+/* x86 kernels are compiled for their own instruction set and only selected when the CPU supports it */
+#if defined(USE_32BPP_RENDERING)
+__attribute__((target("sse2")))
+static void remap_lcd_sse2(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width, int rate)
+{
+  __m128i k = _mm_set1_epi16(rate);
+  __m128i zero = _mm_setzero_si128();
+  __m128i alpha = _mm_set1_epi32((int)LCD_ALPHA);
+
+  while (width >= 4)
+  {
+    __m128i pix = _mm_set_epi32(table[src[3]], table[src[2]], table[src[1]], table[src[0]]);
+    __m128i old = _mm_loadu_si128((const __m128i *)dst);
+
+    /* decay = max(old - pix, 0), pix += (rate * decay) >> 8 */
+    __m128i decay = _mm_subs_epu8(old, pix);
+    __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(decay, zero), k), 8);
+    __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(decay, zero), k), 8);
+    pix = _mm_add_epi8(pix, _mm_packus_epi16(lo, hi));
+
+    _mm_storeu_si128((__m128i *)dst, _mm_or_si128(pix, alpha));
+    src += 4;
+    dst += 4;
+    width -= 4;
+  }
+
+  if (width)
+  {
+    remap_lcd_c(src, dst, table, width, rate);
+  }
+}
+
+__attribute__((target("avx2")))
+static void remap_copy_avx2(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width)
+{
+  while (width >= 8)
+  {
+    __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)src));
+    _mm256_storeu_si256((__m256i *)dst, _mm256_i32gather_epi32((const int *)table, index, 4));
+    src += 8;
+    dst += 8;
+    width -= 8;
+  }
+
+  if (width)
+  {
+    remap_copy_c(src, dst, table, width);
+  }
+}
+
+__attribute__((target("avx2")))
+static void remap_lcd_avx2(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width, int rate)
+{
+  __m256i k = _mm256_set1_epi16(rate);
+  __m256i zero = _mm256_setzero_si256();
+  __m256i alpha = _mm256_set1_epi32((int)LCD_ALPHA);
+
+  while (width >= 8)
+  {
+    __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)src));
+    __m256i pix = _mm256_i32gather_epi32((const int *)table, index, 4);
+    __m256i old = _mm256_loadu_si256((const __m256i *)dst);
+
+    /* decay = max(old - pix, 0), pix += (rate * decay) >> 8 */
+    __m256i decay = _mm256_subs_epu8(old, pix);
+    __m256i lo = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(decay, zero), k), 8);
+    __m256i hi = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(decay, zero), k), 8);
+    pix = _mm256_add_epi8(pix, _mm256_packus_epi16(lo, hi));
+
+    _mm256_storeu_si256((__m256i *)dst, _mm256_or_si256(pix, alpha));
+    src += 8;
+    dst += 8;
+    width -= 8;
+  }
+
+  if (width)
+  {
+    remap_lcd_c(src, dst, table, width, rate);
+  }
+}
+#else
+__attribute__((target("sse2")))
+static void remap_lcd_sse2(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width, int rate)
+{
+  __m128i k = _mm_set1_epi16(rate);
+  __m128i mask5 = _mm_set1_epi16(0x1f);
+  __m128i mask_g = _mm_set1_epi16(LCD_G_MASK);
+  __m128i alpha = _mm_set1_epi16((short)LCD_ALPHA);
+
+  while (width >= 8)
+  {
+    __m128i pix = _mm_setr_epi16(table[src[0]], table[src[1]], table[src[2]], table[src[3]],
+                                 table[src[4]], table[src[5]], table[src[6]], table[src[7]]);
+    __m128i old = _mm_loadu_si128((const __m128i *)dst);
+    __m128i r = _mm_and_si128(_mm_srli_epi16(pix, LCD_R_SHIFT), mask5);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(pix, 5), mask_g);
+    __m128i b = _mm_and_si128(pix, mask5);
+
+    /* decay = max(old - pix, 0), channel += (rate * decay) >> 8 */
+    r = _mm_add_epi16(r, _mm_srli_epi16(_mm_mullo_epi16(_mm_subs_epu16(_mm_and_si128(_mm_srli_epi16(old, LCD_R_SHIFT), mask5), r), k), 8));
+    g = _mm_add_epi16(g, _mm_srli_epi16(_mm_mullo_epi16(_mm_subs_epu16(_mm_and_si128(_mm_srli_epi16(old, 5), mask_g), g), k), 8));
+    b = _mm_add_epi16(b, _mm_srli_epi16(_mm_mullo_epi16(_mm_subs_epu16(_mm_and_si128(old, mask5), b), k), 8));
+
+    pix = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, LCD_R_SHIFT), _mm_slli_epi16(g, 5)), _mm_or_si128(b, alpha));
+    _mm_storeu_si128((__m128i *)dst, pix);
+    src += 8;
+    dst += 8;
+    width -= 8;
+  }
+
+  if (width)
+  {
+    remap_lcd_c(src, dst, table, width, rate);
+  }
+}
+
+/* 16-bit pixels are gathered as 32-bit words (see pixel table padding) then packed */
+__attribute__((target("avx2")))
+INLINE __m256i gather_pixels16(const uint8 *src, const PIXEL_OUT_T *table)
+{
+  __m256i mask = _mm256_set1_epi32(0xffff);
+  __m256i lo = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)src));
+  __m256i hi = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + 8)));
+  lo = _mm256_and_si256(_mm256_i32gather_epi32((const int *)table, lo, 2), mask);
+  hi = _mm256_and_si256(_mm256_i32gather_epi32((const int *)table, hi, 2), mask);
+  return _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);
+}
+
+__attribute__((target("avx2")))
+static void remap_copy_avx2(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width)
+{
+  while (width >= 16)
+  {
+    _mm256_storeu_si256((__m256i *)dst, gather_pixels16(src, table));
+    src += 16;
+    dst += 16;
+    width -= 16;
+  }
+
+  if (width)
+  {
+    remap_copy_c(src, dst, table, width);
+  }
+}
+
+__attribute__((target("avx2")))
+static void remap_lcd_avx2(const uint8 *src, PIXEL_OUT_T *dst, const PIXEL_OUT_T *table, int width, int rate)
+{
+  __m256i k = _mm256_set1_epi16(rate);
+  __m256i mask5 = _mm256_set1_epi16(0x1f);
+  __m256i mask_g = _mm256_set1_epi16(LCD_G_MASK);
+  __m256i alpha = _mm256_set1_epi16((short)LCD_ALPHA);
+
+  while (width >= 16)
+  {
+    __m256i pix = gather_pixels16(src, table);
+    __m256i old = _mm256_loadu_si256((const __m256i *)dst);
+    __m256i r = _mm256_and_si256(_mm256_srli_epi16(pix, LCD_R_SHIFT), mask5);
+    __m256i g = _mm256_and_si256(_mm256_srli_epi16(pix, 5), mask_g);
+    __m256i b = _mm256_and_si256(pix, mask5);
+
+    /* decay = max(old - pix, 0), channel += (rate * decay) >> 8 */
+    r = _mm256_add_epi16(r, _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_subs_epu16(_mm256_and_si256(_mm256_srli_epi16(old, LCD_R_SHIFT), mask5), r), k), 8));
+    g = _mm256_add_epi16(g, _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_subs_epu16(_mm256_and_si256(_mm256_srli_epi16(old, 5), mask_g), g), k), 8));
+    b = _mm256_add_epi16(b, _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_subs_epu16(_mm256_and_si256(old, mask5), b), k), 8));
+
+    pix = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(r, LCD_R_SHIFT), _mm256_slli_epi16(g, 5)), _mm256_or_si256(b, alpha));
+    _mm256_storeu_si256((__m256i *)dst, pix);
+    src += 16;
+    dst += 16;
+    width -= 16;
+  }
+
+  if (width)
+  {
+    remap_lcd_c(src, dst, table, width, rate);
+  }
+}
+#endif
+
+#endif /* SIMD_REMAP_NEON */
+
+#endif /* SIMD_REMAP */
+
+int render_set_remap(int kernel)
+{
+  switch (kernel)
+  {
+    case REMAP_SCALAR:
+      remap_copy = remap_copy_c;
+      remap_lcd = remap_lcd_c;
+      return 1;
+
+#if defined(SIMD_REMAP_NEON)
+    case REMAP_NEON:
+      remap_copy = remap_copy_c;
+      remap_lcd = remap_lcd_neon;
+      return 1;
+#elif defined(SIMD_REMAP)
+    case REMAP_SSE2:
+      if (!__builtin_cpu_supports("sse2")) break;
+      remap_copy = remap_copy_c;
+      remap_lcd = remap_lcd_sse2;
+      return 1;
+
+    case REMAP_AVX2:
+      if (!__builtin_cpu_supports("avx2")) break;
+      remap_copy = remap_copy_avx2;
+      remap_lcd = remap_lcd_avx2;
+      return 1;
+#endif
+  }
+
+  return 0;
+}
+
+void remap_pixels(const uint8 *src, void *dst, int width)
+{
+  if (config.lcd)
+  {
+    remap_lcd(src, (PIXEL_OUT_T *)dst, pixel, width, config.lcd);
+  }
+  else
+  {
+    remap_copy(src, (PIXEL_OUT_T *)dst, pixel, width);
+  }
 }
 
 void remap_line(int line)
 {
-  /* Line width */
-  int width = bitmap.viewport.w + 2*bitmap.viewport.x;
+#ifdef USE_THREAD_CONTEXT
+  if (record_list)
+  {
+    record_changes();
+    record_cmd(CMD_REMAP, line, 0);
+    if (!record_inline) return;
+  }
+#endif
 
-  /* Pixel line buffer */
-  uint8 *src = &linebuf[0][0x20 - bitmap.viewport.x];
+  output_line(line);
+}
 
+/* Framebuffer row of a rendered line, -1 if line is not displayed */
+static int output_row(int line)
+{
   /* Adjust line offset in framebuffer */
   line = (line + bitmap.viewport.y) % lines_per_frame;
 
   /* Take care of Game Gear reduced screen when overscan is disabled */
-  if (line < 0) return;
+  if (line < 0) return -1;
 
   /* Adjust for interlaced output */
   if (interlaced && config.render)
@@ -4821,6 +5716,21 @@ void remap_line(int line)
     line = (line * 2) + odd_frame;
   }
 
+  return line;
+}
+
+static void output_line(int line)
+{
+  /* Line width */
+  int width = bitmap.viewport.w + 2*bitmap.viewport.x;
+
+  /* Pixel line buffer */
+  uint8 *src = &linebuf[0][0x20 - bitmap.viewport.x];
+
+  /* Framebuffer row */
+  line = output_row(line);
+  if (line < 0) return;
+
 #if defined(USE_15BPP_RENDERING) || defined(USE_16BPP_RENDERING)
   /* NTSC Filter (only supported for 15 or 16-bit pixels rendering) */
   if (config.ntsc)
@@ -4841,23 +5751,7 @@ void remap_line(int line)
     CUSTOM_BLITTER(line, width, pixel, src)
 #else
     /* Convert VDP pixel data to output pixel format */
-    PIXEL_OUT_T *dst = ((PIXEL_OUT_T *)&bitmap.data[(line * bitmap.pitch)]);
-    if (config.lcd)
-    {
-      do
-      {
-        RENDER_PIXEL_LCD(src,dst,pixel,config.lcd);
-      }
-      while (--width);
-    }
-    else
-    {
-      do
-      {
-        *dst++ = pixel[*src++];
-      }
-      while (--width);
-    }
+    remap_pixels(src, &bitmap.data[(line * bitmap.pitch)], width);
  #endif
   }
 }
@@ -99,8 +99,34 @@
   *out++ = PIXEL(r,g,b); \
 }
 
+/* Pixel remapping kernels */
+#define REMAP_SCALAR 0
+#define REMAP_SSE2   1
+#define REMAP_AVX2   2
+#define REMAP_NEON   3
+
+/* Pattern cache statistics, counted since previous call to render_get_cache_stats() */
+typedef struct
+{
+  uint32 invalidated;   /* patterns invalidated by VRAM writes */
+  uint32 expanded;      /* flipped pattern variants expanded when used by renderer */
+} pattern_cache_stats_t;
+
+#ifdef USE_THREAD_CONTEXT
+/* Deferred rendering: lines are recorded with the VDP state they need, then rendered */
+/* by another thread (with its own context) while emulation goes on with next frame */
+/* Render lists can also be split between several threads sharing one framebuffer: */
+/* each one applies all state changes but only renders every n-th row of 8 pixels  */
+typedef struct
+{
+  uint8 *data;
+  int size;
+  int alloc;
+} render_list_t;
+#endif
+
 /* Global variables */
-extern uint16 spr_col;
+extern CTX_LOCAL uint16 spr_col;
 
 /* Function prototypes */
 extern void render_init(void);
@@ -108,6 +134,15 @@ extern void render_reset(void);
 extern void render_line(int line);
 extern void blank_line(int line, int offset, int width);
 extern void remap_line(int line);
+extern void remap_pixels(const uint8 *src, void *dst, int width);
+extern int render_set_remap(int kernel);
+extern void render_get_cache_stats(pattern_cache_stats_t *stats);
+#ifdef USE_THREAD_CONTEXT
+extern void render_list_record(render_list_t *list, int validate);
+extern void render_list_replay(const render_list_t *list);
+extern void render_list_replay_band(const render_list_t *list, int band, int bands);
+extern void render_list_free(render_list_t *list);
+#endif
 extern void window_clip(unsigned int data, unsigned int sw);
 extern void render_bg_m0(int line);
 extern void render_bg_m1(int line);
@@ -137,9 +172,9 @@ extern void color_update_m4(int index, unsigned int data);
 extern void color_update_m5(int index, unsigned int data);
 
 /* Function pointers */
-extern void (*render_bg)(int line);
-extern void (*render_obj)(int line);
-extern void (*parse_satb)(int line);
-extern void (*update_bg_pattern_cache)(int index);
+extern CTX_LOCAL void (*render_bg)(int line);
+extern CTX_LOCAL void (*render_obj)(int line);
+extern CTX_LOCAL void (*parse_satb)(int line);
+extern CTX_LOCAL void (*update_bg_pattern_cache)(int index);
 
 #endif /* _RENDER_H_ */
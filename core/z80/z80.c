@@ -209,18 +209,18 @@ UINT32 z80_cycle_ratio;
 #define USE_CYCLES(A) Z80.cycles += (A)
 #endif
 
-Z80_Regs Z80;
-UINT8 z80_last_fetch;
+CTX_LOCAL Z80_Regs Z80;
+CTX_LOCAL UINT8 z80_last_fetch;
 
-unsigned char *z80_readmap[64];
-unsigned char *z80_writemap[64];
+CTX_LOCAL unsigned char *z80_readmap[64];
+CTX_LOCAL unsigned char *z80_writemap[64];
 
-void (*z80_writemem)(unsigned int address, unsigned char data);
-unsigned char (*z80_readmem)(unsigned int address);
-void (*z80_writeport)(unsigned int port, unsigned char data);
-unsigned char (*z80_readport)(unsigned int port);
+CTX_LOCAL void (*z80_writemem)(unsigned int address, unsigned char data);
+CTX_LOCAL unsigned char (*z80_readmem)(unsigned int address);
+CTX_LOCAL void (*z80_writeport)(unsigned int port, unsigned char data);
+CTX_LOCAL unsigned char (*z80_readport)(unsigned int port);
 
-static UINT32 EA;
+static CTX_LOCAL UINT32 EA;
 
 static UINT8 SZ[256];       /* zero and sign flags */
 static UINT8 SZ_BIT[256];   /* zero, sign and parity/overflow (=zero) flags for BIT opcode */
@@ -3419,19 +3419,23 @@ void z80_reset(void)
  ****************************************************************************/
 void z80_run(unsigned int cycles)
 {
+  PROFILE_ENTER_SAMPLED(PROF_Z80);
+
   while( Z80.cycles < cycles )
   {
     /* check for IRQs before each instruction */
     if (Z80.irq_state && IFF1 && !Z80.after_ei)
     {
       take_interrupt();
-      if (Z80.cycles >= cycles) return;
+      if (Z80.cycles >= cycles) break;
     }
 
     Z80.after_ei = FALSE;
     R++;
     EXEC_INLINE(op,ROP());
   }
+
+  PROFILE_LEAVE_SAMPLED(PROF_Z80);
 } 
 
 /****************************************************************************
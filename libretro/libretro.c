@@ -3518,6 +3518,45 @@ void retro_reset(void)
    gen_reset(0);
 }
 
+#ifdef USE_PROFILER
+/* Logs the average time spent in each emulated subsystem, once per second of emulation */
+static void log_profile(void)
+{
+   static uint32 last_frame;
+   static uint32 frames;
+   static double time[PROF_MAX];
+   profile_frame_t profile[16];
+   char line[256];
+   int i, id, count, len;
+
+   while ((count = profiler_read(last_frame, profile, 16)) > 0)
+   {
+      for (i = 0; i < count; i++)
+      {
+         double us_per_tick = profile[i].frame_ticks ? profile[i].frame_ns / 1000.0 / profile[i].frame_ticks : 0;
+         for (id = 0; id < PROF_MAX; id++)
+            time[id] += profile[i].ticks[id] * us_per_tick;
+         last_frame = profile[i].frame;
+         frames++;
+      }
+   }
+
+   if (frames < 60)
+      return;
+
+   len = sprintf(line, "[genplus]: profile (us per frame):");
+   for (id = 0; id < PROF_MAX; id++)
+   {
+      len += sprintf(line + len, " %s %.0f", profiler_name(id), time[id] / frames);
+      time[id] = 0;
+   }
+   frames = 0;
+
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "%s\n", line);
+}
+#endif
+
 void retro_run(void) 
 {
    int do_skip = 0;
@@ -3652,6 +3691,10 @@ void retro_run(void)
    }
 
    audio_cb(soundbuffer, audio_update(soundbuffer));
+
+#ifdef USE_PROFILER
+   log_profile();
+#endif
 }
 
 #undef  CHUNKSIZE
@@ -0,0 +1,729 @@
+/*
+    genplus-headless kernel benchmarks (-b) --
+    Pixel remapping kernels supported by the CPU are timed (ns per line, with and without LCD
+    filter) and checked against the scalar one. Pixel format is the build one
+    (make -f Makefile.headless BPP=8, 15, 16 or 32).
+    Register write traces are played on the MAME YM2612 core (FM only) with each rendering
+    kernel and chip type, block kernels have to produce the same samples as sample by sample
+    rendering.
+    With HAVE_YM3438_CORE, the same traces are played on the Nuked YM3438 core clock by
+    clock and whole samples at once, both have to produce the same samples and chip state, and
+    the same samples as the unmodified core (reference hashes below).
+    Blip buffer kernels are timed (delta insertion and sample output) with PSG noise, high
+    quality FM and three buffer mixing workloads, and checked against the scalar kernel.
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <time.h>
+
+#include "shared.h"
+#include "bench.h"
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Pixel remapping benchmark: two frames of random pixels, remapped alternately so that LCD filter has work to do */
+#define BENCH_WIDTH  320
+#define BENCH_LINES  224
+#define BENCH_PASSES 500
+
+#if defined(USE_8BPP_RENDERING)
+#define BENCH_FORMAT "8bpp"
+#elif defined(USE_15BPP_RENDERING)
+#define BENCH_FORMAT "15bpp"
+#elif defined(USE_16BPP_RENDERING)
+#define BENCH_FORMAT "16bpp"
+#else
+#define BENCH_FORMAT "32bpp"
+#endif
+
+static double bench_kernel(const uint8 *src)
+{
+  int i, line;
+  double start = now();
+
+  for (i = 0; i < BENCH_PASSES; i++)
+  {
+    const uint8 *frame = src + (i & 1) * BENCH_LINES * BENCH_WIDTH;
+    for (line = 0; line < BENCH_LINES; line++)
+    {
+      remap_pixels(frame + line * BENCH_WIDTH, bitmap.data + line * bitmap.pitch, BENCH_WIDTH);
+    }
+  }
+
+  return (now() - start) * 1e9 / (BENCH_PASSES * BENCH_LINES);
+}
+
+/* Returns the number of kernels whose output differs from the scalar one */
+static int bench_remap(void)
+{
+  static const char *names[] = { "scalar", "sse2", "avx2", "neon" };
+  int size = BENCH_LINES * bitmap.pitch;
+  uint8 *src = malloc(2 * BENCH_LINES * BENCH_WIDTH);
+  uint8 *ref = malloc(2 * size);
+  int lcd = config.lcd;
+  uint32 seed = 1;
+  int i, kernel, errors = 0;
+
+  for (i = 0; i < 2 * BENCH_LINES * BENCH_WIDTH; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    src[i] = seed >> 16;
+  }
+
+  for (kernel = REMAP_SCALAR; kernel <= REMAP_NEON; kernel++)
+  {
+    double copy_time, lcd_time;
+    int match;
+
+    if (!render_set_remap(kernel))
+    {
+      continue;
+    }
+
+    /* Check output of both frames, LCD filter output depends on the previous one */
+    config.lcd = 0;
+    bench_kernel(src);
+    match = kernel == REMAP_SCALAR || !memcmp(ref, bitmap.data, size);
+    memcpy(ref, bitmap.data, size);
+    config.lcd = 0x80;
+    bench_kernel(src);
+    match &= kernel == REMAP_SCALAR || !memcmp(ref + size, bitmap.data, size);
+    memcpy(ref + size, bitmap.data, size);
+
+    config.lcd = 0;
+    copy_time = bench_kernel(src);
+    config.lcd = 0x80;
+    lcd_time = bench_kernel(src);
+
+    printf("remap %s %s: %.1f ns/line, %.1f ns/line with LCD filter%s\n", BENCH_FORMAT, names[kernel],
+           copy_time, lcd_time, match ? "" : ", output differs from scalar");
+    errors += !match;
+  }
+
+  config.lcd = lcd;
+  free(src);
+  free(ref);
+  return errors;
+}
+
+/* FM benchmarks: register write traces played on the YM2612 and YM3438 cores */
+#define YM_BENCH_SAMPLES 20000
+#define YM_BENCH_PASSES  5
+
+typedef struct
+{
+  uint32 clock;   /* chip clock the write is done at */
+  uint8 port;
+  uint8 data;
+} ym_write_t;
+
+typedef struct
+{
+  const char *name;
+  ym_write_t *writes;
+  int count;
+  uint32 clock;   /* trace length in chip clocks */
+} ym_trace_t;
+
+static uint32 ym_random(uint32 *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 16;
+}
+
+/* Address write, then data write, each one followed by that many clocks */
+static void ym_trace_write(ym_trace_t *t, int port, int reg, int data, int gap)
+{
+  t->writes = realloc(t->writes, (t->count + 2) * sizeof(ym_write_t));
+  t->writes[t->count].clock = t->clock;
+  t->writes[t->count].port = port;
+  t->writes[t->count++].data = reg;
+  t->clock += gap;
+  t->writes[t->count].clock = t->clock;
+  t->writes[t->count].port = port + 1;
+  t->writes[t->count++].data = data;
+  t->clock += gap;
+}
+
+/* Sound driver like trace: 6 FM channels with LFO and timer A, a new note on one of them every 400 samples */
+static void ym_trace_music(ym_trace_t *t)
+{
+  uint32 seed = 1;
+  int ch, op, port, chan;
+
+  ym_trace_write(t, 0, 0x22, 0x0b, 64);
+  ym_trace_write(t, 0, 0x24, 0xf0, 64);
+  ym_trace_write(t, 0, 0x27, 0x15, 64);
+  for (ch = 0; ch < 6; ch++)
+  {
+    port = (ch < 3) ? 0 : 2;
+    chan = ch % 3;
+    for (op = 0; op < 4; op++)
+    {
+      ym_trace_write(t, port, 0x30 + op * 4 + chan, 0x71 - ch, 64);
+      ym_trace_write(t, port, 0x40 + op * 4 + chan, (op == 3) ? 0x00 : 0x20 + ch, 64);
+      ym_trace_write(t, port, 0x50 + op * 4 + chan, 0x1f, 64);
+      ym_trace_write(t, port, 0x60 + op * 4 + chan, 0x85, 64);
+      ym_trace_write(t, port, 0x70 + op * 4 + chan, 0x02, 64);
+      ym_trace_write(t, port, 0x80 + op * 4 + chan, 0x2f, 64);
+      ym_trace_write(t, port, 0x90 + op * 4 + chan, (ch == 5) ? 0x0a : 0x00, 64);
+    }
+    ym_trace_write(t, port, 0xb0 + chan, ch * 9, 64);
+    ym_trace_write(t, port, 0xb4 + chan, 0xc0 | 0x23, 64);
+  }
+
+  while (t->clock < YM_BENCH_SAMPLES * 24)
+  {
+    ch = ym_random(&seed) % 6;
+    port = (ch < 3) ? 0 : 2;
+    chan = ch % 3;
+    t->clock += 400 * 24;
+    ym_trace_write(t, 0, 0x28, (ch < 3) ? ch : ch + 1, 64);
+    ym_trace_write(t, port, 0xa4 + chan, 0x10 + (ym_random(&seed) & 0x1f), 64);
+    ym_trace_write(t, port, 0xa0 + chan, ym_random(&seed) & 0xff, 64);
+    ym_trace_write(t, 0, 0x28, 0xf0 | ((ch < 3) ? ch : ch + 1), 64);
+    ym_trace_write(t, 0, 0x27, 0x15, 64);
+  }
+}
+
+/* Random registers (test registers included) at random clocks, in bursts */
+static void ym_trace_random(ym_trace_t *t)
+{
+  uint32 seed = 2;
+  int reg, data, r;
+
+  while (t->clock < YM_BENCH_SAMPLES * 24)
+  {
+    r = ym_random(&seed) % 100;
+    data = ym_random(&seed) & 0xff;
+    if (r < 15)
+    {
+      reg = 0x28;
+      data &= 0xf7;
+    }
+    else if (r < 16)
+    {
+      reg = (ym_random(&seed) & 1) ? 0x21 : 0x2c;
+    }
+    else if (r < 22)
+    {
+      reg = 0x22 + ym_random(&seed) % 10;
+    }
+    else if (r < 30)
+    {
+      reg = 0xa0 + ym_random(&seed) % 0x18;
+    }
+    else
+    {
+      reg = 0x30 + ym_random(&seed) % 0x70;
+    }
+    ym_trace_write(t, (ym_random(&seed) & 1) * 2, reg, data, ym_random(&seed) % 40);
+    if ((ym_random(&seed) % 4) == 0)
+    {
+      t->clock += ym_random(&seed) % (50 * 24);
+    }
+  }
+}
+
+/* Plays a trace on the MAME core, by blocks of samples between writes as fm_update does */
+static void fm_play(const ym_trace_t *t, int *buffer)
+{
+  int sample = 0, next, w;
+
+  YM2612ResetChip();
+
+  for (w = 0; w <= t->count; w++)
+  {
+    next = ((w < t->count) ? t->writes[w].clock : t->clock) / 24;
+    if (next > sample)
+    {
+      YM2612Update(buffer + sample * 2, next - sample);
+      sample = next;
+    }
+
+    if (w < t->count)
+    {
+      YM2612Write(t->writes[w].port, t->writes[w].data);
+    }
+  }
+}
+
+/* YM2612 benchmark: the traces are played with each rendering kernel and chip type, returns the
+   number of kernels and chip types whose output differs from sample by sample rendering */
+static int bench_ym2612(void)
+{
+  static const char *type_names[] = { "discrete", "integrated", "enhanced" };
+  static const char *kernel_names[] = { "sample", "block", "avx2" };
+  uint8 *state = malloc(STATE_SIZE);
+  ym_trace_t traces[2];
+  int i, type, kernel, pass, errors = 0;
+
+  /* emulated chip is restored once done */
+  YM2612SaveContext(state);
+  YM2612Init();
+
+  memset(traces, 0, sizeof(traces));
+  traces[0].name = "music";
+  ym_trace_music(&traces[0]);
+  traces[1].name = "random";
+  ym_trace_random(&traces[1]);
+
+  for (i = 0; i < 2; i++)
+  {
+    const ym_trace_t *t = &traces[i];
+    int samples = t->clock / 24;
+    int *out = malloc(samples * 2 * sizeof(int));
+    int *ref = malloc(3 * samples * 2 * sizeof(int));
+
+    for (kernel = YM2612_KERNEL_SAMPLE; kernel <= YM2612_KERNEL_AVX2; kernel++)
+    {
+      if (!YM2612SetKernel(kernel))
+      {
+        continue;
+      }
+
+      printf("ym2612 %s trace, %s kernel:", t->name, kernel_names[kernel]);
+
+      for (type = YM2612_DISCRETE; type <= YM2612_ENHANCED; type++)
+      {
+        int *type_ref = ref + type * samples * 2;
+        double best = 1e9, elapsed;
+        int match;
+
+        YM2612Config(type);
+
+        /* Best of several passes */
+        for (pass = 0; pass < YM_BENCH_PASSES; pass++)
+        {
+          double start = now();
+          fm_play(t, out);
+          elapsed = now() - start;
+          if (elapsed < best)
+          {
+            best = elapsed;
+          }
+        }
+
+        match = kernel == YM2612_KERNEL_SAMPLE || !memcmp(type_ref, out, samples * 2 * sizeof(int));
+        if (kernel == YM2612_KERNEL_SAMPLE)
+        {
+          memcpy(type_ref, out, samples * 2 * sizeof(int));
+        }
+
+        printf("%s %s %.0f samples/s%s", type ? "," : "", type_names[type], samples / best,
+               match ? "" : " (output differs from sample kernel)");
+        errors += !match;
+      }
+
+      printf("\n");
+    }
+
+    free(ref);
+    free(out);
+    free(t->writes);
+  }
+
+  /* back to emulated chip and default kernel */
+  YM2612Init();
+  YM2612Config(config.ym2612);
+  YM2612LoadContext(state);
+  free(state);
+  return errors;
+}
+
+#ifdef HAVE_YM3438_CORE
+/* YM3438 benchmark: traces are played clock by clock (OPN2_Clock) and sample by sample (OPN2_ClockSample,
+   as YM3438_Update does between writes), outputs and chip state are compared on every sample */
+
+/* Output of each trace played clock by clock on the unmodified core (Nuked OPN2 1.0.12, as imported in
+   core/sound/ym3438.c before OPN2_ClockSample was added): FNV-1a hash of the sums of every 24 clocks,
+   left then right. To be regenerated with that core whenever traces change */
+static const struct
+{
+  const char *name;
+  uint64_t hash;
+} ym_reference[] =
+{
+  { "music",  0x2b4710be147e7813ULL },
+  { "random", 0x2728be480ac0fed5ULL }
+};
+
+/* Plays a trace on chip, whole samples at once unless clocks is set. When ref is set,
+   it is clocked alongside and the number of samples that differ is returned. When
+   sums is set, the sum of every 24 clocks is added to it (left and right) */
+static int ym_play(const ym_trace_t *t, ym3438_t *chip, int clocks, ym3438_t *ref, Bit32s *sums)
+{
+  Bit16s buffer[2], ref_buffer[2];
+  Bit32s sample[2], ref_sample[2];
+  uint32 clock = 0, next;
+  uint32 samples = t->clock / 24;
+  int i, w = 0, errors = 0;
+
+  OPN2_Reset(chip);
+  if (ref)
+  {
+    OPN2_Reset(ref);
+  }
+
+  while (clock < t->clock)
+  {
+    while (w < t->count && t->writes[w].clock == clock)
+    {
+      OPN2_Write(chip, t->writes[w].port, t->writes[w].data);
+      if (ref)
+      {
+        OPN2_Write(ref, t->writes[w].port, t->writes[w].data);
+      }
+      w++;
+    }
+    next = (w < t->count) ? t->writes[w].clock : t->clock;
+
+    if (!clocks && (clock % 24) == 0 && (next - clock) >= 24)
+    {
+      OPN2_ClockSample(chip, sample);
+      if (sums)
+      {
+        sums[(clock / 24) * 2] += sample[0];
+        sums[(clock / 24) * 2 + 1] += sample[1];
+      }
+      if (ref)
+      {
+        ref_sample[0] = ref_sample[1] = 0;
+        for (i = 0; i < 24; i++)
+        {
+          OPN2_Clock(ref, ref_buffer);
+          ref_sample[0] += ref_buffer[0];
+          ref_sample[1] += ref_buffer[1];
+        }
+        errors += sample[0] != ref_sample[0] || sample[1] != ref_sample[1] || memcmp(chip, ref, sizeof(ym3438_t));
+      }
+      clock += 24;
+    }
+    else
+    {
+      OPN2_Clock(chip, buffer);
+      if (sums && (clock / 24) < samples)
+      {
+        sums[(clock / 24) * 2] += buffer[0];
+        sums[(clock / 24) * 2 + 1] += buffer[1];
+      }
+      if (ref)
+      {
+        OPN2_Clock(ref, ref_buffer);
+        errors += buffer[0] != ref_buffer[0] || buffer[1] != ref_buffer[1];
+      }
+      clock++;
+    }
+  }
+
+  return errors;
+}
+
+/* Hash of the sums of every 24 clocks of a trace played one way or the other */
+static uint64_t ym_hash(const ym_trace_t *t, ym3438_t *chip, int clocks)
+{
+  int n, samples = t->clock / 24;
+  Bit32s *sums = calloc(samples * 2, sizeof(Bit32s));
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  ym_play(t, chip, clocks, NULL, sums);
+  for (n = 0; n < samples * 2; n++)
+  {
+    hash = (hash ^ (uint32)sums[n]) * 0x100000001b3ULL;
+  }
+
+  free(sums);
+  return hash;
+}
+
+/* Returns the number of samples that differ between both ways of clocking the chip, plus the number
+   of ways whose output differs from the unmodified core */
+static int bench_ym3438(void)
+{
+  static ym3438_t chip, ref;
+  ym_trace_t traces[2];
+  int i, pass, errors = 0;
+
+  memset(traces, 0, sizeof(traces));
+  traces[0].name = "music";
+  ym_trace_music(&traces[0]);
+  traces[1].name = "random";
+  ym_trace_random(&traces[1]);
+
+  for (i = 0; i < 2; i++)
+  {
+    const ym_trace_t *t = &traces[i];
+    double clock_time = 1e9, sample_time = 1e9, elapsed;
+    int samples = t->clock / 24;
+    int diff = ym_play(t, &chip, 0, &ref, NULL);
+    int mismatch = (ym_hash(t, &chip, 1) != ym_reference[i].hash) + (ym_hash(t, &chip, 0) != ym_reference[i].hash);
+
+    /* Best of several passes */
+    for (pass = 0; pass < YM_BENCH_PASSES; pass++)
+    {
+      double start = now();
+      ym_play(t, &chip, 1, NULL, NULL);
+      elapsed = now() - start;
+      if (elapsed < clock_time)
+      {
+        clock_time = elapsed;
+      }
+
+      start = now();
+      ym_play(t, &chip, 0, NULL, NULL);
+      elapsed = now() - start;
+      if (elapsed < sample_time)
+      {
+        sample_time = elapsed;
+      }
+    }
+
+    printf("ym3438 %s trace: %d samples, %d writes, %.0f samples/s by clock, %.0f samples/s by sample (%.2fx)%s%s\n",
+           t->name, samples, t->count, samples / clock_time, samples / sample_time, clock_time / sample_time,
+           diff ? ", output differs" : "", mismatch ? ", output differs from reference core" : "");
+    errors += diff + mismatch;
+    free(t->writes);
+  }
+
+  return errors;
+}
+#endif
+
+/* Blip buffer benchmarks: deltas are added to high quality buffers as PSG noise channel and FM (one delta
+   per sample) do, frames are then read out of one buffer or mixed from three as Mega CD does */
+#define BLIP_BENCH_FRAMES 300
+#define BLIP_BENCH_PASSES 5
+#define BLIP_BENCH_CLOCKS (3420 * 262)   /* NTSC frame length in master clocks */
+#define BLIP_BENCH_RATE   48000
+
+typedef struct
+{
+  uint32 time;
+  int l, r;
+} blip_delta_t;
+
+typedef struct
+{
+  blip_delta_t *deltas;
+  int count;
+  int end[BLIP_BENCH_FRAMES];   /* first delta of next frame */
+} blip_trace_t;
+
+static void blip_trace_add(blip_trace_t *t, uint32 time, int l, int r)
+{
+  t->deltas = realloc(t->deltas, (t->count + 1) * sizeof(blip_delta_t));
+  t->deltas[t->count].time = time;
+  t->deltas[t->count].l = l;
+  t->deltas[t->count++].r = r;
+}
+
+/* PSG noise channel at high shift rate with random volume changes, some deltas on left channel only */
+static void blip_trace_psg(blip_trace_t *t, uint32 seed)
+{
+  int frame, level = 0, out;
+  uint32 time;
+
+  for (frame = 0; frame < BLIP_BENCH_FRAMES; frame++)
+  {
+    for (time = ym_random(&seed) % 256; time < BLIP_BENCH_CLOCKS; time += 256 + ym_random(&seed) % 256)
+    {
+      out = (ym_random(&seed) & 1) ? (ym_random(&seed) % 2800) : -(int)(ym_random(&seed) % 2800);
+      if (out != level)
+      {
+        blip_trace_add(t, time, out - level, (ym_random(&seed) % 8) ? out - level : 0);
+        level = out;
+      }
+    }
+    t->end[frame] = t->count;
+  }
+}
+
+/* FM output every 144 * 7 clocks: small steps and a few jumps larger than 16 bits (the filter overshoot clips some samples) */
+static void blip_trace_fm(blip_trace_t *t, uint32 seed)
+{
+  int frame, i, delta[2], level[2] = { 0, 0 };
+  uint32 time;
+
+  for (frame = 0; frame < BLIP_BENCH_FRAMES; frame++)
+  {
+    for (time = 0; time < BLIP_BENCH_CLOCKS; time += 144 * 7)
+    {
+      for (i = 0; i < 2; i++)
+      {
+        if (ym_random(&seed) % 64)
+        {
+          delta[i] = (int)(ym_random(&seed) % 4001) - 2000;
+          if (level[i] + delta[i] > 30000 || level[i] + delta[i] < -30000)
+          {
+            delta[i] = -delta[i];
+          }
+        }
+        else
+        {
+          delta[i] = (int)(ym_random(&seed) % 60001) - 30000 - level[i];
+        }
+        level[i] += delta[i];
+      }
+      blip_trace_add(t, time, delta[0], delta[1]);
+    }
+    t->end[frame] = t->count;
+  }
+}
+
+/* Plays traces into buffers (one or three), returns output samples and adds time spent in each step */
+static int blip_play(blip_t **blips, const blip_trace_t *traces, int buffers, short *out, double *add_time, double *read_time)
+{
+  int frame, i, d, n, samples = 0;
+  double start;
+
+  for (i = 0; i < buffers; i++)
+  {
+    blip_clear(blips[i]);
+  }
+
+  for (frame = 0; frame < BLIP_BENCH_FRAMES; frame++)
+  {
+    start = now();
+    for (i = 0; i < buffers; i++)
+    {
+      for (d = frame ? traces[i].end[frame - 1] : 0; d < traces[i].end[frame]; d++)
+      {
+        blip_add_delta(blips[i], traces[i].deltas[d].time, traces[i].deltas[d].l, traces[i].deltas[d].r);
+      }
+      blip_end_frame(blips[i], BLIP_BENCH_CLOCKS);
+    }
+    *add_time += now() - start;
+
+    start = now();
+    n = blip_samples_avail(blips[0]);
+    if (buffers == 3)
+    {
+      blip_mix_samples(blips[0], blips[1], blips[2], out + samples * 2, n);
+    }
+    else
+    {
+      blip_read_samples(blips[0], out + samples * 2, n);
+    }
+    samples += n;
+    *read_time += now() - start;
+  }
+
+  return samples;
+}
+
+/* Each kernel plays the workloads, output samples are compared with the scalar kernel ones.
+   Returns the number of workloads whose output differs */
+static int bench_blip(void)
+{
+  static const char *kernel_names[] = { "scalar", "sse2", "avx2" };
+  static const char *names[] = { "psg noise", "hq fm", "mix" };
+  blip_trace_t traces[4];
+  blip_t *blips[3];
+  int size = BLIP_BENCH_FRAMES * 1024 * 2;
+  short *ref = malloc(size * sizeof(short));
+  short *out = malloc(size * sizeof(short));
+  int i, w, kernel, pass, errors = 0;
+
+  memset(traces, 0, sizeof(traces));
+  blip_trace_psg(&traces[0], 1);
+  blip_trace_fm(&traces[1], 2);
+  blip_trace_psg(&traces[2], 3);
+  blip_trace_psg(&traces[3], 4);
+
+  for (i = 0; i < 3; i++)
+  {
+    blips[i] = blip_new(BLIP_BENCH_RATE / 10);
+    blip_set_rates(blips[i], 53693175.0, BLIP_BENCH_RATE);
+  }
+
+  for (w = 0; w < 3; w++)
+  {
+    /* mix: FM, PSG noise and another PSG noise */
+    const blip_trace_t *t = &traces[(w == 2) ? 1 : w];
+    int buffers = (w == 2) ? 3 : 1;
+    int deltas = 0, samples = 0;
+    double scalar_add = 0, scalar_read = 0;
+
+    for (i = 0; i < buffers; i++)
+    {
+      deltas += t[i].count;
+    }
+
+    printf("blip %s:", names[w]);
+
+    for (kernel = blip_kernel_scalar; kernel <= blip_kernel_avx2; kernel++)
+    {
+      double best_add = 1e9, best_read = 1e9;
+      int diff;
+
+      if (!blip_set_kernel(blips[0], kernel))
+      {
+        continue;
+      }
+      blip_set_kernel(blips[1], kernel);
+      blip_set_kernel(blips[2], kernel);
+
+      /* Best of several passes */
+      for (pass = 0; pass < BLIP_BENCH_PASSES; pass++)
+      {
+        double add_time = 0, read_time = 0;
+        samples = blip_play(blips, t, buffers, (kernel == blip_kernel_scalar) ? ref : out, &add_time, &read_time);
+        if (add_time < best_add)
+        {
+          best_add = add_time;
+        }
+        if (read_time < best_read)
+        {
+          best_read = read_time;
+        }
+      }
+
+      if (kernel == blip_kernel_scalar)
+      {
+        scalar_add = best_add;
+        scalar_read = best_read;
+        printf(" %s %.1f ns/delta, %.1f ns/sample", kernel_names[kernel], best_add * 1e9 / deltas, best_read * 1e9 / samples);
+      }
+      else
+      {
+        diff = memcmp(ref, out, samples * 2 * sizeof(short)) != 0;
+        printf(", %s %.1f ns/delta (%.2fx), %.1f ns/sample (%.2fx)%s", kernel_names[kernel], best_add * 1e9 / deltas,
+               scalar_add / best_add, best_read * 1e9 / samples, scalar_read / best_read, diff ? " output differs" : "");
+        errors += diff;
+      }
+    }
+
+    printf("\n");
+  }
+
+  for (i = 0; i < 4; i++)
+  {
+    free(traces[i].deltas);
+  }
+  for (i = 0; i < 3; i++)
+  {
+    blip_delete(blips[i]);
+  }
+  free(ref);
+  free(out);
+
+  return errors;
+}
+
+int bench_run(void)
+{
+  int errors = bench_remap();
+  errors += bench_ym2612();
+#ifdef HAVE_YM3438_CORE
+  errors += bench_ym3438();
+#endif
+  errors += bench_blip();
+  return errors;
+}
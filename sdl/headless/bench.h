@@ -0,0 +1,7 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/* Times pixel remapping, FM and blip buffer kernels, returns the number of outputs that differ from the reference ones */
+extern int bench_run(void);
+
+#endif /* _BENCH_H_ */
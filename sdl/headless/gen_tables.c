@@ -0,0 +1,153 @@
+/*
+    gen_tables --
+    Writes the look-up tables that VDP renderer and YM2612 used to build at startup
+    as const arrays, so they end up in read-only data shared by all running instances.
+
+    Built by "make -f Makefile.headless tables" with BUILD_TABLES defined: the table
+    builders are compiled from the core sources below and linked with the rest of the core.
+*/
+
+#include "../../core/vdp_render.c"
+#include "../../core/sound/ym2612.c"
+
+int log_error = 0;
+md_ntsc_t *md_ntsc;
+sms_ntsc_t *sms_ntsc;
+
+int sdl_input_update(void)
+{
+  return 1;
+}
+
+static FILE *open_table(const char *dir, const char *name)
+{
+  char path[1024];
+  FILE *fp;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  fp = fopen(path, "w");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "Error writing `%s'.\n", path);
+    exit(1);
+  }
+
+  fprintf(fp, "/* Generated by sdl/headless/gen_tables.c (make -f Makefile.headless tables), do not edit */\n\n");
+  return fp;
+}
+
+/* Writes count values of width bytes (negative width for signed values) as braced initializer */
+static void write_values(FILE *fp, const void *data, int count, int width, int per_line)
+{
+  int i;
+
+  fprintf(fp, "{\n");
+  for (i = 0; i < count; i++)
+  {
+    if ((i % per_line) == 0)
+    {
+      fprintf(fp, "  ");
+    }
+
+    switch (width)
+    {
+      case 1:
+        fprintf(fp, "%d,", ((const uint8 *)data)[i]);
+        break;
+      case 4:
+        fprintf(fp, "0x%X,", ((const uint32 *)data)[i]);
+        break;
+      case -4:
+        fprintf(fp, "%d,", ((const int32 *)data)[i]);
+        break;
+    }
+
+    fprintf(fp, ((i % per_line) == per_line - 1 || i == count - 1) ? "\n" : " ");
+  }
+  fprintf(fp, "}");
+}
+
+static void write_vdp_render_tables(const char *dir)
+{
+  static uint32 bp_lut_swapped[0x10000];
+  FILE *fp = open_table(dir, "vdp_render_tables.h");
+  int i;
+
+  /* bitplane table is indexed by two VRAM bytes, generate both byte orders */
+  for (i = 0; i < 0x10000; i++)
+  {
+    bp_lut_swapped[i] = bp_lut[((i & 0xFF) << 8) | (i >> 8)];
+  }
+
+  fprintf(fp, "/* Sprite pattern name offset look-up table (Mode 5) */\n");
+  fprintf(fp, "static const uint8 name_lut[0x400] =\n");
+  write_values(fp, name_lut, 0x400, 1, 32);
+  fprintf(fp, ";\n");
+
+  fprintf(fp, "\n/* Bitplane to packed pixel look-up table (Mode 4) */\n");
+  fprintf(fp, "#ifdef LSB_FIRST\n");
+  fprintf(fp, "static const uint32 bp_lut[0x10000] =\n");
+#ifdef LSB_FIRST
+  write_values(fp, bp_lut, 0x10000, 4, 8);
+#else
+  write_values(fp, bp_lut_swapped, 0x10000, 4, 8);
+#endif
+  fprintf(fp, ";\n#else\n");
+  fprintf(fp, "static const uint32 bp_lut[0x10000] =\n");
+#ifdef LSB_FIRST
+  write_values(fp, bp_lut_swapped, 0x10000, 4, 8);
+#else
+  write_values(fp, bp_lut, 0x10000, 4, 8);
+#endif
+  fprintf(fp, ";\n#endif\n");
+
+  fprintf(fp, "\n/* Layer priority pixel look-up tables */\n");
+  fprintf(fp, "static const uint8 lut[LUT_MAX][LUT_SIZE] =\n{\n");
+  for (i = 0; i < LUT_MAX; i++)
+  {
+    write_values(fp, lut[i], LUT_SIZE, 1, 32);
+    fprintf(fp, (i < LUT_MAX - 1) ? ",\n" : "\n");
+  }
+  fprintf(fp, "};\n");
+
+  fclose(fp);
+}
+
+static void write_ym2612_tables(const char *dir)
+{
+  FILE *fp = open_table(dir, "sound/ym2612_tables.h");
+
+  fprintf(fp, "/* Linear power table */\n");
+  fprintf(fp, "static const signed int tl_tab[TL_TAB_LEN] =\n");
+  write_values(fp, tl_tab, TL_TAB_LEN, -4, 16);
+  fprintf(fp, ";\n");
+
+  fprintf(fp, "\n/* sin waveform table in 'decibel' scale */\n");
+  fprintf(fp, "static const unsigned int sin_tab[SIN_LEN] =\n");
+  write_values(fp, sin_tab, SIN_LEN, -4, 16);
+  fprintf(fp, ";\n");
+
+  fprintf(fp, "\n/* all 128 LFO PM waveforms */\n");
+  fprintf(fp, "static const INT32 lfo_pm_table[128*8*32] =\n");
+  write_values(fp, lfo_pm_table, 128*8*32, -4, 16);
+  fprintf(fp, ";\n");
+
+  fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s coredir\n", argv[0]);
+    return 1;
+  }
+
+  render_init();
+  YM2612Init();
+
+  write_vdp_render_tables(argv[1]);
+  write_ym2612_tables(argv[1]);
+
+  return 0;
+}
@@ -0,0 +1,1200 @@
+/*
+    genplus-headless --
+    Display-less batch runner. Runs a ROM as fast as possible with input from a movie file,
+    prints framebuffer and audio hashes for every frame and emulated frames per second.
+    With -j, runs several instances of the ROM on separate threads (built with USE_THREAD_CONTEXT)
+    and checks that they all produce the same hashes.
+    With -a, every frame is run without rendering and the displayed frame is the one that many
+    frames ahead (system_run_ahead), audio hashes are the same as without it.
+    With -b, pixel remapping, FM and blip buffer kernels are timed after the run and checked
+    against the scalar ones (see bench.c).
+    With -d, frames are recorded into render lists and rendered by a second thread while the next
+    frame is emulated (video hashes are the same as with inline rendering). With -v, frames are
+    rendered both ways and compared. With -t, each frame is split between several render threads,
+    every one rendering every n-th row of 8 pixels (16 in interlace mode 2) of a shared framebuffer.
+    With -c, patterns invalidated by VRAM writes and flipped patterns expanded by the renderer
+    (pattern cache misses) are counted for each frame.
+    With -p, time and calls of each emulated subsystem are written to a CSV file, one line per
+    emulated frame (including run-ahead and replayed frames), and averaged after the run, along
+    with a few counters (FM channel samples skipped on idle channels among them). Requires
+    a build with the profiler compiled in (make -f Makefile.headless PROFILER=1).
+    With -y, FM sound is emulated by the Nuked YM3438 core instead of the MAME one.
+    With -w, sound chip writes of each frame are logged and replayed by a sound thread (built with
+    USE_THREAD_CONTEXT) while the next frame is emulated, audio hashes are the same as inline.
+
+    Movie file: one line per frame, hexadecimal pad state (input.pad[] bits, e.g. 80 = START)
+    for each player separated by spaces. Everything after '#' is a comment, empty lines are skipped.
+    Last line is held once the movie runs out.
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "shared.h"
+#include "sms_ntsc.h"
+#include "md_ntsc.h"
+#include "bench.h"
+
+#define SOUND_FREQUENCY 44100
+
+int log_error = 0;
+
+static CTX_LOCAL short soundframe[4096];
+
+/* NTSC filters are not used, renderer only checks them for NULL */
+md_ntsc_t *md_ntsc;
+sms_ntsc_t *sms_ntsc;
+
+static struct
+{
+  uint16 *pads;
+  int frames;
+} movie;
+
+/* Frame being emulated by the calling thread */
+static CTX_LOCAL int movie_frame;
+
+static int load_movie(const char *filename)
+{
+  char line[256];
+  int size = 0;
+  FILE *fp = fopen(filename, "r");
+  if (fp == NULL)
+  {
+    return 0;
+  }
+
+  while (fgets(line, sizeof(line), fp))
+  {
+    char *pos = strchr(line, '#');
+    char *end;
+    int player;
+
+    if (pos != NULL)
+    {
+      *pos = 0;
+    }
+
+    pos = line;
+    while (*pos == ' ' || *pos == '\t')
+    {
+      pos++;
+    }
+
+    if (*pos == 0 || *pos == '\n' || *pos == '\r')
+    {
+      continue;
+    }
+
+    if (movie.frames == size)
+    {
+      size = size ? size * 2 : 1024;
+      movie.pads = realloc(movie.pads, size * MAX_INPUTS * sizeof(uint16));
+    }
+
+    memset(&movie.pads[movie.frames * MAX_INPUTS], 0, MAX_INPUTS * sizeof(uint16));
+    for (player = 0; player < MAX_INPUTS; player++)
+    {
+      unsigned long value = strtoul(pos, &end, 16);
+      if (end == pos)
+      {
+        break;
+      }
+
+      movie.pads[movie.frames * MAX_INPUTS + player] = value;
+      pos = end;
+    }
+
+    movie.frames++;
+  }
+
+  fclose(fp);
+  return 1;
+}
+
+/* Called by the core once per frame */
+int sdl_input_update(void)
+{
+  int i;
+
+  if (movie.frames)
+  {
+    int frame = movie_frame < movie.frames ? movie_frame : movie.frames - 1;
+    for (i = 0; i < MAX_INPUTS; i++)
+    {
+      input.pad[i] = movie.pads[frame * MAX_INPUTS + i];
+    }
+  }
+
+  return 1;
+}
+
+/* FNV-1a over 32-bit words */
+#define HASH_INIT 0xcbf29ce484222325ULL
+#define HASH_PRIME 0x100000001b3ULL
+
+static uint64_t hash_words(uint64_t hash, const uint32 *words, int count)
+{
+  int i;
+  for (i = 0; i < count; i++)
+  {
+    hash = (hash ^ words[i]) * HASH_PRIME;
+  }
+
+  return hash;
+}
+
+static uint64_t hash_framebuffer(void)
+{
+  /* Active area including borders, same as what the SDL frontend blits */
+  int width = bitmap.viewport.w + 2 * bitmap.viewport.x;
+  int height = bitmap.viewport.h + 2 * bitmap.viewport.y;
+  int row_bytes = width * (bitmap.pitch / bitmap.width);
+  uint64_t hash = HASH_INIT;
+  int y;
+
+  for (y = 0; y < height; y++)
+  {
+    hash = hash_words(hash, (const uint32 *)(bitmap.data + y * bitmap.pitch), row_bytes / 4);
+  }
+
+  return hash;
+}
+
+static uint64_t hash_audio(int samples)
+{
+  /* Stereo samples, two shorts each */
+  return hash_words(HASH_INIT, (const uint32 *)soundframe, samples);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct
+{
+  const char *romname;
+  int frames;
+  int verbose;
+  int history;          /* snapshot history length, 0 = disabled */
+  int ahead;            /* run-ahead frames, 0 = disabled */
+  int bench;            /* time kernels after the run */
+  int render;           /* RENDER_DEFERRED or RENDER_VALIDATE, 0 = inline */
+  int render_threads;   /* threads rendering each frame */
+  int cache_stats;      /* count pattern cache invalidations & expansions */
+  const char *profile;  /* profiler timeline file, NULL = disabled */
+  int status;
+  int pal;
+  double elapsed;
+  uint64_t video;
+  uint64_t audio;
+  int rollbacks;
+  int rollback_errors;
+  double restore_time;
+  snapshot_stats_t snapshots;
+  double snapshot_bytes;
+  double ahead_time;
+  int bench_errors;
+  double render_wait;
+  int render_errors;
+  double cache_invalidated;
+  double cache_expanded;
+  uint32 cache_peak;
+  uint32 profiled;      /* last profiled frame read */
+  double profile_time[PROF_MAX];
+  double profile_calls[PROF_MAX];
+  double profile_instructions;
+  double profile_dma_bytes;
+  double profile_fm_samples;
+  double profile_fm_idle_samples;
+  int sound;            /* sound chips emulated by a sound thread from sound logs */
+  double sound_wait;
+} instance_t;
+
+/* Deferred rendering modes */
+#define RENDER_DEFERRED 1
+#define RENDER_VALIDATE 2
+
+#define MAX_RENDER_THREADS 16
+
+/* Render threads of an instance, render one list at a time into a shared framebuffer */
+typedef struct
+{
+  pthread_t threads[MAX_RENDER_THREADS];
+  int count;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  render_list_t lists[2];
+  const render_list_t *pending;   /* list being rendered, NULL when idle */
+  unsigned int serial;            /* incremented for each submitted list */
+  int busy;                       /* threads still rendering pending list */
+  int quit;
+  uint8 *data;
+  uint64_t video;                 /* hash of last rendered frame */
+} renderer_t;
+
+typedef struct
+{
+  renderer_t *renderer;
+  int band;
+} render_band_t;
+
+/* Sound thread of an instance, replays one sound log at a time with its own sound chips */
+typedef struct
+{
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  sound_log_t logs[2];
+  const sound_log_t *pending;     /* log being replayed, NULL when idle */
+  int quit;
+  uint8 system_hw;                /* emulated system sound chips are set up for */
+  uint8 pal;
+  uint32 clock;
+  uint64_t audio;                 /* hash of last replayed frame */
+  uint8 *state;                   /* sound context of the thread, saved when it quits */
+} mixer_t;
+
+/* Rollback every ROLLBACK_PERIOD frames, ROLLBACK_DEPTH frames back, as netplay would */
+#define ROLLBACK_PERIOD 60
+#define ROLLBACK_DEPTH  8
+
+/* Initialization builds shared look-up tables, only frames run in parallel */
+static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void init_bitmap(void)
+{
+  memset(&bitmap, 0, sizeof(t_bitmap));
+  bitmap.width        = 720;
+  bitmap.height       = 576;
+#if defined(USE_8BPP_RENDERING)
+  bitmap.pitch        = (bitmap.width * 1);
+#elif defined(USE_15BPP_RENDERING)
+  bitmap.pitch        = (bitmap.width * 2);
+#elif defined(USE_16BPP_RENDERING)
+  bitmap.pitch        = (bitmap.width * 2);
+#elif defined(USE_32BPP_RENDERING)
+  bitmap.pitch        = (bitmap.width * 4);
+#endif
+  bitmap.data         = calloc(bitmap.height, bitmap.pitch);
+  bitmap.viewport.changed = 3;
+}
+
+static int init_instance(instance_t *inst)
+{
+  /* initialize Genesis virtual system */
+  init_bitmap();
+
+  /* mark all BIOS as unloaded */
+  system_bios = 0;
+  memset(boot_rom, 0xFF, 0x800);
+
+  /* Load game file */
+  if (!load_rom((char *)inst->romname))
+  {
+    fprintf(stderr, "Error loading file `%s'.\n", inst->romname);
+    return 0;
+  }
+
+  /* initialize system hardware */
+  audio_init(SOUND_FREQUENCY, 0);
+  system_init();
+  system_reset();
+  return 1;
+}
+
+static void run_frame(int do_skip)
+{
+  if (system_hw == SYSTEM_MCD)
+  {
+    system_frame_scd(do_skip);
+  }
+  else if ((system_hw & SYSTEM_PBC) == SYSTEM_MD)
+  {
+    system_frame_gen(do_skip);
+  }
+  else
+  {
+    system_frame_sms(do_skip);
+  }
+}
+
+/* Restores the state of ROLLBACK_DEPTH frames ago and runs them again, video must match */
+static void rollback(instance_t *inst, int frame, const uint64_t *hashes)
+{
+  int i;
+  double start = now();
+
+  if (!snapshot_restore(ROLLBACK_DEPTH))
+  {
+    inst->rollback_errors++;
+    return;
+  }
+
+  inst->restore_time += now() - start;
+  inst->rollbacks++;
+
+  for (i = frame - ROLLBACK_DEPTH + 1; i <= frame; i++)
+  {
+    movie_frame = i;
+    run_frame(0);
+    audio_update(soundframe);
+    if (hash_framebuffer() != hashes[i])
+    {
+      inst->rollback_errors++;
+    }
+    snapshot_push();
+  }
+}
+
+static void *render_thread(void *arg)
+{
+  render_band_t *band = arg;
+  renderer_t *r = band->renderer;
+  unsigned int serial = 0;
+
+  /* Render context has its own bitmap, VDP state is set by render lists */
+  init_bitmap();
+  free(bitmap.data);
+  bitmap.data = r->data;
+
+  pthread_mutex_lock(&r->mutex);
+
+  for (;;)
+  {
+    const render_list_t *list;
+
+    while (r->serial == serial && !r->quit)
+    {
+      pthread_cond_wait(&r->cond, &r->mutex);
+    }
+
+    if (r->quit)
+    {
+      break;
+    }
+
+    serial = r->serial;
+    list = r->pending;
+    pthread_mutex_unlock(&r->mutex);
+
+    render_list_replay_band(list, band->band, r->count);
+
+    pthread_mutex_lock(&r->mutex);
+    if (--r->busy == 0)
+    {
+      /* Last band: whole frame is rendered */
+      r->video = hash_framebuffer();
+      r->pending = NULL;
+      pthread_cond_broadcast(&r->cond);
+    }
+  }
+
+  pthread_mutex_unlock(&r->mutex);
+  free(band);
+  return NULL;
+}
+
+static void render_start(renderer_t *r, int count)
+{
+  int i;
+
+  memset(r, 0, sizeof(renderer_t));
+  pthread_mutex_init(&r->mutex, NULL);
+  pthread_cond_init(&r->cond, NULL);
+  r->count = count;
+  r->data = calloc(bitmap.height, bitmap.pitch);
+
+  for (i = 0; i < count; i++)
+  {
+    render_band_t *band = malloc(sizeof(render_band_t));
+    band->renderer = r;
+    band->band = i;
+    pthread_create(&r->threads[i], NULL, render_thread, band);
+  }
+}
+
+/* Waits until previous list is rendered, returns its video hash */
+static uint64_t render_wait(renderer_t *r)
+{
+  pthread_mutex_lock(&r->mutex);
+  while (r->pending)
+  {
+    pthread_cond_wait(&r->cond, &r->mutex);
+  }
+  pthread_mutex_unlock(&r->mutex);
+  return r->video;
+}
+
+static void render_submit(renderer_t *r, const render_list_t *list)
+{
+  pthread_mutex_lock(&r->mutex);
+  r->pending = list;
+  r->busy = r->count;
+  r->serial++;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->mutex);
+}
+
+static void render_stop(renderer_t *r)
+{
+  int i;
+
+  pthread_mutex_lock(&r->mutex);
+  r->quit = 1;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->mutex);
+
+  for (i = 0; i < r->count; i++)
+  {
+    pthread_join(r->threads[i], NULL);
+  }
+
+  render_list_free(&r->lists[0]);
+  render_list_free(&r->lists[1]);
+  free(r->data);
+  pthread_mutex_destroy(&r->mutex);
+  pthread_cond_destroy(&r->cond);
+}
+
+static void *sound_thread(void *arg)
+{
+  mixer_t *m = arg;
+
+  /* Sound context of its own, chips are initialized as in emulation context */
+  system_hw = m->system_hw;
+  vdp_pal = m->pal;
+  system_clock = m->clock;
+  audio_init(SOUND_FREQUENCY, 0);
+  sound_init();
+  sound_reset();
+
+  pthread_mutex_lock(&m->mutex);
+
+  for (;;)
+  {
+    const sound_log_t *log;
+    uint64_t audio;
+
+    while (!m->pending && !m->quit)
+    {
+      pthread_cond_wait(&m->cond, &m->mutex);
+    }
+
+    if (!m->pending)
+    {
+      break;
+    }
+
+    log = m->pending;
+    pthread_mutex_unlock(&m->mutex);
+
+    sound_log_replay(log);
+    audio = hash_audio(audio_update(soundframe));
+
+    pthread_mutex_lock(&m->mutex);
+    m->audio = audio;
+    m->pending = NULL;
+    pthread_cond_broadcast(&m->cond);
+  }
+
+  pthread_mutex_unlock(&m->mutex);
+
+  /* sound chips are copied back to emulation context (see sound_stop) */
+  sound_context_save(m->state);
+  audio_shutdown();
+  return NULL;
+}
+
+static void sound_start(mixer_t *m)
+{
+  memset(m, 0, sizeof(mixer_t));
+  pthread_mutex_init(&m->mutex, NULL);
+  pthread_cond_init(&m->cond, NULL);
+  m->system_hw = system_hw;
+  m->pal = vdp_pal;
+  m->clock = system_clock;
+  m->state = malloc(STATE_SIZE);
+  pthread_create(&m->thread, NULL, sound_thread, m);
+}
+
+/* Waits until previous log is replayed, returns its audio hash */
+static uint64_t sound_wait(mixer_t *m)
+{
+  pthread_mutex_lock(&m->mutex);
+  while (m->pending)
+  {
+    pthread_cond_wait(&m->cond, &m->mutex);
+  }
+  pthread_mutex_unlock(&m->mutex);
+  return m->audio;
+}
+
+static void sound_submit(mixer_t *m, const sound_log_t *log)
+{
+  pthread_mutex_lock(&m->mutex);
+  m->pending = log;
+  pthread_cond_broadcast(&m->cond);
+  pthread_mutex_unlock(&m->mutex);
+}
+
+static void sound_stop(mixer_t *m)
+{
+  pthread_mutex_lock(&m->mutex);
+  m->quit = 1;
+  pthread_cond_broadcast(&m->cond);
+  pthread_mutex_unlock(&m->mutex);
+
+  pthread_join(m->thread, NULL);
+
+  /* sound chips were only emulated by the sound thread, recording is stopped */
+  sound_context_load(m->state);
+  free(m->state);
+
+  sound_log_free(&m->logs[0]);
+  sound_log_free(&m->logs[1]);
+  pthread_mutex_destroy(&m->mutex);
+  pthread_cond_destroy(&m->cond);
+}
+
+/* Compares active area of rendered frame with inline rendering */
+static int render_compare(renderer_t *r)
+{
+  int width = bitmap.viewport.w + 2 * bitmap.viewport.x;
+  int height = bitmap.viewport.h + 2 * bitmap.viewport.y;
+  int row_bytes = width * (bitmap.pitch / bitmap.width);
+  int y;
+
+  for (y = 0; y < height; y++)
+  {
+    if (memcmp(bitmap.data + y * bitmap.pitch, r->data + y * bitmap.pitch, row_bytes))
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+#ifdef USE_PROFILER
+static void profile_open(FILE *fp)
+{
+  int id;
+
+  fprintf(fp, "frame");
+  for (id = 0; id < PROF_MAX; id++)
+  {
+    fprintf(fp, ",%s_us,%s_calls", profiler_name(id), profiler_name(id));
+  }
+  fprintf(fp, ",m68k_instructions,dma_bytes,fm_samples,fm_idle_samples\n");
+}
+
+/* Writes frames profiled since the previous call to the timeline and adds them to the totals */
+static void profile_collect(instance_t *inst, FILE *fp)
+{
+  profile_frame_t frames[16];
+  int i, id, count;
+
+  while ((count = profiler_read(inst->profiled, frames, 16)) > 0)
+  {
+    for (i = 0; i < count; i++)
+    {
+      const profile_frame_t *f = &frames[i];
+      double us_per_tick = f->frame_ticks ? f->frame_ns / 1000.0 / f->frame_ticks : 0;
+
+      fprintf(fp, "%u", f->frame);
+      for (id = 0; id < PROF_MAX; id++)
+      {
+        fprintf(fp, ",%.2f,%u", f->ticks[id] * us_per_tick, f->calls[id]);
+        inst->profile_time[id] += f->ticks[id] * us_per_tick;
+        inst->profile_calls[id] += f->calls[id];
+      }
+      fprintf(fp, ",%u,%u,%u,%u\n", f->m68k_instructions, f->dma_bytes, f->fm_samples, f->fm_idle_samples);
+
+      inst->profile_instructions += f->m68k_instructions;
+      inst->profile_dma_bytes += f->dma_bytes;
+      inst->profile_fm_samples += f->fm_samples;
+      inst->profile_fm_idle_samples += f->fm_idle_samples;
+      inst->profiled = f->frame;
+    }
+  }
+}
+#endif
+
+static void *run_instance(void *arg)
+{
+  instance_t *inst = arg;
+  uint64_t *hashes = NULL;
+  uint64_t last_audio = 0;
+  uint64_t last_video = 0;
+  renderer_t renderer;
+  mixer_t mixer;
+#ifdef USE_PROFILER
+  FILE *profile = NULL;
+#endif
+  int frame;
+  double start;
+
+  pthread_mutex_lock(&init_mutex);
+  inst->status = init_instance(inst);
+  pthread_mutex_unlock(&init_mutex);
+
+  if (!inst->status)
+  {
+    free(bitmap.data);
+    return NULL;
+  }
+
+  if (inst->history)
+  {
+    snapshot_init(inst->history, 30);
+    hashes = malloc(inst->frames * sizeof(uint64_t));
+  }
+
+  if (inst->render)
+  {
+    if ((system_hw & SYSTEM_PBC) != SYSTEM_MD)
+    {
+      fprintf(stderr, "Deferred rendering is only supported in Mega Drive mode.\n");
+      inst->status = 0;
+      free(bitmap.data);
+      return NULL;
+    }
+
+    render_start(&renderer, inst->render_threads);
+    render_list_record(&renderer.lists[0], inst->render == RENDER_VALIDATE);
+  }
+
+  if (inst->sound)
+  {
+    if (system_hw == SYSTEM_MCD)
+    {
+      fprintf(stderr, "Sound logs are not supported in Mega-CD mode.\n");
+      inst->status = 0;
+      free(bitmap.data);
+      return NULL;
+    }
+
+    sound_start(&mixer);
+    sound_log_record(&mixer.logs[0]);
+  }
+
+#ifdef USE_PROFILER
+  if (inst->profile)
+  {
+    profile = fopen(inst->profile, "w");
+    if (profile == NULL)
+    {
+      fprintf(stderr, "Error writing `%s'.\n", inst->profile);
+      inst->status = 0;
+      free(bitmap.data);
+      return NULL;
+    }
+
+    profile_open(profile);
+    profiler_reset();
+  }
+#endif
+
+  inst->video = HASH_INIT;
+  inst->audio = HASH_INIT;
+  start = now();
+
+  for (frame = 0; frame < inst->frames; frame++)
+  {
+    int samples;
+    uint64_t video, audio;
+
+    movie_frame = frame;
+    run_frame(inst->ahead);
+
+    samples = audio_update(soundframe);
+
+    if (inst->ahead)
+    {
+      double ahead_start = now();
+      if (!system_run_ahead(inst->ahead))
+      {
+        fprintf(stderr, "Run-ahead is not supported on this system.\n");
+        inst->status = 0;
+        break;
+      }
+      inst->ahead_time += now() - ahead_start;
+    }
+
+#ifdef USE_PROFILER
+    if (profile)
+    {
+      profile_collect(inst, profile);
+    }
+#endif
+
+    if (inst->cache_stats)
+    {
+      pattern_cache_stats_t stats;
+      render_get_cache_stats(&stats);
+      inst->cache_invalidated += stats.invalidated;
+      inst->cache_expanded += stats.expanded;
+      if (stats.expanded > inst->cache_peak)
+      {
+        inst->cache_peak = stats.expanded;
+      }
+    }
+
+    video = hash_framebuffer();
+    audio = hash_audio(samples);
+
+    if (inst->sound)
+    {
+      /* Previous frame has been mixed while this one was emulated */
+      double wait_start = now();
+      uint64_t mixed = sound_wait(&mixer);
+      inst->sound_wait += now() - wait_start;
+
+      if (mixer.logs[frame & 1].lost)
+      {
+        fprintf(stderr, "Out of memory recording sound log.\n");
+        inst->status = 0;
+        break;
+      }
+
+      sound_log_record(&mixer.logs[(frame + 1) & 1]);
+      sound_submit(&mixer, &mixer.logs[frame & 1]);
+
+      /* Report previous frame */
+      if (frame > 0)
+      {
+        inst->audio = (inst->audio ^ mixed) * HASH_PRIME;
+        if (inst->verbose)
+        {
+          printf("%d %016llx %016llx\n", frame - 1, (unsigned long long)last_video, (unsigned long long)mixed);
+        }
+      }
+
+      inst->video = (inst->video ^ video) * HASH_PRIME;
+      last_video = video;
+      continue;
+    }
+
+    if (inst->render)
+    {
+      /* Previous frame has been rendered while this one was emulated */
+      double wait_start = now();
+      uint64_t rendered = render_wait(&renderer);
+      inst->render_wait += now() - wait_start;
+
+      render_list_record(&renderer.lists[(frame + 1) & 1], inst->render == RENDER_VALIDATE);
+      render_submit(&renderer, &renderer.lists[frame & 1]);
+
+      if (inst->render == RENDER_VALIDATE)
+      {
+        render_wait(&renderer);
+        inst->render_errors += !render_compare(&renderer);
+      }
+      else
+      {
+        /* Report previous frame */
+        if (frame > 0)
+        {
+          inst->video = (inst->video ^ rendered) * HASH_PRIME;
+          if (inst->verbose)
+          {
+            printf("%d %016llx %016llx\n", frame - 1, (unsigned long long)rendered, (unsigned long long)last_audio);
+          }
+        }
+
+        inst->audio = (inst->audio ^ audio) * HASH_PRIME;
+        last_audio = audio;
+        continue;
+      }
+    }
+
+    inst->video = (inst->video ^ video) * HASH_PRIME;
+    inst->audio = (inst->audio ^ audio) * HASH_PRIME;
+
+    if (inst->history)
+    {
+      hashes[frame] = video;
+      inst->snapshot_bytes += snapshot_push();
+
+      if ((frame % ROLLBACK_PERIOD) == (ROLLBACK_PERIOD - 1) && frame >= ROLLBACK_DEPTH)
+      {
+        rollback(inst, frame, hashes);
+      }
+    }
+
+    if (inst->verbose)
+    {
+      printf("%d %016llx %016llx\n", frame, (unsigned long long)video, (unsigned long long)audio);
+    }
+  }
+
+  if (inst->render)
+  {
+    uint64_t rendered = render_wait(&renderer);
+
+    if (inst->render == RENDER_DEFERRED && frame > 0)
+    {
+      inst->video = (inst->video ^ rendered) * HASH_PRIME;
+      if (inst->verbose)
+      {
+        printf("%d %016llx %016llx\n", frame - 1, (unsigned long long)rendered, (unsigned long long)last_audio);
+      }
+    }
+
+    render_list_record(NULL, 0);
+    render_stop(&renderer);
+  }
+
+  if (inst->sound)
+  {
+    uint64_t mixed = sound_wait(&mixer);
+
+    if (frame > 0)
+    {
+      inst->audio = (inst->audio ^ mixed) * HASH_PRIME;
+      if (inst->verbose)
+      {
+        printf("%d %016llx %016llx\n", frame - 1, (unsigned long long)last_video, (unsigned long long)mixed);
+      }
+    }
+
+    sound_log_record(NULL);
+    sound_stop(&mixer);
+  }
+
+  inst->elapsed = now() - start;
+  inst->pal = vdp_pal;
+
+#ifdef USE_PROFILER
+  if (profile)
+  {
+    profile_collect(inst, profile);
+    fclose(profile);
+  }
+#endif
+
+  if (inst->bench)
+  {
+    inst->bench_errors = bench_run();
+  }
+
+  if (inst->ahead)
+  {
+    system_run_ahead(0);
+  }
+
+  if (inst->history)
+  {
+    snapshot_get_stats(&inst->snapshots);
+    snapshot_shutdown();
+    free(hashes);
+  }
+
+  audio_shutdown();
+  free(bitmap.data);
+#ifdef USE_DYNAMIC_ALLOC
+  free(ext);
+  ext = NULL;
+#endif
+
+  return NULL;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [-n frames] [-i movie] [-j instances] [-s history] [-a frames] [-b] [-d|-v] [-t threads] [-c] [-p file] [-y] [-w] [-q] romfile\n"
+          "  -n frames     number of frames to run (default: movie length, or 3600 without a movie)\n"
+          "  -i movie      input movie, one line of hexadecimal pad states per frame\n"
+          "  -j instances  run that many instances in parallel, one per thread\n"
+          "  -s history    keep snapshots of that many frames, roll back periodically and check replayed video\n"
+          "  -a frames     display the frame that many frames ahead (run-ahead)\n"
+          "  -b            time pixel remapping, FM and blip buffer kernels after the run, check them against scalar ones\n"
+          "  -d            render frames in a second thread while next frame is emulated\n"
+          "  -v            render frames both inline and in a second thread, and compare them\n"
+          "  -t threads    with -d or -v, split each frame between that many render threads (rows of 8 pixels)\n"
+          "  -c            count pattern cache invalidations and expansions\n"
+          "  -p file       write time spent in each subsystem to a CSV file, one line per frame\n"
+          "  -y            use Nuked YM3438 core for FM sound\n"
+          "  -w            emulate sound chips in a second thread from logged chip writes while next frame is emulated\n"
+          "  -q            only print the summary\n",
+          name);
+}
+
+int main(int argc, char **argv)
+{
+  const char *romname = NULL;
+  const char *moviename = NULL;
+  int frames = -1;
+  int jobs = 1;
+  int quiet = 0;
+  int history = 0;
+  int ahead = 0;
+  int bench = 0;
+  int render = 0;
+  int render_threads = 1;
+  int cache_stats = 0;
+  const char *profile = NULL;
+  int ym3438 = 0;
+  int sound = 0;
+  int i, failed = 0;
+  double elapsed = 0;
+  instance_t *instances;
+  pthread_t *threads;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc)
+    {
+      frames = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-i") && i + 1 < argc)
+    {
+      moviename = argv[++i];
+    }
+    else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+    {
+      jobs = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+    {
+      history = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+    {
+      ahead = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-b"))
+    {
+      bench = 1;
+    }
+    else if (!strcmp(argv[i], "-d"))
+    {
+      render = RENDER_DEFERRED;
+    }
+    else if (!strcmp(argv[i], "-v"))
+    {
+      render = RENDER_VALIDATE;
+    }
+    else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+    {
+      render_threads = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-c"))
+    {
+      cache_stats = 1;
+    }
+    else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+    {
+      profile = argv[++i];
+    }
+    else if (!strcmp(argv[i], "-y"))
+    {
+      ym3438 = 1;
+    }
+    else if (!strcmp(argv[i], "-w"))
+    {
+      sound = 1;
+    }
+    else if (!strcmp(argv[i], "-q"))
+    {
+      quiet = 1;
+    }
+    else if (argv[i][0] != '-' && romname == NULL)
+    {
+      romname = argv[i];
+    }
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (romname == NULL || jobs < 1 || history < 0 || (history > 0 && history <= ROLLBACK_DEPTH) || ahead < 0 || (ahead && history) || (bench && jobs > 1) || (render && (history || ahead)) || render_threads < 1 || render_threads > MAX_RENDER_THREADS || (render_threads > 1 && !render) || (cache_stats && render) || (profile && jobs > 1) || (sound && (history || ahead || render)))
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+#ifndef USE_THREAD_CONTEXT
+  if (jobs > 1 || sound)
+  {
+    fprintf(stderr, "Parallel instances and sound thread require a build with USE_THREAD_CONTEXT.\n");
+    return 1;
+  }
+#endif
+
+#ifndef USE_PROFILER
+  if (profile)
+  {
+    fprintf(stderr, "Profiling requires a build with USE_PROFILER (make -f Makefile.headless PROFILER=1).\n");
+    return 1;
+  }
+#endif
+
+  if (moviename != NULL && !load_movie(moviename))
+  {
+    fprintf(stderr, "Error loading movie `%s'.\n", moviename);
+    return 1;
+  }
+
+  if (frames < 0)
+  {
+    frames = movie.frames ? movie.frames : 3600;
+  }
+
+  /* set default config */
+  error_init();
+  set_config_defaults();
+  config.ym3438 = ym3438;
+
+  instances = calloc(jobs, sizeof(instance_t));
+  threads = calloc(jobs, sizeof(pthread_t));
+  for (i = 0; i < jobs; i++)
+  {
+    instances[i].romname = romname;
+    instances[i].frames = frames;
+    instances[i].verbose = !quiet && jobs == 1;
+    instances[i].history = history;
+    instances[i].ahead = ahead;
+    instances[i].bench = bench;
+    instances[i].render = render;
+    instances[i].render_threads = render_threads;
+    instances[i].cache_stats = cache_stats;
+    instances[i].profile = profile;
+    instances[i].sound = sound;
+  }
+
+  if (jobs == 1)
+  {
+    run_instance(&instances[0]);
+  }
+  else
+  {
+    for (i = 0; i < jobs; i++)
+    {
+      pthread_create(&threads[i], NULL, run_instance, &instances[i]);
+    }
+
+    for (i = 0; i < jobs; i++)
+    {
+      pthread_join(threads[i], NULL);
+    }
+  }
+
+  for (i = 0; i < jobs; i++)
+  {
+    if (!instances[i].status)
+    {
+      failed = 1;
+      continue;
+    }
+
+    if (instances[i].video != instances[0].video || instances[i].audio != instances[0].audio)
+    {
+      fprintf(stderr, "Instance %d diverged from instance 0.\n", i);
+      failed = 1;
+    }
+
+    if (instances[i].elapsed > elapsed)
+    {
+      elapsed = instances[i].elapsed;
+    }
+  }
+
+  if (!failed)
+  {
+    /* Wall time of the slowest instance, frames of all instances */
+    printf("%d frames in %.3f s, %.1f fps (%.1fx realtime), video %016llx audio %016llx\n",
+           frames * jobs, elapsed, frames * jobs / elapsed, frames * jobs / elapsed / (instances[0].pal ? 50.0 : 60.0),
+           (unsigned long long)instances[0].video, (unsigned long long)instances[0].audio);
+  }
+
+  if (history)
+  {
+    instance_t *inst = &instances[0];
+    printf("snapshots: %d frames, %d keyframes of %d bytes, %.0f bytes/frame, %u bytes held\n",
+           inst->snapshots.frames, inst->snapshots.keyframes, inst->snapshots.state_size,
+           inst->snapshot_bytes / frames, inst->snapshots.total_bytes);
+    printf("rollbacks: %d, %.1f us per restore, %d errors\n",
+           inst->rollbacks, inst->rollbacks ? inst->restore_time * 1e6 / inst->rollbacks : 0.0, inst->rollback_errors);
+    failed |= inst->rollback_errors != 0;
+  }
+
+  if (ahead && !failed)
+  {
+    instance_t *inst = &instances[0];
+    printf("run-ahead: %d frames, %.1f us per frame, %.1f us of which in system_run_ahead\n",
+           ahead, inst->elapsed * 1e6 / frames, inst->ahead_time * 1e6 / frames);
+  }
+
+  if (render && !failed)
+  {
+    instance_t *inst = &instances[0];
+    if (render == RENDER_VALIDATE)
+    {
+      printf("deferred rendering: %d frames compared, %d differ from inline rendering\n", frames, inst->render_errors);
+    }
+    else
+    {
+      printf("deferred rendering: %.1f us per frame waiting for %d render thread%s\n", inst->render_wait * 1e6 / frames,
+             render_threads, (render_threads > 1) ? "s" : "");
+    }
+    failed |= inst->render_errors != 0;
+  }
+
+  if (sound && !failed)
+  {
+    instance_t *inst = &instances[0];
+    printf("sound thread: %.1f us per frame waiting for mixed frame\n", inst->sound_wait * 1e6 / frames);
+  }
+
+  if (cache_stats && !failed)
+  {
+    instance_t *inst = &instances[0];
+    printf("pattern cache: %.1f patterns invalidated, %.1f flipped patterns expanded per frame (%u at most)\n",
+           inst->cache_invalidated / frames, inst->cache_expanded / frames, inst->cache_peak);
+  }
+
+#ifdef USE_PROFILER
+  if (profile && !failed && instances[0].profiled)
+  {
+    instance_t *inst = &instances[0];
+    double total = 0;
+    int id;
+
+    for (id = 0; id < PROF_MAX; id++)
+    {
+      total += inst->profile_time[id];
+    }
+
+    /* Averages over all emulated frames */
+    printf("profile: %u frames, %.1f us per frame\n", inst->profiled, total / inst->profiled);
+    for (id = 0; id < PROF_MAX; id++)
+    {
+      printf("  %-8s %8.1f us %5.1f%% %8.1f calls\n", profiler_name(id), inst->profile_time[id] / inst->profiled,
+             inst->profile_time[id] * 100 / total, inst->profile_calls[id] / inst->profiled);
+    }
+    printf("  %.0f 68k instructions, %.0f DMA bytes, %.0f FM samples per frame\n", inst->profile_instructions / inst->profiled,
+           inst->profile_dma_bytes / inst->profiled, inst->profile_fm_samples / inst->profiled);
+    printf("  %.0f FM channel samples skipped per frame (idle channels)\n", inst->profile_fm_idle_samples / inst->profiled);
+  }
+#endif
+
+  failed |= instances[0].bench_errors != 0;
+
+  error_shutdown();
+  free(movie.pads);
+  free(instances);
+  free(threads);
+
+  return failed;
+}
@@ -0,0 +1,156 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "debug.h"
+#include "bpt_index.h"
+
+// Breakpoint lookup micro-benchmark
+//
+// Replays a synthetic 68K access stream through the breakpoint index with 0, 10, 100 and 1000
+// watchpoints set, next to the linear list scan that check_breakpoint() used before the index.
+// Only the lookup is timed, not emulation: rates are synthetic frames (ACCESSES_PER_FRAME lookups)
+// per second, an upper bound for the hook path rather than emulator frames per second.
+
+// ~128K 68K cycles per NTSC frame, roughly one hooked access every 4 cycles
+#define ACCESSES_PER_FRAME 32000
+#define BENCH_FRAMES 300
+
+struct access
+{
+    hook_type_t type;
+    int width;
+    unsigned int address;
+};
+
+static struct access trace[ACCESSES_PER_FRAME];
+static breakpoint_t *bpts;
+static int bpt_count;
+
+static void build_trace(void)
+{
+    for (int i = 0; i < ACCESSES_PER_FRAME; i++)
+    {
+        switch (rand() % 6)
+        {
+        case 0:
+        case 1:
+        case 2:
+            // Instruction fetch somewhere in a 1MB ROM
+            trace[i].type = HOOK_M68K_E;
+            trace[i].width = 0;
+            trace[i].address = (rand() % 0x100000) & ~1;
+            break;
+        case 3:
+        case 4:
+            // Data read from ROM or work RAM
+            trace[i].type = HOOK_M68K_R;
+            trace[i].width = 1 << (rand() % 3);
+            trace[i].address = (rand() & 1) ? (rand() % 0x100000) : 0xFFFF0000 | (rand() & 0xFFFF);
+            break;
+        default:
+            // Write to work RAM
+            trace[i].type = HOOK_M68K_W;
+            trace[i].width = 1 << (rand() % 3);
+            trace[i].address = 0xFFFF0000 | (rand() & 0xFFFF);
+            break;
+        }
+    }
+}
+
+static void build_breakpoints(int count)
+{
+    bpts = realloc(bpts, (count ? count : 1) * sizeof(breakpoint_t));
+    bpt_count = count;
+
+    bpt_index_clear();
+    for (int i = 0; i < count; i++)
+    {
+        breakpoint_t *bp = &bpts[i];
+        // Data watchpoints in work RAM that the trace never satisfies (value condition), so every access is a full lookup
+        bp->type = HOOK_M68K_RW;
+        bp->address = 0xFF0000 | (rand() & 0xFFFF);
+        bp->width = 1 + rand() % 16;
+        bp->enabled = 1;
+        bp->condition_provided = 1;
+        bp->value_equal = 0xFFFFFFFF;
+        bp->once = 0;
+
+        bpt_index_add(bp, bp->type, bp->address, bp->address + bp->width);
+    }
+    bpt_index_build();
+}
+
+static int linear_check(hook_type_t type, int width, unsigned int address)
+{
+    int hits = 0;
+    address &= BPT_ADDRESS_MASK;
+    for (int i = 0; i < bpt_count; i++)
+    {
+        breakpoint_t *bp = &bpts[i];
+        if (!(bp->type & type) || !bp->enabled)
+            continue;
+
+        if ((address <= (bp->address + bp->width)) && ((address + width) >= bp->address))
+            hits++;
+    }
+
+    return hits;
+}
+
+static int indexed_check(hook_type_t type, int width, unsigned int address)
+{
+    struct breakpoint_s **hits;
+    return bpt_index_query(type, address, width, &hits);
+}
+
+static double run_frames(int (*check)(hook_type_t type, int width, unsigned int address), long *hits)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int frame = 0; frame < BENCH_FRAMES; frame++)
+    {
+        for (int i = 0; i < ACCESSES_PER_FRAME; i++)
+        {
+            *hits += check(trace[i].type, trace[i].width, trace[i].address);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return BENCH_FRAMES / seconds;
+}
+
+int main(int argc, char **argv)
+{
+    const int counts[] = {0, 10, 100, 1000};
+
+    srand(1);
+    build_trace();
+
+    printf("%d lookups per synthetic frame, %d frames per run\n", ACCESSES_PER_FRAME, BENCH_FRAMES);
+    printf("%12s %16s %16s\n", "breakpoints", "list frames/s", "index frames/s");
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        long linear_hits = 0, indexed_hits = 0;
+        build_breakpoints(counts[i]);
+
+        double linear_fps = run_frames(linear_check, &linear_hits);
+        double indexed_fps = run_frames(indexed_check, &indexed_hits);
+
+        if (linear_hits != indexed_hits)
+        {
+            printf("mismatch: list found %ld candidates, index found %ld\n", linear_hits, indexed_hits);
+            return 1;
+        }
+
+        printf("%12d %16.0f %16.0f\n", counts[i], linear_fps, indexed_fps);
+    }
+
+    return 0;
+}
@@ -90,6 +90,8 @@ appModule.controller(
 
         WsService.send("regs");
         this.onBreakInInterruptsChange();
+        // Function list is built from functions discovered while the game runs
+        WsService.send("enable discovery");
         WsService.syncBreakpoints();
       });
 
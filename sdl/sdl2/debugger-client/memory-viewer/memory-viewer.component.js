@@ -2,8 +2,13 @@ import { to0xHex, toHex } from "../utils.js";
 import { WsService } from "../ws.service.js";
 
 export class MemoryViewerController {
-  /** @type {number[][]} Two dimensional array 16 bytes wide */
+  /** @type {Uint8Array[]} Rows 16 bytes wide */
   memory;
+  /**
+   * Loaded range server sends live updates for
+   * @type {{type: 'ram' | 'vram' | 'cram' | 'z80', address: number, size: number}}
+   */
+  watched;
   // Offset from address
   selected = 0;
   hovered;
@@ -72,6 +77,8 @@ export class MemoryViewerController {
       resizeObserver.observe(this.view);
     });
 
+    WsService.on("delta", (delta) => this.#applyDelta(delta));
+
     this.view.onscroll = () => {
       if (this.stopScrollEvents) {
         return;
@@ -146,11 +153,63 @@ export class MemoryViewerController {
       );
       this.memory = response.data;
       this.address = response.address;
+      this.#watch(response.address, response.bytes.length);
       this.stopScrollEvents = false;
       this.$scope.$apply();
     }, 500);
   }
 
+  /**
+   * Keeps loaded range up to date, replaces previous subscription
+   * @param {number} address
+   * @param {number} size
+   */
+  #watch(address, size) {
+    if (this.watched) {
+      const { type, address, size } = this.watched;
+      WsService.unsubscribe(type, address, size);
+      this.watched = undefined;
+    }
+
+    // ROM doesn't change, only work RAM part of 68K space is watched
+    const type =
+      this.selectedMemType === "rom" ? "ram" : this.selectedMemType;
+    if (type === "ram" && address + size <= 0xe00000) {
+      return;
+    }
+
+    this.watched = { type, address, size };
+    WsService.subscribe(type, address, size);
+  }
+
+  /**
+   * @param {{mem_type: string, runs: {address: number, bytes: Uint8Array}[]}} delta
+   */
+  #applyDelta({ mem_type, runs }) {
+    if (!this.watched || !this.memory) {
+      return;
+    }
+
+    // Work RAM comes in 68K address space
+    const type = this.watched.type === "ram" ? "rom" : this.watched.type;
+    if (mem_type !== type) {
+      return;
+    }
+
+    const start = this.address;
+    const end = start + this.memory.length * 16;
+    runs.forEach(({ address, bytes }) => {
+      const from = Math.max(address, start);
+      const to = Math.min(address + bytes.length, end);
+      for (let i = from; i < to; i++) {
+        this.memory[Math.floor((i - start) / 16)][(i - start) % 16] =
+          bytes[i - address];
+      }
+    });
+
+    this.$scope.$apply();
+  }
+
   /**
    * @param {number} byte
    */
@@ -202,15 +202,17 @@ Address: $${(tileIndex * 32 + rowIndex * 4 + Math.floor(columnIndex / 2))
       this.stopScrollEvents = true;
       setTimeout(async () => {
         console.log('does load')
-        let response = await WsService.showMemoryLocation(
-          offset,
-          TILE_HEIGHT * this.rowsToFillScreen,
-          "vram"
-        );
-        this.vram = response.data;
-
-        response = await WsService.showMemoryLocation(0, 128, "cram");
-        this.cram = response.data;
+        // Both requests go out in one batch
+        const [vram, cram] = await Promise.all([
+          WsService.showMemoryLocation(
+            offset,
+            TILE_HEIGHT * this.rowsToFillScreen,
+            "vram"
+          ),
+          WsService.showMemoryLocation(0, 128, "cram"),
+        ]);
+        this.vram = vram.data;
+        this.cram = cram.data;
 
         this.refresh();
         this.topOffset = offset;
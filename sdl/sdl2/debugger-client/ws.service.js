@@ -1,5 +1,128 @@
+// Binary frame layout, see server.c
+const FRAME_VERSION = 2;
+const FRAME_HEADER_SIZE = 16;
+const FRAME_MEM = 1;
+const FRAME_REGS = 2;
+const FRAME_MEM_DELTA = 3;
+const FRAME_PROFILE = 4;
+/** @type {('rom' | 'vram' | 'cram' | 'z80' | 'vsram')[]} */
+const FRAME_MEM_TYPES = ["rom", "vram", "cram", "z80", "vsram"];
+// Order of u32 values at the start of a FRAME_REGS payload
+const FRAME_REGS_FIELDS = [
+  "pc",
+  "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7",
+  "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",
+  "sp", "sr", "prev_pc",
+  "ntab", "ntbb", "satb", "plane_w", "plane_h",
+  "line_number", "column",
+];
+const FRAME_REGS_STRINGS = ["comment", "file_path", "function_name"];
+// Subsystems of FRAME_PROFILE records, in profiler.h order
+const PROFILE_SUBSYSTEMS = ["frame", "m68k", "z80", "render", "dma", "fm", "sound", "scd", "cdd"];
+
+/**
+ * Decodes a binary frame into the same shape JSON replies have.
+ * Memory is exposed as 16-byte row views over a single Uint8Array, nothing is copied.
+ * @param {ArrayBuffer} buffer
+ */
+function decodeFrame(buffer) {
+  const view = new DataView(buffer);
+  const version = view.getUint8(0);
+  if (version !== FRAME_VERSION) {
+    throw new Error(`Unsupported frame version ${version}`);
+  }
+
+  const type = view.getUint8(1);
+  const id = view.getUint32(4, true) || undefined;
+  const address = view.getUint32(8, true);
+  const length = view.getUint32(12, true);
+  const bytes = new Uint8Array(buffer, FRAME_HEADER_SIZE, length);
+
+  if (type === FRAME_MEM) {
+    const data = [];
+    for (let i = 0; i < length; i += 16) {
+      data.push(bytes.subarray(i, i + 16));
+    }
+
+    return {
+      id,
+      type: "mem",
+      mem_type: FRAME_MEM_TYPES[view.getUint8(2)],
+      address,
+      bytes,
+      data,
+    };
+  }
+
+  if (type === FRAME_REGS) {
+    const data = {};
+    let pos = FRAME_HEADER_SIZE;
+    FRAME_REGS_FIELDS.forEach((field) => {
+      data[field] = view.getInt32(pos, true);
+      pos += 4;
+    });
+
+    const decoder = new TextDecoder();
+    FRAME_REGS_STRINGS.forEach((field) => {
+      const end = new Uint8Array(buffer, pos).indexOf(0) + pos;
+      data[field] = decoder.decode(new Uint8Array(buffer, pos, end - pos));
+      pos = end + 1;
+    });
+
+    return { id, type: "regs", data };
+  }
+
+  if (type === FRAME_MEM_DELTA) {
+    const runs = [];
+    let pos = 0;
+    while (pos < length) {
+      const runAddress = view.getUint32(FRAME_HEADER_SIZE + pos, true);
+      const runLength = view.getUint32(FRAME_HEADER_SIZE + pos + 4, true);
+      runs.push({
+        address: runAddress,
+        bytes: bytes.subarray(pos + 8, pos + 8 + runLength),
+      });
+      pos += 8 + runLength;
+    }
+
+    return {
+      type: "mem_delta",
+      mem_type: FRAME_MEM_TYPES[view.getUint8(2)],
+      runs,
+    };
+  }
+
+  if (type === FRAME_PROFILE) {
+    // Header address is the number of subsystems
+    let pos = FRAME_HEADER_SIZE;
+    const next = () => {
+      pos += 4;
+      return view.getUint32(pos - 4, true);
+    };
+
+    const frames = [];
+    while (pos < FRAME_HEADER_SIZE + length) {
+      const frame = { frame: next(), ns: {}, calls: {} };
+      for (let i = 0; i < address; i++) {
+        frame.ns[PROFILE_SUBSYSTEMS[i] ?? i] = next();
+      }
+      for (let i = 0; i < address; i++) {
+        frame.calls[PROFILE_SUBSYSTEMS[i] ?? i] = next();
+      }
+      frame.m68k_instructions = next();
+      frame.dma_bytes = next();
+      frame.fm_samples = next();
+      frames.push(frame);
+    }
+
+    return { id, type: "profile", frames };
+  }
+
+  throw new Error(`Unknown frame type ${type}`);
+}
+
 export class WsService {
-  /** @typedef {'open'|'message'|'close'} eventTypes */
+  /** @typedef {'open'|'message'|'close'|'delta'|'profile'} eventTypes */
   /** @type {WebSocket} */
   ws;
   static listeners = {};
@@ -28,6 +151,7 @@ export class WsService {
   static doConnect(addr) {
     /* Do connection. */
     const ws = (this.ws = window["ws"] = new WebSocket(addr));
+    ws.binaryType = "arraybuffer";
     ws.onopen = () => {
       this.#callListeners("open");
     };
@@ -35,9 +159,34 @@ export class WsService {
       this.#callListeners("close");
     };
     ws.onmessage = (evt) => {
-      const response = JSON.parse(evt.data);
-      this.#callListeners("message", response);
-      this.#onMessage(response);
+      const response =
+        typeof evt.data === "string"
+          ? JSON.parse(evt.data)
+          : decodeFrame(evt.data);
+
+      // Subscription updates aren't replies to anything
+      if (response.type === "mem_delta") {
+        this.#callListeners("delta", response);
+        return;
+      }
+
+      // Profiled frames streamed after "enable profile"
+      if (response.type === "profile" && response.id === undefined) {
+        this.#callListeners("profile", response);
+        return;
+      }
+
+      // JSON replies to commands with id come wrapped as { id, reply }
+      const id = response.id;
+      const reply = typeof evt.data === "string" ? response.reply : response;
+
+      if (reply !== undefined) {
+        this.#callListeners("message", reply);
+      }
+
+      if (id !== undefined) {
+        this.#resolve(id, reply);
+      }
     };
   }
 
@@ -45,6 +194,13 @@ export class WsService {
    * @param {import('./breakpoints/breakpoints.component').Breakpoint} bpt
    */
   static sendBreakpoint(bpt) {
+    this.send(this.#breakpointCommand(bpt));
+  }
+
+  /**
+   * @param {import('./breakpoints/breakpoints.component').Breakpoint} bpt
+   */
+  static #breakpointCommand(bpt) {
     let type = 0;
     if (bpt.execute) {
       type |= 1;
@@ -72,7 +228,7 @@ export class WsService {
       }
     }
 
-    this.ws.send(`bpt add ${bpt.address} ${type} ${bpt.value_equal ?? ""}`);
+    return `bpt add ${bpt.address} ${type} ${bpt.value_equal ?? ""}`;
   }
 
   static syncBreakpoints() {
@@ -82,22 +238,22 @@ export class WsService {
     ).filter((bpt) => bpt.enabled);
 
     if (this.ws) {
-      this.ws.send("bpt clear_all");
-
-      if (breakpoints.length) {
-        breakpoints.forEach((bpt) => this.sendBreakpoint(bpt));
-      }
+      // Goes out as one batch
+      this.send("bpt clear_all");
+      breakpoints.forEach((bpt) => this.sendBreakpoint(bpt));
     }
   }
 
   /**
    * @param {string|number} address - decimal number or decimal/hex string
    * @param {number} size
-   * @param {'rom' | 'vram' | 'cram'} [type]
+   * @param {'rom' | 'vram' | 'cram' | 'z80'} [type]
    * 
    * @typedef {Object} showMemoryLocationResponse
-   * @prop {number[][]} data - two dimensional array 16 bytes wide
+   * @prop {Uint8Array[]} data - 16 byte wide rows, views into bytes
+   * @prop {Uint8Array} bytes - whole block as received
    * @prop {number} address
+   * @prop {'rom' | 'vram' | 'cram' | 'z80'} mem_type
    * 
    * @returns {Promise<showMemoryLocationResponse>}
    */
@@ -110,6 +266,27 @@ export class WsService {
     return this.sendMessage(`mem ${address} ${size} ${type}`);
   }
 
+  /**
+   * Asks server to send changes to given range after every frame, starting with its current content.
+   * Updates arrive as 'delta' events: { mem_type, runs: { address: number, bytes: Uint8Array }[] }.
+   * Work RAM updates use 68K addresses and 'rom' mem_type.
+   * @param {'ram' | 'vram' | 'cram' | 'vsram' | 'z80'} type
+   * @param {number} address
+   * @param {number} size
+   */
+  static subscribe(type, address, size) {
+    this.send(`sub ${type} ${address} ${size}`);
+  }
+
+  /**
+   * @param {'ram' | 'vram' | 'cram' | 'vsram' | 'z80'} type
+   * @param {number} address
+   * @param {number} size
+   */
+  static unsubscribe(type, address, size) {
+    this.send(`unsub ${type} ${address} ${size}`);
+  }
+
   /**
    * @typedef {Object} instruction
    * @prop {number} address - position of the instruction
@@ -135,31 +312,55 @@ export class WsService {
 
   /**
    * Sends a message. Doesn't expect a reply. Use sendMessage if you need to wait for reply.
+   * Messages sent within the same task go out as a single batch.
    * @param {string} message 
    */
   static send(message) {
-    this.ws.send(message);
+    this.#queue(message);
   }
 
   static close() {
     this.ws.close();
   }
 
+  /**
+   * Sends a message tagged with a request id, resolves with the reply to it.
+   * Commands without a reply resolve with undefined once server has run them.
+   * @param {string} message
+   */
   static sendMessage(message) {
     return new Promise((resolve) => {
-      this.waiting.push(resolve);
-      this.ws.send(message);
+      const id = this.#nextId++;
+      this.#pending.set(id, resolve);
+      this.#queue(`#${id} ${message}`);
     });
   }
 
-  static #onMessage(data) {
-    const resolve = this.waiting.shift();
+  /** @param {string} line */
+  static #queue(line) {
+    if (!this.#batch.length) {
+      queueMicrotask(() => {
+        this.ws.send(this.#batch.join("\n"));
+        this.#batch = [];
+      });
+    }
+
+    this.#batch.push(line);
+  }
+
+  static #resolve(id, reply) {
+    const resolve = this.#pending.get(id);
     if (resolve) {
-      resolve(data);
+      this.#pending.delete(id);
+      resolve(reply);
     }
   }
 
-  static waiting = [];
+  static #nextId = 1;
+  /** @type {Map<number, (reply: any) => void>} */
+  static #pending = new Map();
+  /** @type {string[]} */
+  static #batch = [];
 
   /** @type {import("./asm-viewer/asm-viewer.component").AsmViewerController} */
   static asmViewer;
@@ -110,15 +110,15 @@ export const Ym2612Component = {
 
           console.log({ playCmds });
           playCmds.forEach((cmd) =>
-            ws.send(`memw 0x${(0xa04000 + cmd[1]).toString(16)} 0x${cmd[2]}`)
+            WsService.send(`memw 0x${(0xa04000 + cmd[1]).toString(16)} 0x${cmd[2]}`)
           );
         }
       };
 
       document.onkeyup = (e) => {
         if (keyCodeToFreq[e.code]) {
-          ws.send(`memw 0x${(0xa04000 + 0).toString(16)} 0x28`);
-          ws.send(`memw 0x${(0xa04000 + 1).toString(16)} ${this.channelIdx}`);
+          WsService.send(`memw 0x${(0xa04000 + 0).toString(16)} 0x28`);
+          WsService.send(`memw 0x${(0xa04000 + 1).toString(16)} ${this.channelIdx}`);
         }
       };
 
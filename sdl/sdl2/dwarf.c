@@ -1,91 +1,1048 @@
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
-#include <errno.h>
-#include <stdlib.h> /* atoi */
+#include <stdlib.h>
+#include <stdint.h>
 #include "dwarf.h"
 
-// pipes[0]: parent writes, child reads (child's stdin)
-// pipes[1]: child writes, parent reads (child's stdout)
-static int inpipefd[2];
-static int outpipefd[2];
+// Native ELF/DWARF reader
+//
+// Line programs (.debug_line) and subprogram DIEs (.debug_info) are decoded once when the ELF is loaded
+// into two arrays of address ranges sorted by start address. dwarf_ask() is then a pair of binary searches,
+// cheap enough for process_breakpoints() to call on every instruction while stepping over a line.
+// Handles 32 and 64-bit ELF of either endianness and DWARF versions 2 to 5, SGDK emits 32-bit big endian.
 
-dwarf_ask_t *dwarf_ask(unsigned int address)
+#define DW_TAG_compile_unit 0x11
+#define DW_TAG_subprogram 0x2e
+
+#define DW_AT_name 0x03
+#define DW_AT_stmt_list 0x10
+#define DW_AT_low_pc 0x11
+#define DW_AT_high_pc 0x12
+#define DW_AT_comp_dir 0x1b
+
+#define DW_FORM_addr 0x01
+#define DW_FORM_block2 0x03
+#define DW_FORM_block4 0x04
+#define DW_FORM_data2 0x05
+#define DW_FORM_data4 0x06
+#define DW_FORM_data8 0x07
+#define DW_FORM_string 0x08
+#define DW_FORM_block 0x09
+#define DW_FORM_block1 0x0a
+#define DW_FORM_data1 0x0b
+#define DW_FORM_flag 0x0c
+#define DW_FORM_sdata 0x0d
+#define DW_FORM_strp 0x0e
+#define DW_FORM_udata 0x0f
+#define DW_FORM_ref_addr 0x10
+#define DW_FORM_ref1 0x11
+#define DW_FORM_ref2 0x12
+#define DW_FORM_ref4 0x13
+#define DW_FORM_ref8 0x14
+#define DW_FORM_ref_udata 0x15
+#define DW_FORM_indirect 0x16
+#define DW_FORM_sec_offset 0x17
+#define DW_FORM_exprloc 0x18
+#define DW_FORM_flag_present 0x19
+#define DW_FORM_strx 0x1a
+#define DW_FORM_addrx 0x1b
+#define DW_FORM_ref_sup4 0x1c
+#define DW_FORM_strp_sup 0x1d
+#define DW_FORM_data16 0x1e
+#define DW_FORM_line_strp 0x1f
+#define DW_FORM_ref_sig8 0x20
+#define DW_FORM_implicit_const 0x21
+#define DW_FORM_loclistx 0x22
+#define DW_FORM_rnglistx 0x23
+#define DW_FORM_ref_sup8 0x24
+#define DW_FORM_strx1 0x25
+#define DW_FORM_strx2 0x26
+#define DW_FORM_strx3 0x27
+#define DW_FORM_strx4 0x28
+#define DW_FORM_addrx1 0x29
+#define DW_FORM_addrx2 0x2a
+#define DW_FORM_addrx3 0x2b
+#define DW_FORM_addrx4 0x2c
+#define DW_FORM_GNU_addr_index 0x1f01
+#define DW_FORM_GNU_str_index 0x1f02
+#define DW_FORM_GNU_ref_alt 0x1f20
+#define DW_FORM_GNU_strp_alt 0x1f21
+
+#define DW_UT_type 0x02
+#define DW_UT_skeleton 0x04
+#define DW_UT_split_compile 0x05
+#define DW_UT_split_type 0x06
+
+#define DW_LNS_copy 0x01
+#define DW_LNS_advance_pc 0x02
+#define DW_LNS_advance_line 0x03
+#define DW_LNS_set_file 0x04
+#define DW_LNS_set_column 0x05
+#define DW_LNS_negate_stmt 0x06
+#define DW_LNS_set_basic_block 0x07
+#define DW_LNS_const_add_pc 0x08
+#define DW_LNS_fixed_advance_pc 0x09
+#define DW_LNS_set_prologue_end 0x0a
+#define DW_LNS_set_epilogue_begin 0x0b
+#define DW_LNS_set_isa 0x0c
+#define DW_LNE_end_sequence 0x01
+#define DW_LNE_set_address 0x02
+
+#define DW_LNCT_path 0x1
+#define DW_LNCT_directory_index 0x2
+
+#define SHT_RELA 4
+#define R_68K_32 1
+
+// Bounds checked reader, running past the end sets p to end and returns zeros
+struct cursor
+{
+    const uint8_t *p;
+    const uint8_t *end;
+};
+
+struct section
+{
+    uint8_t *data;
+    size_t size;
+};
+
+struct line_range
+{
+    uint32_t start;
+    uint32_t end;
+    const char *file;
+    uint32_t line;
+    uint32_t column;
+};
+
+struct function_range
+{
+    uint32_t start;
+    uint32_t end;
+    const char *name;
+};
+
+struct attr_spec
+{
+    uint32_t name;
+    uint32_t form;
+    int64_t implicit_const;
+};
+
+struct abbrev
+{
+    uint32_t code;
+    uint32_t tag;
+    int has_children;
+    int attr_count;
+    struct attr_spec *attrs;
+};
+
+struct attr_value
+{
+    uint64_t u;
+    const char *str;
+    // DW_FORM_addr, high_pc is absolute rather than an offset from low_pc
+    int is_address;
+};
+
+// Everything one CU needs to read its DIEs
+struct unit
+{
+    int version;
+    int offset_size;
+    int address_size;
+};
+
+static int big_endian;
+static uint8_t *elf_data;
+static struct section debug_info, debug_abbrev, debug_str, debug_line, debug_line_str;
+
+static struct line_range *lines;
+static int lines_len, lines_size;
+static struct function_range *functions;
+static int functions_len, functions_size;
+
+// Joined directory and file names, freed on reload
+static char **paths;
+static int paths_len, paths_size;
+
+static uint64_t read_bytes(struct cursor *c, int size)
+{
+    if (c->p + size > c->end)
+    {
+        c->p = c->end;
+        return 0;
+    }
+
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++)
+    {
+        int shift = big_endian ? (size - 1 - i) * 8 : i * 8;
+        value |= (uint64_t)c->p[i] << shift;
+    }
+    c->p += size;
+
+    return value;
+}
+
+static uint8_t read_u8(struct cursor *c)
+{
+    return read_bytes(c, 1);
+}
+
+static uint64_t read_uleb(struct cursor *c)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    while (c->p < c->end)
+    {
+        uint8_t b = *c->p++;
+        if (shift < 64)
+            value |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80))
+            break;
+    }
+
+    return value;
+}
+
+static int64_t read_sleb(struct cursor *c)
+{
+    int64_t value = 0;
+    int shift = 0;
+    uint8_t b = 0;
+    while (c->p < c->end)
+    {
+        b = *c->p++;
+        if (shift < 64)
+            value |= (int64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80))
+            break;
+    }
+
+    if (shift < 64 && (b & 0x40))
+        value |= -((int64_t)1 << shift);
+
+    return value;
+}
+
+static const char *read_cstr(struct cursor *c)
+{
+    const char *str = (const char *)c->p;
+    const uint8_t *nul = memchr(c->p, 0, c->end - c->p);
+    if (nul == NULL)
+    {
+        c->p = c->end;
+        return "";
+    }
+
+    c->p = nul + 1;
+    return str;
+}
+
+static void skip(struct cursor *c, uint64_t size)
+{
+    c->p = size > (uint64_t)(c->end - c->p) ? c->end : c->p + size;
+}
+
+static const char *section_str(struct section *s, uint64_t offset)
+{
+    if (s->data == NULL || offset >= s->size || memchr(s->data + offset, 0, s->size - offset) == NULL)
+        return NULL;
+
+    return (const char *)s->data + offset;
+}
+
+// Unit length, switches to 64-bit offsets on the escape value
+static uint64_t read_unit_length(struct cursor *c, int *offset_size)
+{
+    uint64_t length = read_bytes(c, 4);
+    *offset_size = 4;
+    if (length == 0xffffffff)
+    {
+        length = read_bytes(c, 8);
+        *offset_size = 8;
+    }
+
+    return length;
+}
+
+static void *grow(void *arr, int len, int *size, size_t item)
+{
+    if (len < *size)
+        return arr;
+
+    *size = *size ? *size * 2 : 256;
+    arr = realloc(arr, *size * item);
+    if (arr == NULL)
+    {
+        printf("failed to realloc dwarf tables");
+        exit(-1);
+    }
+
+    return arr;
+}
+
+static const char *add_path(const char *dir, const char *name)
+{
+    char *path;
+    if (dir == NULL || dir[0] == 0 || name[0] == '/')
+    {
+        path = malloc(strlen(name) + 1);
+        strcpy(path, name);
+    }
+    else
+    {
+        path = malloc(strlen(dir) + strlen(name) + 2);
+        sprintf(path, "%s/%s", dir, name);
+    }
+
+    paths = grow(paths, paths_len, &paths_size, sizeof(char *));
+    paths[paths_len++] = path;
+
+    return path;
+}
+
+static void add_line(uint32_t start, uint32_t end, const char *file, uint32_t line, uint32_t column)
+{
+    lines = grow(lines, lines_len, &lines_size, sizeof(struct line_range));
+    struct line_range *range = &lines[lines_len++];
+    range->start = start;
+    range->end = end;
+    range->file = file;
+    range->line = line;
+    range->column = column;
+}
+
+static void add_function(uint32_t start, uint32_t end, const char *name)
+{
+    functions = grow(functions, functions_len, &functions_size, sizeof(struct function_range));
+    struct function_range *range = &functions[functions_len++];
+    range->start = start;
+    range->end = end;
+    range->name = name;
+}
+
+// Reads an attribute of given form, value->str is set for string forms
+static void read_form(struct cursor *c, struct unit *unit, uint32_t form, int64_t implicit_const, struct attr_value *value)
 {
-    char msg[20];
-    sprintf(msg, "0x%X\n", address);
-    printf("sending %lu bytes, asking about %s\n", strlen(msg), msg);
+    value->u = 0;
+    value->str = NULL;
+    value->is_address = 0;
+
+    switch (form)
+    {
+    case DW_FORM_addr:
+        value->u = read_bytes(c, unit->address_size);
+        value->is_address = 1;
+        break;
+    case DW_FORM_data1:
+    case DW_FORM_ref1:
+    case DW_FORM_flag:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+        value->u = read_bytes(c, 1);
+        break;
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+        value->u = read_bytes(c, 2);
+        break;
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+        value->u = read_bytes(c, 3);
+        break;
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+    case DW_FORM_ref_sup4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+        value->u = read_bytes(c, 4);
+        break;
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup8:
+        value->u = read_bytes(c, 8);
+        break;
+    case DW_FORM_data16:
+        skip(c, 16);
+        break;
+    case DW_FORM_sdata:
+        value->u = read_sleb(c);
+        break;
+    case DW_FORM_udata:
+    case DW_FORM_ref_udata:
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+    case DW_FORM_GNU_addr_index:
+    case DW_FORM_GNU_str_index:
+        value->u = read_uleb(c);
+        break;
+    case DW_FORM_string:
+        value->str = read_cstr(c);
+        break;
+    case DW_FORM_strp:
+        value->u = read_bytes(c, unit->offset_size);
+        value->str = section_str(&debug_str, value->u);
+        break;
+    case DW_FORM_line_strp:
+        value->u = read_bytes(c, unit->offset_size);
+        value->str = section_str(&debug_line_str, value->u);
+        break;
+    case DW_FORM_ref_addr:
+        value->u = read_bytes(c, unit->version <= 2 ? unit->address_size : unit->offset_size);
+        break;
+    case DW_FORM_sec_offset:
+    case DW_FORM_strp_sup:
+    case DW_FORM_GNU_ref_alt:
+    case DW_FORM_GNU_strp_alt:
+        value->u = read_bytes(c, unit->offset_size);
+        break;
+    case DW_FORM_block1:
+        skip(c, read_bytes(c, 1));
+        break;
+    case DW_FORM_block2:
+        skip(c, read_bytes(c, 2));
+        break;
+    case DW_FORM_block4:
+        skip(c, read_bytes(c, 4));
+        break;
+    case DW_FORM_block:
+    case DW_FORM_exprloc:
+        skip(c, read_uleb(c));
+        break;
+    case DW_FORM_flag_present:
+        value->u = 1;
+        break;
+    case DW_FORM_implicit_const:
+        value->u = implicit_const;
+        break;
+    case DW_FORM_indirect:
+        read_form(c, unit, read_uleb(c), implicit_const, value);
+        break;
+    default:
+        // Can't know the size, give up on the rest of the unit
+        c->p = c->end;
+        break;
+    }
+}
+
+// Decodes line program at offset into line ranges. comp_dir stands in for directory 0 before DWARF 5.
+static void read_line_program(uint64_t offset, const char *comp_dir)
+{
+    if (debug_line.data == NULL || offset >= debug_line.size)
+        return;
+
+    struct cursor c = {debug_line.data + offset, debug_line.data + debug_line.size};
+    struct unit unit = {0};
+    uint64_t length = read_unit_length(&c, &unit.offset_size);
+    if (length > (uint64_t)(c.end - c.p))
+        return;
+
+    const uint8_t *program_end = c.p + length;
+    c.end = program_end;
+
+    unit.version = read_bytes(&c, 2);
+    if (unit.version < 2 || unit.version > 5)
+        return;
+
+    if (unit.version >= 5)
+    {
+        unit.address_size = read_u8(&c);
+        read_u8(&c); // segment_selector_size
+    }
+
+    uint64_t header_length = read_bytes(&c, unit.offset_size);
+    const uint8_t *program_start = c.p + header_length;
+
+    uint8_t min_inst_length = read_u8(&c);
+    if (unit.version >= 4)
+    {
+        read_u8(&c); // maximum_operations_per_instruction, always 1 outside VLIW
+    }
+    read_u8(&c); // default_is_stmt
+    int8_t line_base = (int8_t)read_u8(&c);
+    uint8_t line_range = read_u8(&c);
+    uint8_t opcode_base = read_u8(&c);
+    if (line_range == 0 || opcode_base == 0)
+        return;
+
+    const uint8_t *standard_opcode_lengths = c.p;
+    skip(&c, opcode_base - 1);
+
+    // Directories and files resolve to paths up front, ranges point at them
+    const char *dirs[256];
+    int dirs_len = 0;
+    const char **files = NULL;
+    int files_len = 0, files_size = 0;
+
+    if (unit.version < 5)
+    {
+        dirs[dirs_len++] = comp_dir;
+        while (c.p < c.end && *c.p != 0)
+        {
+            const char *dir = read_cstr(&c);
+            // Relative include directories are relative to the compilation directory
+            if (dirs_len < 256)
+                dirs[dirs_len++] = dir[0] == '/' ? dir : add_path(comp_dir, dir);
+        }
+        read_u8(&c);
+
+        while (c.p < c.end && *c.p != 0)
+        {
+            const char *name = read_cstr(&c);
+            uint64_t dir_index = read_uleb(&c);
+            read_uleb(&c); // mtime
+            read_uleb(&c); // length
+
+            files = grow(files, files_len, &files_size, sizeof(const char *));
+            files[files_len++] = add_path(dir_index < (uint64_t)dirs_len ? dirs[dir_index] : NULL, name);
+        }
+        read_u8(&c);
+    }
+    else
+    {
+        for (int pass = 0; pass < 2; pass++)
+        {
+            uint32_t formats[16][2];
+            int format_count = read_u8(&c);
+            if (format_count > 16)
+                return;
+
+            for (int i = 0; i < format_count; i++)
+            {
+                formats[i][0] = read_uleb(&c);
+                formats[i][1] = read_uleb(&c);
+            }
 
-    char line[200];
-    write(outpipefd[1], msg, strlen(msg));
+            uint64_t count = read_uleb(&c);
+            for (uint64_t n = 0; n < count && c.p < c.end; n++)
+            {
+                const char *path = "";
+                uint64_t dir_index = 0;
+                for (int i = 0; i < format_count; i++)
+                {
+                    struct attr_value value;
+                    read_form(&c, &unit, formats[i][1], 0, &value);
+                    if (formats[i][0] == DW_LNCT_path && value.str != NULL)
+                        path = value.str;
+                    else if (formats[i][0] == DW_LNCT_directory_index)
+                        dir_index = value.u;
+                }
 
-    while (1)
+                if (pass == 0)
+                {
+                    // Directory 0 is the compilation directory
+                    if (dirs_len < 256)
+                    {
+                        dirs[dirs_len] = dirs_len == 0 || path[0] == '/' ? path : add_path(dirs[0], path);
+                        dirs_len++;
+                    }
+                }
+                else
+                {
+                    files = grow(files, files_len, &files_size, sizeof(const char *));
+                    files[files_len++] = add_path(dir_index < (uint64_t)dirs_len ? dirs[dir_index] : NULL, path);
+                }
+            }
+        }
+    }
+
+    // File register counts from 1 before DWARF 5 and from 0 since
+    int file_base = unit.version < 5 ? 1 : 0;
+
+    c.p = program_start;
+    uint64_t address = 0;
+    uint64_t file = 1, line = 1, column = 0;
+    // Previous row starts the range that ends at the current one
+    int have_row = 0;
+    uint64_t row_address = 0, row_file = 0, row_line = 0, row_column = 0;
+
+    while (c.p < c.end)
     {
-        int readBytes = read(inpipefd[0], line, 199);
-        printf("readBytes: %d\n", readBytes);
-        if (readBytes <= 0)
+        uint8_t opcode = read_u8(&c);
+        int emit = 0, end_sequence = 0;
+
+        if (opcode >= opcode_base)
+        {
+            int adjusted = opcode - opcode_base;
+            address += (adjusted / line_range) * min_inst_length;
+            line += line_base + (adjusted % line_range);
+            emit = 1;
+        }
+        else if (opcode == 0)
         {
-            // Closed?
-            printf("readBytes is 0 or negative\n");
-            return NULL;
+            uint64_t len = read_uleb(&c);
+            const uint8_t *next = c.p + len;
+            if (len == 0 || len > (uint64_t)(c.end - c.p))
+                break;
+
+            uint8_t ex_opcode = read_u8(&c);
+            if (ex_opcode == DW_LNE_end_sequence)
+            {
+                emit = 1;
+                end_sequence = 1;
+            }
+            else if (ex_opcode == DW_LNE_set_address)
+            {
+                address = read_bytes(&c, len - 1);
+            }
+            c.p = next;
+        }
+        else
+        {
+            switch (opcode)
+            {
+            case DW_LNS_copy:
+                emit = 1;
+                break;
+            case DW_LNS_advance_pc:
+                address += read_uleb(&c) * min_inst_length;
+                break;
+            case DW_LNS_advance_line:
+                line += read_sleb(&c);
+                break;
+            case DW_LNS_set_file:
+                file = read_uleb(&c);
+                break;
+            case DW_LNS_set_column:
+                column = read_uleb(&c);
+                break;
+            case DW_LNS_negate_stmt:
+            case DW_LNS_set_basic_block:
+            case DW_LNS_set_prologue_end:
+            case DW_LNS_set_epilogue_begin:
+                break;
+            case DW_LNS_const_add_pc:
+                address += ((255 - opcode_base) / line_range) * min_inst_length;
+                break;
+            case DW_LNS_fixed_advance_pc:
+                address += read_bytes(&c, 2);
+                break;
+            default:
+                // Unknown standard opcode, skip its ULEB operands
+                for (int i = 0; i < standard_opcode_lengths[opcode - 1]; i++)
+                    read_uleb(&c);
+                break;
+            }
         }
-        line[readBytes] = 0;
-        printf("[node]: %s", line);
 
-        if (strstr(line, ">not found") != NULL)
+        if (!emit)
+            continue;
+
+        if (have_row && row_address < address)
         {
-            return NULL;
+            uint64_t index = row_file - file_base;
+            add_line(row_address, address, index < (uint64_t)files_len ? files[index] : "", row_line, row_column);
         }
 
-        if (line[0] == '>')
+        have_row = !end_sequence;
+        row_address = address;
+        row_file = file;
+        row_line = line;
+        row_column = column;
+
+        if (end_sequence)
         {
-            char *funcname = strtok(line + 1, " ");
-            char *filename = strtok(NULL, " ");
-            char *linenumber = strtok(NULL, " ");
-            char *column = strtok(NULL, " ");
-
-            dwarf_ask_t *response = malloc(sizeof(dwarf_ask_t));
-            strcpy(response->function_name, funcname);
-            strcpy(response->file_path, filename);
-            response->line_number = atoi(linenumber);
-            response->column = atoi(column);
-            printf("funcname: %s, filename: %s, line: %s, column: %s\n", funcname, filename, linenumber, column);
-            return response;
+            address = 0;
+            file = 1;
+            line = 1;
+            column = 0;
         }
     }
+
+    free(files);
 }
 
-int dwarf_init(void)
+static struct abbrev *read_abbrevs(uint64_t offset, int *count)
 {
-    pipe(inpipefd);
-    pipe(outpipefd);
+    struct abbrev *abbrevs = NULL;
+    int len = 0, size = 0;
+    *count = 0;
 
-    if (fork() > 0)
+    if (offset >= debug_abbrev.size)
+        return NULL;
+
+    struct cursor c = {debug_abbrev.data + offset, debug_abbrev.data + debug_abbrev.size};
+    while (c.p < c.end)
     {
-        // close unused pipe ends
-        close(outpipefd[0]);
-        close(inpipefd[1]);
+        uint32_t code = read_uleb(&c);
+        if (code == 0)
+            break;
+
+        abbrevs = grow(abbrevs, len, &size, sizeof(struct abbrev));
+        struct abbrev *abbrev = &abbrevs[len++];
+        abbrev->code = code;
+        abbrev->tag = read_uleb(&c);
+        abbrev->has_children = read_u8(&c);
+        abbrev->attr_count = 0;
+        abbrev->attrs = NULL;
+
+        int attrs_size = 0;
+        while (c.p < c.end)
+        {
+            uint32_t name = read_uleb(&c);
+            uint32_t form = read_uleb(&c);
+            if (name == 0 && form == 0)
+                break;
+
+            abbrev->attrs = grow(abbrev->attrs, abbrev->attr_count, &attrs_size, sizeof(struct attr_spec));
+            struct attr_spec *spec = &abbrev->attrs[abbrev->attr_count++];
+            spec->name = name;
+            spec->form = form;
+            spec->implicit_const = form == DW_FORM_implicit_const ? read_sleb(&c) : 0;
+        }
     }
-    else
+
+    *count = len;
+    return abbrevs;
+}
+
+static struct abbrev *find_abbrev(struct abbrev *abbrevs, int count, uint32_t code)
+{
+    // Codes are usually assigned sequentially from 1
+    if (code >= 1 && code <= (uint32_t)count && abbrevs[code - 1].code == code)
+        return &abbrevs[code - 1];
+
+    for (int i = 0; i < count; i++)
+    {
+        if (abbrevs[i].code == code)
+            return &abbrevs[i];
+    }
+
+    return NULL;
+}
+
+// Walks one unit's DIEs, collecting subprograms and the line program of the compile unit
+static void read_unit(struct cursor *c, struct unit *unit, struct abbrev *abbrevs, int abbrev_count)
+{
+    while (c->p < c->end)
     {
-        // child
-        dup2(outpipefd[0], STDIN_FILENO);
-        dup2(inpipefd[1], STDOUT_FILENO);
-        dup2(inpipefd[1], STDERR_FILENO);
+        uint32_t code = read_uleb(c);
+        if (code == 0)
+            continue; // end of siblings
+
+        struct abbrev *abbrev = find_abbrev(abbrevs, abbrev_count, code);
+        if (abbrev == NULL)
+            return;
+
+        const char *name = NULL, *comp_dir = NULL;
+        uint64_t low_pc = 0, high_pc = 0, stmt_list = 0;
+        int has_low_pc = 0, has_high_pc = 0, has_stmt_list = 0, high_pc_is_address = 0;
+
+        for (int i = 0; i < abbrev->attr_count; i++)
+        {
+            struct attr_value value;
+            read_form(c, unit, abbrev->attrs[i].form, abbrev->attrs[i].implicit_const, &value);
 
-        // close unused pipe ends
-        close(outpipefd[1]);
-        close(inpipefd[0]);
+            switch (abbrev->attrs[i].name)
+            {
+            case DW_AT_name:
+                name = value.str;
+                break;
+            case DW_AT_comp_dir:
+                comp_dir = value.str;
+                break;
+            case DW_AT_low_pc:
+                low_pc = value.u;
+                has_low_pc = 1;
+                break;
+            case DW_AT_high_pc:
+                high_pc = value.u;
+                high_pc_is_address = value.is_address;
+                has_high_pc = 1;
+                break;
+            case DW_AT_stmt_list:
+                stmt_list = value.u;
+                has_stmt_list = 1;
+                break;
+            }
+        }
 
-        int res = execl("ts-node", "ts-node", "./sdl/sdl2/m68k-nodejs-gdb/index.ts", NULL);
-        int errvalue = errno; // preserve value as first printf may change errno
-        if (res == -1)
+        if (abbrev->tag == DW_TAG_compile_unit && has_stmt_list)
         {
-            printf("failed to start ts-node %d, errno: %d\n", res, errvalue);
+            read_line_program(stmt_list, comp_dir);
         }
 
-        return errvalue;
+        if (abbrev->tag == DW_TAG_subprogram && has_low_pc && has_high_pc)
+        {
+            // DWARF 4 2.17: high_pc of class constant is an offset from low_pc
+            uint64_t end = high_pc_is_address ? high_pc : low_pc + high_pc;
+            add_function(low_pc, end, name ? name : "");
+        }
     }
+}
+
+static void read_debug_info(void)
+{
+    struct cursor c = {debug_info.data, debug_info.data + debug_info.size};
+    while (c.p < c.end)
+    {
+        struct unit unit = {0};
+        uint64_t length = read_unit_length(&c, &unit.offset_size);
+        if (length == 0 || length > (uint64_t)(c.end - c.p))
+            break;
+
+        struct cursor unit_cursor = {c.p, c.p + length};
+        c.p += length;
+
+        unit.version = read_bytes(&unit_cursor, 2);
+        if (unit.version < 2 || unit.version > 5)
+            continue;
+
+        uint64_t abbrev_offset;
+        if (unit.version >= 5)
+        {
+            uint8_t unit_type = read_u8(&unit_cursor);
+            unit.address_size = read_u8(&unit_cursor);
+            abbrev_offset = read_bytes(&unit_cursor, unit.offset_size);
+            if (unit_type == DW_UT_skeleton || unit_type == DW_UT_split_compile)
+            {
+                skip(&unit_cursor, 8); // dwo_id
+            }
+            else if (unit_type == DW_UT_type || unit_type == DW_UT_split_type)
+            {
+                skip(&unit_cursor, 8 + unit.offset_size); // type_signature, type_offset
+            }
+        }
+        else
+        {
+            abbrev_offset = read_bytes(&unit_cursor, unit.offset_size);
+            unit.address_size = read_u8(&unit_cursor);
+        }
+
+        int abbrev_count;
+        struct abbrev *abbrevs = read_abbrevs(abbrev_offset, &abbrev_count);
+        read_unit(&unit_cursor, &unit, abbrevs, abbrev_count);
+
+        for (int i = 0; i < abbrev_count; i++)
+            free(abbrevs[i].attrs);
+        free(abbrevs);
+    }
+}
+
+// Unlinked objects keep .debug_info offsets in relocations, only section relative R_68K_32 is needed there
+static void apply_relocations(struct cursor rela, struct section *target, int elf64)
+{
+    while (rela.p < rela.end)
+    {
+        uint64_t offset = read_bytes(&rela, elf64 ? 8 : 4);
+        uint64_t info = read_bytes(&rela, elf64 ? 8 : 4);
+        int64_t addend = (int32_t)read_bytes(&rela, elf64 ? 8 : 4);
+
+        uint32_t type = elf64 ? (uint32_t)info : (info & 0xff);
+        if (elf64 || type != R_68K_32 || offset + 4 > target->size)
+            continue;
+
+        for (int i = 0; i < 4; i++)
+            target->data[offset + i] = (uint64_t)addend >> (big_endian ? (3 - i) * 8 : i * 8);
+    }
+}
+
+static int cmp_line(const void *a, const void *b)
+{
+    const struct line_range *la = a;
+    const struct line_range *lb = b;
+
+    if (la->start != lb->start)
+        return la->start < lb->start ? -1 : 1;
+
+    return 0;
+}
+
+static int cmp_function(const void *a, const void *b)
+{
+    const struct function_range *fa = a;
+    const struct function_range *fb = b;
+
+    if (fa->start != fb->start)
+        return fa->start < fb->start ? -1 : 1;
 
     return 0;
 }
+
+static void dwarf_free(void)
+{
+    for (int i = 0; i < paths_len; i++)
+        free(paths[i]);
+
+    free(paths);
+    free(lines);
+    free(functions);
+    free(elf_data);
+
+    paths = NULL;
+    lines = NULL;
+    functions = NULL;
+    elf_data = NULL;
+    paths_len = paths_size = lines_len = lines_size = functions_len = functions_size = 0;
+    memset(&debug_info, 0, sizeof(debug_info));
+    memset(&debug_abbrev, 0, sizeof(debug_abbrev));
+    memset(&debug_str, 0, sizeof(debug_str));
+    memset(&debug_line, 0, sizeof(debug_line));
+    memset(&debug_line_str, 0, sizeof(debug_line_str));
+}
+
+int dwarf_load(const char *elf_path)
+{
+    dwarf_free();
+
+    FILE *f = fopen(elf_path, "rb");
+    if (f == NULL)
+        return 0;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    elf_data = malloc(size > 0 ? size : 1);
+    if (size < 0x34 || fread(elf_data, size, 1, f) != 1 || memcmp(elf_data, "\x7f" "ELF", 4) != 0)
+    {
+        fclose(f);
+        dwarf_free();
+        return 0;
+    }
+    fclose(f);
+
+    int elf64 = elf_data[4] == 2;
+    big_endian = elf_data[5] == 2;
+
+    struct cursor header = {elf_data, elf_data + size};
+    header.p = elf_data + (elf64 ? 0x28 : 0x20);
+    uint64_t shoff = read_bytes(&header, elf64 ? 8 : 4);
+    header.p = elf_data + (elf64 ? 0x3a : 0x2e);
+    uint16_t shentsize = read_bytes(&header, 2);
+    uint16_t shnum = read_bytes(&header, 2);
+    uint16_t shstrndx = read_bytes(&header, 2);
+
+    if (shoff == 0 || shoff + (uint64_t)shnum * shentsize > (uint64_t)size || shstrndx >= shnum)
+    {
+        dwarf_free();
+        return 0;
+    }
+
+    // Section name, type and placement
+    struct section sections[shnum];
+    uint32_t names[shnum], types[shnum];
+    for (int i = 0; i < shnum; i++)
+    {
+        struct cursor sh = {elf_data + shoff + i * shentsize, elf_data + size};
+        names[i] = read_bytes(&sh, 4);
+        types[i] = read_bytes(&sh, 4);
+        skip(&sh, elf64 ? 16 : 8); // flags, addr
+        uint64_t offset = read_bytes(&sh, elf64 ? 8 : 4);
+        uint64_t length = read_bytes(&sh, elf64 ? 8 : 4);
+
+        int in_file = types[i] != 8 /* SHT_NOBITS */ && offset + length <= (uint64_t)size;
+        sections[i].data = in_file ? elf_data + offset : NULL;
+        sections[i].size = in_file ? length : 0;
+    }
+
+    int rela_debug_info = -1;
+    for (int i = 0; i < shnum; i++)
+    {
+        const char *name = section_str(&sections[shstrndx], names[i]);
+        if (name == NULL)
+            continue;
+
+        if (strcmp(name, ".debug_info") == 0)
+            debug_info = sections[i];
+        else if (strcmp(name, ".debug_abbrev") == 0)
+            debug_abbrev = sections[i];
+        else if (strcmp(name, ".debug_str") == 0)
+            debug_str = sections[i];
+        else if (strcmp(name, ".debug_line") == 0)
+            debug_line = sections[i];
+        else if (strcmp(name, ".debug_line_str") == 0)
+            debug_line_str = sections[i];
+        else if (strcmp(name, ".rela.debug_info") == 0 && types[i] == SHT_RELA)
+            rela_debug_info = i;
+    }
+
+    if (debug_info.data == NULL || debug_abbrev.data == NULL)
+    {
+        dwarf_free();
+        return 0;
+    }
+
+    if (rela_debug_info >= 0)
+    {
+        struct cursor rela = {sections[rela_debug_info].data, sections[rela_debug_info].data + sections[rela_debug_info].size};
+        apply_relocations(rela, &debug_info, elf64);
+    }
+
+    read_debug_info();
+
+    qsort(lines, lines_len, sizeof(struct line_range), cmp_line);
+    qsort(functions, functions_len, sizeof(struct function_range), cmp_function);
+
+    return lines_len > 0;
+}
+
+int dwarf_init(const char *romname)
+{
+    // Copy romname so we don't trash passed value
+    char *filename = malloc(strlen(romname) + 10);
+    strcpy(filename, romname);
+    // Replace extension with the one SGDK gives the linked ELF
+    char *ext = strrchr(filename, '.');
+    if (ext != NULL && strchr(ext, '/') == NULL)
+        *ext = 0;
+    strcat(filename, ".out");
+
+    int loaded = dwarf_load(filename);
+    if (loaded)
+    {
+        printf("Loaded debug info from %s: %d lines, %d functions\n", filename, lines_len, functions_len);
+    }
+
+    free(filename);
+    return loaded;
+}
+
+int dwarf_ask(unsigned int address, dwarf_ask_t *info)
+{
+    // Last line range starting at or before address
+    int lo = 0, hi = lines_len;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (lines[mid].start <= address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0 || lines[lo - 1].end <= address)
+        return 0;
+
+    struct line_range *line = &lines[lo - 1];
+    info->file_path = line->file;
+    info->line_number = line->line;
+    info->column = line->column;
+    info->function_name = "";
+
+    lo = 0;
+    hi = functions_len;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (functions[mid].start <= address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo > 0 && functions[lo - 1].end > address)
+        info->function_name = functions[lo - 1].name;
+
+    return 1;
+}
@@ -3,13 +3,19 @@
 
 typedef struct
 {
-    char function_name[0x100];
-    char file_path[0x100];
+    // Both point into tables owned by the reader, valid until the next dwarf_load()
+    const char *function_name;
+    const char *file_path;
     unsigned int line_number;
     unsigned int column;
 } dwarf_ask_t;
 
-int dwarf_init(void);
-dwarf_ask_t *dwarf_ask(unsigned int address);
+// Loads debug info from the ELF built alongside the ROM (out/rom.bin -> out/rom.out)
+int dwarf_init(const char *romname);
+// Parses .debug_line and .debug_info into sorted address range tables, returns 0 if there's no usable debug info
+int dwarf_load(const char *elf_path);
+// Binary search over the tables loaded by dwarf_load(), doesn't allocate.
+// Returns 0 if address isn't covered by a line program. function_name is "" outside known functions.
+int dwarf_ask(unsigned int address, dwarf_ask_t *info);
 
 #endif
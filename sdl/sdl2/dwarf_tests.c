@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "dwarf.h"
+#include "dwarf_tests.h"
+
+// Builds a minimal 32-bit big endian ELF, the way SGDK's m68k-elf-gcc lays out DWARF 2:
+// main() at 0x200-0x210 in /src/main.c, VDP_init() at 0x210-0x230 inlined from /src/inc/vdp.h
+
+static unsigned char elf[1024];
+static int elf_len;
+
+static void put_u8(int value)
+{
+    elf[elf_len++] = value;
+}
+
+static void put_u16(int value)
+{
+    put_u8(value >> 8);
+    put_u8(value);
+}
+
+static void put_u32(unsigned int value)
+{
+    put_u16(value >> 16);
+    put_u16(value);
+}
+
+static void put_str(const char *str)
+{
+    memcpy(elf + elf_len, str, strlen(str) + 1);
+    elf_len += strlen(str) + 1;
+}
+
+static void patch_u32(int offset, unsigned int value)
+{
+    int len = elf_len;
+    elf_len = offset;
+    put_u32(value);
+    elf_len = len;
+}
+
+static void write_test_elf(const char *filename)
+{
+    int offsets[5], sizes[5];
+    elf_len = 0;
+
+    // ELF header, section header offset patched in later
+    put_u32(0x7f454c46);
+    put_u8(1); // 32-bit
+    put_u8(2); // big endian
+    put_u8(1);
+    while (elf_len < 16)
+        put_u8(0);
+    put_u16(2);  // ET_EXEC
+    put_u16(4);  // EM_68K
+    put_u32(1);
+    put_u32(0x200);
+    put_u32(0);
+    put_u32(0); // e_shoff
+    put_u32(0);
+    put_u16(52);
+    put_u16(0);
+    put_u16(0);
+    put_u16(40);
+    put_u16(5); // null, .debug_abbrev, .debug_info, .debug_line, .shstrtab
+    put_u16(4);
+
+    // .debug_abbrev: 1 compile unit (name, comp_dir, stmt_list), 2 subprogram (name, low_pc, high_pc)
+    offsets[1] = elf_len;
+    put_u8(1); put_u8(0x11); put_u8(1);
+    put_u8(0x03); put_u8(0x08); put_u8(0x1b); put_u8(0x08); put_u8(0x10); put_u8(0x06); put_u8(0); put_u8(0);
+    put_u8(2); put_u8(0x2e); put_u8(0);
+    put_u8(0x03); put_u8(0x08); put_u8(0x11); put_u8(0x01); put_u8(0x12); put_u8(0x01); put_u8(0); put_u8(0);
+    put_u8(0);
+    sizes[1] = elf_len - offsets[1];
+
+    // .debug_info
+    offsets[2] = elf_len;
+    put_u32(0); // unit_length
+    put_u16(2);
+    put_u32(0);
+    put_u8(4);
+    put_u8(1); put_str("main.c"); put_str("/src"); put_u32(0);
+    put_u8(2); put_str("main"); put_u32(0x200); put_u32(0x210);
+    put_u8(2); put_str("VDP_init"); put_u32(0x210); put_u32(0x230);
+    put_u8(0);
+    sizes[2] = elf_len - offsets[2];
+    patch_u32(offsets[2], sizes[2] - 4);
+
+    // .debug_line
+    offsets[3] = elf_len;
+    put_u32(0); // unit_length
+    put_u16(2);
+    put_u32(0); // header_length
+    int header_start = elf_len;
+    put_u8(2);  // minimum_instruction_length
+    put_u8(1);  // default_is_stmt
+    put_u8(-5); // line_base
+    put_u8(14); // line_range
+    put_u8(13); // opcode_base
+    const int opcode_lengths[] = {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1};
+    for (int i = 0; i < 12; i++)
+        put_u8(opcode_lengths[i]);
+    put_str("inc");
+    put_u8(0);
+    put_str("main.c"); put_u8(0); put_u8(0); put_u8(0);
+    put_str("vdp.h"); put_u8(1); put_u8(0); put_u8(0);
+    put_u8(0);
+    patch_u32(header_start - 4, elf_len - header_start);
+
+    put_u8(0); put_u8(5); put_u8(2); put_u32(0x200); // set_address 0x200
+    put_u8(3); put_u8(4);                            // line 5
+    put_u8(1);                                       // copy
+    put_u8(2); put_u8(4);                            // address 0x208
+    put_u8(3); put_u8(1);                            // line 6
+    put_u8(1);
+    put_u8(4); put_u8(2);                            // vdp.h
+    put_u8(2); put_u8(4);                            // address 0x210
+    put_u8(3); put_u8(10);                           // line 16
+    put_u8(1);
+    put_u8(2); put_u8(16);                           // address 0x230
+    put_u8(0); put_u8(1); put_u8(1);                 // end_sequence
+    sizes[3] = elf_len - offsets[3];
+    patch_u32(offsets[3], sizes[3] - 4);
+
+    // .shstrtab
+    offsets[4] = elf_len;
+    const char *names[] = {"", ".debug_abbrev", ".debug_info", ".debug_line", ".shstrtab"};
+    int name_offsets[5];
+    for (int i = 0; i < 5; i++)
+    {
+        name_offsets[i] = elf_len - offsets[4];
+        put_str(names[i]);
+    }
+    sizes[4] = elf_len - offsets[4];
+
+    // Section headers
+    patch_u32(0x20, elf_len);
+    for (int i = 0; i < 5; i++)
+    {
+        put_u32(i ? name_offsets[i] : 0);
+        put_u32(i == 0 ? 0 : i == 4 ? 3 : 1); // SHT_NULL, SHT_STRTAB, SHT_PROGBITS
+        put_u32(0);
+        put_u32(0);
+        put_u32(i ? offsets[i] : 0);
+        put_u32(i ? sizes[i] : 0);
+        put_u32(0);
+        put_u32(0);
+        put_u32(1);
+        put_u32(0);
+    }
+
+    FILE *f = fopen(filename, "wb");
+    fwrite(elf, elf_len, 1, f);
+    fclose(f);
+}
+
+static void *
+test_dwarf_setup(const MunitParameter params[], void *user_data)
+{
+    write_test_elf("test-dwarf.out");
+    return NULL;
+}
+
+static MunitResult test_ask(const MunitParameter params[], void *data)
+{
+    munit_assert_true(dwarf_init("test-dwarf.bin"));
+
+    dwarf_ask_t info;
+    munit_assert_true(dwarf_ask(0x204, &info));
+    munit_assert_string_equal(info.function_name, "main");
+    munit_assert_string_equal(info.file_path, "/src/main.c");
+    munit_assert_int(info.line_number, ==, 5);
+
+    munit_assert_true(dwarf_ask(0x20e, &info));
+    munit_assert_int(info.line_number, ==, 6);
+
+    munit_assert_true(dwarf_ask(0x210, &info));
+    munit_assert_string_equal(info.function_name, "VDP_init");
+    munit_assert_string_equal(info.file_path, "/src/inc/vdp.h");
+    munit_assert_int(info.line_number, ==, 16);
+
+    // Outside of the line program
+    munit_assert_false(dwarf_ask(0x1fe, &info));
+    munit_assert_false(dwarf_ask(0x230, &info));
+
+    return 0;
+}
+
+static MunitResult test_missing(const MunitParameter params[], void *data)
+{
+    dwarf_ask_t info;
+    munit_assert_false(dwarf_load("missing.out"));
+    munit_assert_false(dwarf_ask(0x204, &info));
+
+    return 0;
+}
+
+static MunitTest tests[] = {
+    {
+        "/test-ask",            /* name */
+        test_ask,               /* test */
+        test_dwarf_setup,       /* setup */
+        NULL,                   /* tear_down */
+        MUNIT_TEST_OPTION_NONE, /* options */
+        NULL                    /* parameters */
+    },
+    {
+        "/test-missing",        /* name */
+        test_missing,           /* test */
+        NULL,                   /* setup */
+        NULL,                   /* tear_down */
+        MUNIT_TEST_OPTION_NONE, /* options */
+        NULL                    /* parameters */
+    },
+    /* Mark the end of the array with an entry where the test
+     * function is NULL */
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+
+const MunitSuite dwarf_suite = {
+    "/dwarf-tests",         /* name */
+    tests,                  /* tests */
+    NULL,                   /* suites */
+    1,                      /* iterations */
+    MUNIT_SUITE_OPTION_NONE /* options */
+};
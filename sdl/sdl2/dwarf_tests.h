@@ -0,0 +1,8 @@
+#ifndef _DWARF_TESTS_H_
+#define _DWARF_TESTS_H_
+
+#include "munit/munit.h"
+
+extern const MunitSuite dwarf_suite;
+
+#endif /* _DWARF_TESTS_H_ */
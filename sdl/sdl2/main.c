@@ -13,6 +13,7 @@
 jmp_buf jmp_env;
 
 #include "storage.h"
+#include "dwarf.h"
 #include "gdb.h"
 
 static Uint32 sdl_sync_timer_callback(Uint32 interval, void *param);
@@ -764,6 +765,7 @@ int main (int argc, char **argv)
   start_server();
   start_gdb_server();
   set_cpu_hook(process_breakpoints);
+  update_hook_mask();
 
   /* mark all BIOS as unloaded */
   system_bios = 0;
@@ -833,6 +835,7 @@ int main (int argc, char **argv)
   }
 
   init_db(argv[1]);
+  dwarf_init(argv[1]);
 
   /* initialize system hardware */
   audio_init(SOUND_FREQUENCY, 0);
@@ -945,11 +948,17 @@ int main (int argc, char **argv)
       pause_emu = 1;
     }
 
+    // Debugger commands only touch emulator state between frames and steps
+    run_commands();
+    // Stepping flags may have been changed by commands, the debugger or the gdb thread
+    update_hook_mask();
+
     if (!pause_emu) {
       sdl_video_update();
       sdl_sound_update(use_sound);
-      // Uncomment to send CRAM updates every frame. Looks nice but kinda wasteful.
-      // send_cram_values();
+      // Only memory written this frame that a client subscribed to
+      send_mem_updates();
+      send_profile_updates();
     }
 
     if(!turbo_mode && sdl_sync.sem_sync && sdl_video.frames_rendered % 3 == 0)
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <sqlite3.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "storage.h"
 #include "rom_analyzer.h"
@@ -11,6 +12,16 @@
 
 #define LENGTH 0x100
 
+// Functions written per transaction
+#define ANALYSIS_BATCH_SIZE 256
+
+// Per instruction tracing, define ANALYZER_VERBOSE to see how functions are discovered
+#ifdef ANALYZER_VERBOSE
+#define analysis_log(...) printf(__VA_ARGS__)
+#else
+#define analysis_log(...) do { if (0) printf(__VA_ARGS__); } while (0)
+#endif
+
 struct Tuple
 {
     int bra_destination;
@@ -73,6 +84,14 @@ struct FromTo
 struct FromTo *visited_branches = NULL;
 int visited_branches_count;
 int visited_branches_size = 0;
+// One bit per 68K word address, mirrors visited_branches for O(1) lookups
+static uint32_t visited_bitmap[0x1000000 >> 6];
+
+static int is_visited(uint32_t address)
+{
+    uint32_t word = (address & 0xFFFFFF) >> 1;
+    return (visited_bitmap[word >> 5] >> (word & 31)) & 1;
+}
 
 void add_function(struct Function *f, int from, int to)
 {
@@ -97,7 +116,7 @@ struct Tuple find_rts(int address, size_t length, const unsigned char *code, csh
 {
     cs_insn *insn;
     int count = cs_disasm(handle, code, length, address, 0, &insn);
-    printf("count: %d, code: %d\n", count, sizeof(code));
+    analysis_log("count: %d, code: %d\n", count, sizeof(code));
 
     if (count == 0)
     {
@@ -130,22 +149,22 @@ struct Tuple find_rts(int address, size_t length, const unsigned char *code, csh
         //        }
         //        bytesAsString[charsWritten - 1] = 0;
 
-        printf("%02X: %s\t, %s\n", insn[i].address, insn[i].mnemonic, insn[i].op_str);
+        analysis_log("%02X: %s\t, %s\n", insn[i].address, insn[i].mnemonic, insn[i].op_str);
 
         if (strstr(insn[i].mnemonic, "dbra") == insn[i].mnemonic)
         {
             int jump_to = insn[i].address + insn[i].detail->m68k.operands[1].br_disp.disp + 2;
-            printf("dbra detected at %02X, jumps to %02X\n", insn[i].address, jump_to);
+            analysis_log("dbra detected at %02X, jumps to %02X\n", insn[i].address, jump_to);
         }
 
         if (strstr(insn[i].mnemonic, "bra") == insn[i].mnemonic)
         {
             int jump_to = insn[i].address + insn[i].detail->m68k.operands[0].br_disp.disp + 2;
-            printf("bra detected at %02X, jumps to %02X\n", insn[i].address, jump_to);
+            analysis_log("bra detected at %02X, jumps to %02X\n", insn[i].address, jump_to);
 
             if (insn[i].address == jump_to)
             {
-                printf("infinite loop detected, treating as end of the function\n");
+                analysis_log("infinite loop detected, treating as end of the function\n");
                 r.return_address = jump_to;
                 return r;
             }
@@ -160,14 +179,14 @@ struct Tuple find_rts(int address, size_t length, const unsigned char *code, csh
         if (strstr(insn[i].mnemonic, "bsr") == insn[i].mnemonic)
         {
             int jump_to = insn[i].address + insn[i].detail->m68k.operands[0].br_disp.disp + 2;
-            printf("bsr detected at %02X, jumps to %02X\n", insn[i].address, jump_to);
+            analysis_log("bsr detected at %02X, jumps to %02X\n", insn[i].address, jump_to);
 
             add_function(f, insn[i].address, jump_to);
         }
 
         if (strstr(insn[i].mnemonic, "rts") == insn[i].mnemonic)
         {
-            printf("rts detected at %02X\n", insn[i].address);
+            analysis_log("rts detected at %02X\n", insn[i].address);
             r.return_address = insn[i].address;
 
             // This is the last instruction in this function
@@ -176,7 +195,7 @@ struct Tuple find_rts(int address, size_t length, const unsigned char *code, csh
 
         if (strstr(insn[i].mnemonic, "rte") == insn[i].mnemonic)
         {
-            printf("rte detected at %02X\n", insn[i].address);
+            analysis_log("rte detected at %02X\n", insn[i].address);
             r.return_address = insn[i].address;
 
             // This is the last instruction in this function
@@ -185,7 +204,7 @@ struct Tuple find_rts(int address, size_t length, const unsigned char *code, csh
 
         if (strstr(insn[i].mnemonic, "illegal") == insn[i].mnemonic)
         {
-            printf("illegal detected at %02X\n", insn[i].address);
+            analysis_log("illegal detected at %02X\n", insn[i].address);
             r.return_address = insn[i].address;
 
             return r;
@@ -211,7 +230,7 @@ struct Tuple find_rts(int address, size_t length, const unsigned char *code, csh
                     int jump_table_size = insn[i - 4].detail->m68k.operands[0].imm + 1;
                     // Every entry in jump table is a word (2 bytes)
                     r.last_address = insn[i].address + insn[i].size + jump_table_size * 2;
-                    printf("jmp detected at %02X with jump table from %02X to %02X\n", insn[i].address,
+                    analysis_log("jmp detected at %02X with jump table from %02X to %02X\n", insn[i].address,
                            insn[i].address + insn[i].size, insn[i].address + insn[i].size + jump_table_size * 2);
 
                     for (size_t j = 0; j < jump_table_size; j++)
@@ -229,10 +248,10 @@ struct Tuple find_rts(int address, size_t length, const unsigned char *code, csh
             default:
                 // Skip jumps that are only known at run-time
                 // e.g. JSR (A0)
-                printf("unhandled jmp\n");
+                analysis_log("unhandled jmp\n");
             }
 
-            printf("jmp detected at %02X to %02X\n", insn[i].address, jump_to);
+            analysis_log("jmp detected at %02X to %02X\n", insn[i].address, jump_to);
             r.return_address = insn[i].address;
 
             if (!jump_to)
@@ -267,10 +286,10 @@ struct Tuple find_rts(int address, size_t length, const unsigned char *code, csh
             default:
                 // Skip jumps that are only known at run-time
                 // e.g. JSR (A0)
-                printf("unhandled jsr\n");
+                analysis_log("unhandled jsr\n");
             }
 
-            printf("jsr detected at %02X to %02X\n", insn[i].address, jump_to);
+            analysis_log("jsr detected at %02X to %02X\n", insn[i].address, jump_to);
 
             if (!jump_to)
             {
@@ -284,7 +303,7 @@ struct Tuple find_rts(int address, size_t length, const unsigned char *code, csh
         if (insn[i].bytes[0] >= 0x62 && insn[i].bytes[0] <= 0x6F)
         {
             int jump_to = insn[i].address + insn[i].detail->m68k.operands[0].br_disp.disp + 2;
-            printf("%s detected at %02X, jumps to %02X\n", insn[i].mnemonic, insn[i].address, jump_to);
+            analysis_log("%s detected at %02X, jumps to %02X\n", insn[i].mnemonic, insn[i].address, jump_to);
 
             // We are only interested in jumps forward
             if (jump_to > insn[i].address)
@@ -325,6 +344,9 @@ void add_visited_branch(struct FromTo branch)
     struct FromTo *x = &visited_branches[visited_branches_count++];
     x->to = branch.to;
     x->from = branch.from;
+
+    uint32_t word = (branch.to & 0xFFFFFF) >> 1;
+    visited_bitmap[word >> 5] |= 1u << (word & 31);
 }
 
 static FILE *pFile;
@@ -332,14 +354,14 @@ unsigned char *code;
 
 unsigned char *read_from_file(unsigned int length, unsigned int address)
 {
-    printf("reading %d bytes at %02X\n", length, address);
+    analysis_log("reading %d bytes at %02X\n", length, address);
     if (fseek(pFile, address, SEEK_SET) != 0)
     {
         printf("failed to seek");
     }
 
     int result = fread(code, 1, length, pFile);
-    printf("read %d bytes\n", result);
+    analysis_log("read %d bytes\n", result);
 
     return code;
 }
@@ -383,7 +405,7 @@ struct Function extract_function(int referenced_from, int address, rom_reader re
         const unsigned char *code = read_rom(LENGTH, address);
 
         r = find_rts(address, LENGTH, code, handle, &f, r);
-        printf("found la %02X, bd %02X\n", r.last_address, r.bra_destination);
+        analysis_log("found la %02X, bd %02X\n", r.last_address, r.bra_destination);
         address = r.last_address;
     } while (r.return_address == 0);
 
@@ -441,7 +463,9 @@ struct Function extract_function(int referenced_from, int address, rom_reader re
             }
 
             qsort(f.instructions, f.instruction_count, sizeof(cs_insn **), cmpfunc);
+#ifdef ANALYZER_VERBOSE
             print_function(f);
+#endif
         }
     }
 
@@ -458,21 +482,25 @@ void dump_visited_branches(void)
     printf("]\n");
 }
 
-void store_in_db(struct Function f)
+static int analyzed_functions;
+static int analyzed_instructions;
+static analysis_progress_hook progress_hook;
+// Functions extracted since the last commit, storage is only locked while they are written
+static struct Function batched[ANALYSIS_BATCH_SIZE];
+static int batched_functions;
+
+static void write_function(struct Function f)
 {
     // referenced_from is 0 when we jump to the code that wasn't decompiled yet
     // There's no way to know if we found the beginning of the function - so don't save it
     if (f.referenced_from != 0)
     {
-        run_sql("INSERT INTO  \"functions\" (\"start_address\", \"end_address\") VALUES ('%d', '%d')\n", f.start_address,
-                f.end_address);
+        store_function(f.start_address, f.end_address);
     }
 
     for (size_t i = 0; i < f.instruction_count; i++)
     {
         cs_insn insn = *f.instructions[i];
-        char op_1[10];
-        sprintf(op_1, "NULL");
         int jump_to = 0;
         if ((strstr(insn.mnemonic, "jsr") == insn.mnemonic) ||
             (strstr(insn.mnemonic, "jmp") == insn.mnemonic) ||
@@ -492,25 +520,16 @@ void store_in_db(struct Function f)
                 break;
             }
 
-            if (jump_to)
-            {
-                sprintf(op_1, "'%X'", jump_to);
-            }
         }
 
-        run_sql("INSERT INTO  \"instructions\" (\"address\", \"mnemonic\", \"op_str\", size, op_1) VALUES ('%d', '%s', '%s', '%d', %s)\n",
-                insn.address, insn.mnemonic, insn.op_str, insn.size, op_1);
+        store_instruction(insn.address, insn.mnemonic, insn.op_str, insn.size, jump_to);
     }
 
-    run_sql("INSERT INTO jump_tables (instruction_address, function_start_address)"
-            "VALUES ('%d', '%d')",
-            f.referenced_from, f.start_address);
+    store_reference(f.referenced_from, f.start_address, NULL);
 
     for (size_t i = 0; i < f.function_count; i++)
     {
-        run_sql("INSERT INTO jump_tables (instruction_address, function_start_address)"
-                "VALUES ('%d', '%d')",
-                f.functions[i].from, f.functions[i].to);
+        store_reference(f.functions[i].from, f.functions[i].to, NULL);
     }
 
     int first_jump = 1;
@@ -520,9 +539,7 @@ void store_in_db(struct Function f)
     {
         if (f.branches->arr[i].type == JUMP_TABLE)
         {
-            run_sql("INSERT INTO jump_tables (instruction_address, function_start_address, type)"
-                    "VALUES (%d, %d, 'jump_table')",
-                    f.branches->arr[i].from, f.branches->arr[i].to);
+            store_reference(f.branches->arr[i].from, f.branches->arr[i].to, "jump_table");
 
             if (first_jump)
             {
@@ -536,52 +553,82 @@ void store_in_db(struct Function f)
         }
         else
         {
-            run_sql("INSERT INTO jump_tables (instruction_address, function_start_address, type)"
-                    "VALUES (%d, %d, 'local_branch')",
-                    f.branches->arr[i].from, f.branches->arr[i].to);
+            store_reference(f.branches->arr[i].from, f.branches->arr[i].to, "local_branch");
         }
     }
+
+    analyzed_functions++;
+    analyzed_instructions += f.instruction_count;
+}
+
+static void commit_batch(void)
+{
+    if (batched_functions == 0)
+    {
+        return;
+    }
+
+    storage_lock();
+    storage_begin();
+    for (int i = 0; i < batched_functions; i++)
+    {
+        write_function(batched[i]);
+    }
+    storage_commit();
+    storage_unlock();
+    batched_functions = 0;
+
+    if (progress_hook)
+    {
+        progress_hook(analyzed_functions, analyzed_instructions, analysis_pending());
+    }
+}
+
+void store_in_db(struct Function f)
+{
+    batched[batched_functions++] = f;
+
+    if (batched_functions >= ANALYSIS_BATCH_SIZE)
+    {
+        commit_batch();
+    }
 }
 
 static struct fam *extracted_functions;
+// Serializes analysis between the background worker and debugger requests
+static pthread_mutex_t extract_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-int extract_functions(int referenced_from, int address, rom_reader read_rom)
+static int extract_functions_locked(int referenced_from, int address, rom_reader read_rom)
 {
     if (extracted_functions == NULL)
     {
+        storage_lock();
         extracted_functions = get_functions();
-        printf("retrieved %d\n", extracted_functions->len);
+        storage_unlock();
+        analysis_log("retrieved %d\n", extracted_functions->len);
         for (size_t i = 0; i < extracted_functions->len; i++)
         {
             struct FromTo start = {.to = extracted_functions->arr[i], .from = 0};
             add_visited_branch(start);
         }
 
+#ifdef ANALYZER_VERBOSE
         dump_visited_branches();
+#endif
     }
 
     struct Function f = extract_function(referenced_from, address, read_rom);
-    printf("found function %02X to %02X with %d branches\n", f.start_address, f.end_address, f.function_count);
+    analysis_log("found function %02X to %02X with %d branches\n", f.start_address, f.end_address, f.function_count);
 
     store_in_db(f);
 
     for (int i = 0; i < f.function_count; i++)
     {
-        printf("found branching function from %02X to %02X\n", f.functions[i].from, f.functions[i].to);
-
-        bool branch_visited = false;
-        for (int j = 0; j < visited_branches_count; j++)
-        {
-            if (visited_branches[j].to == f.functions[i].to)
-            {
-                branch_visited = true;
-                printf("branch already visited from %02X, skipping\n", visited_branches[j].from);
-                break;
-            }
-        }
+        analysis_log("found branching function from %02X to %02X\n", f.functions[i].from, f.functions[i].to);
 
-        if (branch_visited)
+        if (is_visited(f.functions[i].to))
         {
+            analysis_log("branch already visited, skipping\n");
             continue;
         }
         else
@@ -589,17 +636,145 @@ int extract_functions(int referenced_from, int address, rom_reader read_rom)
             add_visited_branch(f.functions[i]);
         }
 
+#ifdef ANALYZER_VERBOSE
         if (visited_branches_count % 50 == 0)
         {
             dump_visited_branches();
         }
+#endif
 
-        extract_functions(f.functions[i].from, f.functions[i].to, read_rom);
+        extract_functions_locked(f.functions[i].from, f.functions[i].to, read_rom);
     }
 
     return 0;
 }
 
+int extract_functions(int referenced_from, int address, rom_reader read_rom)
+{
+    pthread_mutex_lock(&extract_mutex);
+    int rc = extract_functions_locked(referenced_from, address, read_rom);
+    commit_batch();
+    pthread_mutex_unlock(&extract_mutex);
+
+    return rc;
+}
+
+// Single producer (emulation thread), single consumer (analysis thread) ring buffer
+#define ANALYSIS_QUEUE_SIZE 4096
+
+struct AnalysisJob
+{
+    int referenced_from;
+    int address;
+};
+
+static struct AnalysisJob analysis_queue[ANALYSIS_QUEUE_SIZE];
+// Only written by producer
+static unsigned int analysis_head;
+// Only written by consumer
+static unsigned int analysis_tail;
+static rom_reader analysis_reader;
+static pthread_t analysis_thread;
+// Set by the analysis thread from picking up a batch until it is committed
+static int analysis_active;
+// Analysis thread sleeps on this until jobs are queued
+static pthread_mutex_t analysis_wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t analysis_wake = PTHREAD_COND_INITIALIZER;
+
+int analysis_enqueue(int referenced_from, int address)
+{
+    unsigned int head = __atomic_load_n(&analysis_head, __ATOMIC_RELAXED);
+    unsigned int tail = __atomic_load_n(&analysis_tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == ANALYSIS_QUEUE_SIZE)
+    {
+        return 0;
+    }
+
+    struct AnalysisJob *job = &analysis_queue[head % ANALYSIS_QUEUE_SIZE];
+    job->referenced_from = referenced_from;
+    job->address = address;
+    __atomic_store_n(&analysis_head, head + 1, __ATOMIC_RELEASE);
+
+    // Only held by the analysis thread while it checks the queue, never during analysis
+    pthread_mutex_lock(&analysis_wake_mutex);
+    pthread_cond_signal(&analysis_wake);
+    pthread_mutex_unlock(&analysis_wake_mutex);
+
+    return 1;
+}
+
+int analysis_pending(void)
+{
+    return __atomic_load_n(&analysis_head, __ATOMIC_ACQUIRE) - __atomic_load_n(&analysis_tail, __ATOMIC_ACQUIRE);
+}
+
+int analysis_busy(void)
+{
+    // Worker raises the flag before it dequeues, so there is no window where both read as idle
+    return __atomic_load_n(&analysis_active, __ATOMIC_ACQUIRE) || analysis_pending() > 0;
+}
+
+void analysis_set_progress_hook(analysis_progress_hook hook)
+{
+    progress_hook = hook;
+}
+
+static void *analysis_worker(void *arg)
+{
+    while (1)
+    {
+        // Nothing queued, new code paths are rare once the game is running
+        pthread_mutex_lock(&analysis_wake_mutex);
+        while (analysis_pending() == 0)
+        {
+            pthread_cond_wait(&analysis_wake, &analysis_wake_mutex);
+        }
+        __atomic_store_n(&analysis_active, 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&analysis_wake_mutex);
+
+        // Whatever is queued now goes into the same batch, committed once the queue runs dry or the batch is full.
+        // Storage is only locked while a batch is written, debugger commands on the emulation thread don't wait for disassembly
+        pthread_mutex_lock(&extract_mutex);
+        while (analysis_pending() > 0)
+        {
+            unsigned int tail = __atomic_load_n(&analysis_tail, __ATOMIC_RELAXED);
+            struct AnalysisJob job = analysis_queue[tail % ANALYSIS_QUEUE_SIZE];
+            __atomic_store_n(&analysis_tail, tail + 1, __ATOMIC_RELEASE);
+
+            if (!is_visited(job.address))
+            {
+                struct FromTo start = {.to = job.address, .from = job.referenced_from};
+                add_visited_branch(start);
+                extract_functions_locked(job.referenced_from, job.address, analysis_reader);
+            }
+        }
+        commit_batch();
+        pthread_mutex_unlock(&extract_mutex);
+        __atomic_store_n(&analysis_active, 0, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+void analysis_start(rom_reader read_rom)
+{
+    if (analysis_reader != NULL)
+    {
+        return;
+    }
+
+    analysis_reader = read_rom;
+    if (pthread_create(&analysis_thread, NULL, analysis_worker, NULL) != 0)
+    {
+        printf("failed to start analysis thread\n");
+        analysis_reader = NULL;
+        return;
+    }
+
+    pthread_detach(analysis_thread);
+}
+
 uint32_t endian_swap(uint32_t x)
 {
     return (x >> 24) |
@@ -898,21 +1073,24 @@ void simulate_function(struct Function f, rom_reader read_rom)
 }
 
 // Returns results of executing instruction at address - used to show helpful hints on the assembly line
+// Capstone handles can't be shared between threads, this one is not used by the analysis thread
+static csh simulate_handle;
+
 void simulate_instruction(uint32_t address, uint32_t dar[16], char *comment, rom_reader read_memory)
 {
-    if (handle == 0)
+    if (simulate_handle == 0)
     {
-        if (cs_open(CS_ARCH_M68K, CS_MODE_M68K_000, &handle) != CS_ERR_OK)
+        if (cs_open(CS_ARCH_M68K, CS_MODE_M68K_000, &simulate_handle) != CS_ERR_OK)
             return;
 
-        if (cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON) != CS_ERR_OK)
+        if (cs_option(simulate_handle, CS_OPT_DETAIL, CS_OPT_ON) != CS_ERR_OK)
             return;
     }
 
     cs_insn *insns;
     size_t length = 10;
     unsigned char *code = read_memory(length, address);
-    int count = cs_disasm(handle, code, length, address, 1, &insns);
+    int count = cs_disasm(simulate_handle, code, length, address, 1, &insns);
     if (count > 0)
     {
         cs_insn insn = insns[0];
@@ -950,11 +1128,17 @@ void populate_data(FILE *pFile, int address, int length, int size)
         sizeCode = 'l';
     }
 
+    char mnemonic[5];
+    char op_str[10];
+    sprintf(mnemonic, "dc.%c", sizeCode);
+
+    storage_begin();
     for (int i = 0; i < length; i += size)
     {
-        run_sql("INSERT INTO  \"instructions\" (\"address\", \"mnemonic\", \"op_str\") VALUES ('%d', 'dc.%c', '%02X');",
-                i, sizeCode, endian_swap(*((uint32_t *)code + (i / size))));
+        sprintf(op_str, "%02X", endian_swap(*((uint32_t *)code + (i / size))));
+        store_instruction(i, mnemonic, op_str, 0, 0);
     }
+    storage_commit();
 }
 
 static uint32_t read_rom_uint(FILE *pFile, uint32_t address)
@@ -986,16 +1170,6 @@ rom_reader init_file_reader(char *filename)
     return read_from_file;
 }
 
-struct SqlResult must_run_sql(const char *sql)
-{
-    struct SqlResult result = run_sql(sql);
-    if (result.zErrMsg)
-    {
-        printf("SQL error: %s\n", result.zErrMsg);
-        exit(1);
-    }
-}
-
 #ifdef OWN_APP
 int main(int argc, char **argv)
 {
@@ -1008,10 +1182,7 @@ int main(int argc, char **argv)
     init_db(argv[1]);
 
     printf("db connected\n");
-    must_run_sql("DELETE FROM \"instructions\";");
-    must_run_sql("DELETE FROM \"functions\";");
-    must_run_sql("DELETE FROM \"jump_tables\";");
-    must_run_sql("DELETE FROM \"labels\" WHERE source = 'system';");
+    storage_clear_analysis();
 
     init_file_reader(argv[1]);
 
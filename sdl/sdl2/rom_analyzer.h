@@ -4,6 +4,18 @@
 
 typedef unsigned char *(*rom_reader)(unsigned int length, unsigned int address);
 int extract_functions(int referenced_from, int address, rom_reader read_rom);
+// Starts background thread that extracts functions queued by analysis_enqueue()
+void analysis_start(rom_reader read_rom);
+// Lock-free, safe to call from emulation thread. Returns 0 if queue is full.
+int analysis_enqueue(int referenced_from, int address);
+// Number of queued jobs the analysis thread hasn't picked up yet
+int analysis_pending(void);
+// Non-zero while jobs are queued or the analysis thread hasn't committed its batch yet
+int analysis_busy(void);
+
+// Called from analysis thread after every committed batch
+typedef void (*analysis_progress_hook)(int functions, int instructions, int pending);
+void analysis_set_progress_hook(analysis_progress_hook hook);
 void simulate_instruction(uint32_t address, uint32_t dar[16], char *comment, rom_reader read_rom);
 rom_reader init_file_reader(char *filename);
 
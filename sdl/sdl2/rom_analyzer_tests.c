@@ -3,6 +3,7 @@
 #include "rom_analyzer_tests.h"
 #include "munit/munit.h"
 #include "storage_tests.h"
+#include "dwarf_tests.h"
 #include "rom_analyzer.h"
 #include "extract_function.h"
 
@@ -103,6 +104,7 @@ int main(int argc, char *argv[])
 {
   const MunitSuite suites[] = {
       storage_suite,
+      dwarf_suite,
       {NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE},
   };
   const MunitSuite suite = {
@@ -5,10 +5,11 @@
 #include <unistd.h>
 #include <ws.h>
 #include <string.h>
-#include <math.h>
+#include <pthread.h>
 
 // To get access to CPU registers
 #include "m68k.h"
+#include "server.h"
 #include "storage.h"
 // To unpause emu
 #include "main.h"
@@ -28,9 +29,173 @@
 
 #include "dwarf.h"
 
-char *regs_as_json();
-char *read_memory_as_json(uint32_t address, uint16_t size, char *type);
-uint32_t read_number_token();
+// For send_mem_updates()
+#include "mem_watch.h"
+
+// Commands are text lines, one message can carry many of them separated by '\n'.
+// A line prefixed with "#<id> " gets its reply tagged with that id:
+// - JSON replies are wrapped as { "id": <id>, "reply": <json> }
+// - binary replies carry it in the header
+// - commands without a reply are acknowledged with { "id": <id> }
+// Lines without an id behave as before and replies are sent in the order of commands.
+
+// Binary frames, sent with ws_sendframe_bin(). All fields are little endian:
+//   u8  version  - WS_FRAME_VERSION, bumped on any layout change
+//   u8  type     - enum ws_frame_type
+//   u8  mem_type - enum ws_mem_type, 0 for non-memory frames
+//   u8  reserved
+//   u32 id       - id of the command this frame replies to, 0 if not a reply
+//   u32 address  - first byte of the payload in mem_type address space
+//   u32 length   - payload length in bytes
+// followed by the raw payload
+#define WS_FRAME_VERSION 2
+#define WS_FRAME_HEADER_SIZE 16
+
+enum ws_frame_type
+{
+	WS_FRAME_MEM = 1,
+	// 27 u32 registers followed by NUL terminated comment, file_path and function_name
+	WS_FRAME_REGS = 2,
+	// Changed parts of subscribed memory, runs of u32 address, u32 length and raw bytes. Header address is 0.
+	WS_FRAME_MEM_DELTA = 3,
+	// Profiled frames (see profiler.h), header address is the number of subsystems (n). One record per frame:
+	// u32 frame, n x u32 nanoseconds, n x u32 calls, u32 68k instructions, u32 DMA bytes, u32 FM samples
+	WS_FRAME_PROFILE = 4
+};
+
+enum ws_mem_type
+{
+	WS_MEM_ROM = 0,
+	WS_MEM_VRAM = 1,
+	WS_MEM_CRAM = 2,
+	WS_MEM_Z80 = 3,
+	WS_MEM_VSRAM = 4
+};
+
+// How each watched region is read and addressed in WS_FRAME_MEM_DELTA frames
+static const struct
+{
+	char *type;
+	enum ws_mem_type mem_type;
+	uint32_t base;
+} watch_regions[WATCH_REGIONS] = {
+	[WATCH_VRAM] = {"vram", WS_MEM_VRAM, 0},
+	[WATCH_CRAM] = {"cram", WS_MEM_CRAM, 0},
+	[WATCH_VSRAM] = {"vsram", WS_MEM_VSRAM, 0},
+	[WATCH_RAM] = {"ram", WS_MEM_ROM, 0xFF0000},
+	[WATCH_ZRAM] = {"z80", WS_MEM_Z80, 0xA00000},
+};
+
+unsigned char *regs_as_frame(uint32_t *frame_size);
+unsigned char *read_memory_as_frame(uint32_t address, uint32_t size, char *type, uint32_t *frame_size);
+
+// Splits a command line on spaces. Unlike strtok() it keeps no hidden state.
+struct tokens
+{
+	char *pos;
+};
+
+static void run_command(ws_cli_conn_t *client, uint32_t id, char *command);
+static void send_reply(ws_cli_conn_t *client, uint32_t id, char *message, unsigned char *frame, uint32_t frame_size);
+static void run_asm_requests(void);
+static char *next_token(struct tokens *t);
+static char *rest_of_line(struct tokens *t);
+uint32_t read_number_token(struct tokens *t);
+int watch_region_from_type(char *type, uint32_t address, watch_region_t *region, uint32_t *offset);
+
+static unsigned char *put_u32(unsigned char *pos, uint32_t value)
+{
+	pos[0] = value;
+	pos[1] = value >> 8;
+	pos[2] = value >> 16;
+	pos[3] = value >> 24;
+	return pos + 4;
+}
+
+/**
+ * Allocates a frame with room for @p length payload bytes and fills in the header.
+ * Returns pointer to the frame, payload starts at WS_FRAME_HEADER_SIZE.
+ */
+static unsigned char *frame_alloc(enum ws_frame_type type, enum ws_mem_type mem_type, uint32_t address, uint32_t length)
+{
+	unsigned char *frame = malloc(WS_FRAME_HEADER_SIZE + length);
+	frame[0] = WS_FRAME_VERSION;
+	frame[1] = type;
+	frame[2] = mem_type;
+	frame[3] = 0;
+	put_u32(put_u32(put_u32(frame + 4, 0), address), length);
+
+	return frame;
+}
+
+#ifdef USE_PROFILER
+// "enable profile": frames profiled since last one sent are streamed after every frame
+static int profile_stream;
+static uint32_t profile_sent;
+
+/**
+ * Returns a WS_FRAME_PROFILE frame with the frames profiled after frame @p since (possibly none)
+ * and stores the number of the last one in @p last.
+ */
+static unsigned char *profile_as_frame(uint32_t since, uint32_t *last, uint32_t *frame_size)
+{
+	static profile_frame_t frames[PROFILE_FRAMES];
+	const uint32_t record_size = (1 + 2 * PROF_MAX + 3) * 4;
+
+	int count = profiler_read(since, frames, PROFILE_FRAMES);
+	unsigned char *frame = frame_alloc(WS_FRAME_PROFILE, WS_MEM_ROM, PROF_MAX, count * record_size);
+	unsigned char *pos = frame + WS_FRAME_HEADER_SIZE;
+	for (int i = 0; i < count; i++)
+	{
+		const profile_frame_t *f = &frames[i];
+		double ns_per_tick = f->frame_ticks ? (double)f->frame_ns / f->frame_ticks : 0;
+
+		pos = put_u32(pos, f->frame);
+		for (int id = 0; id < PROF_MAX; id++)
+		{
+			pos = put_u32(pos, f->ticks[id] * ns_per_tick);
+		}
+		for (int id = 0; id < PROF_MAX; id++)
+		{
+			pos = put_u32(pos, f->calls[id]);
+		}
+		pos = put_u32(put_u32(put_u32(pos, f->m68k_instructions), f->dma_bytes), f->fm_samples);
+		*last = f->frame;
+	}
+
+	*frame_size = WS_FRAME_HEADER_SIZE + count * record_size;
+	return frame;
+}
+#endif
+
+// Commands received by the server thread, run by the emulation thread in run_commands()
+struct command
+{
+	struct command *next;
+	ws_cli_conn_t *client;
+	char text[];
+};
+
+static pthread_mutex_t command_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct command *command_head;
+static struct command **command_tail = &command_head;
+// Connected clients, guarded by command_mutex
+static int client_count;
+
+/**
+ * @brief Appends a command to the queue, command_mutex must be held.
+ */
+static void queue_command(ws_cli_conn_t *client, const unsigned char *text, uint64_t size)
+{
+	struct command *cmd = malloc(sizeof(struct command) + size + 1);
+	cmd->next = NULL;
+	cmd->client = client;
+	memcpy(cmd->text, text, size);
+	cmd->text[size] = 0;
+
+	*command_tail = cmd;
+	command_tail = &cmd->next;
+}
 
 /**
  * @brief Called when a client connects to the server.
@@ -47,6 +212,10 @@ void onopen(ws_cli_conn_t *client)
 #ifndef DISABLE_VERBOSE
 	printf("Connection opened, addr: %s, port: %s\n", cli, port);
 #endif
+
+	pthread_mutex_lock(&command_mutex);
+	client_count++;
+	pthread_mutex_unlock(&command_mutex);
 }
 
 /**
@@ -63,6 +232,16 @@ void onclose(ws_cli_conn_t *client)
 #ifndef DISABLE_VERBOSE
 	printf("Connection closed, addr: %s\n", cli);
 #endif
+
+	// Nobody is left to receive memory deltas, drop subscriptions (and the write hooks they need)
+	// on the emulation thread, queued after the last commands of the client
+	pthread_mutex_lock(&command_mutex);
+	if (--client_count == 0)
+	{
+		const char unsub_all[] = "unsub all";
+		queue_command(NULL, (const unsigned char *)unsub_all, sizeof(unsub_all) - 1);
+	}
+	pthread_mutex_unlock(&command_mutex);
 }
 
 /**
@@ -72,7 +251,12 @@ void debug_event_handler(dbg_event_t type, void *data)
 {
 	if (type == DBG_STEP)
 	{
-		ws_sendframe_txt(NULL, regs_as_json());
+		send_mem_updates();
+
+		uint32_t frame_size;
+		unsigned char *frame = regs_as_frame(&frame_size);
+		ws_sendframe_bin(NULL, (const char *)frame, frame_size);
+		free(frame);
 	}
 
 	if (type == DBG_YM2612)
@@ -82,13 +266,90 @@ void debug_event_handler(dbg_event_t type, void *data)
 	}
 }
 
+/**
+ * @brief Called from analysis thread each time a batch of functions is stored
+ */
+void analysis_progress_handler(int functions, int instructions, int pending)
+{
+	char message[150];
+	sprintf(message, "{ \"type\": \"analysis\", \"functions\": %d, \"instructions\": %d, \"pending\": %d }",
+			functions, instructions, pending);
+	ws_sendframe_txt(NULL, message);
+}
+
 void send_cram_values()
 {
-	ws_sendframe_txt(NULL, read_memory_as_json(0, 32 * 4, "cram"));
+	uint32_t frame_size;
+	unsigned char *frame = read_memory_as_frame(0, 32 * 4, "cram", &frame_size);
+	ws_sendframe_bin(NULL, (const char *)frame, frame_size);
+	free(frame);
 }
 
 /**
- * @brief Called when a client connects to the server.
+ * @brief Sends subscribed memory written since the previous call, once per frame from the emulation thread
+ */
+void send_mem_updates()
+{
+	static unsigned int runs[(WATCH_WORDS * 16 + 1) * 2];
+
+	if (!mem_watch_active())
+	{
+		return;
+	}
+
+	for (int region = 0; region < WATCH_REGIONS; region++)
+	{
+		int count = mem_watch_collect(region, runs);
+		if (count == 0)
+		{
+			continue;
+		}
+
+		uint32_t length = 0;
+		for (int i = 0; i < count; i++)
+		{
+			length += 8 + runs[i * 2 + 1];
+		}
+
+		unsigned char *frame = frame_alloc(WS_FRAME_MEM_DELTA, watch_regions[region].mem_type, 0, length);
+		unsigned char *pos = frame + WS_FRAME_HEADER_SIZE;
+		for (int i = 0; i < count; i++)
+		{
+			uint32_t address = watch_regions[region].base + runs[i * 2];
+			uint32_t size = runs[i * 2 + 1];
+			pos = put_u32(put_u32(pos, address), size);
+			read_memory_block(pos, address, size, watch_regions[region].type);
+			pos += size;
+		}
+
+		ws_sendframe_bin(NULL, (const char *)frame, WS_FRAME_HEADER_SIZE + length);
+		free(frame);
+	}
+}
+
+/**
+ * @brief Sends frames profiled since the previous call when "enable profile" is on, once per frame from the emulation thread
+ */
+void send_profile_updates()
+{
+#ifdef USE_PROFILER
+	if (!profile_stream)
+	{
+		return;
+	}
+
+	uint32_t frame_size;
+	unsigned char *frame = profile_as_frame(profile_sent, &profile_sent, &frame_size);
+	if (frame_size > WS_FRAME_HEADER_SIZE)
+	{
+		ws_sendframe_bin(NULL, (const char *)frame, frame_size);
+	}
+	free(frame);
+#endif
+}
+
+/**
+ * @brief Called when a client sends a message. Message is queued for the emulation thread.
  *
  * @param client Client connection. The @p client parameter is used
  * in order to send messages and retrieve informations about the
@@ -111,21 +372,149 @@ void onmessage(ws_cli_conn_t *client,
 		   msg, size, type, cli);
 #endif
 
+	pthread_mutex_lock(&command_mutex);
+	queue_command(client, msg, size);
+	pthread_mutex_unlock(&command_mutex);
+}
+
+/**
+ * @brief Runs commands queued since the last call. Called from the emulation loop
+ * between frames and whenever debugger stops, so commands never race the CPU core.
+ */
+void run_commands()
+{
+	run_asm_requests();
+
+	pthread_mutex_lock(&command_mutex);
+	struct command *cmd = command_head;
+	command_head = NULL;
+	command_tail = &command_head;
+	pthread_mutex_unlock(&command_mutex);
+
+	while (cmd != NULL)
+	{
+		char *line = cmd->text;
+		while (line != NULL)
+		{
+			char *next = strchr(line, '\n');
+			if (next != NULL)
+			{
+				*next++ = 0;
+			}
+
+			size_t len = strlen(line);
+			if (len && line[len - 1] == '\r')
+			{
+				line[len - 1] = 0;
+			}
+
+			// Optional "#<id> " prefix
+			uint32_t id = 0;
+			if (line[0] == '#')
+			{
+				id = strtoul(line + 1, &line, 10);
+				while (*line == ' ')
+				{
+					line++;
+				}
+			}
+
+			if (line[0] != 0)
+			{
+				run_command(cmd->client, id, line);
+			}
+
+			line = next;
+		}
+
+		struct command *done = cmd;
+		cmd = cmd->next;
+		free(done);
+	}
+}
+
+// "asm" requests waiting for the analysis thread, only touched by the emulation thread
+struct asm_request
+{
+	struct asm_request *next;
+	ws_cli_conn_t *client;
+	uint32_t id;
+	uint32_t address;
+	uint32_t index;
+	uint16_t size;
+};
+
+static struct asm_request *asm_head;
+static struct asm_request **asm_tail = &asm_head;
+
+static void defer_asm_request(ws_cli_conn_t *client, uint32_t id, uint32_t address, uint32_t index, uint16_t size)
+{
+	struct asm_request *req = malloc(sizeof(struct asm_request));
+	req->next = NULL;
+	req->client = client;
+	req->id = id;
+	req->address = address;
+	req->index = index;
+	req->size = size;
+
+	*asm_tail = req;
+	asm_tail = &req->next;
+}
+
+/**
+ * @brief Replies to deferred "asm" requests once the analysis thread has committed
+ * everything queued. Still missing instructions are reported as an error, like before.
+ */
+static void run_asm_requests(void)
+{
+	if (asm_head == NULL || analysis_busy())
+	{
+		return;
+	}
+
+	struct asm_request *req = asm_head;
+	asm_head = NULL;
+	asm_tail = &asm_head;
+
+	while (req != NULL)
+	{
+		char *message = NULL;
+		storage_lock();
+		disasm_as_json(req->index, req->address, req->size, &message);
+		storage_unlock();
+		send_reply(req->client, req->id, message, NULL, 0);
+
+		struct asm_request *done = req;
+		req = req->next;
+		free(done);
+	}
+}
+
+/**
+ * @brief Runs a single command line and sends its reply.
+ *
+ * @param id Request id to tag the reply with, 0 if client didn't provide one.
+ */
+static void run_command(ws_cli_conn_t *client, uint32_t id, char *command)
+{
 	char *message = NULL;
+	unsigned char *frame = NULL;
+	uint32_t frame_size = 0;
 
-	if (strcmp((const char *)msg, "regs") == 0)
+	if (strcmp(command, "regs") == 0)
 	{
-		message = regs_as_json();
+		frame = regs_as_frame(&frame_size);
 	}
 
 	// Format: "regs set <reg> <value>"
-	if (strstr((const char *)msg, "regs set") == (const char *)msg)
+	if (strstr(command, "regs set") == command)
 	{
-		strtok((char *)msg, " ");
-		strtok(NULL, " "); // Skip "set"
+		struct tokens t = {command};
+		next_token(&t);
+		next_token(&t); // Skip "set"
 
-		m68k_register_t reg = read_number_token();
-		uint32_t value = read_number_token();
+		m68k_register_t reg = read_number_token(&t);
+		uint32_t value = read_number_token(&t);
 
 		m68k_set_reg(reg, value);
 	}
@@ -134,37 +523,55 @@ void onmessage(ws_cli_conn_t *client,
 	// Pass either <address> or <index>
 	// <address> is used when retrieving by PC
 	// <index> is used when free scrolling
-	if (strstr((const char *)msg, "asm") == (const char *)msg)
+	if (strstr(command, "asm") == command)
 	{
-		strtok((char *)msg, " ");
+		struct tokens t = {command};
+		next_token(&t);
 
-		uint32_t address = read_number_token();
-		uint32_t index = read_number_token();
-		uint16_t size = atoi(strtok(NULL, " "));
+		uint32_t address = read_number_token(&t);
+		uint32_t index = read_number_token(&t);
+		uint16_t size = read_number_token(&t);
+		storage_lock();
 		int rc = disasm_as_json(index, address, size, &message);
+		storage_unlock();
+		// Analysis thread extracts the function, reply is sent by run_asm_requests() once it's done
 		if (rc == STORAGE_INSTRUCTION_MISSING)
 		{
-			extract_functions(0, address, read_memory);
-			disasm_as_json(index, address, size, &message);
+			start_function_analysis();
+			if (analysis_enqueue(0, address))
+			{
+				free(message);
+				defer_asm_request(client, id, address, index, size);
+				return;
+			}
 		}
 	}
 
-	if (strcmp((const char *)msg, "step_over_line") == 0)
+	if (strcmp(command, "step_over_line") == 0)
 	{
-		dwarf_ask_t *dwarf_info = dwarf_ask(m68k.pc);
-		dbg_step_over_line = dwarf_info->line_number;
-		dbg_trace = 0;
-		pause_emu = 0;
+		dwarf_ask_t dwarf_info;
+		if (dwarf_ask(m68k.pc, &dwarf_info))
+		{
+			dbg_step_over_line = dwarf_info.line_number;
+			dbg_trace = 0;
+			pause_emu = 0;
+		}
+		else
+		{
+			// No line info here, fall back to a single step
+			dbg_trace = 1;
+			pause_emu = 0;
+		}
 	}
 
-	if (strcmp((const char *)msg, "step_over") == 0)
+	if (strcmp(command, "step_over") == 0)
 	{
 		dbg_step_over = 1;
 		dbg_trace = 1;
 		pause_emu = 0;
 	}
 
-	if (strcmp((const char *)msg, "step") == 0)
+	if (strcmp(command, "step") == 0)
 	{
 		dbg_step_over = 0;
 		dbg_step_over_line = 0;
@@ -172,7 +579,7 @@ void onmessage(ws_cli_conn_t *client,
 		pause_emu = 0;
 	}
 
-	if (strcmp((const char *)msg, "run") == 0)
+	if (strcmp(command, "run") == 0)
 	{
 		dbg_step_over = 0;
 		dbg_step_over_line = 0;
@@ -180,61 +587,157 @@ void onmessage(ws_cli_conn_t *client,
 		pause_emu = 0;
 	}
 
-	if (strcmp((const char *)msg, "reset") == 0)
+	if (strcmp(command, "reset") == 0)
 	{
 		system_reset();
-		message = regs_as_json();
+		frame = regs_as_frame(&frame_size);
 	}
 
-	if (strcmp((const char *)msg, "funcs") == 0)
+	if (strcmp(command, "funcs") == 0)
 	{
+		storage_lock();
 		message = funcs();
+		storage_unlock();
 	}
 
-	if (strcmp((const char *)msg, "enable break_in_interrupts") == 0)
+	if (strcmp(command, "enable break_in_interrupts") == 0)
 	{
 		break_in_interrupt = 1;
 	}
 
-	if (strcmp((const char *)msg, "disable break_in_interrupts") == 0)
+	if (strcmp(command, "disable break_in_interrupts") == 0)
 	{
 		break_in_interrupt = 0;
 	}
 
-	// Format: "mem <address> <size> (<type: "vram" | "cram">)"
-	if (strstr((const char *)msg, "mem ") == (const char *)msg)
+	if (strcmp(command, "enable rom_log") == 0)
+	{
+		set_rom_log(1);
+	}
+
+	if (strcmp(command, "disable rom_log") == 0)
+	{
+		set_rom_log(0);
+	}
+
+	if (strcmp(command, "enable discovery") == 0)
+	{
+		set_function_discovery(1);
+	}
+
+	if (strcmp(command, "disable discovery") == 0)
+	{
+		set_function_discovery(0);
+	}
+
+#ifdef USE_PROFILER
+	// Format: "profile (<since>)", replies with a WS_FRAME_PROFILE frame of the frames profiled after
+	// frame number <since> that are still held (last PROFILE_FRAMES)
+	if (strcmp(command, "profile") == 0 || strstr(command, "profile ") == command)
+	{
+		struct tokens t = {command};
+		next_token(&t);
+
+		uint32_t since = read_number_token(&t);
+		uint32_t last;
+		frame = profile_as_frame(since, &last, &frame_size);
+	}
+
+	// Profiled frames are then sent after every frame, starting with the ones held
+	if (strcmp(command, "enable profile") == 0)
+	{
+		profile_stream = 1;
+		profile_sent = 0;
+	}
+
+	if (strcmp(command, "disable profile") == 0)
+	{
+		profile_stream = 0;
+	}
+#endif
+
+	// Format: "mem <address> <size> (<type: "vram" | "cram" | "vsram" | "z80">)", replies with a WS_FRAME_MEM frame
+	if (strstr(command, "mem ") == command)
+	{
+		struct tokens t = {command};
+		next_token(&t);
+
+		uint32_t address = read_number_token(&t);
+		uint32_t size = read_number_token(&t);
+		char *type = next_token(&t);
+		frame = read_memory_as_frame(address, size, type, &frame_size);
+	}
+
+	// Format: "sub <memtype> <address> <size>", memtype: "vram" | "cram" | "vsram" | "ram" | "z80"
+	// Changed blocks are sent with WS_FRAME_MEM_DELTA frames after every frame, starting with the whole range
+	if (strstr(command, "sub ") == command)
 	{
-		strtok((char *)msg, " ");
+		struct tokens t = {command};
+		next_token(&t);
+
+		char *mem_type = next_token(&t);
+		uint32_t address = read_number_token(&t);
+		uint32_t size = read_number_token(&t);
 
-		uint32_t address = read_number_token();
-		uint16_t size = atoi(strtok(NULL, " "));
-		char *type = strtok(NULL, " ");
-		message = read_memory_as_json(address, size, type);
-		printf("reading addr: %u, with size: %d, val: %s\n", address, size, message);
+		watch_region_t region;
+		uint32_t offset;
+		if (watch_region_from_type(mem_type, address, &region, &offset))
+		{
+			mem_watch_subscribe(region, offset, size);
+			update_hook_mask();
+		}
+	}
+
+	// Format: "unsub <memtype> <address> <size>"
+	if (strstr(command, "unsub ") == command && strcmp(command, "unsub all") != 0)
+	{
+		struct tokens t = {command};
+		next_token(&t);
+
+		char *mem_type = next_token(&t);
+		uint32_t address = read_number_token(&t);
+		uint32_t size = read_number_token(&t);
+
+		watch_region_t region;
+		uint32_t offset;
+		if (watch_region_from_type(mem_type, address, &region, &offset))
+		{
+			mem_watch_unsubscribe(region, offset, size);
+			update_hook_mask();
+		}
+	}
+
+	// Format: "unsub all"
+	if (strcmp(command, "unsub all") == 0)
+	{
+		mem_watch_clear();
+		update_hook_mask();
 	}
 
 	// Format: "memw <address> <value> <memtype>"
-	if (strstr((const char *)msg, "memw ") == (const char *)msg)
+	if (strstr(command, "memw ") == command)
 	{
-		strtok((char *)msg, " ");
+		struct tokens t = {command};
+		next_token(&t);
 
-		uint32_t address = read_number_token();
-		uint16_t value = read_number_token();
-		char *mem_type = strtok(NULL, " ");
+		uint32_t address = read_number_token(&t);
+		uint16_t value = read_number_token(&t);
+		char *mem_type = next_token(&t);
 		write_memory_byte(address, value, mem_type);
 	}
 
 	// Format: "bpt add <address> <type> (<condition: "value_equal">)"
-	if (strstr((const char *)msg, "bpt add ") == (const char *)msg)
+	if (strstr(command, "bpt add ") == command)
 	{
-		strtok((char *)msg, " ");
-		strtok(NULL, " "); // Skip "add"
+		struct tokens t = {command};
+		next_token(&t);
+		next_token(&t); // Skip "add"
 
-		uint32_t address = read_number_token();
-		uint16_t type = read_number_token();
+		uint32_t address = read_number_token(&t);
+		uint16_t type = read_number_token(&t);
 
-		char *condition_provided = strtok(NULL, " ");
-		uint32_t value_equal_num;
+		char *condition_provided = next_token(&t);
+		uint32_t value_equal_num = 0;
 		if (condition_provided != NULL)
 		{
 			value_equal_num = strtol(condition_provided, NULL, 0);
@@ -244,63 +747,149 @@ void onmessage(ws_cli_conn_t *client,
 	}
 
 	// Format: "bpt clear_all"
-	if (strcmp((const char *)msg, "bpt clear_all") == 0)
+	if (strcmp(command, "bpt clear_all") == 0)
 	{
 		clear_bpt_list();
 	}
 
 	// Format: "fn name <address> <name>"
-	if (strstr((const char *)msg, "fn name ") == (const char *)msg)
+	if (strstr(command, "fn name ") == command)
 	{
-		strtok((char *)msg, " ");
-		strtok(NULL, " "); // Skip "name"
+		struct tokens t = {command};
+		next_token(&t);
+		next_token(&t); // Skip "name"
 
-		uint32_t address = read_number_token();
-		char *name = strtok(NULL, " ");
+		uint32_t address = read_number_token(&t);
+		char *name = next_token(&t);
 
+		storage_lock();
 		create_label(address, name);
+		storage_unlock();
 	}
 
 	// Format: "fn comment <address> <comment>"
-	if (strstr((const char *)msg, "fn comment ") == (const char *)msg)
+	if (strstr(command, "fn comment ") == command)
 	{
-		strtok((char *)msg, " ");
-		strtok(NULL, " "); // Skip "comment"
+		struct tokens t = {command};
+		next_token(&t);
+		next_token(&t); // Skip "comment"
 
-		uint32_t address = read_number_token();
-		char *comment = strtok(NULL, "");
+		uint32_t address = read_number_token(&t);
+		char *comment = rest_of_line(&t);
 
+		storage_lock();
 		add_function_comment(address, comment);
+		storage_unlock();
 	}
 
 	// Format: "add comment <address> <comment>"
-	if (strstr((const char *)msg, "add comment ") == (const char *)msg)
+	if (strstr(command, "add comment ") == command)
 	{
-		strtok((char *)msg, " ");
-		strtok(NULL, " "); // Skip "comment"
+		struct tokens t = {command};
+		next_token(&t);
+		next_token(&t); // Skip "comment"
 
-		uint32_t address = read_number_token();
-		char *comment = strtok(NULL, "");
+		uint32_t address = read_number_token(&t);
+		char *comment = rest_of_line(&t);
 
+		storage_lock();
 		add_comment(address, comment);
+		storage_unlock();
+	}
+
+	send_reply(client, id, message, frame, frame_size);
+}
+
+/**
+ * @brief Sends reply to a command, tagged with request @p id. Frees @p message and @p frame.
+ */
+static void send_reply(ws_cli_conn_t *client, uint32_t id, char *message, unsigned char *frame, uint32_t frame_size)
+{
+	if (message == NULL && frame == NULL && id)
+	{
+		char ack[40];
+		sprintf(ack, "{ \"id\": %u }", id);
+		ws_sendframe_txt(client, ack);
 	}
 
 	if (message != NULL)
 	{
+		if (id)
+		{
+			char *reply = malloc(strlen(message) + 40);
+			sprintf(reply, "{ \"id\": %u, \"reply\": %s }", id, message);
+			free(message);
+			message = reply;
+		}
+
 		ws_sendframe_txt(client, message);
 		free(message);
 	}
+
+	if (frame != NULL)
+	{
+		put_u32(frame + 4, id);
+		ws_sendframe_bin(client, (const char *)frame, frame_size);
+		free(frame);
+	}
+}
+
+/**
+ * Returns next space separated token, NULL at the end of line.
+ * Token is terminated in place.
+ */
+static char *next_token(struct tokens *t)
+{
+	char *pos = t->pos;
+	while (*pos == ' ')
+	{
+		pos++;
+	}
+
+	if (*pos == 0)
+	{
+		t->pos = pos;
+		return NULL;
+	}
+
+	char *token = pos;
+	while (*pos != 0 && *pos != ' ')
+	{
+		pos++;
+	}
+
+	if (*pos != 0)
+	{
+		*pos++ = 0;
+	}
+
+	t->pos = pos;
+	return token;
+}
+
+/**
+ * Returns whatever is left of the line (e.g. comment text), NULL if nothing.
+ */
+static char *rest_of_line(struct tokens *t)
+{
+	char *rest = t->pos;
+	t->pos += strlen(rest);
+	return *rest ? rest : NULL;
 }
 
 /**
  * Reads next token in space separated line. Convert it to number.
- * Supports hexadecimal values prepended by 0x.
+ * Supports hexadecimal values prepended by 0x. Missing token reads as 0.
  */
-uint32_t read_number_token()
+uint32_t read_number_token(struct tokens *t)
 {
 	uint32_t address;
-	char *address_string = strtok(NULL, " ");
-	if (strstr(address_string, "0x") == address_string)
+	char *address_string = next_token(t);
+	if (address_string == NULL)
+	{
+		address = 0;
+	}
+	else if (strstr(address_string, "0x") == address_string)
 	{
 		address = (int)strtol(address_string, NULL, 0);
 	}
@@ -312,112 +901,134 @@ uint32_t read_number_token()
 	return address;
 }
 
-char *regs_as_json()
+/**
+ * Maps memtype and address used by "mem" command to a watched region.
+ * Returns 0 when there's nothing to watch there (e.g. ROM).
+ */
+int watch_region_from_type(char *type, uint32_t address, watch_region_t *region, uint32_t *offset)
+{
+	if (type == NULL)
+	{
+		return 0;
+	}
+
+	for (int i = 0; i < WATCH_REGIONS; i++)
+	{
+		if (strcmp(type, watch_regions[i].type) == 0)
+		{
+			*region = i;
+			*offset = address - watch_regions[i].base;
+			// Work and Z80 RAM are mirrored, accept both offsets and 68K addresses
+			if (i == WATCH_RAM || i == WATCH_ZRAM)
+			{
+				*offset = address & (mem_watch_size(i) - 1);
+			}
+
+			return 1;
+		}
+	}
+
+	// Memory viewer shows work RAM as part of 68K address space
+	if (strcmp(type, "rom") == 0 && (address & 0xE00000) == 0xE00000)
+	{
+		*region = WATCH_RAM;
+		*offset = address & 0xFFFF;
+		return 1;
+	}
+
+	return 0;
+}
+
+unsigned char *regs_as_frame(uint32_t *frame_size)
 {
 	char comment[200];
 	comment[0] = 0;
 	simulate_instruction(m68k.pc, m68k.dar, comment, read_memory);
 
-	dwarf_ask_t *dwarf_info = dwarf_ask(m68k.pc);
-
-	char *message = malloc(600);
-	sprintf(message, "{ \"type\": \"regs\", \"data\": {"
-					 "\"pc\": %d, "
-					 "\"d0\": %d, "
-					 "\"d1\": %d, "
-					 "\"d2\": %d, "
-					 "\"d3\": %d, "
-					 "\"d4\": %d, "
-					 "\"d5\": %d, "
-					 "\"d6\": %d, "
-					 "\"d7\": %d, "
-					 "\"a0\": %d, "
-					 "\"a1\": %d, "
-					 "\"a2\": %d, "
-					 "\"a3\": %d, "
-					 "\"a4\": %d, "
-					 "\"a5\": %d, "
-					 "\"a6\": %d, "
-					 "\"a7\": %d, "
-					 "\"sp\": %d, "
-					 "\"sr\": %d, "
-					 "\"prev_pc\": %d, "
-					 "\"comment\": \"%s\", "
-					 "\"ntab\": %d, "	 /* Name table A base address */
-					 "\"ntbb\": %d, "	 /* Name table B base address */
-					 "\"satb\": %d, "	 /* Sprite attribute table base address */
-					 "\"plane_w\": %d, " /* Plane width in tiles (multiply by to get pixels) */
-					 "\"plane_h\": %d, " /* Plane height in tiles */
-					 "\"file_path\": \"%s\", "
-					 "\"function_name\": \"%s\", "
-					 "\"line_number\": %d, "
-					 "\"column\": %d "
-					 "}}",
-			m68k.pc,
-			m68k.dar[0],
-			m68k.dar[1],
-			m68k.dar[2],
-			m68k.dar[3],
-			m68k.dar[4],
-			m68k.dar[5],
-			m68k.dar[6],
-			m68k.dar[7],
-			m68k.dar[8], // A0
-			m68k.dar[9],
-			m68k.dar[10],
-			m68k.dar[11],
-			m68k.dar[12],
-			m68k.dar[13],
-			m68k.dar[14],
-			m68k.dar[15], // A7
-			m68k.dar[15],
-			m68k_get_reg(M68K_REG_SR),
-			m68k.prev_pc,
-			comment,
-			ntab,
-			ntbb,
-			satb,
-			((reg[16] & 3) + 1) * 32,
-			(((reg[16] >> 4) & 3) + 1) * 32,
-			(dwarf_info ? dwarf_info->file_path : ""),
-			(dwarf_info ? dwarf_info->function_name : ""),
-			(dwarf_info ? dwarf_info->line_number : 0),
-			(dwarf_info ? dwarf_info->column : 0));
-
-	free(dwarf_info);
-
-	return message;
+	dwarf_ask_t dwarf_info = {.function_name = "", .file_path = ""};
+	dwarf_ask(m68k.pc, &dwarf_info);
+
+	// Order matches the register list decoded by ws.service.js
+	uint32_t regs[] = {
+		m68k.pc,
+		m68k.dar[0],
+		m68k.dar[1],
+		m68k.dar[2],
+		m68k.dar[3],
+		m68k.dar[4],
+		m68k.dar[5],
+		m68k.dar[6],
+		m68k.dar[7],
+		m68k.dar[8], // A0
+		m68k.dar[9],
+		m68k.dar[10],
+		m68k.dar[11],
+		m68k.dar[12],
+		m68k.dar[13],
+		m68k.dar[14],
+		m68k.dar[15], // A7
+		m68k.dar[15], // SP
+		m68k_get_reg(M68K_REG_SR),
+		m68k.prev_pc,
+		ntab,							 /* Name table A base address */
+		ntbb,							 /* Name table B base address */
+		satb,							 /* Sprite attribute table base address */
+		((reg[16] & 3) + 1) * 32,		 /* Plane width in tiles (multiply by to get pixels) */
+		(((reg[16] >> 4) & 3) + 1) * 32, /* Plane height in tiles */
+		dwarf_info.line_number,
+		dwarf_info.column};
+	const char *strings[] = {comment, dwarf_info.file_path, dwarf_info.function_name};
+
+	uint32_t length = sizeof(regs);
+	for (int i = 0; i < 3; i++)
+	{
+		length += strlen(strings[i]) + 1;
+	}
+
+	unsigned char *frame = frame_alloc(WS_FRAME_REGS, WS_MEM_ROM, 0, length);
+	unsigned char *pos = frame + WS_FRAME_HEADER_SIZE;
+	for (int i = 0; i < sizeof(regs) / sizeof(regs[0]); i++)
+	{
+		pos = put_u32(pos, regs[i]);
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		size_t len = strlen(strings[i]) + 1;
+		memcpy(pos, strings[i], len);
+		pos += len;
+	}
+
+	*frame_size = WS_FRAME_HEADER_SIZE + length;
+	return frame;
 }
 
-// type: 'rom' | 'vram' | 'cram'
-char *read_memory_as_json(uint32_t address, uint16_t size, char *type)
+// type: 'rom' | 'vram' | 'cram' | 'vsram' | 'z80'
+unsigned char *read_memory_as_frame(uint32_t address, uint32_t size, char *type, uint32_t *frame_size)
 {
-	// Each byte representation is 3 digits max (e.g. 255) plus 1 byte for comma, plus some extra bytes for template
-	char *result = malloc(size * 4 + 100);
-	char *template = "{ \"type\": \"mem\", \"mem_type\": \"%s\", \"address\": %u, \"data\": [";
-	if (type == NULL)
+	enum ws_mem_type mem_type = WS_MEM_ROM;
+	if (type != NULL)
 	{
-		type = "rom";
+		if (strcmp(type, "vram") == 0)
+			mem_type = WS_MEM_VRAM;
+		else if (strcmp(type, "cram") == 0)
+			mem_type = WS_MEM_CRAM;
+		else if (strcmp(type, "z80") == 0)
+			mem_type = WS_MEM_Z80;
+		else if (strcmp(type, "vsram") == 0)
+			mem_type = WS_MEM_VSRAM;
 	}
-	char *pos = result + sprintf(result, template, type, address);
 
-	for (int block = 0; block < ceil(size / 16.0); block++)
+	// Nothing is larger than the 68K address space
+	if (size > 0x1000000)
 	{
-		if (block > 0)
-		{
-			pos += sprintf(pos, ",");
-		}
-
-		pos += sprintf(pos, "[");
-		for (uint16_t i = block * 16; i < fmin((block + 1) * 16, size); i++)
-		{
-			char *lastChar = (i + 1 == fmin((block + 1) * 16, size)) ? "]" : ",";
-			pos += sprintf(pos, "%u%s", read_memory_byte(address + i, type), lastChar);
-		}
+		size = 0x1000000;
 	}
-	sprintf(pos, "]}");
 
-	return result;
+	unsigned char *frame = frame_alloc(WS_FRAME_MEM, mem_type, address, size);
+	read_memory_block(frame + WS_FRAME_HEADER_SIZE, address, size, type);
+
+	*frame_size = WS_FRAME_HEADER_SIZE + size;
+	return frame;
 }
 
 void start_server()
@@ -438,5 +1049,5 @@ void start_server()
 		.evs.onmessage = &onmessage});
 
 	set_debug_hook(debug_event_handler);
-	dwarf_init();
+	analysis_set_progress_hook(analysis_progress_handler);
 }
@@ -3,6 +3,12 @@
 #define _SERVER_H_
 
 extern void start_server();
+// Runs commands received since last call, must be called from the emulation thread
+void run_commands();
 void send_cram_values();
+// Sends memory changed since last call to subscribed clients
+void send_mem_updates();
+// Sends frames profiled since last call when clients enabled it
+void send_profile_updates();
 
 #endif /* _SERVER_H_ */
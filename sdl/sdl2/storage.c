@@ -1,12 +1,155 @@
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 
 #include <sqlite3.h>
+#include <pthread.h>
 #include "storage.h"
 #include <sys/stat.h>
 
 sqlite3 *db;
 
+// Set while storage_begin() transaction is open
+static int in_transaction = 0;
+
+// Disassembly listing - function comments, labels, instructions and multiline comments in address order.
+// Derived from the other tables and kept up to date by refresh_listing(), so scrolling is an index range fetch.
+// seq orders rows sharing an address, target is the address op_str refers to so label renames can find its users.
+//
+// The dense row index lives in listing_blocks: number of rows per 256 bytes of address space and the row its
+// first entry is on. Adding a comment line only shifts first_row of later blocks instead of renumbering every row.
+#define LISTING_BLOCK_SHIFT 8
+// Same shift as SQL literal
+#define LISTING_STRINGIFY(x) #x
+#define LISTING_SHIFT_SQL(x) LISTING_STRINGIFY(x)
+#define LISTING_SHIFT LISTING_SHIFT_SQL(LISTING_BLOCK_SHIFT)
+#define LISTING_SCHEMA "\
+CREATE TABLE IF NOT EXISTS \"listing\" (\"address\" integer NOT NULL, \"seq\" integer NOT NULL, \"type\" text, \"mnemonic\" text, \"op_str\" text, \"op_1\" text, \"target\" integer, \"target_name\" text, \"comment\" text, PRIMARY KEY (address, seq)) WITHOUT ROWID;\
+CREATE INDEX IF NOT EXISTS \"listing_target\" ON \"listing\" (\"target\");\
+CREATE TABLE IF NOT EXISTS \"listing_blocks\" (\"block\" integer, \"rows\" integer NOT NULL, \"first_row\" integer, PRIMARY KEY (block));\
+CREATE INDEX IF NOT EXISTS \"listing_blocks_row\" ON \"listing_blocks\" (\"first_row\");\
+CREATE INDEX IF NOT EXISTS \"ref_function\" ON \"jump_tables\" (\"function_start_address\");"
+
+// Label name replaces op_str, label address replaces op_1
+#define LISTING_COLUMNS "address, mnemonic, ifnull(target_name, op_str) AS op_str, CASE WHEN target_name IS NULL THEN op_1 ELSE printf('%X', target) END AS op_1, comment, type"
+// Rows ?1 - ?2 to ?1 + ?2, rows start at 1. Skips into the block holding the first one.
+#define LISTING_WINDOW "FROM listing WHERE address >= (SELECT block << " LISTING_SHIFT " FROM start) ORDER BY address, seq \
+LIMIT ?1 + ?2 - max(?1 - ?2, 1) + 1 OFFSET max(?1 - ?2, 1) - (SELECT first_row FROM start)"
+#define LISTING_WINDOW_START "WITH start AS (SELECT block, first_row FROM listing_blocks WHERE first_row <= max(?1 - ?2, 1) AND rows > 0 ORDER BY first_row DESC LIMIT 1) "
+
+// Queries run often enough to keep prepared, see prepare()
+enum statement
+{
+    STMT_INSERT_FUNCTION,
+    STMT_INSERT_INSTRUCTION,
+    STMT_INSERT_REFERENCE,
+    STMT_UPSERT_LABEL,
+    STMT_UPSERT_SYSTEM_LABEL,
+    STMT_DELETE_LABEL,
+    STMT_SELECT_LABEL,
+    STMT_UPSERT_COMMENT,
+    STMT_DELETE_COMMENT,
+    STMT_UPSERT_FUNCTION_COMMENT,
+    STMT_DELETE_FUNCTION_COMMENT,
+    STMT_SELECT_FUNCTIONS,
+    STMT_FUNCTIONS_JSON,
+    STMT_COUNT_INSTRUCTIONS,
+    STMT_DISASM_ROW,
+    STMT_DISASM_WINDOW,
+    STMT_DISASM_WINDOW_JSON,
+    STMT_SELECT_INSTRUCTION,
+    STMT_SELECT_COMMENT,
+    STMT_SELECT_FUNCTION_COMMENT,
+    STMT_IS_FUNCTION,
+    STMT_IS_LOCAL_BRANCH,
+    STMT_LISTING_SPAN,
+    STMT_LISTING_DELETE,
+    STMT_LISTING_INSERT,
+    STMT_LISTING_RESIZE_BLOCK,
+    STMT_LISTING_BASE,
+    STMT_LISTING_RENUMBER,
+    STMT_LISTING_RETARGET,
+    STMT_LISTING_ADDRESSES,
+    STMT_COUNT
+};
+
+static const char *statement_sql[STMT_COUNT] = {
+    [STMT_INSERT_FUNCTION] = "INSERT OR IGNORE INTO functions (start_address, end_address) VALUES (?, ?)",
+    [STMT_INSERT_INSTRUCTION] = "INSERT OR IGNORE INTO instructions (address, mnemonic, op_str, size, op_1) VALUES (?, ?, ?, ?, ?)",
+    [STMT_INSERT_REFERENCE] = "INSERT OR IGNORE INTO jump_tables (instruction_address, function_start_address, type) VALUES (?, ?, ?)",
+    // Label addresses are hex text so they can be matched against op_str
+    [STMT_UPSERT_LABEL] = "INSERT OR REPLACE INTO labels (address, name) VALUES (printf('%X', ?), ?)",
+    [STMT_UPSERT_SYSTEM_LABEL] = "INSERT OR REPLACE INTO labels (address, name, source) VALUES (printf('%X', ?), ?, 'system')",
+    [STMT_DELETE_LABEL] = "DELETE FROM labels WHERE address = printf('%X', ?)",
+    [STMT_SELECT_LABEL] = "SELECT name FROM labels WHERE address = printf('%X', ?)",
+    [STMT_UPSERT_COMMENT] = "INSERT OR REPLACE INTO instruction_comments (address, comment) VALUES (?, ?)",
+    [STMT_DELETE_COMMENT] = "DELETE FROM instruction_comments WHERE address = ?",
+    [STMT_UPSERT_FUNCTION_COMMENT] = "INSERT OR REPLACE INTO function_comments (address, comment) VALUES (?, ?)",
+    [STMT_DELETE_FUNCTION_COMMENT] = "DELETE FROM function_comments WHERE address = ?",
+    [STMT_SELECT_FUNCTIONS] = "SELECT start_address FROM functions",
+    [STMT_FUNCTIONS_JSON] = "SELECT json_group_array(json_object('start_address', start_address, 'end_address', end_address, 'name', t.name, 'references', json(t.refs), 'comment', t.comment)) from \n\
+    (SELECT \n\
+    f.*, \n\
+    NULLIF(json_group_array (( \n\
+            -- Find a function that surrounds referenced instruction \n\
+            SELECT \n\
+                json_object('address', printf ('%X', jt.instruction_address), 'func_address', printf ('%X', start_address), 'func', ref_label.name) \n\
+                FROM functions ref_f \n\
+            -- Get a label for referenced function \n\
+            LEFT JOIN labels ref_label ON ref_label.address = printf ('%X', ref_f.start_address) \n\
+        WHERE \n\
+            jt.instruction_address BETWEEN start_address \n\
+            AND end_address \n\
+        ORDER BY \n\
+            start_address DESC \n\
+        LIMIT 1)), '[null]') AS refs, \n\
+    l.name, \n\
+    fc.comment \n\
+FROM \n\
+    functions f \n\
+    LEFT JOIN jump_tables jt ON jt.function_start_address = f.start_address \n\
+    LEFT JOIN labels l ON l.address = printf ('%X', f.start_address) \n\
+    LEFT JOIN function_comments fc ON fc.address = f.start_address \n\
+GROUP BY \n\
+    f.start_address \n\
+ORDER BY \n\
+    f.start_address) t",
+    [STMT_COUNT_INSTRUCTIONS] = "SELECT first_row + rows - 1 FROM listing_blocks ORDER BY block DESC LIMIT 1",
+    [STMT_DISASM_ROW] = "SELECT (SELECT first_row FROM listing_blocks WHERE block = ?1 >> " LISTING_SHIFT ") \
++ (SELECT count(*) FROM listing WHERE address >= (?1 >> " LISTING_SHIFT ") << " LISTING_SHIFT " AND address < ?1) + seq \
+FROM listing WHERE address = ?1 AND type = ''",
+    [STMT_DISASM_WINDOW] = LISTING_WINDOW_START "SELECT " LISTING_COLUMNS " " LISTING_WINDOW,
+    [STMT_DISASM_WINDOW_JSON] = LISTING_WINDOW_START "SELECT json_group_array (json_object('address', address, 'mnemonic', mnemonic, 'op_str', op_str, 'op_1', op_1, 'comment', comment, 'type', type)) \
+FROM (SELECT " LISTING_COLUMNS " " LISTING_WINDOW ")",
+    [STMT_SELECT_INSTRUCTION] = "SELECT mnemonic, op_str, op_1 FROM instructions WHERE address = ?",
+    [STMT_SELECT_COMMENT] = "SELECT comment FROM instruction_comments WHERE address = ?",
+    [STMT_SELECT_FUNCTION_COMMENT] = "SELECT comment FROM function_comments WHERE address = ?",
+    [STMT_IS_FUNCTION] = "SELECT 1 FROM functions WHERE start_address = ?",
+    [STMT_IS_LOCAL_BRANCH] = "SELECT 1 FROM jump_tables WHERE function_start_address = ? AND type = 'local_branch' LIMIT 1",
+    [STMT_LISTING_SPAN] = "SELECT count(*) FROM listing WHERE address = ?",
+    [STMT_LISTING_DELETE] = "DELETE FROM listing WHERE address = ?",
+    [STMT_LISTING_INSERT] = "INSERT INTO listing (address, seq, type, mnemonic, op_str, op_1, target, target_name, comment) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
+    [STMT_LISTING_RESIZE_BLOCK] = "INSERT INTO listing_blocks (block, rows) VALUES (?1, ?2) ON CONFLICT (block) DO UPDATE SET rows = rows + ?2",
+    [STMT_LISTING_BASE] = "SELECT first_row + rows FROM listing_blocks WHERE block < ? ORDER BY block DESC LIMIT 1",
+    [STMT_LISTING_RENUMBER] = "UPDATE listing_blocks SET first_row = r.n \
+FROM (SELECT block, ?2 + sum(rows) OVER (ORDER BY block) - rows AS n FROM listing_blocks WHERE block >= ?1) AS r \
+WHERE listing_blocks.block = r.block",
+    [STMT_LISTING_RETARGET] = "UPDATE listing SET target_name = ?2 WHERE target = ?1",
+    [STMT_LISTING_ADDRESSES] = "SELECT address FROM instructions \
+UNION SELECT start_address FROM functions \
+UNION SELECT function_start_address FROM jump_tables WHERE type = 'local_branch' \
+UNION SELECT address FROM instruction_comments \
+UNION SELECT address FROM function_comments",
+};
+
+static sqlite3_stmt *statements[STMT_COUNT];
+
+// Blocks from this one on need their first row recalculated
+static int listing_dirty = 0;
+static uint32_t listing_dirty_from;
+
+static void listing_rebuild(void);
+
 void init_db(const char *romname)
 {
     // Copy romname so we don't trash passed value
@@ -32,6 +175,18 @@ void init_db(const char *romname)
         fclose(f);
     }
 
+    // Cached statements belong to the previous connection
+    if (db != NULL)
+    {
+        for (int i = 0; i < STMT_COUNT; i++)
+        {
+            sqlite3_finalize(statements[i]);
+            statements[i] = NULL;
+        }
+        sqlite3_close(db);
+        in_transaction = 0;
+    }
+
     int rc = sqlite3_open(filename, &db);
     if (rc != SQLITE_OK)
     {
@@ -44,6 +199,433 @@ void init_db(const char *romname)
     {
         run_sql(sql);
     }
+
+    // Lets debugger read while analyzer writes, and only syncs on checkpoints
+    run_sql("PRAGMA journal_mode=WAL");
+    run_sql("PRAGMA synchronous=NORMAL");
+
+    // Databases made before the listing existed get it built once
+    listing_dirty = 0;
+    run_sql(LISTING_SCHEMA);
+    struct SqlResult listed = run_sql("SELECT EXISTS (SELECT 1 FROM listing), EXISTS (SELECT 1 FROM instructions)");
+    if (listed.nRow == 1 && atoi(listed.aResult[2]) == 0 && atoi(listed.aResult[3]) == 1)
+    {
+        listing_rebuild();
+    }
+    sqlite3_free_table(listed.aResult);
+}
+
+// Statements are compiled on first use and reused for the lifetime of the connection
+static sqlite3_stmt *prepare(enum statement id)
+{
+    sqlite3_stmt **stmt = &statements[id];
+    if (*stmt == NULL && sqlite3_prepare_v2(db, statement_sql[id], -1, stmt, NULL) != SQLITE_OK)
+    {
+        printf("SQL error: %s\n", sqlite3_errmsg(db));
+        exit(1);
+    }
+
+    sqlite3_reset(*stmt);
+    sqlite3_clear_bindings(*stmt);
+
+    return *stmt;
+}
+
+static void step(sqlite3_stmt *stmt)
+{
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+    {
+        printf("SQL error: %s\n", sqlite3_errmsg(db));
+    }
+
+    sqlite3_reset(stmt);
+}
+
+// Runs a write statement and reports it the way run_sql() does
+static struct SqlResult step_changes(sqlite3_stmt *stmt)
+{
+    struct SqlResult r = {0};
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+    {
+        r.zErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+        printf("SQL error: %s\n", r.zErrMsg);
+    }
+    else
+    {
+        r.rowsAffected = sqlite3_changes(db);
+    }
+
+    sqlite3_reset(stmt);
+    return r;
+}
+
+// Returns a malloc'ed copy of a text column, or NULL - strdup is not available with -std=c99
+static char *column_copy(sqlite3_stmt *stmt, int column)
+{
+    const unsigned char *text = sqlite3_column_text(stmt, column);
+    if (text == NULL)
+    {
+        return NULL;
+    }
+
+    size_t size = sqlite3_column_bytes(stmt, column) + 1;
+    char *copy = malloc(size);
+    memcpy(copy, text, size);
+    return copy;
+}
+
+int storage_next(struct StorageIter *it)
+{
+    int rc = sqlite3_step(it->stmt);
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+    {
+        printf("SQL error: %s\n", sqlite3_errmsg(db));
+    }
+
+    return rc == SQLITE_ROW;
+}
+
+int64_t storage_int(struct StorageIter *it, int column)
+{
+    return sqlite3_column_int64(it->stmt, column);
+}
+
+const char *storage_text(struct StorageIter *it, int column)
+{
+    return (const char *)sqlite3_column_text(it->stmt, column);
+}
+
+const char *storage_column_name(struct StorageIter *it, int column)
+{
+    return sqlite3_column_name(it->stmt, column);
+}
+
+void storage_done(struct StorageIter *it)
+{
+    if (it->stmt)
+    {
+        sqlite3_reset(it->stmt);
+        it->stmt = NULL;
+    }
+}
+
+// Adds delta rows to the block holding address
+static void resize_listing_block(uint32_t address, int delta)
+{
+    uint32_t block = address >> LISTING_BLOCK_SHIFT;
+
+    sqlite3_stmt *stmt = prepare(STMT_LISTING_RESIZE_BLOCK);
+    sqlite3_bind_int64(stmt, 1, block);
+    sqlite3_bind_int(stmt, 2, delta);
+    step(stmt);
+
+    if (!listing_dirty || block < listing_dirty_from)
+    {
+        listing_dirty_from = block;
+    }
+    listing_dirty = 1;
+}
+
+// Blocks before listing_dirty_from are numbered, continue after the last of them
+static void renumber_listing(void)
+{
+    if (!listing_dirty)
+        return;
+
+    sqlite3_stmt *stmt = prepare(STMT_LISTING_BASE);
+    sqlite3_bind_int64(stmt, 1, listing_dirty_from);
+    int64_t base = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 1;
+    sqlite3_reset(stmt);
+
+    stmt = prepare(STMT_LISTING_RENUMBER);
+    sqlite3_bind_int64(stmt, 1, listing_dirty_from);
+    sqlite3_bind_int64(stmt, 2, base);
+    step(stmt);
+
+    listing_dirty = 0;
+}
+
+// Reads a single text column keyed by address, returns a copy or NULL
+static char *select_text(enum statement id, uint32_t address)
+{
+    sqlite3_stmt *stmt = prepare(id);
+    sqlite3_bind_int64(stmt, 1, address);
+
+    char *text = NULL;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        text = column_copy(stmt, 0);
+    }
+
+    sqlite3_reset(stmt);
+    return text;
+}
+
+static int select_exists(enum statement id, uint32_t address)
+{
+    sqlite3_stmt *stmt = prepare(id);
+    sqlite3_bind_int64(stmt, 1, address);
+    int exists = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_reset(stmt);
+
+    return exists;
+}
+
+// Absolute address an operand like "$1664.l" or "$FF0000(pc)" refers to
+static int operand_target(const char *op_str, uint32_t *target)
+{
+    if (op_str == NULL || op_str[0] != '$')
+        return 0;
+
+    char *end;
+    unsigned long value = strtoul(op_str + 1, &end, 16);
+    if (end == op_str + 1)
+        return 0;
+
+    if (*end != 0 && strcasecmp(end, ".l") != 0 && strcasecmp(end, "(pc)") != 0)
+        return 0;
+
+    *target = value;
+    return 1;
+}
+
+static void listing_insert(uint32_t address, int seq, const char *type, const char *mnemonic, const char *op_str, const char *op_1, const char *comment)
+{
+    sqlite3_stmt *stmt = prepare(STMT_LISTING_INSERT);
+    sqlite3_bind_int64(stmt, 1, address);
+    sqlite3_bind_int(stmt, 2, seq);
+    sqlite3_bind_text(stmt, 3, type, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, mnemonic, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 5, op_str, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 6, op_1, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 9, comment, -1, SQLITE_TRANSIENT);
+
+    uint32_t target;
+    char target_name[256];
+    if (operand_target(op_str, &target))
+    {
+        sqlite3_bind_int64(stmt, 7, target);
+        if (get_label(target, target_name, sizeof(target_name)))
+        {
+            sqlite3_bind_text(stmt, 8, target_name, -1, SQLITE_TRANSIENT);
+        }
+    }
+
+    step(stmt);
+}
+
+// Multiline comments get a row per line after the first, function comments start with an empty line
+static int listing_insert_lines(uint32_t address, int seq, const char *type, char *text, int skip_first)
+{
+    char *line = text;
+    for (int i = 0; line != NULL; i++)
+    {
+        char *next = strchr(line, '\n');
+        if (next != NULL)
+        {
+            *next++ = 0;
+        }
+
+        if (i > 0 || !skip_first)
+        {
+            listing_insert(address, seq++, type, NULL, "", "", line);
+        }
+        line = next;
+    }
+
+    return seq;
+}
+
+// Regenerates listing rows at address from functions, labels, instructions and comments
+static void refresh_listing(uint32_t address)
+{
+    sqlite3_stmt *stmt = prepare(STMT_LISTING_SPAN);
+    sqlite3_bind_int64(stmt, 1, address);
+    sqlite3_step(stmt);
+    int old_count = sqlite3_column_int(stmt, 0);
+    sqlite3_reset(stmt);
+
+    stmt = prepare(STMT_LISTING_DELETE);
+    sqlite3_bind_int64(stmt, 1, address);
+    step(stmt);
+
+    int seq = 0;
+    char *comment = select_text(STMT_SELECT_FUNCTION_COMMENT, address);
+    if (comment != NULL)
+    {
+        listing_insert(address, seq++, "function_comment", NULL, "", "", "");
+        seq = listing_insert_lines(address, seq, "function_comment", comment, 0);
+        free(comment);
+    }
+
+    int is_function = select_exists(STMT_IS_FUNCTION, address);
+    if (is_function || select_exists(STMT_IS_LOCAL_BRANCH, address))
+    {
+        char name[256];
+        if (!get_label(address, name, sizeof(name)))
+        {
+            snprintf(name, sizeof(name), "%s_%08X", is_function ? "FUN" : "LAB", address);
+        }
+        listing_insert(address, seq++, "label", name, "", "", "");
+    }
+
+    comment = select_text(STMT_SELECT_COMMENT, address);
+    stmt = prepare(STMT_SELECT_INSTRUCTION);
+    sqlite3_bind_int64(stmt, 1, address);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        listing_insert(address, seq++, "", (const char *)sqlite3_column_text(stmt, 0), (const char *)sqlite3_column_text(stmt, 1),
+                       (const char *)sqlite3_column_text(stmt, 2), comment);
+    }
+    sqlite3_reset(stmt);
+
+    if (comment != NULL)
+    {
+        seq = listing_insert_lines(address, seq, "comment", comment, 1);
+        free(comment);
+    }
+
+    if (seq != old_count)
+    {
+        resize_listing_block(address, seq - old_count);
+    }
+
+    // Batches renumber once on commit
+    if (!in_transaction)
+    {
+        renumber_listing();
+    }
+}
+
+static void listing_rebuild(void)
+{
+    int own_transaction = !in_transaction;
+    storage_begin();
+
+    sqlite3_exec(db, "DELETE FROM listing; DELETE FROM listing_blocks;", NULL, NULL, NULL);
+
+    // Collect addresses first, refresh_listing() reuses the statements
+    struct fam *addresses = fam_new(0);
+    struct StorageIter it = {.stmt = prepare(STMT_LISTING_ADDRESSES)};
+    while (storage_next(&it))
+    {
+        fam_append(addresses, storage_int(&it, 0));
+    }
+    storage_done(&it);
+
+    for (uint32_t i = 0; i < addresses->len; i++)
+    {
+        refresh_listing(addresses->arr[i]);
+    }
+
+    free(addresses->arr);
+    free(addresses);
+
+    if (own_transaction)
+    {
+        storage_commit();
+    }
+}
+
+// Cached statements and the listing aren't safe to share between the debugger and analysis threads
+static pthread_mutex_t storage_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void storage_lock(void)
+{
+    pthread_mutex_lock(&storage_mutex);
+}
+
+void storage_unlock(void)
+{
+    pthread_mutex_unlock(&storage_mutex);
+}
+
+void storage_begin(void)
+{
+    if (!in_transaction)
+    {
+        sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+        in_transaction = 1;
+    }
+}
+
+void storage_commit(void)
+{
+    if (in_transaction)
+    {
+        renumber_listing();
+        sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+        in_transaction = 0;
+    }
+}
+
+void storage_clear_analysis(void)
+{
+    storage_commit();
+    sqlite3_exec(db, "DELETE FROM instructions; DELETE FROM functions; DELETE FROM jump_tables; DELETE FROM labels WHERE source = 'system';", NULL, NULL, NULL);
+    // Comments outlive the analysis
+    listing_rebuild();
+}
+
+void store_function(uint32_t start_address, uint32_t end_address)
+{
+    sqlite3_stmt *stmt = prepare(STMT_INSERT_FUNCTION);
+    sqlite3_bind_int64(stmt, 1, start_address);
+    sqlite3_bind_int64(stmt, 2, end_address);
+    step(stmt);
+
+    if (sqlite3_changes(db))
+    {
+        refresh_listing(start_address);
+    }
+}
+
+void store_instruction(uint32_t address, const char *mnemonic, const char *op_str, int size, uint32_t op_1)
+{
+    sqlite3_stmt *stmt = prepare(STMT_INSERT_INSTRUCTION);
+    sqlite3_bind_int64(stmt, 1, address);
+    sqlite3_bind_text(stmt, 2, mnemonic, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, op_str, -1, SQLITE_STATIC);
+    if (size)
+    {
+        sqlite3_bind_int(stmt, 4, size);
+    }
+
+    // Branch targets are stored as hex text so they can be matched against labels
+    if (op_1)
+    {
+        char op_1_hex[10];
+        sprintf(op_1_hex, "%X", op_1);
+        sqlite3_bind_text(stmt, 5, op_1_hex, -1, SQLITE_TRANSIENT);
+    }
+
+    step(stmt);
+
+    if (sqlite3_changes(db))
+    {
+        refresh_listing(address);
+    }
+}
+
+void store_reference(uint32_t instruction_address, uint32_t function_start_address, const char *type)
+{
+    sqlite3_stmt *stmt = prepare(STMT_INSERT_REFERENCE);
+    sqlite3_bind_int64(stmt, 1, instruction_address);
+    sqlite3_bind_int64(stmt, 2, function_start_address);
+    if (type)
+    {
+        sqlite3_bind_text(stmt, 3, type, -1, SQLITE_STATIC);
+    }
+
+    step(stmt);
+
+    // Local branch targets get a label row
+    if (sqlite3_changes(db) && type != NULL && strcmp(type, "local_branch") == 0)
+    {
+        refresh_listing(function_start_address);
+    }
 }
 
 struct SqlResult run_sql(const char *sql, ...)
@@ -54,181 +636,116 @@ struct SqlResult run_sql(const char *sql, ...)
         exit(1);
     }
 
-    va_list arg;
+    va_list arg, arg_copy;
     va_start(arg, sql);
-    size_t needed = vsnprintf(NULL, 0, sql, arg);
+    // vsnprintf consumes the list, format from a copy
+    va_copy(arg_copy, arg);
+    size_t needed = vsnprintf(NULL, 0, sql, arg_copy);
+    va_end(arg_copy);
     char *sql_formatted = malloc(needed + 1);
     vsprintf(sql_formatted, sql, arg);
     va_end(arg);
 
+#ifdef STORAGE_VERBOSE
     printf("%s\n", sql_formatted);
+#endif
 
     char **aResult;
     int nRow = 0, nCol = 0;
     char *zErrMsg = 0;
     int rc = sqlite3_get_table(db, sql_formatted, &aResult, &nRow, &nCol, &zErrMsg);
+    free(sql_formatted);
     if (rc != SQLITE_OK)
     {
         struct SqlResult r = {.zErrMsg = zErrMsg};
         printf("SQL error: %s\n", zErrMsg);
         return r;
-        // sqlite3_free(zErrMsg);
     }
 
     int rowsAffected = sqlite3_changes(db);
+#ifdef STORAGE_VERBOSE
     printf("RowsReturned: %d RowsAffected: %d\n", nRow, rowsAffected);
-
-    free(sql_formatted);
+#endif
 
     struct SqlResult r = {.aResult = aResult, .nRow = nRow, .nCol = nCol, .zErrMsg = zErrMsg, .rowsAffected = rowsAffected};
     return r;
 }
 
-struct SqlResult get_instructions(uint32_t *index, uint32_t address, int as_json, size_t length_around, char **errMsg)
-{
-    // name is a label.name
-    const char *json_select = "SELECT json_group_array (json_object('address', address, 'mnemonic', mnemonic, 'op_str', ifnull(op_1_label_name, op_str), 'op_1', ifnull(op_1_label_address, op_1), 'comment', COMMENT, 'type', type))";
-    const char *sql_select = "SELECT address, mnemonic, ifnull(name,op_str) as op_str, op_1, comment";
-
-    const char *body = "FROM (\n\
-    SELECT\n\
-        row_number() OVER (ORDER BY t.address) AS rowNum,\n\
-        l.name AS op_1_label_name,\n\
-        l.address AS op_1_label_address,\n\
-        *\n\
-    FROM (\n\
-\n\
-    -- Split is a recursive function that splits multiline comments into rows\n\
-    WITH RECURSIVE split(address, comment, str, type, lineIdx) AS (\n\
-        SELECT address, '', comment || X'0A', 'function_comment' as type, -1 as lineIdx FROM function_comments\n\
-    	UNION ALL\n\
-        SELECT address, '', comment || X'0A', 'instruction_comment' as type, -1 as lineIdx FROM instruction_comments\n\
-        UNION ALL\n\
-        SELECT address,\n\
-        substr(str, 1, instr(str, X'0A')-1),\n\
-        substr(str, instr(str, X'0A')+1),\n\
-        type,\n\
-        lineIdx + 1\n\
-        FROM split WHERE str!='' and instr(str, X'0A') > 0\n\
-    )\n\
-\n\
-    -- Selects function comments\n\
-    SELECT\n\
-        0 AS id,\n\
-        address,\n\
-        NULL as mnemonic,\n\
-        '' AS op_str,\n\
-        0 AS size,\n\
-        '' AS op_1,\n\
-        'function_comment' as type,\n\
-        comment\n\
-    FROM split\n\
-    WHERE type = 'function_comment'\n\
-    UNION ALL\n\
-    -- Selects all function labels\n\
-    SELECT\n\
-        0 AS id,\n\
-        start_address AS address,\n\
-        ifnull(l.name, 'FUN_' || printf ('%08X', start_address)) AS mnemonic,\n\
-        '' AS op_str,\n\
-        0 AS size,\n\
-        '' AS op_1,\n\
-        'label' as type,\n\
-        '' as comment \n\
-    FROM functions f\n\
-        LEFT JOIN labels l ON printf('%X', f.start_address) = l.address\n\
-    UNION ALL\n\
-\n\
-    -- Selects all local branch labels\n\
-    SELECT \n\
-        0 AS id, \n\
-        jt.function_start_address as 'address', \n\
-        ifnull(l.name, 'LAB_' || printf ('%08X', jt.function_start_address)) AS mnemonic,\n\
-        0 AS size,\n\
-        '' AS op_1,\n\
-        name, \n\
-        'label' AS type,\n\
-        '' AS comment\n\
-    FROM jump_tables jt\n\
-        LEFT JOIN labels l ON printf('%X', jt.function_start_address) = l.address\n\
-        LEFT JOIN functions f ON f.start_address = jt.function_start_address\n\
-        WHERE jt.type = 'local_branch'\n\
-        -- Exclude local branch labels that are also function labels\n\
-        AND f.id IS NULL\n\
-    GROUP BY jt.function_start_address\n\
-    UNION ALL\n\
-\n\
-    -- Selects all instructions\n\
-    SELECT\n\
-        i.id,\n\
-        i.address,\n\
-        mnemonic,\n\
-        op_str,\n\
-        size,\n\
-        op_1,\n\
-        '' as type,\n\
-        ic.comment\n\
-    FROM\n\
-        instructions i\n\
-        LEFT JOIN instruction_comments ic ON ic.address = i.address\n\
-    UNION ALL\n\
-\n\
-    -- Selects all multiline instruction comments, skips first line as it's on the same line as instruction \n\
-    SELECT\n\
-        0 AS id,\n\
-        address,\n\
-        NULL as mnemonic,\n\
-        '' AS op_str,\n\
-        0 AS size,\n\
-        '' AS op_1,\n\
-        'comment' as type,\n\
-        comment\n\
-    FROM split\n\
-    WHERE type = 'instruction_comment' AND lineIdx > 0) t\n\
-    LEFT JOIN labels l ON replace(replace(replace(upper(t.op_str), '$', ''), '.L', ''), '(PC)', '') = l.address) x\n";
+// Looks up listing row of the instruction at address, 0 if it's not in the database
+static uint32_t disasm_row(uint32_t address)
+{
+    renumber_listing();
+
+    sqlite3_stmt *stmt = prepare(STMT_DISASM_ROW);
+    sqlite3_bind_int64(stmt, 1, address);
+
+    uint32_t row = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        row = sqlite3_column_int64(stmt, 0);
+    }
+
+    sqlite3_reset(stmt);
+    return row;
+}
+
+int get_instructions(struct StorageIter *it, uint32_t *index, uint32_t address, int as_json, size_t length_around, char **errMsg)
+{
+    it->stmt = NULL;
 
     if (address)
     {
-        struct SqlResult rowNum = run_sql("SELECT rowNum %s WHERE address = 0x%X and type = ''", body, address);
-        if (rowNum.nRow == 0)
+        uint32_t row = disasm_row(address);
+        if (row == 0)
         {
             *errMsg = "Address not found";
-            return rowNum;
+            return STORAGE_INSTRUCTION_MISSING;
         }
-        *index = atoi(rowNum.aResult[1]);
-        sqlite3_free_table(rowNum.aResult);
+        *index = row;
     }
 
-    return run_sql("%s %s WHERE\
-    x.rowNum >= %d - %d\
-    AND x.rowNum <= %d + %d", as_json ? json_select : sql_select, body, *index, length_around, *index, length_around);
+    renumber_listing();
+    it->stmt = prepare(as_json ? STMT_DISASM_WINDOW_JSON : STMT_DISASM_WINDOW);
+    sqlite3_bind_int64(it->stmt, 1, *index);
+    sqlite3_bind_int64(it->stmt, 2, length_around);
+
+    return 0;
 }
 
 int disasm_as_json(uint32_t index, uint32_t address, size_t length, char **jsonOut)
 {
-    struct SqlResult count = run_sql("select count(*) from instructions");
-
-    char *errMsg = (char*)-1;
-    struct SqlResult result = get_instructions(&index, address, 1, 100, &errMsg);
-    if (errMsg != (char*)-1) {
+    sqlite3_stmt *count_stmt = prepare(STMT_COUNT_INSTRUCTIONS);
+    sqlite3_step(count_stmt);
+    int64_t count = sqlite3_column_int64(count_stmt, 0);
+    sqlite3_reset(count_stmt);
+
+    char *errMsg;
+    struct StorageIter it;
+    if (get_instructions(&it, &index, address, 1, 100, &errMsg) == STORAGE_INSTRUCTION_MISSING)
+    {
         *jsonOut = malloc(strlen(errMsg) + 100);
         sprintf(*jsonOut, "{ \"type\": \"asm\", \"error\": \"%s\" }", errMsg);
         return STORAGE_INSTRUCTION_MISSING;
     }
 
-    *jsonOut = malloc(strlen(result.aResult[1]) + 100);
+    const char *data = storage_next(&it) ? storage_text(&it, 0) : NULL;
+    if (data == NULL)
+    {
+        data = "[]";
+    }
 
-    sprintf(*jsonOut, "{ \"type\": \"asm\", \"index\": %u, \"count\": %s, \"data\": %s }", index >= 100 ? index - 100 : 0, count.aResult[1], result.aResult[1]);
+    *jsonOut = malloc(strlen(data) + 100);
+    sprintf(*jsonOut, "{ \"type\": \"asm\", \"index\": %u, \"count\": %lld, \"data\": %s }", index >= 100 ? index - 100 : 0, (long long)count, data);
 
-    sqlite3_free_table(result.aResult);
-    sqlite3_free_table(count.aResult);
+    storage_done(&it);
+    return 0;
 }
 
 struct fam *fam_new(size_t size)
 {
     struct fam *fam1 = malloc(sizeof(struct fam));
     fam1->len = size;
-    fam1->arr = malloc(sizeof(int) * size);
+    fam1->arr = malloc(sizeof(uint32_t) * size);
 
     return fam1;
 }
@@ -236,7 +753,7 @@ struct fam *fam_new(size_t size)
 void fam_append(struct fam *fam1, int value)
 {
     fam1->len++;
-    fam1->arr = realloc(fam1->arr, fam1->len * sizeof(int));
+    fam1->arr = realloc(fam1->arr, fam1->len * sizeof(uint32_t));
     if (fam1->arr == NULL)
     {
         printf("failed to realloc fam1");
@@ -248,90 +765,110 @@ void fam_append(struct fam *fam1, int value)
 
 struct fam *get_functions(void)
 {
-    struct SqlResult result = run_sql("select start_address from functions");
-
-    struct fam *fam1 = fam_new(result.nRow);
+    struct StorageIter it = {.stmt = prepare(STMT_SELECT_FUNCTIONS)};
+    struct fam *fam1 = fam_new(0);
 
-    for (size_t i = 1; i <= result.nRow; i++)
+    while (storage_next(&it))
     {
-        fam1->arr[i - 1] = atoi(result.aResult[i]);
+        fam_append(fam1, storage_int(&it, 0));
     }
 
-    sqlite3_free_table(result.aResult);
-
+    storage_done(&it);
     return fam1;
 }
 
 char *funcs(void)
 {
-    struct SqlResult result = run_sql("SELECT json_group_array(json_object('start_address', start_address, 'end_address', end_address, 'name', t.name, 'references', json(t.refs), 'comment', t.comment)) from \n\
-    (SELECT \n\
-    f.*, \n\
-    NULLIF(json_group_array (( \n\
-            -- Find a function that surrounds referenced instruction \n\
-            SELECT \n\
-                json_object('address', printf ('%%X', jt.instruction_address), 'func_address', printf ('%%X', start_address), 'func', ref_label.name) \n\
-                FROM functions ref_f \n\
-            -- Get a label for referenced function \n\
-            LEFT JOIN labels ref_label ON ref_label.address = printf ('%%X', ref_f.start_address) \n\
-        WHERE \n\
-            jt.instruction_address BETWEEN start_address \n\
-            AND end_address \n\
-        ORDER BY \n\
-            start_address DESC \n\
-        LIMIT 1)), '[null]') AS refs, \n\
-    l.name, \n\
-    fc.comment \n\
-FROM \n\
-    functions f \n\
-    LEFT JOIN jump_tables jt ON jt.function_start_address = f.start_address \n\
-    LEFT JOIN labels l ON l.address = printf ('%%X', f.start_address) \n\
-    LEFT JOIN function_comments fc ON fc.address = f.start_address \n\
-GROUP BY \n\
-    f.start_address \n\
-ORDER BY \n\
-    f.start_address) t");
+    sqlite3_stmt *stmt = prepare(STMT_FUNCTIONS_JSON);
+
+    // Caller frees the message
+    char *json = NULL;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        json = column_copy(stmt, 0);
+    }
+
+    sqlite3_reset(stmt);
+    return json;
+}
+
+int get_label(uint32_t address, char *name, size_t size)
+{
+    sqlite3_stmt *stmt = prepare(STMT_SELECT_LABEL);
+    sqlite3_bind_int64(stmt, 1, address);
 
-    return result.aResult[1];
+    int found = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0) != NULL)
+    {
+        snprintf(name, size, "%s", sqlite3_column_text(stmt, 0));
+        found = 1;
+    }
+
+    sqlite3_reset(stmt);
+    return found;
+}
+
+// Label row at address and operands pointing to it show the new name
+static void relabel_listing(uint32_t address, const char *name)
+{
+    sqlite3_stmt *stmt = prepare(STMT_LISTING_RETARGET);
+    sqlite3_bind_int64(stmt, 1, address);
+    sqlite3_bind_text(stmt, 2, name, -1, SQLITE_TRANSIENT);
+    step(stmt);
+
+    refresh_listing(address);
 }
 
 void create_label(uint32_t address, char *name)
 {
+    sqlite3_stmt *stmt;
     if (name == NULL) 
     {
-        run_sql("DELETE FROM labels WHERE address = '%X'", address);
+        stmt = prepare(STMT_DELETE_LABEL);
     } 
     else 
     {
-        run_sql("INSERT OR REPLACE INTO labels (address, name) VALUES ('%X', '%s')", address, name);
+        stmt = prepare(STMT_UPSERT_LABEL);
+        sqlite3_bind_text(stmt, 2, name, -1, SQLITE_TRANSIENT);
     }
+
+    sqlite3_bind_int64(stmt, 1, address);
+    step(stmt);
+
+    relabel_listing(address, name);
 }
 
 void create_system_label(uint32_t address, char *name)
 {
-    run_sql("INSERT OR REPLACE INTO labels (address, name, source) VALUES ('%X', '%s', 'system')", address, name);
+    sqlite3_stmt *stmt = prepare(STMT_UPSERT_SYSTEM_LABEL);
+    sqlite3_bind_int64(stmt, 1, address);
+    sqlite3_bind_text(stmt, 2, name, -1, SQLITE_TRANSIENT);
+    step(stmt);
+
+    relabel_listing(address, name);
 }
 
-struct SqlResult add_comment(uint32_t address, char *comment)
+static struct SqlResult upsert_comment(enum statement upsert, enum statement delete, uint32_t address, char *comment)
 {
-    if (comment == NULL)
+    sqlite3_stmt *stmt = prepare(comment == NULL ? delete : upsert);
+    sqlite3_bind_int64(stmt, 1, address);
+    if (comment != NULL)
     {
-        return run_sql("DELETE FROM instruction_comments WHERE address = '%d'", address);
-    }
-    else
-    {
-        return run_sql("INSERT OR REPLACE INTO instruction_comments (address, comment) VALUES ('%d', '%s')", address, comment);
+        sqlite3_bind_text(stmt, 2, comment, -1, SQLITE_TRANSIENT);
     }
+
+    struct SqlResult r = step_changes(stmt);
+    refresh_listing(address);
+
+    return r;
+}
+
+struct SqlResult add_comment(uint32_t address, char *comment)
+{
+    return upsert_comment(STMT_UPSERT_COMMENT, STMT_DELETE_COMMENT, address, comment);
 }
 
 struct SqlResult add_function_comment(uint32_t address, char *comment)
 {
-    if (comment == NULL)
-    {
-        return run_sql("DELETE FROM function_comments WHERE address = '%d'", address);
-    }
-    else
-    {
-        return run_sql("INSERT OR REPLACE INTO function_comments (address, comment) VALUES ('%d', '%s')", address, comment);
-    }
+    return upsert_comment(STMT_UPSERT_FUNCTION_COMMENT, STMT_DELETE_FUNCTION_COMMENT, address, comment);
 }
@@ -9,25 +9,62 @@
 
 #define STORAGE_INSTRUCTION_MISSING 1 // Instruction not found in the database
 
+struct sqlite3_stmt;
+
+// Rows of a query running on a cached statement, valid until storage_done() or the next call using the same query
+struct StorageIter
+{
+    struct sqlite3_stmt *stmt;
+};
+
+// Advances to the next row, returns 0 once there are no more
+int storage_next(struct StorageIter *it);
+int64_t storage_int(struct StorageIter *it, int column);
+const char *storage_text(struct StorageIter *it, int column);
+const char *storage_column_name(struct StorageIter *it, int column);
+// Releases the statement so it can be reused
+void storage_done(struct StorageIter *it);
+
 void init_db(const char *filename);
 int disasm_as_json(uint32_t index, uint32_t address, size_t length, char **jsonOut);
 char *funcs(void);
 
 struct fam { 
-    uint16_t len; 
+    uint32_t len; 
     uint32_t* arr; 
 }; 
 struct fam *fam_new(size_t size);
 void fam_append(struct fam *fam1, int value);
 struct fam *get_functions(void);
 void create_label(uint32_t address, char *name);
+// Copies label name at address into name, returns 0 if there is none
+int get_label(uint32_t address, char *name, size_t size);
 void create_system_label(uint32_t address, char *name);
 struct SqlResult add_comment(uint32_t address, char *comment);
-struct SqlResult get_instructions(uint32_t *index, uint32_t address, int as_json, size_t length_around, char **errMsg);
+// Opens disasm window of length_around rows on either side of index, or of the row at address if it's not 0.
+// Returns STORAGE_INSTRUCTION_MISSING if address isn't in the database.
+int get_instructions(struct StorageIter *it, uint32_t *index, uint32_t address, int as_json, size_t length_around, char **errMsg);
 struct SqlResult add_function_comment(uint32_t address, char *comment);
 
+// Formats and runs ad hoc SQL, define STORAGE_VERBOSE to echo it
 struct SqlResult run_sql(const char *sql, ...);
 
+// Held around storage calls by threads sharing the database, take it after the analysis lock
+void storage_lock(void);
+void storage_unlock(void);
+
+// Batched writes - everything between storage_begin() and storage_commit() is one transaction
+void storage_begin(void);
+void storage_commit(void);
+// Drops everything rom analyzer produced, keeps user labels and comments
+void storage_clear_analysis(void);
+// Prepared statement inserts used by rom analyzer, duplicates are ignored
+void store_function(uint32_t start_address, uint32_t end_address);
+// op_1 is the branch target, pass 0 if instruction doesn't branch. Pass size 0 to leave it NULL.
+void store_instruction(uint32_t address, const char *mnemonic, const char *op_str, int size, uint32_t op_1);
+// type is 'jump_table', 'local_branch' or NULL for function references
+void store_reference(uint32_t instruction_address, uint32_t function_start_address, const char *type);
+
 struct SqlResult
 {
     char **aResult;
@@ -5,24 +5,127 @@ static void *
 test_storage_setup(const MunitParameter params[], void *user_data)
 {
     remove("test-db.sqlite3");
+    remove("test-db.sqlite3-wal");
+    remove("test-db.sqlite3-shm");
     init_db("test-db.sqlite3");
 }
 
 static MunitResult test_add_comment(const MunitParameter params[], void *data)
 {
     // Insert a dummy instruction at address 0x0
-    run_sql("INSERT INTO instructions (address, mnemonic, op_str) VALUES ('0', 'dc.l', '200')");
+    store_instruction(0, "dc.l", "200", 0, 0);
     struct SqlResult result = add_comment(0, "new-comment");
     munit_assert_null(result.zErrMsg);
     munit_assert_int(result.rowsAffected, ==, 1);
 
     uint32_t index = 1;
     char *errMsg;
-    result = get_instructions(&index, 0, 0, 0, &errMsg);
+    struct StorageIter it;
+    munit_assert_int(get_instructions(&it, &index, 0, 0, 0, &errMsg), ==, 0);
+    munit_assert_true(storage_next(&it));
     // assert column name
-    munit_assert_string_equal(result.aResult[4], "comment");
+    munit_assert_string_equal(storage_column_name(&it, 4), "comment");
     // assert column content
-    munit_assert_string_equal(result.aResult[9], "new-comment");
+    munit_assert_string_equal(storage_text(&it, 4), "new-comment");
+    storage_done(&it);
+
+    return 0;
+}
+
+static MunitResult test_store_batch(const MunitParameter params[], void *data)
+{
+    storage_begin();
+    store_function(0x200, 0x204);
+    store_instruction(0x200, "jsr", "$1664.l", 6, 0x1664);
+    store_instruction(0x204, "rts", "", 2, 0);
+    // Duplicates are ignored
+    store_instruction(0x204, "rts", "", 2, 0);
+    store_reference(0x200, 0x1664, NULL);
+    storage_commit();
+
+    struct SqlResult result = run_sql("SELECT address, op_1, size FROM instructions ORDER BY address");
+    munit_assert_int(result.nRow, ==, 2);
+    munit_assert_string_equal(result.aResult[3], "512");
+    munit_assert_string_equal(result.aResult[4], "1664");
+    munit_assert_null(result.aResult[7]);
+
+    result = run_sql("SELECT start_address, end_address FROM functions");
+    munit_assert_int(result.nRow, ==, 1);
+    munit_assert_string_equal(result.aResult[3], "516");
+
+    result = run_sql("SELECT type FROM jump_tables WHERE instruction_address = 512");
+    munit_assert_int(result.nRow, ==, 1);
+    munit_assert_null(result.aResult[1]);
+
+    return 0;
+}
+
+static MunitResult test_labels(const MunitParameter params[], void *data)
+{
+    char name[32];
+    munit_assert_false(get_label(0x1664, name, sizeof(name)));
+
+    // Quotes used to break formatted SQL
+    create_label(0x1664, "it's_main");
+    munit_assert_true(get_label(0x1664, name, sizeof(name)));
+    munit_assert_string_equal(name, "it's_main");
+
+    struct SqlResult result = run_sql("SELECT address FROM labels");
+    munit_assert_string_equal(result.aResult[1], "1664");
+
+    create_label(0x1664, NULL);
+    munit_assert_false(get_label(0x1664, name, sizeof(name)));
+
+    return 0;
+}
+
+static MunitResult test_listing(const MunitParameter params[], void *data)
+{
+    storage_begin();
+    store_function(0x200, 0x20a);
+    store_instruction(0x200, "jsr", "$300.l", 6, 0x300);
+    store_instruction(0x206, "bra.s", "$200", 2, 0x200);
+    store_instruction(0x208, "rts", "", 2, 0);
+    storage_commit();
+
+    uint32_t index = 0;
+    char *errMsg;
+    struct StorageIter it;
+    munit_assert_int(get_instructions(&it, &index, 0x206, 0, 0, &errMsg), ==, 0);
+    // FUN_00000200 label takes the first row
+    munit_assert_int(index, ==, 3);
+    storage_done(&it);
+
+    // Comment lines push everything after them down
+    add_function_comment(0x200, "entry\npoint");
+    add_comment(0x200, "calls\nsub");
+    create_label(0x200, "main");
+
+    index = 0;
+    munit_assert_int(get_instructions(&it, &index, 0x206, 0, 0, &errMsg), ==, 0);
+    munit_assert_int(index, ==, 7);
+    storage_done(&it);
+
+    const char *types[] = {"function_comment", "function_comment", "function_comment", "label", "", "comment", "", ""};
+    index = 5;
+    get_instructions(&it, &index, 0, 0, 4, &errMsg);
+    for (int i = 0; i < 8; i++)
+    {
+        munit_assert_true(storage_next(&it));
+        munit_assert_string_equal(storage_text(&it, 5), types[i]);
+    }
+    munit_assert_false(storage_next(&it));
+    storage_done(&it);
+
+    // Branch to the renamed function shows its label
+    index = 7;
+    get_instructions(&it, &index, 0, 0, 0, &errMsg);
+    munit_assert_true(storage_next(&it));
+    munit_assert_string_equal(storage_text(&it, 2), "main");
+    munit_assert_string_equal(storage_text(&it, 3), "200");
+    storage_done(&it);
+
+    munit_assert_int(get_instructions(&it, &index, 0x204, 0, 0, &errMsg), ==, STORAGE_INSTRUCTION_MISSING);
 
     return 0;
 }
@@ -36,6 +139,30 @@ static MunitTest tests[] = {
         MUNIT_TEST_OPTION_NONE, /* options */
         NULL                    /* parameters */
     },
+    {
+        "/test-store-batch",    /* name */
+        test_store_batch,       /* test */
+        test_storage_setup,     /* setup */
+        NULL,                   /* tear_down */
+        MUNIT_TEST_OPTION_NONE, /* options */
+        NULL                    /* parameters */
+    },
+    {
+        "/test-labels",         /* name */
+        test_labels,            /* test */
+        test_storage_setup,     /* setup */
+        NULL,                   /* tear_down */
+        MUNIT_TEST_OPTION_NONE, /* options */
+        NULL                    /* parameters */
+    },
+    {
+        "/test-listing",        /* name */
+        test_listing,           /* test */
+        test_storage_setup,     /* setup */
+        NULL,                   /* tear_down */
+        MUNIT_TEST_OPTION_NONE, /* options */
+        NULL                    /* parameters */
+    },
     /* Mark the end of the array with an entry where the test
      * function is NULL */
     {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};